@@ -0,0 +1,333 @@
+#! /usr/bin/python
+
+# netproxy -- a TCP proxy that makes a fast link look slow and lossy,
+# for benchmarking distcc over WAN and VPN links on one machine.
+
+# Copyright 2026 The distcc Authors
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+
+# Put it between a client and a local distccd:
+#
+#   distccd --daemon --port 3632 --allow 127.0.0.1
+#   netproxy.py --listen 4000 --target 127.0.0.1:3632 \
+#       --bandwidth 10mbit --rtt 40 --jitter 5 --loss 0.5 --stats net.json
+#   DISTCC_HOSTS=127.0.0.1:4000,lzo make -j8 CC="distcc gcc"
+#
+# Each direction of each connection is a separate link.  Data read from
+# one side is cut into segments, each of which is held back until the
+# link would have finished sending it at --bandwidth, plus half of
+# --rtt and some --jitter.  Segments are never reordered, since TCP
+# wouldn't deliver them out of order either.
+#
+# Userspace can't drop a TCP segment, so --loss is modelled as what the
+# far end would see: a lost segment arrives a retransmission timeout
+# late, and everything behind it waits.
+#
+# --stats writes the bytes, segments and losses in each direction, for
+# each connection and in total, as JSON whenever a connection closes.
+
+from __future__ import print_function
+
+import getopt
+import json
+import os
+import random
+import signal
+import socket
+import sys
+import threading
+import time
+
+try:
+    import queue
+except ImportError:
+    import Queue as queue
+
+
+SEGMENT = 1448                  # bytes of payload in one TCP segment
+MIN_RTO = 0.2                   # Linux's minimum retransmission timeout
+
+
+def parse_rate(s):
+    """Parse a rate like 10mbit, 512kbit or 2MB into bytes per second.
+
+    A bare number is bits per second; 0 means no limit."""
+    s = s.strip().lower()
+    units = [('gbit', 1e9 / 8), ('mbit', 1e6 / 8), ('kbit', 1e3 / 8),
+             ('bit', 1.0 / 8), ('gb', 1e9), ('mb', 1e6), ('kb', 1e3),
+             ('b', 1.0)]
+    for suffix, scale in units:
+        if s.endswith(suffix):
+            return float(s[:-len(suffix)]) * scale
+    return float(s) / 8
+
+
+def parse_addr(s, default_host):
+    if ':' in s:
+        host, port = s.rsplit(':', 1)
+    else:
+        host, port = default_host, s
+    return host, int(port)
+
+
+class LinkParams:
+    """How one direction of a connection behaves."""
+    def __init__(self, rate=0.0, delay=0.0, jitter=0.0, loss=0.0):
+        self.rate = rate            # bytes per second, or 0
+        self.delay = delay          # one-way, seconds
+        self.jitter = jitter        # seconds either side of delay
+        self.loss = loss            # probability per segment
+
+    def rto(self):
+        return max(MIN_RTO, 2 * (self.delay * 2 + self.jitter))
+
+
+class Link:
+    """Carry one direction of a connection from src to dst."""
+
+    def __init__(self, name, src, dst, params, rng, stats):
+        self.name = name
+        self.src, self.dst = src, dst
+        self.params = params
+        self.rng = rng
+        self.stats = stats
+        self.stats.update({'bytes': 0, 'segments': 0, 'lost': 0})
+        # Enough to keep a fast link busy, without buffering so much that
+        # the sender doesn't feel the link is slow.
+        self.pending = queue.Queue(maxsize=64)
+        self.free_at = 0.0          # when the link finishes what it has
+        self.last_arrival = 0.0
+
+    def start(self):
+        self.threads = [threading.Thread(target=self.read_side),
+                        threading.Thread(target=self.write_side)]
+        for t in self.threads:
+            t.daemon = True
+            t.start()
+
+    def join(self):
+        for t in self.threads:
+            t.join()
+
+    def arrival_time(self, size):
+        p = self.params
+        now = time.time()
+        if p.rate:
+            self.free_at = max(now, self.free_at) + size / p.rate
+        else:
+            self.free_at = now
+        arrival = self.free_at + p.delay
+        if p.jitter:
+            arrival += self.rng.uniform(-p.jitter, p.jitter)
+        if p.loss and self.rng.random() < p.loss:
+            arrival += p.rto()
+            self.stats['lost'] += 1
+        arrival = max(arrival, self.last_arrival, now)
+        self.last_arrival = arrival
+        return arrival
+
+    def read_side(self):
+        while True:
+            try:
+                data = self.src.recv(65536)
+            except socket.error:
+                data = b''
+            if not data:
+                self.pending.put((time.time(), None))
+                return
+            for i in range(0, len(data), SEGMENT):
+                seg = data[i:i + SEGMENT]
+                self.pending.put((self.arrival_time(len(seg)), seg))
+
+    def write_side(self):
+        while True:
+            when, seg = self.pending.get()
+            wait = when - time.time()
+            if wait > 0:
+                time.sleep(wait)
+            try:
+                if seg is None:
+                    self.dst.shutdown(socket.SHUT_WR)
+                    return
+                self.dst.sendall(seg)
+            except socket.error:
+                # The far end has gone; stop reading from the near end too.
+                try:
+                    self.src.shutdown(socket.SHUT_RD)
+                except socket.error:
+                    pass
+                return
+            self.stats['bytes'] += len(seg)
+            self.stats['segments'] += 1
+
+
+class Proxy:
+    def __init__(self, listen, target, up, down, seed, stats_file, verbose):
+        self.listen, self.target = listen, target
+        self.up, self.down = up, down
+        self.rng = random.Random(seed)
+        self.stats_file = stats_file
+        self.verbose = verbose
+        self.lock = threading.Lock()
+        self.connections = []
+        self.totals = {'connections': 0,
+                       'up': {'bytes': 0, 'segments': 0, 'lost': 0},
+                       'down': {'bytes': 0, 'segments': 0, 'lost': 0}}
+
+    def serve(self):
+        ls = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        ls.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        ls.bind(self.listen)
+        ls.listen(64)
+        print('netproxy listening on %s:%d' % ls.getsockname())
+        sys.stdout.flush()
+        while True:
+            client, addr = ls.accept()
+            t = threading.Thread(target=self.handle, args=(client, addr))
+            t.daemon = True
+            t.start()
+
+    def handle(self, client, addr):
+        try:
+            server = socket.create_connection(self.target)
+        except socket.error as e:
+            if self.verbose:
+                print('netproxy: connect to %s:%d failed: %s'
+                      % (self.target + (e,)), file=sys.stderr)
+            client.close()
+            return
+        for s in client, server:
+            s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+
+        start = time.time()
+        conn = {'client': '%s:%d' % addr[:2], 'up': {}, 'down': {}}
+        with self.lock:
+            # Each connection gets its own generator, so that its losses
+            # don't depend on what other connections are doing.
+            rng = random.Random(self.rng.random())
+        links = [Link('up', client, server, self.up, rng, conn['up']),
+                 Link('down', server, client, self.down, rng, conn['down'])]
+        for link in links:
+            link.start()
+        for link in links:
+            link.join()
+        client.close()
+        server.close()
+        conn['seconds'] = round(time.time() - start, 6)
+
+        with self.lock:
+            self.connections.append(conn)
+            self.totals['connections'] += 1
+            for d in 'up', 'down':
+                for k in 'bytes', 'segments', 'lost':
+                    self.totals[d][k] += conn[d][k]
+            if self.verbose:
+                print('netproxy: %(client)s closed after %(seconds).3fs' % conn,
+                      'up %(bytes)d bytes %(lost)d lost,' % conn['up'],
+                      'down %(bytes)d bytes %(lost)d lost' % conn['down'],
+                      file=sys.stderr)
+            self.write_stats()
+
+    def write_stats(self):
+        if not self.stats_file:
+            return
+        tmp = self.stats_file + '.tmp'
+        with open(tmp, 'w') as f:
+            json.dump({'total': self.totals, 'connections': self.connections},
+                      f, indent=1, sort_keys=True)
+        os.rename(tmp, self.stats_file)
+
+
+def usage():
+    print("""Usage: netproxy.py --listen [HOST:]PORT --target HOST:PORT [OPTION]...
+
+Forward TCP connections from --listen to --target through a simulated link.
+
+  --bandwidth RATE         rate each way, e.g. 10mbit, 512kbit, 2MB (no limit)
+  --up-bandwidth RATE      rate from client to server
+  --down-bandwidth RATE    rate from server to client
+  --rtt MS                 round-trip time added (0)
+  --jitter MS              vary each segment's delay by up to this much (0)
+  --loss PERCENT           chance of a segment being lost and resent (0)
+  --seed N                 seed for jitter and loss (1)
+  --stats FILE             write byte counts per direction here, as JSON
+  -v, --verbose            report each connection on stderr
+""")
+
+
+def main(argv):
+    try:
+        opts, args = getopt.getopt(argv, 'v', [
+            'listen=', 'target=', 'bandwidth=', 'up-bandwidth=',
+            'down-bandwidth=', 'rtt=', 'jitter=', 'loss=', 'seed=',
+            'stats=', 'verbose', 'help'])
+    except getopt.GetoptError as e:
+        print('netproxy: %s' % e, file=sys.stderr)
+        usage()
+        return 1
+
+    listen = target = None
+    up_rate = down_rate = 0.0
+    rtt = jitter = loss = 0.0
+    seed = 1
+    stats_file = None
+    verbose = False
+    for opt, val in opts:
+        if opt == '--help':
+            usage()
+            return 0
+        elif opt == '--listen':
+            listen = parse_addr(val, '127.0.0.1')
+        elif opt == '--target':
+            target = parse_addr(val, '127.0.0.1')
+        elif opt == '--bandwidth':
+            up_rate = down_rate = parse_rate(val)
+        elif opt == '--up-bandwidth':
+            up_rate = parse_rate(val)
+        elif opt == '--down-bandwidth':
+            down_rate = parse_rate(val)
+        elif opt == '--rtt':
+            rtt = float(val) / 1000
+        elif opt == '--jitter':
+            jitter = float(val) / 1000
+        elif opt == '--loss':
+            loss = float(val) / 100
+        elif opt == '--seed':
+            seed = int(val)
+        elif opt == '--stats':
+            stats_file = val
+        elif opt in ('-v', '--verbose'):
+            verbose = True
+    if args or not listen or not target:
+        usage()
+        return 1
+
+    up = LinkParams(up_rate, rtt / 2, jitter, loss)
+    down = LinkParams(down_rate, rtt / 2, jitter, loss)
+    proxy = Proxy(listen, target, up, down, seed, stats_file, verbose)
+    # Let "kill" stop us as quietly as ^C does.
+    signal.signal(signal.SIGTERM, lambda sig, frame: sys.exit(0))
+    try:
+        proxy.serve()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
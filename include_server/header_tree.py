@@ -0,0 +1,243 @@
+#! /usr/bin/env python3
+
+# Copyright 2026 The distcc Authors
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+"""Generate synthetic source trees for benchmarking the include server.
+
+The tree looks like this:
+
+  src/unit_NNN.c          translation units
+  include/config.h        macros naming headers, for computed includes
+  include/lvlD/h_D_I.h    headers, 'width' of them at each of 'depth' levels
+
+Each translation unit includes 'fanout' headers of level 0, and each header
+of level D includes 'fanout' headers of level D+1, chosen at random; so the
+closures of different units overlap, as they do in real projects.  A
+fraction 'computed' of these includes are computed, as in
+
+  #include "config.h"
+  #include HDR_2_17
+
+with HDR_2_17 defined in config.h; the rest are written with quotes or angle
+brackets.  A fraction 'system' of the headers also include a system header
+such as <stdio.h>.  Every header has include guards and 'lines' lines of
+declarations for the parser to get through.
+
+The same arguments and seed always give the same tree.
+"""
+
+import getopt
+import os
+import random
+import sys
+
+SYSTEM_HEADERS = ['stdio.h', 'stdlib.h', 'string.h', 'stddef.h',
+                  'stdint.h', 'errno.h', 'limits.h', 'ctype.h']
+
+
+class HeaderTree(object):
+  """A synthetic source tree, and what each of its units includes.
+
+  After Generate, 'units' is the list of translation units, and
+  'closure[unit]' is the set of non-system files the unit includes, both
+  as paths relative to 'root'.
+  """
+
+  def __init__(self, root, units=20, depth=4, width=30, fanout=4,
+               computed=0.2, system=0.1, lines=40, seed=1):
+    self.root = root
+    self.num_units = units
+    self.depth = depth
+    self.width = width
+    self.fanout = min(fanout, width)
+    self.computed = computed
+    self.system = system
+    self.lines = lines
+    self.seed = seed
+    self.units = []
+    self.closure = {}
+
+  def _Header(self, level, i):
+    return 'lvl%d/h_%d_%d.h' % (level, level, i)
+
+  def _Write(self, relpath, text):
+    path = os.path.join(self.root, relpath)
+    dirname = os.path.dirname(path)
+    if not os.path.isdir(dirname):
+      os.makedirs(dirname)
+    f = open(path, 'w')
+    f.write(text)
+    f.close()
+
+  def _IncludeLines(self, rng, children, macros):
+    """Return the #include lines for children, noting computed ones."""
+    lines = []
+    uses_config = False
+    for (level, i) in children:
+      header = self._Header(level, i)
+      r = rng.random()
+      if r < self.computed:
+        macro = 'HDR_%d_%d' % (level, i)
+        macros[macro] = header
+        uses_config = True
+        lines.append('#include %s' % macro)
+      elif r < self.computed + (1 - self.computed) / 2:
+        lines.append('#include "%s"' % header)
+      else:
+        lines.append('#include <%s>' % header)
+    if uses_config:
+      lines.insert(0, '#include "config.h"')
+    return lines
+
+  def _Body(self, name):
+    lines = []
+    for k in range(self.lines):
+      if k % 4 == 0:
+        lines.append('#define %s_K%d (%d + %d)' % (name.upper(), k, k,
+                                                   len(name)))
+      else:
+        lines.append('static inline int %s_f%d(int x) { return x * %d; }'
+                     % (name, k, k))
+    return lines
+
+  def Generate(self):
+    """Write the tree under root, and work out each unit's closure."""
+    rng = random.Random(self.seed)
+    macros = {}
+    # What each header includes directly, as (level, index) pairs.
+    edges = {}
+
+    for level in range(self.depth):
+      for i in range(self.width):
+        if level + 1 < self.depth:
+          children = [(level + 1, c)
+                      for c in rng.sample(range(self.width), self.fanout)]
+        else:
+          children = []
+        edges[(level, i)] = children
+        name = 'h_%d_%d' % (level, i)
+        guard = name.upper() + '_H'
+        text = ['#ifndef %s' % guard, '#define %s' % guard]
+        text += self._IncludeLines(rng, children, macros)
+        if rng.random() < self.system:
+          text.append('#include <%s>' % rng.choice(SYSTEM_HEADERS))
+        text += self._Body(name)
+        text.append('#endif')
+        self._Write(os.path.join('include', self._Header(level, i)),
+                    '\n'.join(text) + '\n')
+
+    self.units = []
+    self.closure = {}
+    for u in range(self.num_units):
+      unit = 'src/unit_%03d.c' % u
+      roots = [(0, c) for c in rng.sample(range(self.width), self.fanout)]
+      text = ['#include "config.h"']
+      text += self._IncludeLines(rng, roots, macros)
+      text += ['int unit_%03d(int x)' % u, '{', '  return x;', '}']
+      self._Write(unit, '\n'.join(text) + '\n')
+
+      seen = set()
+      todo = list(roots)
+      while todo:
+        node = todo.pop()
+        if node not in seen:
+          seen.add(node)
+          todo.extend(edges[node])
+      closure = set([unit, 'include/config.h'])
+      closure |= set([os.path.join('include', self._Header(*node))
+                      for node in seen])
+      self.units.append(unit)
+      self.closure[unit] = closure
+
+    text = ['#ifndef CONFIG_H', '#define CONFIG_H']
+    text += ['#define %s "%s"' % (macro, macros[macro])
+             for macro in sorted(macros)]
+    text.append('#endif')
+    self._Write('include/config.h', '\n'.join(text) + '\n')
+
+  def CompileCommand(self, unit, compiler='gcc'):
+    """Return the argv that compiles unit, when run in root."""
+    return [compiler, '-Iinclude', '-c', unit,
+            '-o', os.path.splitext(unit)[0] + '.o']
+
+
+def Usage():
+  print("""Usage: header_tree.py [OPTION]... DIR
+
+Write a synthetic source tree into DIR for benchmarking the include server.
+
+  --units=N        translation units (20)
+  --depth=N        levels of headers (4)
+  --width=N        headers at each level (30)
+  --fanout=N       headers each file includes from the next level (4)
+  --computed=F     fraction of includes that are computed (0.2)
+  --system=F       fraction of headers that include a system header (0.1)
+  --lines=N        lines of declarations in each header (40)
+  --seed=N         seed for the random choices (1)
+""")
+
+
+# Options common to this and include_server_bench.py, and their types.
+TREE_OPTIONS = {'units': int, 'depth': int, 'width': int, 'fanout': int,
+                'computed': float, 'system': float, 'lines': int,
+                'seed': int}
+
+
+def ParseTreeOption(opt, arg, kwargs):
+  """If opt is one of TREE_OPTIONS, put its value in kwargs."""
+  name = opt.lstrip('-')
+  if name not in TREE_OPTIONS:
+    return False
+  kwargs[name] = TREE_OPTIONS[name](arg)
+  return True
+
+
+def main(argv):
+  try:
+    opts, args = getopt.getopt(argv, '',
+                               [name + '=' for name in TREE_OPTIONS]
+                               + ['help'])
+  except getopt.GetoptError as e:
+    print('header_tree.py: %s' % e, file=sys.stderr)
+    Usage()
+    return 1
+  kwargs = {}
+  for opt, arg in opts:
+    if opt == '--help':
+      Usage()
+      return 0
+    try:
+      ParseTreeOption(opt, arg, kwargs)
+    except ValueError:
+      Usage()
+      return 1
+  if len(args) != 1:
+    Usage()
+    return 1
+
+  tree = HeaderTree(args[0], **kwargs)
+  tree.Generate()
+  sizes = [len(tree.closure[unit]) for unit in tree.units]
+  print('%d units, %d headers, closure of %d to %d files (mean %.1f)'
+        % (len(tree.units), tree.depth * tree.width + 1,
+           min(sizes), max(sizes), float(sum(sizes)) / len(sizes)))
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main(sys.argv[1:]))
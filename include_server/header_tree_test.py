@@ -0,0 +1,85 @@
+#! /usr/bin/env python3
+
+# Copyright 2026 The distcc Authors
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+"""Check that the include server finds exactly the closures that
+header_tree.py says its synthetic trees have."""
+
+import os
+import shutil
+import tempfile
+import unittest
+
+import basics
+import header_tree
+import include_analyzer_memoizing_node
+import parse_command
+
+
+class HeaderTreeTest(unittest.TestCase):
+
+  def setUp(self):
+    basics.opt_debug_pattern = 1
+    self.cwd = os.getcwd()
+    self.root = os.path.realpath(tempfile.mkdtemp(prefix='header_tree_test.'))
+    self.client_root_keeper = basics.ClientRootKeeper()
+    self.include_analyzer = (
+        include_analyzer_memoizing_node.IncludeAnalyzerMemoizingNode(
+            self.client_root_keeper))
+
+  def tearDown(self):
+    os.chdir(self.cwd)
+    self.client_root_keeper.CleanOutClientRoots()
+    shutil.rmtree(self.root)
+
+  def Closure(self, tree, unit):
+    """Return the files under root that the include server says unit uses."""
+    a = self.include_analyzer
+    closure = a.ProcessCompilationCommand(
+        tree.root,
+        parse_command.ParseCommandArgs(
+            tree.CompileCommand(unit), tree.root, a.includepath_map,
+            a.directory_map, a.compiler_defaults))
+    prefix = tree.root + '/'
+    return set([a.realpath_map.string[idx][len(prefix):]
+                for idx in closure
+                if a.realpath_map.string[idx].startswith(prefix)])
+
+  def test_Closures(self):
+    tree = header_tree.HeaderTree(self.root, units=6, depth=3, width=12,
+                                  fanout=3, computed=0.5, system=0.3,
+                                  lines=5, seed=7)
+    tree.Generate()
+    os.chdir(self.root)
+    for unit in tree.units:
+      self.assertEqual(self.Closure(tree, unit), tree.closure[unit])
+
+  def test_Deterministic(self):
+    trees = []
+    for subdir in 'a', 'b':
+      tree = header_tree.HeaderTree(os.path.join(self.root, subdir),
+                                    units=4, seed=3)
+      tree.Generate()
+      trees.append(tree)
+    self.assertEqual(trees[0].closure, trees[1].closure)
+    for relpath in ['include/config.h', 'include/lvl1/h_1_5.h'] + trees[0].units:
+      self.assertEqual(open(os.path.join(trees[0].root, relpath)).read(),
+                       open(os.path.join(trees[1].root, relpath)).read())
+
+
+unittest.main()
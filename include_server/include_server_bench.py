@@ -0,0 +1,363 @@
+#! /usr/bin/env python3
+
+# Copyright 2026 The distcc Authors
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+# USA.
+
+"""Benchmark the include server on a synthetic source tree.
+
+A tree is made by header_tree.py, and each of its translation units is put
+through the include server's analysis several times:
+
+  cold      a new analyzer, as for the first compile of a build
+  warm      the same analyzer again, with everything memoized
+  restat    after ClearStatCaches, as after a --stat_reset_triggers hit
+
+For each pass, 'analyze' times ParseCommandArgs and
+ProcessCompilationCommand (which runs RunAlgorithm), and 'compress' times
+Compress, which copies the closure into the client root.  Then, unless
+--no-socket is given, a real include server is started and sent the same
+compilations over its Unix socket, the way the distcc client does, by
+'concurrency' clients at once for each level given.
+
+Results are printed as one JSON object per line.  Times are in
+milliseconds; 'rss_kb' is the growth in resident memory over the pass.
+Run with the pump extension on PYTHONPATH, as "make include-server-bench"
+does.
+"""
+
+import getopt
+import json
+import os
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+import basics
+import compress_files
+import header_tree
+import include_analyzer_memoizing_node
+import parse_command
+import statistics
+
+
+def _RssKb(pid='self'):
+  """Return the resident set size of process pid, in kilobytes."""
+  try:
+    for line in open('/proc/%s/status' % pid):
+      if line.startswith('VmRSS:'):
+        return int(line.split()[1])
+  except IOError:
+    pass
+  return 0
+
+
+def _Summary(times):
+  """Return count, mean and percentiles of a list of seconds, in ms."""
+  times = sorted(times)
+  n = len(times)
+  if not n:
+    return {'n': 0}
+  def Pct(p):
+    return round(times[min(n - 1, int(p * n))] * 1000, 3)
+  return {'n': n,
+          'mean_ms': round(sum(times) / n * 1000, 3),
+          'p50_ms': Pct(0.50),
+          'p90_ms': Pct(0.90),
+          'p99_ms': Pct(0.99),
+          'max_ms': round(times[-1] * 1000, 3)}
+
+
+def _Report(record):
+  print(json.dumps(record, sort_keys=True))
+  sys.stdout.flush()
+
+
+class AnalyzerBench(object):
+  """Run the include analysis in this process."""
+
+  def __init__(self, tree, compiler):
+    self.tree = tree
+    self.compiler = compiler
+    basics.opt_debug_pattern = basics.DEBUG_WARNING
+    self.client_root_keeper = basics.ClientRootKeeper()
+    self.analyzer = (
+        include_analyzer_memoizing_node.IncludeAnalyzerMemoizingNode(
+            self.client_root_keeper))
+
+  def Pass(self, name):
+    """Analyze and compress every unit of the tree once, and report."""
+    a = self.analyzer
+    analyze_times = []
+    compress_times = []
+    closure_sizes = []
+    parsed_before = statistics.parse_file_counter
+    rss_before = _RssKb()
+    for unit in self.tree.units:
+      cmd = self.tree.CompileCommand(unit, self.compiler)
+      start = time.perf_counter()
+      parsed_command = parse_command.ParseCommandArgs(
+          cmd, self.tree.root, a.includepath_map, a.directory_map,
+          a.compiler_defaults)
+      closure = a.ProcessCompilationCommand(self.tree.root, parsed_command)
+      analyzed = time.perf_counter()
+      a.compress_files.Compress(closure, self.client_root_keeper,
+                                a.currdir_idx)
+      done = time.perf_counter()
+      analyze_times.append(analyzed - start)
+      compress_times.append(done - analyzed)
+      closure_sizes.append(len(closure))
+    _Report({'bench': 'analyze', 'pass': name,
+             'files_parsed': statistics.parse_file_counter - parsed_before,
+             'closure_mean': round(float(sum(closure_sizes))
+                                   / len(closure_sizes), 1),
+             'rss_kb': _RssKb() - rss_before,
+             'analyze': _Summary(analyze_times),
+             'compress': _Summary(compress_times)})
+
+  def Run(self):
+    os.chdir(self.tree.root)
+    try:
+      self.Pass('cold')
+      self.Pass('warm')
+      self.analyzer.ClearStatCaches()
+      # Compress only copies files it hasn't seen, so clear that too, to
+      # make this pass pay for the copying again.
+      self.analyzer.compress_files.files_compressed = set()
+      self.Pass('restat')
+    finally:
+      self.client_root_keeper.CleanOutClientRoots()
+
+
+# The distcc protocol: a four-letter token, then eight hex digits giving a
+# number or the length of the string that follows.
+
+def _XToken(token, n):
+  return ('%s%08x' % (token, n)).encode()
+
+
+def _XString(token, s):
+  data = s.encode()
+  return _XToken(token, len(data)) + data
+
+
+class _Reader(object):
+
+  def __init__(self, sock):
+    self.file = sock.makefile('rb')
+
+  def Token(self, token):
+    header = self.file.read(12)
+    if len(header) != 12 or header[:4] != token.encode():
+      raise IOError('expected %s from include server, got %r'
+                    % (token, header))
+    return int(header[4:], 16)
+
+  def String(self, token):
+    return self.file.read(self.Token(token)).decode()
+
+
+class SocketBench(object):
+  """Run a real include server and talk to it over its socket."""
+
+  def __init__(self, tree, compiler, include_server):
+    self.tree = tree
+    self.compiler = compiler
+    self.include_server = include_server
+    self.tmpdir = tempfile.mkdtemp(prefix='include_server_bench.')
+    self.port = os.path.join(self.tmpdir, 'socket')
+    self.pid = None
+
+  def Start(self):
+    pid_file = os.path.join(self.tmpdir, 'pid')
+    # The server forks, and its parent exits once the child is listening.
+    subprocess.check_call([sys.executable, self.include_server,
+                           '--port', self.port, '--pid_file', pid_file,
+                           '--no-email'])
+    self.pid = int(open(pid_file).read())
+
+  def Stop(self):
+    if self.pid:
+      os.kill(self.pid, signal.SIGTERM)
+      for unused_i in range(100):
+        try:
+          os.kill(self.pid, 0)
+        except OSError:
+          break
+        time.sleep(0.05)
+    shutil.rmtree(self.tmpdir, ignore_errors=True)
+
+  def Request(self, unit):
+    """Ask the server for the closure of unit; return its file count."""
+    argv = self.tree.CompileCommand(unit, self.compiler)
+    request = (_XString('CDIR', self.tree.root)
+               + _XToken('ARGC', len(argv))
+               + b''.join([_XString('ARGV', arg) for arg in argv]))
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+      sock.connect(self.port)
+      sock.sendall(request)
+      reader = _Reader(sock)
+      count = reader.Token('ARGC')
+      for unused_i in range(count):
+        reader.String('ARGV')
+    finally:
+      sock.close()
+    if count == 0:
+      raise IOError('include server did not cover %s' % unit)
+    return count
+
+  def Level(self, name, concurrency, requests):
+    """Send requests compilations from concurrency clients, and report."""
+    units = self.tree.units
+    times = []
+    errors = []
+    lock = threading.Lock()
+    next_request = [0]
+
+    def Client():
+      while True:
+        with lock:
+          i = next_request[0]
+          next_request[0] += 1
+        if i >= requests:
+          return
+        start = time.perf_counter()
+        try:
+          self.Request(units[i % len(units)])
+        except (IOError, OSError) as why:
+          with lock:
+            errors.append(str(why))
+          continue
+        with lock:
+          times.append(time.perf_counter() - start)
+
+    rss_before = _RssKb(self.pid)
+    start = time.perf_counter()
+    threads = [threading.Thread(target=Client) for i in range(concurrency)]
+    for t in threads:
+      t.start()
+    for t in threads:
+      t.join()
+    elapsed = time.perf_counter() - start
+    record = {'bench': 'socket', 'pass': name, 'concurrency': concurrency,
+              'requests': requests, 'errors': len(errors),
+              'requests_per_sec': round(len(times) / elapsed, 1),
+              'server_rss_kb': _RssKb(self.pid),
+              'server_rss_growth_kb': _RssKb(self.pid) - rss_before,
+              'latency': _Summary(times)}
+    if errors:
+      record['first_error'] = errors[0]
+    _Report(record)
+    return not errors
+
+  def Run(self, levels, requests):
+    self.Start()
+    try:
+      ok = self.Level('cold', 1, len(self.tree.units))
+      for concurrency in levels:
+        ok = self.Level('warm', concurrency, requests) and ok
+    finally:
+      self.Stop()
+    return ok
+
+
+def Usage():
+  print("""Usage: include_server_bench.py [OPTION]... [DIR]
+
+Benchmark the include server on a synthetic tree made in DIR, or in a
+temporary directory.  The tree options are those of header_tree.py:
+
+  --units=N, --depth=N, --width=N, --fanout=N,
+  --computed=F, --system=F, --lines=N, --seed=N
+
+  --compiler=CC          compiler named in the commands (gcc)
+  --concurrency=N,...    clients at once on the socket (1,2,4,8)
+  --requests=N           requests at each concurrency (4 per unit)
+  --no-socket            skip the include server socket benchmark
+""")
+
+
+def main(argv):
+  try:
+    opts, args = getopt.getopt(
+        argv, '',
+        [name + '=' for name in header_tree.TREE_OPTIONS]
+        + ['compiler=', 'concurrency=', 'requests=', 'no-socket', 'help'])
+  except getopt.GetoptError as e:
+    print('include_server_bench.py: %s' % e, file=sys.stderr)
+    Usage()
+    return 1
+  tree_kwargs = {}
+  compiler = 'gcc'
+  levels = [1, 2, 4, 8]
+  requests = None
+  use_socket = True
+  try:
+    for opt, arg in opts:
+      if opt == '--help':
+        Usage()
+        return 0
+      elif header_tree.ParseTreeOption(opt, arg, tree_kwargs):
+        pass
+      elif opt == '--compiler':
+        compiler = arg
+      elif opt == '--concurrency':
+        levels = [int(n) for n in arg.split(',')]
+      elif opt == '--requests':
+        requests = int(arg)
+      elif opt == '--no-socket':
+        use_socket = False
+  except ValueError:
+    Usage()
+    return 1
+  if len(args) > 1:
+    Usage()
+    return 1
+
+  if args:
+    root = os.path.abspath(args[0])
+    made_root = False
+  else:
+    root = tempfile.mkdtemp(prefix='header_tree.')
+    made_root = True
+  # The include server works with real paths.
+  root = os.path.realpath(root)
+
+  include_server = os.path.join(
+      os.path.dirname(os.path.abspath(__file__)), 'include_server.py')
+  ok = True
+  try:
+    tree = header_tree.HeaderTree(root, **tree_kwargs)
+    tree.Generate()
+    if requests is None:
+      requests = 4 * len(tree.units)
+    AnalyzerBench(tree, compiler).Run()
+    if use_socket:
+      ok = SocketBench(tree, compiler, include_server).Run(levels, requests)
+  finally:
+    if made_root:
+      shutil.rmtree(root, ignore_errors=True)
+  return not ok
+
+
+if __name__ == '__main__':
+  sys.exit(main(sys.argv[1:]))
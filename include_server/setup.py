@@ -145,6 +145,7 @@ ext = distutils.extension.Extension(
               'src/filename.c',
               'src/bulk.c',
               'src/sendfile.c',
+              'src/uring.c',
               'src/compress.c',
               'src/argutil.c',
               'src/cleanup.c',
@@ -0,0 +1,637 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Resident client agent.
+ *
+ * "distcc --agent" listens on a Unix socket in the distcc directory.
+ * When DISTCC_AGENT is set, each distcc invocation hands its arguments,
+ * environment, working directory, umask and stdio descriptors to the agent
+ * and waits for an exit status, before it sets up anything of its own.
+ *
+ * The agent keeps what every compile would otherwise work out again: the
+ * parsed host list, and which of those hosts are in backoff.  The list is
+ * parsed again only when its text changes, and the backoff files are
+ * checked at most once a second.  Each compile then runs in a child forked
+ * with that state, which goes straight to dcc_build_somewhere().  The client
+ * code keeps a lot of per-compile global state (cleanup lists, signal
+ * handlers, alarms, the environment the compiler is run with), so a child
+ * per compile is much simpler than threads, and compiles still run
+ * concurrently.  Things that have to be shared between concurrent compiles
+ * -- locks, host backoff, the address cache -- stay in the distcc
+ * directory, where unaccelerated distcc processes see them too.
+ *
+ * If there is no agent, or it can't take the request, distcc just carries
+ * on and compiles in-process.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "rpc.h"
+#include "emaillog.h"
+#include "hosts.h"
+#include "agent.h"
+
+extern char **environ;
+
+static pid_t dcc_agent_child_pid = 0;
+static volatile sig_atomic_t dcc_agent_shim_signal = 0;
+
+/* What a client sends to have a compile done. */
+struct dcc_agent_request {
+    int fds[3];
+    unsigned mask;
+    char *cwd;
+    char **argv;
+    char **envv;
+};
+
+/* The host list as parsed, the text it was parsed from, and a copy with
+ * the hosts in backoff taken out as of dcc_agent_health_time. */
+static struct dcc_hostdef *dcc_agent_hosts = NULL;
+static char *dcc_agent_hosts_text = NULL;
+static struct dcc_hostdef *dcc_agent_healthy = NULL;
+static time_t dcc_agent_health_time = 0;
+
+/* Local slots before any --localslots in the host list. */
+static int dcc_agent_local_slots, dcc_agent_local_cpp_slots;
+
+
+/**
+ * Work out where the agent socket lives.  Returns a newly allocated string.
+ **/
+static int dcc_agent_sockaddr(struct sockaddr_un *sa, char **path_ret)
+{
+    char *topdir;
+    int ret;
+
+    if ((ret = dcc_get_top_dir(&topdir)))
+        return ret;
+
+    if (asprintf(path_ret, "%s/%s", topdir, DCC_AGENT_SOCKET) == -1) {
+        rs_log_error("asprintf failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    if (strlen(*path_ret) >= sizeof sa->sun_path) {
+        rs_log_warning("agent socket name \"%s\" is too long", *path_ret);
+        free(*path_ret);
+        *path_ret = NULL;
+        return EXIT_BAD_ARGUMENTS;
+    }
+
+    memset(sa, 0, sizeof *sa);
+    sa->sun_family = AF_UNIX;
+    strcpy(sa->sun_path, *path_ret);
+    return 0;
+}
+
+
+/**
+ * Pass our stdin, stdout and stderr to the agent.
+ **/
+static int dcc_agent_send_fds(int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char byte = 'F';
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof fds)];
+    } control;
+
+    memset(&msg, 0, sizeof msg);
+    memset(&control, 0, sizeof control);
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+
+    if (sendmsg(fd, &msg, 0) != 1) {
+        rs_trace("failed to send stdio to agent: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    return 0;
+}
+
+
+static int dcc_agent_recv_fds(int fd, int fds[3])
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char byte;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+
+    memset(&msg, 0, sizeof msg);
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+
+    if (recvmsg(fd, &msg, 0) != 1) {
+        rs_log_error("failed to receive stdio from client: %s",
+                     strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+        || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int))
+        || (msg.msg_flags & MSG_CTRUNC)) {
+        rs_log_error("client didn't send its stdio");
+        return EXIT_PROTOCOL_ERROR;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+    return 0;
+}
+
+
+/**
+ * Make sure that the agent is only used by the user who started it.  The
+ * socket's permissions should already ensure that, but the distcc
+ * directory might be shared.
+ **/
+static int dcc_agent_check_peer(int fd)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof cred;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1) {
+        rs_log_error("getsockopt(SO_PEERCRED) failed: %s", strerror(errno));
+        return EXIT_ACCESS_DENIED;
+    }
+    if (cred.uid != getuid()) {
+        rs_log_warning("refusing request from uid %d", (int) cred.uid);
+        return EXIT_ACCESS_DENIED;
+    }
+#else
+    (void) fd;
+#endif
+    return 0;
+}
+
+
+static void dcc_agent_free_request(struct dcc_agent_request *req)
+{
+    int i;
+
+    for (i = 0; i < 3; i++)
+        if (req->fds[i] != -1)
+            close(req->fds[i]);
+    free(req->cwd);
+    if (req->argv)
+        dcc_free_argv(req->argv);
+    if (req->envv)
+        dcc_free_argv(req->envv);
+}
+
+
+static int dcc_agent_read_request(int fd, struct dcc_agent_request *req)
+{
+    int ret;
+
+    memset(req, 0, sizeof *req);
+    req->fds[0] = req->fds[1] = req->fds[2] = -1;
+
+    if ((ret = dcc_agent_recv_fds(fd, req->fds)))
+        return ret;
+
+    if ((ret = dcc_r_token_int(fd, "UMSK", &req->mask))
+        || (ret = dcc_r_token_string(fd, "CDIR", &req->cwd))
+        || (ret = dcc_r_argv(fd, "ARGC", "ARGV", &req->argv))
+        || (ret = dcc_r_argv(fd, "ENVC", "ENVV", &req->envv))) {
+        rs_log_error("failed to read request from client");
+        return ret;
+    }
+    return 0;
+}
+
+
+/**
+ * Bring the cached host list up to date for a request, whose environment
+ * is in effect.  The list is parsed again only if its text has changed;
+ * the backoff files are checked at most once a second.
+ *
+ * Returns 0 if dcc_agent_healthy can be used for this request.
+ **/
+static int dcc_agent_update_hosts(void)
+{
+    struct dcc_hostdef *list = NULL;
+    char *text, *source;
+    time_t now = time(NULL);
+    int n = 0, ret;
+
+    if ((ret = dcc_get_hostlist_text(&text, &source)))
+        return ret;
+
+    /* Zeroconf host lists change underneath us; leave them to the child. */
+    if (strstr(text, "+zeroconf")) {
+        free(text);
+        free(source);
+        return EXIT_BAD_HOSTSPEC;
+    }
+
+    if (dcc_agent_hosts_text && !strcmp(text, dcc_agent_hosts_text)) {
+        free(text);
+    } else {
+        dcc_host_affinity = dcc_host_randomize = 0;
+        dcc_hostdef_local->n_slots = dcc_agent_local_slots;
+        dcc_hostdef_local_cpp->n_slots = dcc_agent_local_cpp_slots;
+
+        if ((ret = dcc_parse_hosts(text, source, &list, &n, NULL))) {
+            dcc_free_hostlist(list);
+            free(text);
+            free(source);
+            return ret;
+        }
+        rs_log_info("parsed %d hosts from %s", n, source);
+
+        dcc_free_hostlist(dcc_agent_hosts);
+        free(dcc_agent_hosts_text);
+        dcc_agent_hosts = list;
+        dcc_agent_hosts_text = text;
+        dcc_agent_health_time = 0;
+    }
+    free(source);
+
+    if (now != dcc_agent_health_time) {
+        dcc_free_hostlist(dcc_agent_healthy);
+        dcc_agent_healthy = NULL;
+        dcc_agent_health_time = 0;
+        if ((ret = dcc_copy_hostlist(dcc_agent_hosts, &dcc_agent_healthy,
+                                     &n))
+            || (ret = dcc_remove_disliked(&dcc_agent_healthy)))
+            return ret;
+        dcc_agent_health_time = now;
+    }
+    return 0;
+}
+
+
+/**
+ * Run a compile, in a child of the agent.  Never returns.
+ *
+ * If anything goes wrong before we send APID the client will compile by
+ * itself, so we just go away quietly.
+ **/
+static void dcc_agent_run_request(int fd, struct dcc_agent_request *req,
+                                  int have_hosts,
+                                  dcc_agent_main_fn *compile)
+{
+    int i, ret;
+
+    if (chdir(req->cwd) == -1) {
+        rs_log_error("failed to chdir to %s: %s", req->cwd, strerror(errno));
+        _exit(EXIT_IO_ERROR);
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (dup2(req->fds[i], i) == -1) {
+            rs_log_error("dup2 failed: %s", strerror(errno));
+            _exit(EXIT_IO_ERROR);
+        }
+    }
+    for (i = 0; i < 3; i++)
+        if (req->fds[i] > STDERR_FILENO)
+            close(req->fds[i]);
+
+    umask((mode_t) req->mask);
+    environ = req->envv;
+
+    /* Log just as the client would have. */
+    rs_remove_all_loggers();
+    dcc_set_trace_from_env();
+    dcc_setup_log_email();
+
+    if (have_hosts)
+        dcc_set_hostlist(dcc_agent_healthy, 1);
+
+    /* The compiler mustn't hold the connection open. */
+    set_cloexec_flag(fd, 1);
+
+    /* Put this compile in its own process group, so that a signal
+     * forwarded by the client reaches the compiler too. */
+    setpgid(0, 0);
+
+    if (dcc_x_token_int(fd, "APID", (unsigned) getpid()))
+        _exit(EXIT_IO_ERROR);
+
+    ret = compile(dcc_argv_len(req->argv), req->argv);
+    dcc_maybe_send_email();
+
+    /* Anything the client printed must be out before it moves on. */
+    fflush(NULL);
+    dcc_x_token_int(fd, "STAT", (unsigned) ret);
+    dcc_exit(ret);
+}
+
+
+static int dcc_agent_get_idle(void)
+{
+    const char *idle = getenv("DISTCC_AGENT_IDLE");
+
+    if (idle && *idle)
+        return atoi(idle);
+    return DCC_AGENT_IDLE_DEFAULT;
+}
+
+
+/**
+ * Run the agent until it has been idle for DISTCC_AGENT_IDLE seconds.
+ **/
+int dcc_agent_serve(dcc_agent_main_fn *compile)
+{
+    struct sockaddr_un sa;
+    struct dcc_agent_request req;
+    char *path, *dir;
+    char **agent_env = environ;
+    int listen_fd, fd, ret, idle, have_hosts;
+    int n_children = 0;
+    time_t last_busy;
+    pid_t pid;
+
+    if ((ret = dcc_agent_sockaddr(&sa, &path)))
+        return ret;
+
+    /* Get the distcc directories made and cached before forking, so
+     * the children don't have to. */
+    if ((ret = dcc_get_lock_dir(&dir)) || (ret = dcc_get_state_dir(&dir)))
+        return ret;
+
+    dcc_agent_local_slots = dcc_hostdef_local->n_slots;
+    dcc_agent_local_cpp_slots = dcc_hostdef_local_cpp->n_slots;
+
+    dcc_ignore_sigpipe(1);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        rs_log_error("socket failed: %s", strerror(errno));
+        return EXIT_BIND_FAILED;
+    }
+
+    if (connect(listen_fd, (struct sockaddr *) &sa, sizeof sa) == 0) {
+        rs_log_error("an agent is already listening on %s", path);
+        close(listen_fd);
+        return EXIT_BIND_FAILED;
+    }
+    close(listen_fd);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        rs_log_error("socket failed: %s", strerror(errno));
+        return EXIT_BIND_FAILED;
+    }
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *) &sa, sizeof sa) == -1
+        || chmod(path, 0600) == -1
+        || listen(listen_fd, SOMAXCONN) == -1) {
+        rs_log_error("failed to listen on %s: %s", path, strerror(errno));
+        close(listen_fd);
+        return EXIT_BIND_FAILED;
+    }
+    set_cloexec_flag(listen_fd, 1);
+
+    idle = dcc_agent_get_idle();
+    rs_log_info("agent listening on %s", path);
+
+    last_busy = time(NULL);
+    for (;;) {
+        struct pollfd pfd;
+        int status;
+
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            n_children--;
+            last_busy = time(NULL);
+        }
+
+        pfd.fd = listen_fd;
+        pfd.events = POLLIN;
+        ret = poll(&pfd, 1, 1000);
+        if (ret == -1 && errno != EINTR) {
+            rs_log_error("poll failed: %s", strerror(errno));
+            break;
+        }
+        if (ret <= 0) {
+            if (idle > 0 && n_children == 0
+                && time(NULL) - last_busy >= idle) {
+                rs_log_info("agent idle for %ds; exiting", idle);
+                break;
+            }
+            continue;
+        }
+
+        if ((fd = accept(listen_fd, NULL, NULL)) == -1) {
+            if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED)
+                rs_log_error("accept failed: %s", strerror(errno));
+            continue;
+        }
+
+        if (dcc_agent_check_peer(fd)) {
+            close(fd);
+            continue;
+        }
+
+        /* If the request can't be read, the client compiles by itself. */
+        if (dcc_agent_read_request(fd, &req)) {
+            dcc_agent_free_request(&req);
+            close(fd);
+            continue;
+        }
+
+        /* Look at the host list as the client would have. */
+        environ = req.envv;
+        have_hosts = dcc_agent_update_hosts() == 0;
+        environ = agent_env;
+
+        fflush(NULL);
+        pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            dcc_agent_run_request(fd, &req, have_hosts, compile);
+            /* not reached */
+        } else if (pid == -1) {
+            /* The client will compile by itself. */
+            rs_log_error("fork failed: %s", strerror(errno));
+        } else {
+            rs_trace("child %d handling request", (int) pid);
+            n_children++;
+            last_busy = time(NULL);
+        }
+        dcc_agent_free_request(&req);
+        close(fd);
+    }
+
+    close(listen_fd);
+    unlink(path);
+    free(path);
+    dcc_free_hostlist(dcc_agent_hosts);
+    dcc_free_hostlist(dcc_agent_healthy);
+    free(dcc_agent_hosts_text);
+    return 0;
+}
+
+
+static void dcc_agent_shim_signalled(int whichsig)
+{
+    dcc_agent_shim_signal = whichsig;
+    if (dcc_agent_child_pid > 0)
+        kill(-dcc_agent_child_pid, whichsig);
+}
+
+
+/**
+ * Is this invocation a compile, rather than one of distcc's own options?
+ * The agent only does compiles.
+ **/
+static int dcc_agent_is_compile(int argc, char **argv)
+{
+    const char *name = dcc_find_basename(argv[0]);
+
+    if (strstr(name, "distcc") == NULL)
+        return 1;               /* masquerading as the compiler */
+    if (!strcmp(name, "distcc-lto-make") || argc <= 1)
+        return 0;
+    return strncmp(argv[1], "--", 2) != 0 && strcmp(argv[1], "-j") != 0;
+}
+
+
+/**
+ * If DISTCC_AGENT is set, have the agent do this compilation.  This is
+ * called before distcc sets anything up, so it must not need logging.
+ *
+ * @returns 0 if the agent ran it, with the exit code in @p status; or
+ * nonzero if we should do it ourselves.
+ **/
+int dcc_agent_forward(int argc, char **argv, int *status)
+{
+    struct sockaddr_un sa;
+    struct pollfd pfd;
+    char *path;
+    char cwd[MAXPATHLEN + 1];
+    unsigned pid, val;
+    mode_t mask;
+    int fd;
+
+    if (!dcc_getenv_bool("DISTCC_AGENT", 0)
+        || !dcc_agent_is_compile(argc, argv))
+        return 1;
+
+    if (dcc_agent_sockaddr(&sa, &path))
+        return 1;
+
+    if (getcwd(cwd, sizeof cwd) == NULL) {
+        free(path);
+        return 1;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        free(path);
+        return 1;
+    }
+    if (connect(fd, (struct sockaddr *) &sa, sizeof sa) == -1) {
+        rs_trace("no agent on %s: %s", path, strerror(errno));
+        free(path);
+        close(fd);
+        return 1;
+    }
+    free(path);
+
+    mask = umask(0);
+    umask(mask);
+
+    if (dcc_agent_send_fds(fd)
+        || dcc_x_token_int(fd, "UMSK", (unsigned) mask)
+        || dcc_x_token_string(fd, "CDIR", cwd)
+        || dcc_x_argv(fd, "ARGC", "ARGV", argv)
+        || dcc_x_argv(fd, "ENVC", "ENVV", environ)
+        || dcc_r_token_int(fd, "APID", &pid)) {
+        rs_trace("agent didn't take the request; compiling here");
+        close(fd);
+        return 1;
+    }
+
+    /* From here on, the compile belongs to the agent. */
+    dcc_agent_child_pid = (pid_t) pid;
+    signal(SIGTERM, dcc_agent_shim_signalled);
+    signal(SIGINT, dcc_agent_shim_signalled);
+    signal(SIGHUP, dcc_agent_shim_signalled);
+
+    /* This can take as long as the compile does, which may well be longer
+     * than the IO timeout. */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (poll(&pfd, 1, -1) == -1 && errno == EINTR)
+        ;
+
+    /* If we were interrupted, die the same way once the compile has. */
+    if (dcc_agent_shim_signal) {
+        signal(dcc_agent_shim_signal, SIG_DFL);
+        raise(dcc_agent_shim_signal);
+    }
+
+    if (dcc_r_token_int(fd, "STAT", &val) == 0) {
+        *status = (int) val;
+    } else {
+        dcc_set_trace_from_env();
+        rs_log_error("agent process %u went away", pid);
+        *status = EXIT_DISTCC_FAILED;
+    }
+    close(fd);
+    return 0;
+}
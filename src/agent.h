@@ -0,0 +1,36 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __DISTCC_AGENT_H__
+#define __DISTCC_AGENT_H__
+
+/* Name of the agent's socket, inside the distcc directory. */
+#define DCC_AGENT_SOCKET "agent.sock"
+
+/* Seconds the agent waits with no work before it exits. */
+#define DCC_AGENT_IDLE_DEFAULT 600
+
+typedef int dcc_agent_main_fn(int argc, char **argv);
+
+/* agent.c */
+int dcc_agent_serve(dcc_agent_main_fn *compile);
+int dcc_agent_forward(int argc, char **argv, int *status);
+
+#endif /* __DISTCC_AGENT_H__ */
@@ -20,20 +20,26 @@
 
 #include <gssapi/gssapi.h>
 
+#include "ticket.h"
+
 /* Handshake exchange character. */
 #define HANDSHAKE '*'
 /* Notification of server access. */
 #define ACCESS 'y'
 /* Notification of server access denied. */
 #define NO_ACCESS 'n'
+/* Handshake from a client that can resume with a session ticket. */
+#define TICKET_HANDSHAKE '+'
 
 struct dcc_hostdef;
 
 int dcc_gssapi_acquire_credentials(void);
 void dcc_gssapi_release_credentials(void);
 int dcc_gssapi_obtain_list(int mode);
+int dcc_gssapi_ticket_init(void);
 void dcc_gssapi_free_list(void);
 int dcc_gssapi_check_client(int to_net_fd, int from_net_fd);
+extern char *dcc_auth_principal;
 int dcc_gssapi_perform_requested_security(const struct dcc_hostdef *host,
                       int to_net_fd,
 					  int from_net_fd);
@@ -45,3 +51,4 @@ int dcc_gssapi_compare_flags(OM_uint32 req_flags, OM_uint32 ret_flags);
 void dcc_gssapi_delete_ctx(gss_ctx_id_t *ctx_handle);
 int send_token(int sd, gss_buffer_t token);
 int recv_token(int sd, gss_buffer_t token);
+int dcc_random_bytes(unsigned char *buf, size_t len);
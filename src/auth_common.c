@@ -24,10 +24,15 @@
 #include <arpa/inet.h>
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "auth.h"
 #include "distcc.h"
@@ -233,3 +238,23 @@ int recv_token(int sd, gss_buffer_t token) {
 
     return 0;
 }
+
+/*
+ * Fill a buffer with bytes from the kernel's random number generator,
+ * for session keys and challenges.
+ *
+ * Returns 0 on success, otherwise error.
+ */
+int dcc_random_bytes(unsigned char *buf, size_t len) {
+    int fd, ret;
+
+    if ((fd = open("/dev/urandom", O_RDONLY)) == -1) {
+        rs_log_error("failed to open /dev/urandom: %s.", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    ret = dcc_readx(fd, buf, len);
+    close(fd);
+
+    return ret;
+}
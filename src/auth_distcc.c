@@ -26,14 +26,20 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include "auth.h"
 #include "distcc.h"
 #include "exitcode.h"
 #include "hosts.h"
 #include "netutil.h"
+#include "rpc.h"
+#include "sha256.h"
 #include "trace.h"
 
 static int dcc_gssapi_establish_secure_context(const struct dcc_hostdef *host,
@@ -41,8 +47,14 @@ static int dcc_gssapi_establish_secure_context(const struct dcc_hostdef *host,
 					       int from_net_sd,
 					       OM_uint32 req_flags,
 					       OM_uint32 *ret_flags);
-static int dcc_gssapi_send_handshake(int to_net_sd, int from_net_sd);
+static int dcc_gssapi_send_handshake(int to_net_sd, int from_net_sd,
+				     char handshake);
 static int dcc_gssapi_recv_notification(int sd);
+static int dcc_gssapi_resume_session(const struct dcc_hostdef *host,
+				     int to_net_sd,
+				     int from_net_sd,
+				     int *resumed);
+static int dcc_gssapi_recv_ticket(const struct dcc_hostdef *host, int sd);
 
 /**
  * Global security context in case other services are implemented in the
@@ -52,7 +64,10 @@ gss_ctx_id_t distcc_ctx_handle = GSS_C_NO_CONTEXT;
 
 /*
  * Perform any requested security.  Message replay and out of sequence
- * detection are given in addition to mutual authentication.
+ * detection are given in addition to mutual authentication.  If the
+ * host has the ",ticket" option, we first try to resume a session with
+ * a ticket the server gave us earlier, and ask for a new ticket if we
+ * have to authenticate in full.
  *
  * @param to_net_sd.	Socket to write to.
  *
@@ -63,11 +78,30 @@ gss_ctx_id_t distcc_ctx_handle = GSS_C_NO_CONTEXT;
 int dcc_gssapi_perform_requested_security(const struct dcc_hostdef *host,
 					  int to_net_sd,
 					  int from_net_sd) {
+    int resumed = 0;
     int ret;
     OM_uint32 req_flags, ret_flags;
 
     req_flags = GSS_C_MUTUAL_FLAG | GSS_C_REPLAY_FLAG | GSS_C_SEQUENCE_FLAG;
 
+    if ((ret = dcc_gssapi_send_handshake(to_net_sd, from_net_sd,
+					host->auth_ticket ? TICKET_HANDSHAKE
+							  : HANDSHAKE)) != 0) {
+        return ret;
+    }
+
+    if (host->auth_ticket) {
+        if ((ret = dcc_gssapi_resume_session(host, to_net_sd, from_net_sd,
+					    &resumed)) != 0) {
+            return ret;
+        }
+
+        if (resumed) {
+            rs_log_info("Session resumed - happy compiling!");
+            return 0;
+        }
+    }
+
     if ((ret = dcc_gssapi_establish_secure_context(host,
 						  to_net_sd,
 						  from_net_sd,
@@ -86,14 +120,20 @@ int dcc_gssapi_perform_requested_security(const struct dcc_hostdef *host,
         return ret;
     }
 
+    if (host->auth_ticket) {
+        if ((ret = dcc_gssapi_recv_ticket(host, from_net_sd)) != 0) {
+            dcc_gssapi_delete_ctx(&distcc_ctx_handle);
+            return ret;
+        }
+    }
+
     rs_log_info("Authentication complete - happy compiling!");
 
     return 0;
 }
 
 /*
- * Establish a secure context using the GSS-API.  A handshake is attempted in
- * order to detect a non-authenticating server.  The server IP address is obtained
+ * Establish a secure context using the GSS-API.  The server IP address is obtained
  * from the socket and is used to perform an fqdn lookup in case a DNS alias is
  * used as a host spec, this ensures we authenticate against the correct server.
  * We attempt to extract the server principal name, a service, from the
@@ -194,10 +234,6 @@ static int dcc_gssapi_establish_secure_context(const struct dcc_hostdef *host,
     output_tok.value = NULL;
     output_tok.length = 0;
 
-    if ((ret = dcc_gssapi_send_handshake(to_net_sd, from_net_sd)) != 0) {
-        return ret;
-    }
-
     do
     {
         major_status = gss_init_sec_context(&minor_status,
@@ -262,16 +298,20 @@ static int dcc_gssapi_establish_secure_context(const struct dcc_hostdef *host,
 
 /*
  * Attempt handshake exchange with the server to indicate client's
- * desire to authenticate.
+ * desire to authenticate.  This also detects a non-authenticating
+ * server.
  *
  * @param to_net_sd.	Socket to write to.
  *
  * @param from_net_sd.	Socket to read from.
  *
+ * @param handshake.	HANDSHAKE, or TICKET_HANDSHAKE to use tickets.
+ *
  * Returns 0 on success, otherwise error.
  */
-static int dcc_gssapi_send_handshake(int to_net_sd, int from_net_sd) {
-    char auth = HANDSHAKE;
+static int dcc_gssapi_send_handshake(int to_net_sd, int from_net_sd,
+				     char handshake) {
+    char auth = handshake;
     fd_set sockets;
     int ret;
     struct timeval timeout;
@@ -309,7 +349,7 @@ static int dcc_gssapi_send_handshake(int to_net_sd, int from_net_sd) {
 
     rs_log_info("Received %c.", auth);
 
-    if (auth != HANDSHAKE) {
+    if (auth != handshake) {
         rs_log_crit("No server handshake.");
         return EXIT_GSSAPI_FAILED;
     }
@@ -362,3 +402,259 @@ static int dcc_gssapi_recv_notification(int sd) {
     rs_log_info("Access granted by server.");
     return 0;
 }
+
+/*
+ * Work out where the session ticket for a host is kept.
+ *
+ * @param host.		The server the ticket is for.
+ *
+ * @param fname_ret.	Returns a newly allocated file name.
+ *
+ * Returns 0 on success, otherwise error.
+ */
+static int dcc_gssapi_ticket_filename(const struct dcc_hostdef *host,
+				      char **fname_ret) {
+    char *dir;
+    int ret;
+
+    if ((ret = dcc_get_subdir("auth", &dir)) != 0) {
+        return ret;
+    }
+
+    ret = asprintf(fname_ret, "%s/%s_%d", dir, host->hostname, host->port);
+    free(dir);
+
+    return (ret == -1) ? EXIT_OUT_OF_MEMORY : 0;
+}
+
+/*
+ * Offer the server our session ticket, if we have one that has not
+ * expired.  The file holds the expiry time, the session key and the
+ * ticket.  The server proves that it issued the ticket before we prove
+ * that we hold its key; if it doesn't recognise the ticket we carry on
+ * with a full authentication on the same connection.
+ *
+ * @param host.		The server we are talking to.
+ *
+ * @param to_net_sd.	Socket to write to.
+ *
+ * @param from_net_sd.	Socket to read from.
+ *
+ * @param resumed.	Set to 1 if the server let us in.
+ *
+ * Returns 0 on success, otherwise error.
+ */
+static int dcc_gssapi_resume_session(const struct dcc_hostdef *host,
+				     int to_net_sd,
+				     int from_net_sd,
+				     int *resumed) {
+    char *fname = NULL;
+    char token[5];
+    unsigned char buf[4 + DCC_SHA256_LEN + DCC_TICKET_MAX_LEN];
+    unsigned char client_nonce[DCC_TICKET_NONCE_LEN];
+    unsigned char server_nonce[DCC_TICKET_NONCE_LEN];
+    unsigned char proof[DCC_SHA256_LEN], expected[DCC_SHA256_LEN];
+    unsigned char *session_key = buf + 4;
+    unsigned char *ticket = buf + 4 + DCC_SHA256_LEN;
+    unsigned val;
+    size_t len = 0;
+    int ret;
+    uint32_t expiry;
+    FILE *f;
+
+    *resumed = 0;
+
+    if (dcc_gssapi_ticket_filename(host, &fname) == 0
+        && (f = fopen(fname, "rb")) != NULL) {
+        len = fread(buf, 1, sizeof buf, f);
+        fclose(f);
+    }
+
+    if (len > 4 + DCC_SHA256_LEN + DCC_TICKET_HEADER_LEN) {
+        expiry = (uint32_t) buf[0] << 24 | (uint32_t) buf[1] << 16
+            | (uint32_t) buf[2] << 8 | buf[3];
+        if ((time_t) expiry <= time(NULL)) {
+            rs_trace("session ticket for %s has expired", host->hostname);
+            len = 0;
+        } else {
+            len -= 4 + DCC_SHA256_LEN;
+        }
+    } else {
+        len = 0;
+    }
+
+    if (len == 0) {
+        free(fname);
+        return dcc_x_token_int(to_net_sd, "NOTK", 0);
+    }
+
+    if ((ret = dcc_random_bytes(client_nonce, sizeof client_nonce)) != 0
+        || (ret = dcc_x_token_int(to_net_sd, "TICK", len)) != 0
+        || (ret = dcc_writex(to_net_sd, ticket, len)) != 0
+        || (ret = dcc_writex(to_net_sd, client_nonce,
+                             sizeof client_nonce)) != 0
+        || (ret = dcc_r_sometoken_int(from_net_sd, token, &val)) != 0) {
+        goto out;
+    }
+
+    if (strcmp(token, "NOTK") == 0) {
+        rs_log_info("Server refused our session ticket.");
+        unlink(fname);
+        goto out;
+    } else if (strcmp(token, "RSUM") != 0) {
+        rs_log_error("Unexpected reply to session ticket: %s.", token);
+        ret = EXIT_PROTOCOL_ERROR;
+        goto out;
+    }
+
+    if ((ret = dcc_readx(from_net_sd, server_nonce,
+                         sizeof server_nonce)) != 0
+        || (ret = dcc_readx(from_net_sd, proof, sizeof proof)) != 0) {
+        goto out;
+    }
+
+    dcc_ticket_proof(session_key, "distccd", client_nonce, server_nonce,
+                     expected);
+
+    if (!dcc_mem_equal(proof, expected, sizeof proof)) {
+        rs_log_crit("Server could not prove it issued our session ticket.");
+        unlink(fname);
+        ret = EXIT_GSSAPI_FAILED;
+        goto out;
+    }
+
+    dcc_ticket_proof(session_key, "distcc", server_nonce, client_nonce,
+                     proof);
+
+    if ((ret = dcc_writex(to_net_sd, proof, sizeof proof)) != 0) {
+        goto out;
+    }
+
+    if ((ret = dcc_gssapi_recv_notification(from_net_sd)) != 0) {
+        unlink(fname);
+        goto out;
+    }
+
+    *resumed = 1;
+
+  out:
+    memset(buf, 0, 4 + DCC_SHA256_LEN);
+    free(fname);
+    return ret;
+}
+
+/*
+ * Receive the session ticket that the server gives us after a full
+ * authentication, and store it with its session key for next time.
+ * The key comes wrapped by our GSS-API context.  Failing to store the
+ * ticket only costs us a full authentication next time.
+ *
+ * @param host.		The server we are talking to.
+ *
+ * @param sd.		Socket to read from.
+ *
+ * Returns 0 on success, otherwise error.
+ */
+static int dcc_gssapi_recv_ticket(const struct dcc_hostdef *host, int sd) {
+    char token[5];
+    char *fname = NULL, *tmp = NULL;
+    gss_buffer_desc input_tok = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc output_tok = GSS_C_EMPTY_BUFFER;
+    unsigned char *ticket = NULL;
+    unsigned char head[4];
+    unsigned char *key_msg;
+    unsigned len;
+    int conf_state = 0;
+    int fd, ok, ret;
+    uint32_t expiry, lifetime;
+    OM_uint32 major_status, minor_status;
+
+    if ((ret = dcc_r_sometoken_int(sd, token, &len)) != 0) {
+        return ret;
+    }
+
+    if (strcmp(token, "NOTK") == 0) {
+        rs_log_info("Server did not issue a session ticket.");
+        return 0;
+    }
+
+    if (strcmp(token, "TICK") != 0
+        || len < DCC_TICKET_HEADER_LEN || len > DCC_TICKET_MAX_LEN) {
+        rs_log_error("Malformed session ticket.");
+        return EXIT_PROTOCOL_ERROR;
+    }
+
+    if ((ticket = malloc(len)) == NULL) {
+        rs_log_error("malloc failed : %u bytes: out of memory.", len);
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    if ((ret = dcc_readx(sd, ticket, len)) != 0
+        || (ret = recv_token(sd, &input_tok)) != 0) {
+        goto out;
+    }
+
+    major_status = gss_unwrap(&minor_status,
+			      distcc_ctx_handle,
+			      &input_tok,
+			      &output_tok,
+			      &conf_state,
+			      NULL);
+
+    if (GSS_ERROR(major_status) || !conf_state
+        || output_tok.length != DCC_SHA256_LEN + 4) {
+        rs_log_error("Failed to unwrap session ticket key.");
+        dcc_gssapi_status_to_log(major_status, GSS_C_GSS_CODE);
+        goto out;
+    }
+
+    key_msg = output_tok.value;
+    lifetime = (uint32_t) key_msg[DCC_SHA256_LEN] << 24
+        | (uint32_t) key_msg[DCC_SHA256_LEN + 1] << 16
+        | (uint32_t) key_msg[DCC_SHA256_LEN + 2] << 8
+        | key_msg[DCC_SHA256_LEN + 3];
+
+    if (lifetime <= DCC_TICKET_SLACK) {
+        goto out;
+    }
+
+    expiry = (uint32_t) time(NULL) + lifetime - DCC_TICKET_SLACK;
+    head[0] = (unsigned char) (expiry >> 24);
+    head[1] = (unsigned char) (expiry >> 16);
+    head[2] = (unsigned char) (expiry >> 8);
+    head[3] = (unsigned char) expiry;
+
+    /* Several clients may be saving at once, so write a private file
+     * and rename it into place. */
+    if (dcc_gssapi_ticket_filename(host, &fname) != 0
+        || asprintf(&tmp, "%s.%ld", fname, (long) getpid()) == -1) {
+        tmp = NULL;
+        goto out;
+    }
+
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+        rs_log_warning("failed to create %s: %s", tmp, strerror(errno));
+        goto out;
+    }
+
+    ok = dcc_writex(fd, head, sizeof head) == 0
+        && dcc_writex(fd, key_msg, DCC_SHA256_LEN) == 0
+        && dcc_writex(fd, ticket, len) == 0;
+
+    if (close(fd) == 0 && ok && rename(tmp, fname) == 0) {
+        rs_trace("saved session ticket to %s", fname);
+    } else {
+        unlink(tmp);
+    }
+
+  out:
+    if (output_tok.value) {
+        memset(output_tok.value, 0, output_tok.length);
+    }
+    dcc_gssapi_cleanup(&input_tok, &output_tok, NULL);
+    free(ticket);
+    free(fname);
+    free(tmp);
+
+    return ret;
+}
@@ -25,15 +25,19 @@
 #endif
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "auth.h"
 #include "distcc.h"
 #include "dopt.h"
 #include "exitcode.h"
 #include "netutil.h"
+#include "rpc.h"
+#include "sha256.h"
 #include "trace.h"
 
 /*Maximum length of principal name in black/white list.*/
@@ -44,8 +48,14 @@
 static int dcc_gssapi_accept_secure_context(int to_net_sd,
 					    int from_net_sd,
 					    OM_uint32 *ret_flags,
+					    OM_uint32 *time_rec,
 					    char **principal);
-static int dcc_gssapi_recv_handshake(int from_net_sd, int to_net_sd);
+static int dcc_gssapi_recv_handshake(int from_net_sd, int to_net_sd,
+				     char *handshake);
+static int dcc_gssapi_check_ticket(int to_net_sd, int from_net_sd,
+				   int *resumed);
+static int dcc_gssapi_issue_ticket(int sd, const char *principal,
+				   OM_uint32 time_rec);
 static int dcc_gssapi_check_list(char *principal, int sd);
 static int dcc_gssapi_bin_search(char *key);
 static int dcc_gssapi_notify_client(int sd, char status);
@@ -58,40 +68,61 @@ gss_cred_id_t creds;
 /*Global security context in case other services*/
 /*are implemented in the future.*/
 gss_ctx_id_t distccd_ctx_handle = GSS_C_NO_CONTEXT;
+
+/*Principal of the client authenticated on this connection, if any.*/
+char *dcc_auth_principal = NULL;
 /*Global sorted list of principal names from either a specified*/
 /*blacklist or a whitelist available to all children*/
 char **list = NULL;
 /*Global count of the number of principal names in the sorted list.*/
 int list_count = 0;
+/*Secret from which session ticket keys are derived, made before*/
+/*forking so that every child accepts the others' tickets.*/
+static unsigned char ticket_key[DCC_SHA256_LEN];
+static unsigned char ticket_key_id[DCC_TICKET_KEY_ID_LEN];
+static int ticket_key_ready = 0;
 
 /*
- * Perform any requested security.
+ * Perform any requested security.  A client that offers a valid
+ * session ticket is let in without a new GSS-API exchange; otherwise,
+ * if it asked for one, it is given a ticket once authenticated.
  *
  * @param to_net_sd.	Socket to write to.
  *
  * @param from_net_sd.	Socket to read from.
  *
- * @param ret_flags.	A representation of the services requested
- *			by the client.
- *
- * @param principal.	The name of the client principal.
- *
  * Returns 0 on success, otherwise error.
  */
 int dcc_gssapi_check_client(int to_net_sd, int from_net_sd) {
+    char handshake;
     char *principal = NULL;
+    int resumed = 0;
     int ret;
-    OM_uint32 ret_flags;
+    OM_uint32 ret_flags, time_rec = 0;
+
+    if ((ret = dcc_gssapi_recv_handshake(from_net_sd, to_net_sd,
+					&handshake)) != 0) {
+        return ret;
+    }
+
+    if (handshake == TICKET_HANDSHAKE) {
+        if ((ret = dcc_gssapi_check_ticket(to_net_sd, from_net_sd,
+					  &resumed)) != 0 || resumed) {
+            return ret;
+        }
+    }
 
     if ((ret = dcc_gssapi_accept_secure_context(to_net_sd,
 					       from_net_sd,
 					       &ret_flags,
+					       &time_rec,
 					       &principal)) != 0) {
         return ret;
     }
 
     if ((ret = dcc_gssapi_compare_flags(GSS_C_MUTUAL_FLAG | GSS_C_REPLAY_FLAG | GSS_C_SEQUENCE_FLAG, ret_flags)) != 0) {
 	dcc_gssapi_delete_ctx(&distccd_ctx_handle);
+	free(principal);
         return ret;
     }
 
@@ -105,18 +136,23 @@ int dcc_gssapi_check_client(int to_net_sd, int from_net_sd) {
 	    free(principal);
             return ret;
         }
-
-	free(principal);
     } else {
 	rs_log_info("Notifying client.");
 
 	if ((ret = dcc_gssapi_notify_client(to_net_sd, ACCESS)) != 0) {
 	    dcc_gssapi_delete_ctx(&distccd_ctx_handle);
+	    free(principal);
 	    return ret;
 	}
     }
 
-    return 0;
+    if (handshake == TICKET_HANDSHAKE) {
+        ret = dcc_gssapi_issue_ticket(to_net_sd, principal, time_rec);
+    }
+
+    free(dcc_auth_principal);
+    dcc_auth_principal = principal;
+    return ret;
 }
 
 /*
@@ -131,6 +167,8 @@ int dcc_gssapi_check_client(int to_net_sd, int from_net_sd) {
  *			requested by the client to be returned to
  *			the invoking function.
  *
+ * @param time_rec.	How many seconds the context remains valid.
+ *
  * @param principal.	The name of the client principal to be returned
  *			to the invoking function.
  *
@@ -139,6 +177,7 @@ int dcc_gssapi_check_client(int to_net_sd, int from_net_sd) {
 static int dcc_gssapi_accept_secure_context(int to_net_sd,
 					    int from_net_sd,
 					    OM_uint32 *ret_flags,
+					    OM_uint32 *time_rec,
 					    char **principal) {
     gss_buffer_desc input_tok = GSS_C_EMPTY_BUFFER;
     gss_buffer_desc name_buffer = GSS_C_EMPTY_BUFFER;
@@ -153,10 +192,6 @@ static int dcc_gssapi_accept_secure_context(int to_net_sd,
     output_tok.value = NULL;
     output_tok.length = 0;
 
-    if ((ret = dcc_gssapi_recv_handshake(from_net_sd, to_net_sd)) != 0) {
-        return ret;
-    }
-
     do {
             if ((ret = recv_token(from_net_sd, &input_tok)) != 0) {
 		rs_log_error("Error receiving token.");
@@ -174,7 +209,7 @@ static int dcc_gssapi_accept_secure_context(int to_net_sd,
 						  NULL,
 						  &output_tok,
 						  ret_flags,
-						  NULL,
+						  time_rec,
 						  NULL);
 
             if (GSS_ERROR(major_status)) {
@@ -238,15 +273,19 @@ static int dcc_gssapi_accept_secure_context(int to_net_sd,
 
 /*
  * Attempt handshake exchange with the client to indicate server's
- * desire to authenticate.
+ * desire to authenticate.  The client's handshake character is echoed
+ * back so that it knows we understood it.
  *
  * @param from_net_sd.	Socket to read from.
  *
  * @param to_net_sd.	Socket to write to.
  *
+ * @param handshake.	Returns the client's handshake character.
+ *
  * Returns 0 on success, otherwise error.
  */
-static int dcc_gssapi_recv_handshake(int from_net_sd, int to_net_sd) {
+static int dcc_gssapi_recv_handshake(int from_net_sd, int to_net_sd,
+				     char *handshake) {
     char auth;
     int ret;
 
@@ -258,11 +297,13 @@ static int dcc_gssapi_recv_handshake(int from_net_sd, int to_net_sd) {
 
     rs_log_info("Received %c.", auth);
 
-    if (auth != HANDSHAKE) {
+    if (auth != HANDSHAKE && auth != TICKET_HANDSHAKE) {
 	rs_log_crit("No client handshake - did the client require authentication?");
 	return EXIT_GSSAPI_FAILED;
     }
 
+    *handshake = auth;
+
     rs_log_info("Sending handshake.");
 
     if ((ret = dcc_writex(to_net_sd, &auth, sizeof(auth))) != 0) {
@@ -274,6 +315,203 @@ static int dcc_gssapi_recv_handshake(int from_net_sd, int to_net_sd) {
     return 0;
 }
 
+/*
+ * Handle the client's offer of a session ticket.  If the ticket was
+ * issued by us and hasn't expired, each side proves it holds the
+ * ticket's session key, and the client is let in without a GSS-API
+ * exchange: it passed any black or white list when the ticket was
+ * issued.  Otherwise the client is told "NOTK" and goes on to
+ * authenticate in full.
+ *
+ * @param to_net_sd.	Socket to write to.
+ *
+ * @param from_net_sd.	Socket to read from.
+ *
+ * @param resumed.	Set to 1 if the client has been granted access.
+ *
+ * Returns 0 on success, otherwise error.
+ */
+static int dcc_gssapi_check_ticket(int to_net_sd, int from_net_sd,
+				   int *resumed) {
+    char token[5];
+    unsigned char client_nonce[DCC_TICKET_NONCE_LEN];
+    unsigned char server_nonce[DCC_TICKET_NONCE_LEN];
+    unsigned char session_key[DCC_SHA256_LEN];
+    unsigned char proof[DCC_SHA256_LEN], expected[DCC_SHA256_LEN];
+    unsigned char *ticket = NULL;
+    unsigned len;
+    int ret;
+
+    *resumed = 0;
+
+    if ((ret = dcc_r_sometoken_int(from_net_sd, token, &len)) != 0) {
+        return ret;
+    }
+
+    if (strcmp(token, "NOTK") == 0) {
+        rs_log_info("Client has no session ticket.");
+        return 0;
+    }
+
+    if (strcmp(token, "TICK") != 0
+        || len < DCC_TICKET_HEADER_LEN || len > DCC_TICKET_MAX_LEN) {
+        rs_log_error("Malformed session ticket.");
+        return EXIT_PROTOCOL_ERROR;
+    }
+
+    if ((ticket = malloc(len + 1)) == NULL) {
+        rs_log_error("malloc failed : %u bytes: out of memory.", len + 1);
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    if ((ret = dcc_readx(from_net_sd, ticket, len)) != 0
+        || (ret = dcc_readx(from_net_sd, client_nonce,
+                            sizeof client_nonce)) != 0) {
+        free(ticket);
+        return ret;
+    }
+
+    ticket[len] = '\0';
+
+    if (!ticket_key_ready
+        || !dcc_ticket_valid(ticket_key_id, ticket, len, time(NULL))) {
+        rs_log_info("Refusing stale or foreign session ticket.");
+        free(ticket);
+        return dcc_x_token_int(to_net_sd, "NOTK", 0);
+    }
+
+    dcc_ticket_session_key(ticket_key, ticket, len, session_key);
+
+    if ((ret = dcc_random_bytes(server_nonce, sizeof server_nonce)) != 0) {
+        free(ticket);
+        return ret;
+    }
+
+    dcc_ticket_proof(session_key, "distccd", client_nonce, server_nonce,
+                     proof);
+
+    if ((ret = dcc_x_token_int(to_net_sd, "RSUM", 0)) != 0
+        || (ret = dcc_writex(to_net_sd, server_nonce,
+                             sizeof server_nonce)) != 0
+        || (ret = dcc_writex(to_net_sd, proof, sizeof proof)) != 0
+        || (ret = dcc_readx(from_net_sd, proof, sizeof proof)) != 0) {
+        free(ticket);
+        return ret;
+    }
+
+    dcc_ticket_proof(session_key, "distcc", server_nonce, client_nonce,
+                     expected);
+    memset(session_key, 0, sizeof session_key);
+
+    if (!dcc_mem_equal(proof, expected, sizeof proof)) {
+        rs_log_crit("Access denied - bad session ticket proof.");
+        free(ticket);
+        dcc_gssapi_notify_client(to_net_sd, NO_ACCESS);
+        return EXIT_GSSAPI_FAILED;
+    }
+
+    rs_log_info("Resumed session for %s.",
+                (char *) ticket + DCC_TICKET_HEADER_LEN);
+    free(dcc_auth_principal);
+    dcc_auth_principal = strdup((char *) ticket + DCC_TICKET_HEADER_LEN);
+    free(ticket);
+
+    if ((ret = dcc_gssapi_notify_client(to_net_sd, ACCESS)) != 0) {
+        return ret;
+    }
+
+    *resumed = 1;
+    return 0;
+}
+
+/*
+ * Give a newly authenticated client a session ticket.  The ticket
+ * itself is sent in the clear: it only names the principal and the
+ * expiry time.  Its session key is derived from it with our secret,
+ * and is sent wrapped by the GSS-API context, so only this client can
+ * learn it.
+ *
+ * @param sd.		Socket to write to.
+ *
+ * @param principal.	The name of the client principal.
+ *
+ * @param time_rec.	Lifetime of the client's GSS-API context; the
+ *			ticket expires no later than that.
+ *
+ * Returns 0 on success, otherwise error.
+ */
+static int dcc_gssapi_issue_ticket(int sd, const char *principal,
+				   OM_uint32 time_rec) {
+    gss_buffer_desc input_tok = GSS_C_EMPTY_BUFFER;
+    gss_buffer_desc output_tok = GSS_C_EMPTY_BUFFER;
+    unsigned char *ticket;
+    unsigned char key_msg[DCC_SHA256_LEN + 4];
+    unsigned lifetime = arg_ticket_lifetime;
+    size_t len;
+    int conf_state = 0;
+    int ret;
+    OM_uint32 major_status, minor_status;
+
+    len = DCC_TICKET_HEADER_LEN + strlen(principal);
+
+    if (!ticket_key_ready || arg_ticket_lifetime <= 0
+        || len > DCC_TICKET_MAX_LEN) {
+        return dcc_x_token_int(sd, "NOTK", 0);
+    }
+
+    if (time_rec != GSS_C_INDEFINITE && time_rec < lifetime) {
+        lifetime = time_rec;
+    }
+
+    if ((ticket = malloc(len)) == NULL) {
+        rs_log_error("malloc failed : %ld bytes: out of memory.", (long) len);
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    dcc_ticket_make(ticket_key_id, principal,
+                    (uint32_t) time(NULL) + lifetime, ticket);
+    dcc_ticket_session_key(ticket_key, ticket, len, key_msg);
+    key_msg[DCC_SHA256_LEN] = (unsigned char) (lifetime >> 24);
+    key_msg[DCC_SHA256_LEN + 1] = (unsigned char) (lifetime >> 16);
+    key_msg[DCC_SHA256_LEN + 2] = (unsigned char) (lifetime >> 8);
+    key_msg[DCC_SHA256_LEN + 3] = (unsigned char) lifetime;
+
+    input_tok.value = key_msg;
+    input_tok.length = sizeof key_msg;
+
+    major_status = gss_wrap(&minor_status,
+			    distccd_ctx_handle,
+			    1,
+			    GSS_C_QOP_DEFAULT,
+			    &input_tok,
+			    &conf_state,
+			    &output_tok);
+    memset(key_msg, 0, sizeof key_msg);
+
+    if (GSS_ERROR(major_status) || !conf_state) {
+        rs_log_error("Failed to seal session ticket key; not issuing one.");
+        dcc_gssapi_status_to_log(major_status, GSS_C_GSS_CODE);
+        dcc_gssapi_cleanup(NULL, &output_tok, NULL);
+        free(ticket);
+        return dcc_x_token_int(sd, "NOTK", 0);
+    }
+
+    if ((ret = dcc_x_token_int(sd, "TICK", len)) == 0
+        && (ret = dcc_writex(sd, ticket, len)) == 0) {
+        ret = send_token(sd, &output_tok);
+    }
+
+    if (ret == 0) {
+        rs_log_info("Issued session ticket to %s for %u seconds.",
+                    principal, lifetime);
+    }
+
+    dcc_gssapi_cleanup(NULL, &output_tok, NULL);
+    free(ticket);
+
+    return ret;
+}
+
 /*
  * Check the name of the connecting client principal against the sorted
  * list of principal names using a binary search to determine access
@@ -464,6 +702,34 @@ int dcc_gssapi_acquire_credentials(void) {
     return 0;
 }
 
+/*
+ * Make the secret used to issue session tickets.  This must be done
+ * before forking children, which then all accept each other's tickets;
+ * tickets don't survive a restart of the daemon.
+ *
+ * Returns 0 on success, otherwise error.
+ */
+int dcc_gssapi_ticket_init(void) {
+    int ret;
+
+    if (arg_ticket_lifetime <= 0) {
+        rs_log_info("Session tickets disabled.");
+        return 0;
+    }
+
+    if ((ret = dcc_random_bytes(ticket_key, sizeof ticket_key)) != 0
+        || (ret = dcc_random_bytes(ticket_key_id,
+                                   sizeof ticket_key_id)) != 0) {
+        return ret;
+    }
+
+    ticket_key_ready = 1;
+    rs_log_info("Issuing session tickets valid for %d seconds.",
+                arg_ticket_lifetime);
+
+    return 0;
+}
+
 /*
  * Release acquired credentials.
  */
@@ -92,7 +92,7 @@ int dcc_disliked_host(const struct dcc_hostdef *host)
 }
 
 
-static int dcc_check_backoff(struct dcc_hostdef *host)
+int dcc_check_backoff(struct dcc_hostdef *host)
 {
     int ret;
     time_t mtime;
@@ -116,14 +116,14 @@ int dcc_remove_disliked(struct dcc_hostdef **hostlist)
 {
     struct dcc_hostdef *h;
 
-    if (!dcc_backoff_is_enabled())
+    if (!dcc_backoff_is_enabled() || dcc_hostlist_checked)
 	return 0;
 
     while ((h = *hostlist) != NULL) {
         if (dcc_check_backoff(h) != 0) {
             rs_trace("remove %s from list", h->hostdef_string);
             *hostlist = h->next;
-            free(h);
+            dcc_free_hostdef(h);
         } else {
             /* check next one */
             hostlist = &h->next;
@@ -0,0 +1,887 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Run every compilation in a compilation database (compile_commands.json)
+ * from a single distcc process.
+ *
+ * Each compilation is run in a forked child of this process, which runs
+ * the ordinary client code, so there's no make, shell or exec of distcc per
+ * file.  Rather than have every child fight over the lock files for a slot,
+ * the parent keeps count of how many compilations it has running on each
+ * host and gives each child a host list naming just the host it should
+ * use.
+ *
+ * Each child's stdout and stderr go to an unlinked temporary file, and are
+ * copied out together with a result line in the order the commands appear
+ * in the database, however the compilations actually finish.
+ *
+ * distcc-lto-make (lto.c) uses the same scheduler for LTO partitions.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "hosts.h"
+#include "batch.h"
+
+
+/* Also check each host's backoff file no more often than this. */
+#define DCC_BATCH_BACKOFF_CHECK 1
+
+/* Descriptors kept back for the child's own use. */
+#define DCC_BATCH_SPARE_FDS 64
+
+
+struct dcc_batch_host {
+    struct dcc_hostdef *host;
+    int running;
+    int backed_off;
+    time_t checked;
+};
+
+struct dcc_batch_job {
+    pid_t pid;
+    struct dcc_batch_host *host;
+    int out_fd, err_fd;
+    int done;
+    int reported;
+    int status;
+    struct timeval start;
+    double elapsed;
+};
+
+
+static void dcc_json_ws(const char **p)
+{
+    while (**p == ' ' || **p == '\t' || **p == '\n' || **p == '\r')
+        (*p)++;
+}
+
+
+static int dcc_json_expect(const char **p, char c)
+{
+    dcc_json_ws(p);
+    if (**p != c) {
+        rs_log_error("compilation database: expected '%c' near \"%.20s\"",
+                     c, *p);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    (*p)++;
+    return 0;
+}
+
+
+static int dcc_json_hex4(const char *s, unsigned *val)
+{
+    int i;
+
+    *val = 0;
+    for (i = 0; i < 4; i++) {
+        char c = s[i];
+        *val <<= 4;
+        if (c >= '0' && c <= '9')
+            *val |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            *val |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            *val |= c - 'A' + 10;
+        else
+            return EXIT_BAD_ARGUMENTS;
+    }
+    return 0;
+}
+
+
+static char *dcc_json_put_utf8(char *o, unsigned c)
+{
+    if (c < 0x80) {
+        *o++ = (char) c;
+    } else if (c < 0x800) {
+        *o++ = (char) (0xc0 | (c >> 6));
+        *o++ = (char) (0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        *o++ = (char) (0xe0 | (c >> 12));
+        *o++ = (char) (0x80 | ((c >> 6) & 0x3f));
+        *o++ = (char) (0x80 | (c & 0x3f));
+    } else {
+        *o++ = (char) (0xf0 | (c >> 18));
+        *o++ = (char) (0x80 | ((c >> 12) & 0x3f));
+        *o++ = (char) (0x80 | ((c >> 6) & 0x3f));
+        *o++ = (char) (0x80 | (c & 0x3f));
+    }
+    return o;
+}
+
+
+/**
+ * Read a JSON string into a newly allocated buffer.
+ **/
+static int dcc_json_string(const char **p, char **ret)
+{
+    const char *s;
+    char *o;
+    unsigned c, lo;
+
+    if (dcc_json_expect(p, '"'))
+        return EXIT_BAD_ARGUMENTS;
+
+    /* The decoded string is never longer than the encoded one. */
+    for (s = *p; *s && *s != '"'; s++)
+        if (*s == '\\' && s[1])
+            s++;
+    if (!*s) {
+        rs_log_error("compilation database: unterminated string");
+        return EXIT_BAD_ARGUMENTS;
+    }
+    if ((*ret = o = malloc(s - *p + 1)) == NULL) {
+        rs_log_error("malloc failed");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    for (s = *p; *s != '"'; s++) {
+        if (*s != '\\') {
+            *o++ = *s;
+            continue;
+        }
+        switch (*++s) {
+        case 'b': *o++ = '\b'; break;
+        case 'f': *o++ = '\f'; break;
+        case 'n': *o++ = '\n'; break;
+        case 'r': *o++ = '\r'; break;
+        case 't': *o++ = '\t'; break;
+        case 'u':
+            if (dcc_json_hex4(s + 1, &c))
+                goto bad;
+            s += 4;
+            if (c >= 0xd800 && c < 0xdc00 && s[1] == '\\' && s[2] == 'u'
+                && dcc_json_hex4(s + 3, &lo) == 0
+                && lo >= 0xdc00 && lo < 0xe000) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+                s += 6;
+            }
+            o = dcc_json_put_utf8(o, c);
+            break;
+        default:
+            /* \" \\ \/ */
+            *o++ = *s;
+            break;
+        }
+    }
+    *o = '\0';
+    *p = s + 1;
+    return 0;
+
+  bad:
+    rs_log_error("compilation database: bad \\u escape");
+    free(*ret);
+    *ret = NULL;
+    return EXIT_BAD_ARGUMENTS;
+}
+
+
+/**
+ * Skip over any JSON value we don't care about.
+ **/
+static int dcc_json_skip(const char **p)
+{
+    char *s;
+    int ret;
+
+    dcc_json_ws(p);
+    switch (**p) {
+    case '"':
+        if ((ret = dcc_json_string(p, &s)))
+            return ret;
+        free(s);
+        return 0;
+    case '[':
+    case '{': {
+        char close = (**p == '[') ? ']' : '}';
+
+        (*p)++;
+        dcc_json_ws(p);
+        if (**p == close) {
+            (*p)++;
+            return 0;
+        }
+        for (;;) {
+            if (close == '}') {
+                if ((ret = dcc_json_skip(p))
+                    || (ret = dcc_json_expect(p, ':')))
+                    return ret;
+            }
+            if ((ret = dcc_json_skip(p)))
+                return ret;
+            dcc_json_ws(p);
+            if (**p == ',') {
+                (*p)++;
+            } else {
+                return dcc_json_expect(p, close);
+            }
+        }
+    }
+    default:
+        /* numbers, true, false, null */
+        if (!**p || strchr(",]}", **p)) {
+            rs_log_error("compilation database: expected a value");
+            return EXIT_BAD_ARGUMENTS;
+        }
+        while (**p && !strchr(",]} \t\r\n", **p))
+            (*p)++;
+        return 0;
+    }
+}
+
+
+static int dcc_json_string_array(const char **p, char ***ret)
+{
+    char **a = NULL;
+    int n = 0, r;
+
+    if ((r = dcc_json_expect(p, '[')))
+        return r;
+    if ((a = calloc(1, sizeof a[0])) == NULL)
+        return EXIT_OUT_OF_MEMORY;
+
+    dcc_json_ws(p);
+    if (**p == ']') {
+        (*p)++;
+        *ret = a;
+        return 0;
+    }
+    for (;;) {
+        char **b = realloc(a, (n + 2) * sizeof a[0]);
+
+        if (b == NULL) {
+            r = EXIT_OUT_OF_MEMORY;
+            break;
+        }
+        a = b;
+        a[n+1] = NULL;
+        if ((r = dcc_json_string(p, &a[n])))
+            break;
+        n++;
+        dcc_json_ws(p);
+        if (**p != ',') {
+            if ((r = dcc_json_expect(p, ']')))
+                break;
+            *ret = a;
+            return 0;
+        }
+        (*p)++;
+    }
+    dcc_free_argv(a);
+    return r;
+}
+
+
+/**
+ * Split a "command" entry the way a POSIX shell would split a simple
+ * command: on unquoted whitespace, with '', "" and backslash quoting.
+ **/
+int dcc_batch_split_command(const char *cmd, char ***argv_ret)
+{
+    char **argv;
+    char *buf, *o;
+    const char *s;
+    int n = 0, in_word = 0;
+
+    /* No more words than there are characters, and no word longer than
+     * the command. */
+    if ((argv = calloc(strlen(cmd) / 2 + 2, sizeof argv[0])) == NULL
+        || (buf = malloc(strlen(cmd) + 1)) == NULL) {
+        free(argv);
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    o = buf;
+    for (s = cmd; ; s++) {
+        if (*s == '\0' || *s == ' ' || *s == '\t' || *s == '\n') {
+            if (in_word) {
+                *o = '\0';
+                if ((argv[n++] = strdup(buf)) == NULL)
+                    goto oom;
+                o = buf;
+                in_word = 0;
+            }
+            if (*s == '\0')
+                break;
+            continue;
+        }
+        in_word = 1;
+        if (*s == '\'') {
+            for (s++; *s && *s != '\''; s++)
+                *o++ = *s;
+        } else if (*s == '"') {
+            for (s++; *s && *s != '"'; s++) {
+                if (*s == '\\' && s[1] && strchr("\"\\$`\n", s[1]))
+                    s++;
+                *o++ = *s;
+            }
+        } else if (*s == '\\' && s[1]) {
+            *o++ = *++s;
+        } else {
+            *o++ = *s;
+        }
+        if (*s == '\0') {
+            rs_log_error("unterminated quote in \"%s\"", cmd);
+            free(buf);
+            dcc_free_argv(argv);
+            return EXIT_BAD_ARGUMENTS;
+        }
+    }
+
+    free(buf);
+    *argv_ret = argv;
+    return 0;
+
+  oom:
+    free(buf);
+    dcc_free_argv(argv);
+    return EXIT_OUT_OF_MEMORY;
+}
+
+
+/**
+ * Parse a compilation database.
+ *
+ * Entries have a "directory" and either an "arguments" array or a "command"
+ * string; "file" is used only to report results.  Other keys are ignored.
+ **/
+int dcc_batch_parse(const char *json, struct dcc_batch_entry **entries,
+                    int *n_entries)
+{
+    const char *p = json;
+    struct dcc_batch_entry *e = NULL, *ent;
+    char *key, *command;
+    int n = 0, ret;
+
+    *entries = NULL;
+    *n_entries = 0;
+
+    if ((ret = dcc_json_expect(&p, '[')))
+        return ret;
+    dcc_json_ws(&p);
+    if (*p == ']')
+        return 0;
+
+    for (;;) {
+        struct dcc_batch_entry *f = realloc(e, (n + 1) * sizeof *e);
+
+        if (f == NULL) {
+            ret = EXIT_OUT_OF_MEMORY;
+            goto fail;
+        }
+        e = f;
+        ent = &e[n++];
+        memset(ent, 0, sizeof *ent);
+        command = NULL;
+
+        if ((ret = dcc_json_expect(&p, '{')))
+            goto fail;
+        dcc_json_ws(&p);
+        while (*p != '}') {
+            if ((ret = dcc_json_string(&p, &key))
+                || (ret = dcc_json_expect(&p, ':')))
+                goto fail;
+
+            if (!strcmp(key, "directory") && !ent->directory)
+                ret = dcc_json_string(&p, &ent->directory);
+            else if (!strcmp(key, "file") && !ent->file)
+                ret = dcc_json_string(&p, &ent->file);
+            else if (!strcmp(key, "arguments") && !ent->argv)
+                ret = dcc_json_string_array(&p, &ent->argv);
+            else if (!strcmp(key, "command") && !command)
+                ret = dcc_json_string(&p, &command);
+            else
+                ret = dcc_json_skip(&p);
+            free(key);
+            if (ret)
+                goto fail;
+
+            dcc_json_ws(&p);
+            if (*p == ',') {
+                p++;
+                dcc_json_ws(&p);
+            } else if (*p != '}') {
+                ret = dcc_json_expect(&p, '}');
+                goto fail;
+            }
+        }
+        p++;
+
+        if (!ent->argv && command)
+            ret = dcc_batch_split_command(command, &ent->argv);
+        free(command);
+        if (ret)
+            goto fail;
+        if (!ent->directory || !ent->argv || !ent->argv[0]) {
+            rs_log_error("compilation database entry %d has no directory "
+                         "or command", n);
+            ret = EXIT_BAD_ARGUMENTS;
+            goto fail;
+        }
+
+        dcc_json_ws(&p);
+        if (*p != ',')
+            break;
+        p++;
+    }
+    if ((ret = dcc_json_expect(&p, ']')))
+        goto fail;
+
+    *entries = e;
+    *n_entries = n;
+    return 0;
+
+  fail:
+    dcc_batch_free(e, n);
+    return ret;
+}
+
+
+void dcc_batch_free(struct dcc_batch_entry *entries, int n_entries)
+{
+    int i;
+
+    for (i = 0; i < n_entries; i++) {
+        free(entries[i].directory);
+        free(entries[i].file);
+        if (entries[i].argv)
+            dcc_free_argv(entries[i].argv);
+    }
+    free(entries);
+}
+
+
+/**
+ * Read a whole file.  dcc_load_file_string() won't do, because
+ * databases for big trees run to many megabytes.
+ **/
+int dcc_batch_load(const char *fname, char **buf_ret)
+{
+    struct stat sb;
+    char *buf;
+    size_t done = 0;
+    ssize_t r;
+    int fd;
+
+    if ((fd = open(fname, O_RDONLY)) == -1) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        return EXIT_NO_SUCH_FILE;
+    }
+    if (fstat(fd, &sb) == -1) {
+        rs_log_error("fstat %s failed: %s", fname, strerror(errno));
+        close(fd);
+        return EXIT_IO_ERROR;
+    }
+    if ((buf = malloc((size_t) sb.st_size + 1)) == NULL) {
+        close(fd);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    while (done < (size_t) sb.st_size
+           && (r = read(fd, buf + done, (size_t) sb.st_size - done)) != 0) {
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            rs_log_error("read %s failed: %s", fname, strerror(errno));
+            free(buf);
+            close(fd);
+            return EXIT_IO_ERROR;
+        }
+        done += r;
+    }
+    buf[done] = '\0';
+    close(fd);
+    *buf_ret = buf;
+    return 0;
+}
+
+
+/**
+ * An anonymous file to hold one compilation's output.
+ **/
+static int dcc_batch_output_file(int *fd_ret)
+{
+    const char *tmp_top;
+    char *name;
+    int fd, ret;
+
+    if ((ret = dcc_get_tmp_top(&tmp_top)))
+        return ret;
+    if (asprintf(&name, "%s/distcc_batch_XXXXXX", tmp_top) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if ((fd = mkstemp(name)) == -1) {
+        rs_log_error("failed to create %s: %s", name, strerror(errno));
+        free(name);
+        return EXIT_IO_ERROR;
+    }
+    unlink(name);
+    free(name);
+    set_cloexec_flag(fd, 1);
+    *fd_ret = fd;
+    return 0;
+}
+
+
+static void dcc_batch_copy_out(int from_fd, int to_fd)
+{
+    char buf[8192];
+    ssize_t r;
+
+    if (lseek(from_fd, 0, SEEK_SET) == -1)
+        return;
+    while ((r = read(from_fd, buf, sizeof buf)) > 0)
+        if (dcc_writex(to_fd, buf, (size_t) r))
+            break;
+}
+
+
+/**
+ * Pick the first host in the list that has a free slot and isn't backing
+ * off.  If every host is backing off, compile here, on as many CPUs as we
+ * have.
+ *
+ * @returns NULL if everything is busy.
+ **/
+static struct dcc_batch_host *dcc_batch_pick_host(struct dcc_batch_host *hosts,
+                                                  int n_hosts,
+                                                  struct dcc_batch_host *local)
+{
+    int i, any_up = 0;
+    time_t now = time(NULL);
+
+    for (i = 0; i < n_hosts; i++) {
+        struct dcc_batch_host *h = &hosts[i];
+
+        if (dcc_backoff_is_enabled()
+            && now - h->checked >= DCC_BATCH_BACKOFF_CHECK) {
+            h->backed_off = dcc_check_backoff(h->host) != 0;
+            h->checked = now;
+        }
+        if (h->backed_off)
+            continue;
+        any_up = 1;
+        if (h->running < h->host->n_slots)
+            return h;
+    }
+
+    if (!any_up && local->running < local->host->n_slots)
+        return local;
+    return NULL;
+}
+
+
+/**
+ * Run one compilation, in a child of the batch process.  Never returns.
+ **/
+static void dcc_batch_child(struct dcc_batch_entry *e,
+                            struct dcc_batch_job *job,
+                            dcc_batch_main_fn *client_main)
+{
+    char **argv, **a;
+    int null_fd, ret;
+
+    if (dup2(job->out_fd, STDOUT_FILENO) == -1
+        || dup2(job->err_fd, STDERR_FILENO) == -1)
+        _exit(EXIT_IO_ERROR);
+    if ((null_fd = open("/dev/null", O_RDONLY)) != -1) {
+        dup2(null_fd, STDIN_FILENO);
+        close(null_fd);
+    }
+
+    if (chdir(e->directory) == -1) {
+        rs_log_error("failed to chdir to %s: %s", e->directory,
+                     strerror(errno));
+        _exit(EXIT_IO_ERROR);
+    }
+
+    if (setenv("DISTCC_HOSTS", job->host->host->hostdef_string, 1) == -1)
+        _exit(EXIT_OUT_OF_MEMORY);
+
+    /* Run it as "distcc COMPILER ARGS", whether or not the database
+     * already goes through distcc. */
+    a = e->argv;
+    if (strstr(dcc_find_basename(a[0]), "distcc") && a[1])
+        a++;
+    if (!(argv = calloc(dcc_argv_len(a) + 2, sizeof argv[0])))
+        _exit(EXIT_OUT_OF_MEMORY);
+    argv[0] = (char *) "distcc";
+    memcpy(&argv[1], a, dcc_argv_len(a) * sizeof a[0]);
+
+    ret = client_main(dcc_argv_len(argv), argv);
+    fflush(NULL);
+    dcc_exit(ret);
+}
+
+
+static int dcc_batch_usage(void)
+{
+    fprintf(stderr,
+            "usage: distcc --batch [-k] [-j JOBS] compile_commands.json\n");
+    return EXIT_BAD_ARGUMENTS;
+}
+
+
+/**
+ * Run every entry in @p entries, up to @p max_jobs at once, or as many as
+ * the hosts have slots for if it's zero.
+ *
+ * Normally each compilation's output is copied out with a result line, in
+ * the order of @p entries.  DCC_BATCH_UNORDERED copies it out as soon as
+ * the compilation finishes instead, and DCC_BATCH_QUIET leaves out the
+ * result lines.
+ *
+ * @returns 0, or the status of the first compilation that failed.
+ **/
+int dcc_batch_schedule(struct dcc_batch_entry *entries, int n, int max_jobs,
+                       int flags, dcc_batch_main_fn *client_main)
+{
+    struct dcc_batch_job *jobs = NULL;
+    struct dcc_batch_host *hosts = NULL, local;
+    struct dcc_hostdef *list = NULL, *l, local_def;
+    struct rlimit rl;
+    int keep_going = flags & DCC_BATCH_KEEP_GOING, window;
+    int n_hosts, i, ret, first_failure = 0;
+    int next_start = 0, next_report = 0, running = 0;
+
+    if (n == 0)
+        return 0;
+
+    if ((ret = dcc_get_hostlist(&list, &n_hosts)))
+        goto out;
+    if ((hosts = calloc(n_hosts, sizeof hosts[0])) == NULL
+        || (jobs = calloc(n, sizeof jobs[0])) == NULL) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+    for (i = 0, l = list; l; l = l->next, i++) {
+        hosts[i].host = l;
+        if (max_jobs <= 0)
+            max_jobs += l->n_slots;
+    }
+    if (max_jobs <= 0)
+        max_jobs = 1;
+
+    /* Somewhere to go if every host is backing off. */
+    local_def = *dcc_hostdef_local;
+    dcc_ncpus(&local_def.n_slots);
+    memset(&local, 0, sizeof local);
+    local.host = &local_def;
+
+    /* Every compilation that hasn't been reported yet holds two files
+     * open, so get all the descriptors we can and don't run so far ahead
+     * of the oldest compilation that we'd run out. */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        if (rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+            getrlimit(RLIMIT_NOFILE, &rl);
+        }
+        if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > 1 << 20)
+            rl.rlim_cur = 1 << 20;
+        window = ((int) rl.rlim_cur - DCC_BATCH_SPARE_FDS) / 2;
+    } else {
+        window = 256;
+    }
+    if (window < 1)
+        window = 1;
+
+    rs_trace("batch of %d compilations, up to %d at once on %d hosts",
+             n, max_jobs, n_hosts);
+
+    while (next_report < n) {
+        struct dcc_batch_job *job;
+        int status;
+        pid_t pid;
+
+        while (next_start < n && running < max_jobs
+               && next_start - next_report < window
+               && (keep_going || !first_failure)) {
+            struct dcc_batch_host *h;
+
+            if (!(h = dcc_batch_pick_host(hosts, n_hosts, &local)))
+                break;
+            job = &jobs[next_start];
+            job->host = h;
+            if ((ret = dcc_batch_output_file(&job->out_fd))
+                || (ret = dcc_batch_output_file(&job->err_fd)))
+                goto out;
+            gettimeofday(&job->start, NULL);
+            fflush(NULL);
+            if ((pid = fork()) == 0) {
+                dcc_batch_child(&entries[next_start], job, client_main);
+                /* not reached */
+            } else if (pid == -1) {
+                rs_log_error("fork failed: %s", strerror(errno));
+                close(job->out_fd);
+                close(job->err_fd);
+                if (running == 0) {
+                    ret = EXIT_DISTCC_FAILED;
+                    goto out;
+                }
+                break;
+            }
+            job->pid = pid;
+            h->running++;
+            running++;
+            next_start++;
+        }
+
+        if (running == 0)
+            break;
+
+        while ((pid = waitpid(-1, &status, 0)) == -1 && errno == EINTR)
+            ;
+        if (pid == -1) {
+            rs_log_error("waitpid failed: %s", strerror(errno));
+            ret = EXIT_DISTCC_FAILED;
+            goto out;
+        }
+        for (i = next_report; i < next_start; i++)
+            if (jobs[i].pid == pid && !jobs[i].done)
+                break;
+        if (i == next_start)
+            continue;
+
+        job = &jobs[i];
+        job->done = 1;
+        if (WIFEXITED(status))
+            job->status = WEXITSTATUS(status);
+        else
+            job->status = EXIT_COMPILER_CRASHED;
+        {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            job->elapsed = (now.tv_sec - job->start.tv_sec)
+                + (now.tv_usec - job->start.tv_usec) / 1e6;
+        }
+        job->host->running--;
+        running--;
+
+        /* Report everything that's finished, in order unless we were
+         * asked not to bother. */
+        for (i = next_report; i < next_start; i++) {
+            struct dcc_batch_entry *e = &entries[i];
+
+            job = &jobs[i];
+            if (!job->done) {
+                if (flags & DCC_BATCH_UNORDERED)
+                    continue;
+                break;
+            }
+            if (job->reported)
+                continue;
+            dcc_batch_copy_out(job->out_fd, STDOUT_FILENO);
+            dcc_batch_copy_out(job->err_fd, STDERR_FILENO);
+            close(job->out_fd);
+            close(job->err_fd);
+            if (!(flags & DCC_BATCH_QUIET)) {
+                printf("[%d/%d] %s %s (%.2fs)\n", i + 1, n,
+                       job->status ? "FAILED" : "ok",
+                       e->file ? e->file : e->argv[0], job->elapsed);
+            }
+            fflush(stdout);
+            if (job->status && !first_failure)
+                first_failure = job->status;
+            job->reported = 1;
+        }
+        while (next_report < next_start && jobs[next_report].reported)
+            next_report++;
+    }
+
+    if (next_report < n)
+        rs_log_error("stopped after %d of %d compilations", next_report, n);
+    ret = first_failure;
+
+  out:
+    free(jobs);
+    free(hosts);
+    while (list) {
+        l = list->next;
+        dcc_free_hostdef(list);
+        list = l;
+    }
+    return ret;
+}
+
+
+/**
+ * distcc --batch [-k] [-j JOBS] FILE
+ *
+ * @p argv[0] is "--batch".
+ **/
+int dcc_batch_run(int argc, char **argv, dcc_batch_main_fn *client_main)
+{
+    struct dcc_batch_entry *entries = NULL;
+    const char *fname = NULL;
+    char *json = NULL;
+    int flags = 0, max_jobs = 0;
+    int n, i, ret;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-k")) {
+            flags |= DCC_BATCH_KEEP_GOING;
+        } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            max_jobs = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "-j", 2) && argv[i][2]) {
+            max_jobs = atoi(argv[i] + 2);
+        } else if (!fname && argv[i][0] != '-') {
+            fname = argv[i];
+        } else {
+            return dcc_batch_usage();
+        }
+    }
+    if (!fname)
+        return dcc_batch_usage();
+
+    if ((ret = dcc_batch_load(fname, &json)))
+        return ret;
+    ret = dcc_batch_parse(json, &entries, &n);
+    free(json);
+    if (ret)
+        return ret;
+
+    ret = dcc_batch_schedule(entries, n, max_jobs, flags, client_main);
+    dcc_batch_free(entries, n);
+    return ret;
+}
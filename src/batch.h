@@ -0,0 +1,51 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __DISTCC_BATCH_H__
+#define __DISTCC_BATCH_H__
+
+/** One entry from a compilation database. */
+struct dcc_batch_entry {
+    char *directory;
+    char *file;
+    char **argv;
+};
+
+typedef int dcc_batch_main_fn(int argc, char **argv);
+
+/* Flags for dcc_batch_schedule(). */
+#define DCC_BATCH_KEEP_GOING    1
+#define DCC_BATCH_UNORDERED     2
+#define DCC_BATCH_QUIET         4
+
+/* batch.c */
+int dcc_batch_parse(const char *json, struct dcc_batch_entry **entries,
+                    int *n_entries);
+void dcc_batch_free(struct dcc_batch_entry *entries, int n_entries);
+int dcc_batch_split_command(const char *cmd, char ***argv_ret);
+int dcc_batch_load(const char *fname, char **buf_ret);
+int dcc_batch_schedule(struct dcc_batch_entry *entries, int n, int max_jobs,
+                       int flags, dcc_batch_main_fn *client_main);
+int dcc_batch_run(int argc, char **argv, dcc_batch_main_fn *client_main);
+
+/* lto.c */
+int dcc_lto_make(int argc, char **argv, dcc_batch_main_fn *client_main);
+
+#endif /* __DISTCC_BATCH_H__ */
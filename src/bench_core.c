@@ -0,0 +1,744 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/*
+ * bench_core.c:
+ * Microbenchmarks for the protocol, bulk transfer and compression code.
+ *
+ * Each benchmark does one operation many times and prints a line of JSON
+ * giving its parameters, the number of operations and payload bytes,
+ * elapsed and CPU seconds, and the rates.  Where there are two ends, the
+ * receiver is a child process talking over a socketpair or loopback TCP,
+ * and CPU and syscalls are the sum of both.
+ *
+ * Syscalls are the read/write calls counted in /proc/self/io plus
+ * io_uring_enter() calls, or null where /proc/self/io is missing.
+ * Transfers done with sendfile() are not counted.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef HAVE_ELF_H
+#  include <elf.h>
+#endif
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "rpc.h"
+#include "bulk.h"
+#include "fix_debug_info.h"
+
+const char *rs_program_name = "bench_core";
+
+static double scale = 1.0;
+static size_t file_size = 256 << 10;
+static size_t debug_size = 1 << 20;
+static int n_headers = 2000;
+static char *work_dir;
+
+static const char *transports[] = { "socketpair", "tcp" };
+
+struct bench_stats {
+    double cpu;                 /* seconds */
+    unsigned long syscalls;
+    int have_syscalls;
+};
+
+
+static void get_stats(struct bench_stats *s)
+{
+    struct rusage ru;
+    char line[128];
+    FILE *f;
+
+    getrusage(RUSAGE_SELF, &ru);
+    s->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+        + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+    s->syscalls = dcc_uring_enters;
+    s->have_syscalls = 0;
+    if ((f = fopen("/proc/self/io", "r")) != NULL) {
+        while (fgets(line, sizeof line, f)) {
+            unsigned long v;
+            if (sscanf(line, "syscr: %lu", &v) == 1
+                || sscanf(line, "syscw: %lu", &v) == 1) {
+                s->syscalls += v;
+                s->have_syscalls = 1;
+            }
+        }
+        fclose(f);
+    }
+}
+
+
+static void diff_stats(struct bench_stats *d, const struct bench_stats *a,
+                       const struct bench_stats *b)
+{
+    d->cpu = b->cpu - a->cpu;
+    d->syscalls = b->syscalls - a->syscalls;
+    d->have_syscalls = a->have_syscalls && b->have_syscalls;
+}
+
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static void die(const char *what)
+{
+    fprintf(stderr, "bench_core: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+
+static long scaled(long n)
+{
+    long v = (long) (n * scale);
+
+    return v > 0 ? v : 1;
+}
+
+
+static void report(const char *bench, const char *transport,
+                   const char *compress, long ops, double bytes,
+                   double elapsed, const struct bench_stats *d)
+{
+    if (elapsed <= 0)
+        elapsed = 1e-6;
+    printf("{\"bench\": \"%s\"", bench);
+    if (transport)
+        printf(", \"transport\": \"%s\"", transport);
+    if (compress)
+        printf(", \"compress\": \"%s\"", compress);
+    printf(", \"ops\": %ld, \"bytes\": %.0f, \"seconds\": %.6f, "
+           "\"cpu_seconds\": %.6f, \"ops_per_sec\": %.1f, "
+           "\"bytes_per_sec\": %.0f, \"syscalls\": ",
+           ops, bytes, elapsed, d->cpu, ops / elapsed, bytes / elapsed);
+    if (d->have_syscalls)
+        printf("%lu}\n", d->syscalls);
+    else
+        printf("null}\n");
+    fflush(stdout);
+}
+
+
+/* Fill @p buf with something shaped like preprocessed C. */
+static void fill_source(char *buf, size_t len, unsigned seed)
+{
+    char line[96];
+    size_t done = 0;
+    unsigned i;
+    int n;
+
+    for (i = seed; done < len; i++) {
+        n = snprintf(line, sizeof line,
+                     "static const int table_%u[] = { %u, %u, %u };\n",
+                     i, i * 7 % 1000, i * 13 % 1000, i * 31 % 1000);
+        if ((size_t) n > len - done)
+            n = (int) (len - done);
+        memcpy(buf + done, line, n);
+        done += n;
+    }
+}
+
+
+static char *work_path(const char *fmt, ...)
+{
+    char *rel, *path;
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (vasprintf(&rel, fmt, ap) == -1)
+        die("vasprintf");
+    va_end(ap);
+    if (asprintf(&path, "%s/%s", work_dir, rel) == -1)
+        die("asprintf");
+    free(rel);
+    return path;
+}
+
+
+static void write_file(const char *path, const char *buf, size_t len)
+{
+    int fd;
+
+    if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1)
+        die(path);
+    if (dcc_writex(fd, buf, len))
+        exit(1);
+    close(fd);
+}
+
+
+/* Make the directories leading up to @p path. */
+static void make_parents(const char *path)
+{
+    char *copy, *p;
+
+    if ((copy = strdup(path)) == NULL)
+        die("strdup");
+    for (p = copy + 1; (p = strchr(p, '/')) != NULL; p++) {
+        *p = '\0';
+        if (mkdir(copy, 0777) == -1 && errno != EEXIST)
+            die(copy);
+        *p = '/';
+    }
+    free(copy);
+}
+
+
+static void open_channel(const char *transport, int *send_fd, int *recv_fd)
+{
+    struct sockaddr_in sa;
+    socklen_t len = sizeof sa;
+    int fds[2], listen_fd;
+
+    if (strcmp(transport, "socketpair") == 0) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+            die("socketpair");
+        *send_fd = fds[0];
+        *recv_fd = fds[1];
+        return;
+    }
+
+    memset(&sa, 0, sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1
+        || bind(listen_fd, (struct sockaddr *) &sa, sizeof sa) == -1
+        || getsockname(listen_fd, (struct sockaddr *) &sa, &len) == -1
+        || listen(listen_fd, 1) == -1)
+        die("listen");
+    if ((*send_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1
+        || connect(*send_fd, (struct sockaddr *) &sa, sizeof sa) == -1)
+        die("connect");
+    if ((*recv_fd = accept(listen_fd, NULL, NULL)) == -1)
+        die("accept");
+    close(listen_fd);
+}
+
+
+typedef int (*bench_end)(int fd, long ops, void *arg);
+
+/*
+ * Run @p sender against @p receiver, which runs in a child, and report
+ * the time until the receiver has finished.
+ */
+static void run_pair(const char *bench, const char *transport,
+                     const char *compress, bench_end sender,
+                     bench_end receiver, void *arg, long ops, double bytes)
+{
+    struct bench_stats before, after, d, rd;
+    int send_fd, recv_fd, report_fds[2], status;
+    double start, elapsed;
+    pid_t pid;
+
+    open_channel(transport, &send_fd, &recv_fd);
+    if (pipe(report_fds) == -1)
+        die("pipe");
+    fflush(stdout);
+    if ((pid = fork()) == -1)
+        die("fork");
+    if (pid == 0) {
+        close(send_fd);
+        close(report_fds[0]);
+        get_stats(&before);
+        if (receiver(recv_fd, ops, arg))
+            _exit(1);
+        get_stats(&after);
+        diff_stats(&d, &before, &after);
+        _exit(dcc_writex(report_fds[1], &d, sizeof d) ? 1 : 0);
+    }
+    close(recv_fd);
+    close(report_fds[1]);
+
+    get_stats(&before);
+    start = now();
+    if (sender(send_fd, ops, arg)) {
+        fprintf(stderr, "bench_core: %s: sending failed\n", bench);
+        exit(1);
+    }
+    if (dcc_readx(report_fds[0], &rd, sizeof rd)) {
+        fprintf(stderr, "bench_core: %s: receiving failed\n", bench);
+        exit(1);
+    }
+    elapsed = now() - start;
+    get_stats(&after);
+    diff_stats(&d, &before, &after);
+    if (waitpid(pid, &status, 0) == -1 || status != 0) {
+        fprintf(stderr, "bench_core: %s: receiver failed\n", bench);
+        exit(1);
+    }
+    close(send_fd);
+    close(report_fds[0]);
+
+    d.cpu += rd.cpu;
+    d.syscalls += rd.syscalls;
+    d.have_syscalls = d.have_syscalls && rd.have_syscalls;
+    report(bench, transport, compress, ops, bytes, elapsed, &d);
+}
+
+
+static int send_tokens(int fd, long ops, void *arg)
+{
+    long i;
+    int ret;
+
+    (void) arg;
+    for (i = 0; i < ops; i++) {
+        if ((ret = dcc_x_token_int(fd, "ARGV", (unsigned) i)))
+            return ret;
+    }
+    return 0;
+}
+
+
+static int recv_tokens(int fd, long ops, void *arg)
+{
+    unsigned val;
+    long i;
+    int ret;
+
+    (void) arg;
+    for (i = 0; i < ops; i++) {
+        if ((ret = dcc_r_token_int(fd, "ARGV", &val)))
+            return ret;
+        if (val != (unsigned) i)
+            return EXIT_PROTOCOL_ERROR;
+    }
+    return 0;
+}
+
+
+static void bench_token(void)
+{
+    long ops = scaled(200000);
+    unsigned i;
+
+    for (i = 0; i < sizeof transports / sizeof transports[0]; i++)
+        run_pair("token_int", transports[i], NULL, send_tokens, recv_tokens,
+                 NULL, ops, 12.0 * ops);
+}
+
+
+struct file_arg {
+    const char *src, *dst;
+    enum dcc_compress compr;
+};
+
+
+static int send_file(int fd, long ops, void *arg)
+{
+    struct file_arg *a = arg;
+    long i;
+    int ret;
+
+    for (i = 0; i < ops; i++) {
+        if ((ret = dcc_x_file(fd, a->src, "DOTI", a->compr, NULL)))
+            return ret;
+    }
+    return 0;
+}
+
+
+static int recv_file(int fd, long ops, void *arg)
+{
+    struct file_arg *a = arg;
+    long i;
+    int ret;
+
+    for (i = 0; i < ops; i++) {
+        if ((ret = dcc_r_token_file(fd, "DOTI", a->dst, a->compr)))
+            return ret;
+    }
+    return 0;
+}
+
+
+static void bench_file(void)
+{
+    struct file_arg a;
+    long ops = scaled((long) ((256 << 20) / file_size));
+    char *buf;
+    unsigned i;
+    int c;
+
+    if ((buf = malloc(file_size)) == NULL)
+        die("malloc");
+    fill_source(buf, file_size, 0);
+    a.src = work_path("send.i");
+    a.dst = work_path("recv.i");
+    write_file(a.src, buf, file_size);
+    free(buf);
+
+    for (i = 0; i < sizeof transports / sizeof transports[0]; i++) {
+        for (c = 0; c < 2; c++) {
+            a.compr = c ? DCC_COMPRESS_LZO1X : DCC_COMPRESS_NONE;
+            run_pair("file", transports[i], c ? "lzo1x" : "none",
+                     send_file, recv_file, &a, ops, (double) file_size * ops);
+        }
+    }
+}
+
+
+static void bench_lzo(void)
+{
+    struct bench_stats before, after, d;
+    long i, ops = scaled((long) ((256 << 20) / file_size));
+    char *buf, *out = NULL, *path;
+    size_t out_len = 0;
+    double start;
+    int in_fd, out_fd;
+
+    if ((buf = malloc(file_size)) == NULL)
+        die("malloc");
+    fill_source(buf, file_size, 0);
+
+    get_stats(&before);
+    start = now();
+    for (i = 0; i < ops; i++) {
+        free(out);
+        if (dcc_compress_lzo1x_alloc(buf, file_size, &out, &out_len))
+            exit(1);
+    }
+    get_stats(&after);
+    diff_stats(&d, &before, &after);
+    report("lzo1x_compress", NULL, "lzo1x", ops, (double) file_size * ops,
+           now() - start, &d);
+
+    path = work_path("in.lzo");
+    write_file(path, out, out_len);
+    if ((in_fd = open(path, O_RDONLY)) == -1)
+        die(path);
+    free(path);
+    path = work_path("out.i");
+    if ((out_fd = open(path, O_RDWR|O_CREAT|O_TRUNC, 0666)) == -1)
+        die(path);
+    free(path);
+
+    get_stats(&before);
+    start = now();
+    for (i = 0; i < ops; i++) {
+        if (lseek(in_fd, 0, SEEK_SET) == -1
+            || ftruncate(out_fd, 0) == -1
+            || lseek(out_fd, 0, SEEK_SET) == -1)
+            die("rewind");
+        if (dcc_r_bulk_lzo1x(out_fd, in_fd, (unsigned) out_len))
+            exit(1);
+    }
+    get_stats(&after);
+    diff_stats(&d, &before, &after);
+    report("lzo1x_decompress", NULL, "lzo1x", ops, (double) file_size * ops,
+           now() - start, &d);
+
+    close(in_fd);
+    close(out_fd);
+    free(out);
+    free(buf);
+}
+
+
+struct many_arg {
+    char **names;
+    unsigned n;
+    char *recv_dir;
+};
+
+
+static int send_many(int fd, long ops, void *arg)
+{
+    struct many_arg *a = arg;
+    long i;
+    int ret;
+
+    for (i = 0; i < ops; i += a->n) {
+        if ((ret = dcc_x_many_files(fd, a->n, a->names)))
+            return ret;
+    }
+    return 0;
+}
+
+
+static int recv_many(int fd, long ops, void *arg)
+{
+    struct many_arg *a = arg;
+    long i;
+    int ret;
+
+    for (i = 0; i < ops; i += a->n) {
+        ret = dcc_r_many_files(fd, a->recv_dir, DCC_COMPRESS_LZO1X);
+        dcc_cleanup_tempfiles();
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+
+/*
+ * Send a tree of small headers as the include server would lay them out:
+ * already compressed, under a mirror directory.  An operation is one
+ * file; bytes are the uncompressed size.
+ */
+static void bench_many(void)
+{
+    struct many_arg a;
+    long rounds = scaled(10);
+    double total = 0;
+    char *buf, *out;
+    size_t len, out_len;
+    unsigned i;
+
+    a.n = (unsigned) n_headers;
+    if ((a.names = calloc(a.n + 1, sizeof *a.names)) == NULL
+        || (buf = malloc(8192)) == NULL)
+        die("malloc");
+    for (i = 0; i < a.n; i++) {
+        len = 512 + (i * 2654435761u) % 7680;
+        fill_source(buf, len, i);
+        if (dcc_compress_lzo1x_alloc(buf, len, &out, &out_len))
+            exit(1);
+        a.names[i] = work_path("mirror/usr/include/dir%02u/h%04u.h.lzo",
+                               i % 50, i);
+        make_parents(a.names[i]);
+        write_file(a.names[i], out, out_len);
+        free(out);
+        total += len;
+    }
+    free(buf);
+
+    for (i = 0; i < sizeof transports / sizeof transports[0]; i++) {
+        a.recv_dir = work_path("recv-%s", transports[i]);
+        if (mkdir(a.recv_dir, 0777) == -1)
+            die(a.recv_dir);
+        run_pair("many_files", transports[i], "lzo1x", send_many, recv_many,
+                 &a, rounds * a.n, total * rounds);
+        free(a.recv_dir);
+    }
+
+    for (i = 0; i < a.n; i++)
+        free(a.names[i]);
+    free(a.names);
+}
+
+
+#ifdef HAVE_ELF_H
+/*
+ * Write a relocatable ELF file with a .debug_info of @p size bytes and a
+ * small .debug_str, each holding @p dir once, as a compiler's output
+ * would.
+ */
+static void write_elf(const char *path, size_t size, const char *dir)
+{
+    static const char shstrtab[] = "\0.debug_info\0.debug_str\0.shstrtab";
+    Elf64_Ehdr *eh;
+    Elf64_Shdr *sh;
+    size_t str_size = 4096, total, off;
+    char *image;
+
+    off = sizeof *eh + size + str_size + sizeof shstrtab;
+    off = (off + 7) & ~(size_t) 7;
+    total = off + 4 * sizeof *sh;
+    if ((image = calloc(1, total)) == NULL)
+        die("calloc");
+
+    eh = (Elf64_Ehdr *) (void *) image;
+    memcpy(eh->e_ident, ELFMAG, SELFMAG);
+    eh->e_ident[EI_CLASS] = ELFCLASS64;
+#if WORDS_BIGENDIAN
+    eh->e_ident[EI_DATA] = ELFDATA2MSB;
+#else
+    eh->e_ident[EI_DATA] = ELFDATA2LSB;
+#endif
+    eh->e_ident[EI_VERSION] = EV_CURRENT;
+    eh->e_type = ET_REL;
+    eh->e_version = EV_CURRENT;
+    eh->e_ehsize = sizeof *eh;
+    eh->e_shoff = off;
+    eh->e_shentsize = sizeof *sh;
+    eh->e_shnum = 4;
+    eh->e_shstrndx = 3;
+
+    sh = (Elf64_Shdr *) (void *) (image + off);
+    off = sizeof *eh;
+    fill_source(image + off, size, 0);
+    memcpy(image + off + size / 2, dir, strlen(dir) + 1);
+    sh[1].sh_name = 1;
+    sh[1].sh_type = SHT_PROGBITS;
+    sh[1].sh_offset = off;
+    sh[1].sh_size = size;
+
+    off += size;
+    snprintf(image + off, str_size, "%s/module.c", dir);
+    sh[2].sh_name = 13;
+    sh[2].sh_type = SHT_PROGBITS;
+    sh[2].sh_flags = SHF_MERGE|SHF_STRINGS;
+    sh[2].sh_offset = off;
+    sh[2].sh_size = str_size;
+
+    off += str_size;
+    memcpy(image + off, shstrtab, sizeof shstrtab);
+    sh[3].sh_name = 24;
+    sh[3].sh_type = SHT_STRTAB;
+    sh[3].sh_offset = off;
+    sh[3].sh_size = sizeof shstrtab;
+
+    write_file(path, image, total);
+    free(image);
+}
+
+
+static void bench_debuginfo(void)
+{
+    /* Both the same length, so that each run can undo the last. */
+    static const char *dirs[] = { "/tmp/distccd_AbCdEf/work",
+                                  "/home/builder/src/tree/x" };
+    struct bench_stats before, after, d;
+    long i, ops = scaled(500);
+    double start;
+    char *path;
+
+    path = work_path("debug.o");
+    write_elf(path, debug_size, dirs[0]);
+
+    get_stats(&before);
+    start = now();
+    for (i = 0; i < ops; i++) {
+        if (dcc_fix_debug_info(path, dirs[(i + 1) % 2], dirs[i % 2]))
+            exit(1);
+    }
+    get_stats(&after);
+    diff_stats(&d, &before, &after);
+    report("fix_debug_info", NULL, NULL, ops, (double) debug_size * ops,
+           now() - start, &d);
+    free(path);
+}
+#else
+static void bench_debuginfo(void)
+{
+    fprintf(stderr, "bench_core: no <elf.h>, skipping fix_debug_info\n");
+}
+#endif
+
+
+static int remove_one(const char *path, const struct stat *st, int flag,
+                      struct FTW *ftw)
+{
+    (void) st; (void) flag; (void) ftw;
+    remove(path);
+    return 0;
+}
+
+
+static const struct {
+    const char *name;
+    void (*fn)(void);
+} benches[] = {
+    { "token", bench_token },
+    { "file", bench_file },
+    { "lzo", bench_lzo },
+    { "many", bench_many },
+    { "debuginfo", bench_debuginfo },
+};
+
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: bench_core [-s SCALE] [-k KB] [-n FILES] [-d KB] "
+            "[BENCH...]\n"
+            "  -s SCALE  multiply the number of operations (default 1)\n"
+            "  -k KB     size of the file and lzo runs (default 256)\n"
+            "  -n FILES  headers sent by the many run (default 2000)\n"
+            "  -d KB     size of .debug_info in the debuginfo run "
+            "(default 1024)\n"
+            "benches: token file lzo many debuginfo (default all)\n");
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    unsigned b;
+    int i, c, any = 0;
+
+    rs_trace_set_level(RS_LOG_WARNING);
+    rs_add_logger(rs_logger_file, RS_LOG_WARNING, NULL, STDERR_FILENO);
+
+    while ((c = getopt(argc, argv, "s:k:n:d:")) != -1) {
+        switch (c) {
+        case 's': scale = atof(optarg); break;
+        case 'k': file_size = (size_t) atol(optarg) << 10; break;
+        case 'n': n_headers = atoi(optarg); break;
+        case 'd': debug_size = (size_t) atol(optarg) << 10; break;
+        default: usage();
+        }
+    }
+    if (scale <= 0 || file_size == 0 || n_headers <= 0 || debug_size == 0)
+        usage();
+
+    if (asprintf(&work_dir, "%s/bench_core.XXXXXX",
+                 tmpdir ? tmpdir : "/tmp") == -1)
+        die("asprintf");
+    if (mkdtemp(work_dir) == NULL)
+        die(work_dir);
+
+    for (b = 0; b < sizeof benches / sizeof benches[0]; b++) {
+        int wanted = (optind == argc);
+        for (i = optind; i < argc; i++) {
+            if (strcmp(argv[i], benches[b].name) == 0)
+                wanted = 1;
+        }
+        if (!wanted)
+            continue;
+        any = 1;
+        benches[b].fn();
+    }
+
+    nftw(work_dir, remove_one, 16, FTW_DEPTH|FTW_PHYS);
+    if (!any)
+        usage();
+    return 0;
+}
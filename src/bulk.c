@@ -142,6 +142,17 @@ static int dcc_x_file_lzo1x(int out_fd,
     if (in_len == 0) {
         if ((ret = dcc_x_token_int(out_fd, token, 0)))
             goto out;
+    } else if (in_len >= DCC_LZO_SPILL_SIZE) {
+        int spill_fd;
+
+        if ((ret = dcc_compress_file_lzo1x_spill(in_fd, in_len, &spill_fd,
+                                                 &out_len)))
+            goto out;
+        if ((ret = dcc_x_token_int(out_fd, token, out_len)) == 0)
+            ret = dcc_pump_sendfile(out_fd, spill_fd, out_len);
+        close(spill_fd);
+        if (ret)
+            goto out;
     } else {
         if ((ret = dcc_compress_file_lzo1x(in_fd, in_len, &out_buf, &out_len)))
             goto out;
@@ -198,9 +209,14 @@ int dcc_x_file(int ofd,
         /* FIXME: These could get truncated if the file was very large (>4G).
          * That seems pretty unlikely. */
 #ifdef HAVE_SENDFILE
+        /* h_pumpbench shows sendfile() beating io_uring for sends, so
+         * --io-uring only takes over where there's no sendfile(). */
         ret = dcc_pump_sendfile(ofd, ifd, (size_t) f_size);
 #else
-        ret = dcc_pump_readwrite(ofd, ifd, (size_t) f_size);
+        if (dcc_uring_usable())
+            ret = dcc_pump_uring(ofd, ifd, (size_t) f_size);
+        else
+            ret = dcc_pump_readwrite(ofd, ifd, (size_t) f_size);
 #endif
     } else if (compression == DCC_COMPRESS_LZO1X) {
         ret = dcc_x_file_lzo1x(ofd, ifd, token, f_size);
@@ -220,10 +236,160 @@ int dcc_x_file(int ofd,
 }
 
 
+/* Uncompressed files at least this big have their space reserved before
+ * they're received, so that big objects aren't fragmented. */
+#define DCC_R_FILE_PREALLOC (1 << 20)
+
+
+/**
+ * Make a name in the same directory as @p filename for a file that will be
+ * renamed over it.  @p seq makes it unique within this process.
+ **/
+static int dcc_r_file_hidden_name(const char *filename, int seq,
+                                  char **name_ret)
+{
+    const char *base = strrchr(filename, '/');
+    int dir_len = base ? (int) (base - filename + 1) : 0;
+
+    base = base ? base + 1 : filename;
+    if (asprintf(name_ret, "%.*s.%s.%ld.%d.tmp", dir_len, filename, base,
+                 (long) getpid(), seq) == -1) {
+        *name_ret = NULL;
+        return EXIT_OUT_OF_MEMORY;
+    }
+    return 0;
+}
+
+
+/**
+ * Open a file in the same directory as @p filename to receive it into, so
+ * that nobody sees it until it's complete.
+ *
+ * Where possible this is an O_TMPFILE, which has no name at all until it's
+ * published and so can't be left behind.  Otherwise it is a hidden file,
+ * whose name is put in @p temp_ret and which is removed if we're
+ * interrupted.
+ *
+ * Returns -1 if neither can be made, e.g. because the directory isn't
+ * writable.
+ **/
+static int dcc_r_file_open_temp(const char *filename, int flags,
+                                char **temp_ret)
+{
+    int fd, seq;
+
+    *temp_ret = NULL;
+
+#if defined(O_TMPFILE) && defined(HAVE_LINKAT)
+    /* Publishing it needs /proc to name the file. */
+    if (access("/proc/self/fd", X_OK) == 0) {
+        const char *slash = strrchr(filename, '/');
+        char *dir;
+
+        if (slash == filename)
+            dir = strdup("/");
+        else if (slash)
+            dir = strndup(filename, (size_t) (slash - filename));
+        else
+            dir = strdup(".");
+        if (dir == NULL)
+            return -1;
+        fd = open(dir, flags | O_TMPFILE, 0666);
+        free(dir);
+        if (fd != -1)
+            return fd;
+        /* Not supported by the filesystem or kernel; try a name instead. */
+    }
+#endif
+
+    for (seq = 0; seq < 100; seq++) {
+        if (dcc_r_file_hidden_name(filename, seq, temp_ret))
+            return -1;
+        fd = open(*temp_ret, flags | O_CREAT | O_EXCL, 0666);
+        if (fd != -1) {
+            if (dcc_add_cleanup(*temp_ret)) {
+                close(fd);
+                unlink(*temp_ret);
+                break;
+            }
+            return fd;
+        }
+        if (errno != EEXIST)
+            break;
+        free(*temp_ret);
+        *temp_ret = NULL;
+    }
+    free(*temp_ret);
+    *temp_ret = NULL;
+    return -1;
+}
+
+
+/**
+ * Give the complete file open on @p fd the name @p filename, atomically
+ * replacing anything that's already there.  @p temp is its hidden name,
+ * or NULL for an O_TMPFILE.
+ **/
+static int dcc_r_file_publish(int fd, const char *temp, const char *filename)
+{
+#if defined(O_TMPFILE) && defined(HAVE_LINKAT)
+    char proc[64];
+    char *hidden = NULL;
+    int seq;
+
+    if (temp == NULL) {
+        snprintf(proc, sizeof proc, "/proc/self/fd/%d", fd);
+        if (linkat(AT_FDCWD, proc, AT_FDCWD, filename,
+                   AT_SYMLINK_FOLLOW) == 0)
+            return 0;
+        if (errno != EEXIST) {
+            rs_log_error("failed to link %s: %s", filename, strerror(errno));
+            return EXIT_IO_ERROR;
+        }
+
+        /* Something is in the way, so give it a name we can rename. */
+        for (seq = 0; ; seq++) {
+            free(hidden);
+            if (dcc_r_file_hidden_name(filename, seq, &hidden))
+                return EXIT_OUT_OF_MEMORY;
+            if (linkat(AT_FDCWD, proc, AT_FDCWD, hidden,
+                       AT_SYMLINK_FOLLOW) == 0)
+                break;
+            if (errno != EEXIST || seq == 100) {
+                rs_log_error("failed to link %s: %s", hidden,
+                             strerror(errno));
+                free(hidden);
+                return EXIT_IO_ERROR;
+            }
+        }
+        temp = hidden;
+    }
+#else
+    const char *hidden = NULL;
+    (void) fd;
+#endif
+
+    if (rename(temp, filename) == -1) {
+        rs_log_error("failed to rename %s to %s: %s", temp, filename,
+                     strerror(errno));
+        unlink(temp);
+        free((char *) hidden);
+        return EXIT_IO_ERROR;
+    }
+    free((char *) hidden);
+    return 0;
+}
+
+
 /**
  * Receive a file stream from the network into a local file.
  * Make all necessary directories if they don't exist.
  *
+ * The file is received under another name in the same directory, and only
+ * renamed into place once all of it has arrived.  An interrupted transfer
+ * leaves the old file, or none, rather than a truncated one that make
+ * would think is up to date.
+ *
  * Can handle compression.
  *
  * @param len Compressed length of the incoming file.
@@ -233,24 +399,23 @@ int dcc_r_file(int ifd, const char *filename,
                unsigned len,
                enum dcc_compress compr)
 {
-    int ofd;
+    int ofd, flags;
     int ret, close_ret;
+    char *temp = NULL;
+    int in_place = 0;
     struct stat s;
 
     /* This is meant to behave similarly to the output routines in bfd/cache.c
      * in gnu binutils, because makefiles or configure scripts may depend on
      * it for edge cases.
      *
-     * We try to remove the output file first, if its size is not 0.  That
-     * should make the newly created file be owned by the current user; it
-     * might also help in the dangerous case of some other process still
-     * reading from the file.
-     *
-     * Checking for size 0 means that we won't unlink special files like
-     * /dev/null or fifos.
+     * Renaming the new file over the old one means that it is owned by the
+     * current user; it also helps in the dangerous case of some other
+     * process still reading from the file.
      *
-     * However, failure to remove the file does not cause a warning; we may
-     * not have write permission on the directory, but +w for the file.
+     * Special files like /dev/null or fifos are written to in place, and so
+     * are files in directories we can't write, as long as we have +w for
+     * the file.
      */
 
     if (dcc_mk_tmp_ancestor_dirs(filename)) {
@@ -258,42 +423,73 @@ int dcc_r_file(int ifd, const char *filename,
         return EXIT_IO_ERROR;
     }
 
-    if (stat(filename, &s) == 0) {
-        if (s.st_size != 0) {
-            if (unlink(filename) && errno != ENOENT) {
-                rs_trace("failed to remove %s: %s", filename, strerror(errno));
-                /* continue */
-            }
-        }
-    } else {
-        if (errno != ENOENT) {
-            rs_trace("stat %s failed: %s", filename, strerror(errno));
-        }
+    /* Big compressed files are decompressed into a mapping of the file,
+     * which needs read access too. */
+    flags = O_BINARY
+        | (compr == DCC_COMPRESS_LZO1X && len >= DCC_LZO_SPILL_SIZE
+           ? O_RDWR : O_WRONLY);
+
+    if (dcc_mem_tmp_fd(filename) != -1) {
+        in_place = 1;           /* nobody else can see it anyway */
+    } else if (stat(filename, &s) == 0) {
+        in_place = !S_ISREG(s.st_mode);
+    } else if (errno != ENOENT) {
+        rs_trace("stat %s failed: %s", filename, strerror(errno));
         /* continue */
     }
 
-    ofd = open(filename, O_TRUNC|O_WRONLY|O_CREAT|O_BINARY, 0666);
+    ofd = -1;
+    if (!in_place
+        && (ofd = dcc_r_file_open_temp(filename, flags, &temp)) == -1) {
+        rs_trace("can't make a temporary file beside %s: %s", filename,
+                 strerror(errno));
+        in_place = 1;
+    }
+    if (in_place)
+        ofd = open(filename, flags|O_TRUNC|O_CREAT, 0666);
     if (ofd == -1) {
         rs_log_error("failed to create %s: %s", filename, strerror(errno));
         return EXIT_IO_ERROR;
     }
 
+#ifdef HAVE_FALLOCATE
+    if (!in_place && compr == DCC_COMPRESS_NONE
+        && len >= DCC_R_FILE_PREALLOC)
+        fallocate(ofd, FALLOC_FL_KEEP_SIZE, 0, (off_t) len);   /* just a hint */
+#endif
+
     ret = 0;
     if (len > 0) {
         ret = dcc_r_bulk(ofd, ifd, len, compr);
     }
-    close_ret = dcc_close(ofd);
+
+    if (in_place) {
+        close_ret = dcc_close(ofd);
+    } else if (temp) {
+        if ((close_ret = dcc_close(ofd)) == 0 && ret == 0)
+            ret = dcc_r_file_publish(-1, temp, filename);
+    } else {
+        /* An O_TMPFILE has to be published while it's open. */
+        if (ret == 0)
+            ret = dcc_r_file_publish(ofd, NULL, filename);
+        if ((close_ret = dcc_close(ofd)) != 0 && ret == 0)
+            unlink(filename);
+    }
 
     if (!ret && !close_ret) {
         rs_trace("received %d bytes to file %s", len, filename);
+        free(temp);
         return 0;
     }
 
     rs_trace("failed to receive %s, removing it", filename);
-    if (unlink(filename)) {
+    if (in_place && unlink(filename)) {
         rs_log_error("failed to unlink %s after failed transfer: %s",
                      filename, strerror(errno));
+    } else if (temp) {
+        unlink(temp);
     }
+    free(temp);
     return EXIT_IO_ERROR;
 }
 
@@ -366,3 +562,41 @@ int dcc_copy_file_to_fd(const char *in_fname, int out_fd)
     }
     return 0;
 }
+
+
+/**
+ * If the in-memory file @p *name_ret has grown past the limit, move it to
+ * disk and give its new name in @p *name_ret.  The memfd is closed and its
+ * name freed, so @p name_ret must be the only copy of it.
+ **/
+int dcc_mem_tmp_spill(char **name_ret)
+{
+    struct stat sb;
+    char *disk;
+    int fd, disk_fd, ret;
+
+    if ((fd = dcc_mem_tmp_fd(*name_ret)) == -1)
+        return 0;
+    if (fstat(fd, &sb) == -1 || sb.st_size <= dcc_mem_tmp_limit() << 20)
+        return 0;
+
+    if ((ret = dcc_make_tmpnam("distcc_spill", ".tmp", &disk)))
+        return ret;
+    rs_trace("moving %ld bytes from memory to %s", (long) sb.st_size, disk);
+    if ((disk_fd = open(disk, O_WRONLY|O_TRUNC)) == -1) {
+        rs_log_error("failed to open %s: %s", disk, strerror(errno));
+        free(disk);
+        return EXIT_IO_ERROR;
+    }
+    ret = dcc_copy_file_to_fd(*name_ret, disk_fd);
+    if (close(disk_fd) == -1 && ret == 0)
+        ret = EXIT_IO_ERROR;
+    if (ret) {
+        free(disk);
+        return ret;
+    }
+    close(fd);
+    free(*name_ret);
+    *name_ret = disk;
+    return 0;
+}
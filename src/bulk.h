@@ -39,6 +39,7 @@ int dcc_r_token_file(int ifd,
 
 int dcc_open_read(const char *fname, int *ifd, off_t *fsize);
 int dcc_copy_file_to_fd(const char *in_fname, int out_fd);
+int dcc_mem_tmp_spill(char **name_ret);
 
 /* clirpc.c */
 int dcc_x_many_files(int ofd,
@@ -0,0 +1,172 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Flat directories of files named by their hash, kept to a size limit by
+ * throwing out the least recently used.
+ *
+ * The server's profile cache (gcda.c) and the client's ltrans cache
+ * (lto.c) both work this way.  Files are added under a temporary name and
+ * renamed into place, so a reader never sees half of one; a hit should
+ * touch the file so that it counts as recently used.
+ **/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "bulk.h"
+#include "cachedir.h"
+
+
+/**
+ * Copy @p from to a new file @p to, created with @p mode.  A partial copy
+ * is removed.
+ **/
+int dcc_cache_copy(const char *from, const char *to, mode_t mode)
+{
+    int fd, ret;
+
+    if ((fd = open(to, O_WRONLY|O_CREAT|O_TRUNC, mode)) == -1) {
+        rs_log_error("failed to create %s: %s", to, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    ret = dcc_copy_file_to_fd(from, fd);
+    if (close(fd) == -1 && ret == 0)
+        ret = EXIT_IO_ERROR;
+    if (ret)
+        unlink(to);
+    return ret;
+}
+
+
+/**
+ * Hard link @p from to @p to, or copy it if they are on different
+ * filesystems.
+ **/
+int dcc_cache_link_or_copy(const char *from, const char *to, mode_t mode)
+{
+    if (link(from, to) == 0)
+        return 0;
+    return dcc_cache_copy(from, to, mode);
+}
+
+
+/**
+ * Put @p fname into the cache as @p cached, replacing whatever was there.
+ **/
+int dcc_cache_store(const char *fname, const char *cached, mode_t mode)
+{
+    char *tmp;
+    int ret;
+
+    if (asprintf(&tmp, "%s.%ld.tmp", cached, (long) getpid()) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    unlink(tmp);
+    if ((ret = dcc_cache_link_or_copy(fname, tmp, mode)) == 0
+        && rename(tmp, cached) == -1) {
+        rs_log_warning("failed to rename %s: %s", tmp, strerror(errno));
+        unlink(tmp);
+        ret = EXIT_IO_ERROR;
+    }
+    free(tmp);
+    return ret;
+}
+
+
+/**
+ * Throw out the least recently used files in @p dir whose names end in
+ * @p suffix, until those that are left fit in @p limit_mb.  @p what names
+ * the cache in trace messages.
+ **/
+void dcc_cache_prune(const char *dir, const char *suffix, long limit_mb,
+                     const char *what)
+{
+    struct cache_file {
+        char *name;
+        time_t mtime;
+        off_t size;
+    } *files = NULL, *f;
+    DIR *d;
+    struct dirent *de;
+    struct stat sb;
+    int n = 0, size = 0, i, j;
+    off_t total = 0, limit = (off_t) limit_mb << 20;
+
+    if (!(d = opendir(dir)))
+        return;
+    while ((de = readdir(d))) {
+        char *name;
+
+        if (!str_endswith(suffix, de->d_name))
+            continue;
+        if (asprintf(&name, "%s/%s", dir, de->d_name) == -1)
+            break;
+        if (stat(name, &sb) == -1) {
+            free(name);
+            continue;
+        }
+        if (n == size) {
+            size = size ? size * 2 : 256;
+            if (!(f = realloc(files, size * sizeof files[0]))) {
+                free(name);
+                break;
+            }
+            files = f;
+        }
+        files[n].name = name;
+        files[n].mtime = sb.st_mtime;
+        files[n].size = sb.st_size;
+        total += sb.st_size;
+        n++;
+    }
+    closedir(d);
+
+    while (total > limit && n > 0) {
+        for (i = 0, j = 1; j < n; j++)
+            if (files[j].mtime < files[i].mtime)
+                i = j;
+        rs_trace("dropping %s from the %s cache", files[i].name, what);
+        unlink(files[i].name);
+        total -= files[i].size;
+        free(files[i].name);
+        files[i] = files[--n];
+    }
+
+    for (i = 0; i < n; i++)
+        free(files[i].name);
+    free(files);
+}
@@ -0,0 +1,31 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __DISTCC_CACHEDIR_H__
+#define __DISTCC_CACHEDIR_H__
+
+/* cachedir.c */
+int dcc_cache_copy(const char *from, const char *to, mode_t mode);
+int dcc_cache_link_or_copy(const char *from, const char *to, mode_t mode);
+int dcc_cache_store(const char *fname, const char *cached, mode_t mode);
+void dcc_cache_prune(const char *dir, const char *suffix, long limit_mb,
+                     const char *what);
+
+#endif /* __DISTCC_CACHEDIR_H__ */
@@ -0,0 +1,364 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Per-job cgroups and memory-aware admission, for --cgroup.
+ *
+ * distccd is given a cgroup v2 directory it may write to.  At startup the
+ * daemon moves itself into a "daemon" leaf underneath, and enables the
+ * memory controller for the children of the directory.  Each compiler then
+ * runs in a "job-PID" cgroup of its own, with memory.high set to
+ * --job-memory and memory.max to --job-memory-max.
+ *
+ * Before creating its cgroup a job waits until its --job-memory fits in
+ * what is left: MemAvailable less what running jobs have reserved but not
+ * yet used, and within --memory-budget if that is set.  The directory is
+ * locked while a job checks and creates its cgroup, so two jobs can't both
+ * take the last of the memory.  A job always runs if it would be the only
+ * one.
+ *
+ * If the kernel killed the compiler at memory.max, the client is told so
+ * it can send the job to a bigger host.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "dopt.h"
+#include "exec.h"
+#include "daemon.h"
+
+#ifdef HAVE_LINUX
+
+/** How long to wait between looks at free memory, while a job waits. */
+#define DCC_ADMIT_POLL_MS 250
+
+/* This job's cgroup directory and its cgroup.procs, while it runs. */
+static char *dcc_job_cgroup, *dcc_job_cgroup_procs;
+
+/* Set once dcc_cgroup_init() has set up --cgroup. */
+static int dcc_cgroup_ready = 0;
+
+
+static int dcc_cgroup_write(const char *dir, const char *file,
+                            const char *value)
+{
+    char path[PATH_MAX];
+    int fd, ret = 0;
+
+    snprintf(path, sizeof path, "%s/%s", dir, file);
+    if ((fd = open(path, O_WRONLY | O_CLOEXEC)) == -1
+        || write(fd, value, strlen(value)) == -1) {
+        rs_log_warning("failed to write \"%s\" to %s: %s", value, path,
+                       strerror(errno));
+        ret = EXIT_IO_ERROR;
+    }
+    if (fd != -1)
+        close(fd);
+    return ret;
+}
+
+
+/**
+ * Read the value for @p key from a flat-keyed file such as memory.events,
+ * or the single number in a file such as memory.current if @p key is
+ * NULL.  Returns -1 if it can't be read.
+ **/
+static long long dcc_cgroup_read(const char *dir, const char *file,
+                                 const char *key)
+{
+    char path[PATH_MAX], line[256];
+    long long val = -1;
+    size_t klen = key ? strlen(key) : 0;
+    FILE *f;
+
+    snprintf(path, sizeof path, "%s/%s", dir, file);
+    if (!(f = fopen(path, "r")))
+        return -1;
+    while (fgets(line, sizeof line, f)) {
+        if (!key) {
+            val = strtoll(line, NULL, 10);
+            break;
+        }
+        if (strncmp(line, key, klen) == 0 && line[klen] == ' ') {
+            val = strtoll(line + klen + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return val;
+}
+
+
+/**
+ * Kill anything left in the job cgroup @p dir and remove it.
+ **/
+static void dcc_cgroup_remove(const char *dir)
+{
+    int i;
+
+    for (i = 0; i < 20; i++) {
+        if (rmdir(dir) == 0 || errno == ENOENT)
+            return;
+        if (errno != EBUSY)
+            break;
+        if (i == 0)
+            dcc_cgroup_write(dir, "cgroup.kill", "1");
+        usleep(10000);
+    }
+    rs_log_warning("failed to remove cgroup %s: %s", dir, strerror(errno));
+}
+
+
+/**
+ * Set up --cgroup in the daemon, after it has detached.
+ **/
+int dcc_cgroup_init(void)
+{
+    char *leaf, pid[32], path[PATH_MAX];
+    DIR *d;
+    struct dirent *de;
+    int ret;
+
+    if (!arg_cgroup) {
+        if (arg_job_memory || arg_job_memory_max || arg_memory_budget)
+            rs_log_warning("memory limits need --cgroup; ignoring them");
+        return 0;
+    }
+
+    snprintf(path, sizeof path, "%s/cgroup.controllers", arg_cgroup);
+    if (access(path, R_OK) == -1 || access(arg_cgroup, W_OK) == -1) {
+        rs_log_error("%s is not a cgroup v2 directory we can write to",
+                     arg_cgroup);
+        return EXIT_BAD_ARGUMENTS;
+    }
+
+    /* A cgroup with controllers enabled for its children can't hold
+     * processes itself, so move out of the way first. */
+    if (asprintf(&leaf, "%s/daemon", arg_cgroup) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if (mkdir(leaf, 0755) == -1 && errno != EEXIST) {
+        rs_log_error("failed to create cgroup %s: %s", leaf, strerror(errno));
+        free(leaf);
+        return EXIT_IO_ERROR;
+    }
+    snprintf(pid, sizeof pid, "%ld", (long) getpid());
+    ret = dcc_cgroup_write(leaf, "cgroup.procs", pid);
+    free(leaf);
+    if (ret
+        || (ret = dcc_cgroup_write(arg_cgroup, "cgroup.subtree_control",
+                                   "+memory")))
+        return ret;
+
+    /* Clear out jobs left by an earlier daemon. */
+    if ((d = opendir(arg_cgroup))) {
+        while ((de = readdir(d))) {
+            char *job;
+
+            if (!str_startswith("job-", de->d_name))
+                continue;
+            if (asprintf(&job, "%s/%s", arg_cgroup, de->d_name) == -1)
+                break;
+            dcc_cgroup_remove(job);
+            free(job);
+        }
+        closedir(d);
+    }
+
+    rs_log_info("running jobs in cgroups under %s", arg_cgroup);
+    dcc_cgroup_ready = 1;
+    return 0;
+}
+
+
+/**
+ * Whether a job reserving @p need_mb fits now.
+ **/
+static int dcc_job_memory_fits(long long need_mb)
+{
+    long long pending = 0, charged = 0, avail;
+    int n_jobs = 0;
+    DIR *d;
+    struct dirent *de;
+
+    if (!(d = opendir(arg_cgroup)))
+        return 1;
+    while ((de = readdir(d))) {
+        char *job;
+        long long cur;
+
+        if (!str_startswith("job-", de->d_name))
+            continue;
+        if (asprintf(&job, "%s/%s", arg_cgroup, de->d_name) == -1)
+            break;
+        cur = dcc_cgroup_read(job, "memory.current", NULL);
+        free(job);
+        if (cur < 0)
+            continue;
+        cur >>= 20;
+        n_jobs++;
+        if (cur < arg_job_memory)
+            pending += arg_job_memory - cur;
+        charged += cur > arg_job_memory ? cur : arg_job_memory;
+    }
+    closedir(d);
+
+    if (n_jobs == 0)
+        return 1;
+    if (arg_memory_budget && charged + need_mb > arg_memory_budget)
+        return 0;
+    if ((avail = dcc_get_mem_available()) >= 0 && avail - pending < need_mb)
+        return 0;
+    return 1;
+}
+
+
+/**
+ * Wait for memory to run the compiler, then make its cgroup and have
+ * dcc_spawn_child() put it there.
+ **/
+int dcc_job_cgroup_enter(void)
+{
+    char value[32];
+    int lock_fd, waited = 0;
+
+    if (!dcc_cgroup_ready)
+        return 0;
+
+    if ((lock_fd = open(arg_cgroup, O_RDONLY | O_DIRECTORY | O_CLOEXEC))
+        == -1) {
+        rs_log_error("failed to open %s: %s", arg_cgroup, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    while (1) {
+        while (flock(lock_fd, LOCK_EX) == -1 && errno == EINTR)
+            ;
+        if (dcc_job_memory_fits(arg_job_memory))
+            break;
+        flock(lock_fd, LOCK_UN);
+        if (!waited++)
+            rs_log_info("waiting for %dMB of memory to start job",
+                        arg_job_memory);
+        usleep(DCC_ADMIT_POLL_MS * 1000);
+    }
+
+    if (asprintf(&dcc_job_cgroup, "%s/job-%ld", arg_cgroup,
+                 (long) getpid()) == -1
+        || asprintf(&dcc_job_cgroup_procs, "%s/cgroup.procs",
+                    dcc_job_cgroup) == -1) {
+        close(lock_fd);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    dcc_cgroup_remove(dcc_job_cgroup);
+    if (mkdir(dcc_job_cgroup, 0755) == -1) {
+        rs_log_warning("failed to create cgroup %s: %s", dcc_job_cgroup,
+                       strerror(errno));
+        free(dcc_job_cgroup);
+        free(dcc_job_cgroup_procs);
+        dcc_job_cgroup = dcc_job_cgroup_procs = NULL;
+        close(lock_fd);
+        return 0;
+    }
+    close(lock_fd);
+
+    if (arg_job_memory) {
+        snprintf(value, sizeof value, "%lld", (long long) arg_job_memory << 20);
+        dcc_cgroup_write(dcc_job_cgroup, "memory.high", value);
+    }
+    if (arg_job_memory_max) {
+        snprintf(value, sizeof value, "%lld",
+                 (long long) arg_job_memory_max << 20);
+        dcc_cgroup_write(dcc_job_cgroup, "memory.max", value);
+    }
+    /* If the compiler is killed, take its children with it. */
+    dcc_cgroup_write(dcc_job_cgroup, "memory.oom.group", "1");
+
+    dcc_child_cgroup = dcc_job_cgroup_procs;
+    if (waited)
+        rs_trace("admitted after waiting for memory");
+    return 0;
+}
+
+
+/**
+ * Remove the job's cgroup once the compiler is done.  Returns EXIT_JOB_OOM,
+ * with the limit in @p limit_mb, if the kernel killed it for going over
+ * memory.max.
+ **/
+int dcc_job_cgroup_leave(unsigned *limit_mb)
+{
+    int ret = 0;
+
+    if (!dcc_job_cgroup)
+        return 0;
+
+    if (dcc_cgroup_read(dcc_job_cgroup, "memory.events", "oom_kill") > 0) {
+        rs_log_warning("compiler killed at the %dMB job memory limit",
+                       arg_job_memory_max);
+        *limit_mb = (unsigned) arg_job_memory_max;
+        ret = EXIT_JOB_OOM;
+    }
+    dcc_cgroup_remove(dcc_job_cgroup);
+
+    dcc_child_cgroup = NULL;
+    free(dcc_job_cgroup);
+    free(dcc_job_cgroup_procs);
+    dcc_job_cgroup = dcc_job_cgroup_procs = NULL;
+    return ret;
+}
+
+#else /* !HAVE_LINUX */
+
+int dcc_cgroup_init(void)
+{
+    return 0;
+}
+
+int dcc_job_cgroup_enter(void)
+{
+    return 0;
+}
+
+int dcc_job_cgroup_leave(unsigned *UNUSED(limit_mb))
+{
+    return 0;
+}
+
+#endif /* !HAVE_LINUX */
@@ -39,11 +39,14 @@
 #include <signal.h>
 
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <arpa/inet.h>
 
 #include <netdb.h>
 
@@ -156,21 +159,43 @@ out_failed:
 }
 
 
+/* A resolved address of a server. */
+struct dcc_addr {
+    struct dcc_sockaddr_storage ss;
+    socklen_t len;
+};
+
+#define DCC_ADDR_FAMILY(a) (((const struct sockaddr *) &(a)->ss)->sa_family)
+
+/* We never try more than this many addresses for one host. */
+#define DCC_MAX_ADDRS 16
+
+/* Resolved addresses are kept in $DISTCC_DIR/addrs for this many seconds
+ * by default.  After that they are still used while a background process
+ * looks the name up again, until they are this many times too old. */
+#define DCC_ADDR_CACHE_TTL 60
+#define DCC_ADDR_CACHE_STALE_FACTOR 10
+
+/* Time between starting connections to successive addresses, as
+ * recommended by RFC 8305. */
+#define DCC_CONNECT_ATTEMPT_DELAY_MS 250
+
+
 #if defined(ENABLE_RFC2553)
 
 /**
- * Open a socket to a tcp remote host with the specified port.
+ * Look up @p host, returning up to @p max addresses.  If @p numeric_only
+ * is set, only succeed if @p host is already a numeric address, without
+ * consulting the resolver.
  **/
-int dcc_connect_by_name(const char *host, int port, int *p_fd)
+static int dcc_resolve_addrs(const char *host, int port, int numeric_only,
+                             struct dcc_addr *addrs, int max, int *n_addrs)
 {
     struct addrinfo hints;
-    struct addrinfo *res;
+    struct addrinfo *res, *ai;
     int error;
-    int ret;
     char portname[20];
 
-    rs_trace("connecting to %s port %d", host, port);
-
     /* Unfortunately for us, getaddrinfo wants the port (service) as a string */
     snprintf(portname, sizeof portname, "%d", port);
 
@@ -178,33 +203,67 @@ int dcc_connect_by_name(const char *host, int port, int *p_fd)
     /* set-up hints structure */
     hints.ai_family = PF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
+    if (numeric_only)
+        hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
     error = getaddrinfo(host, portname, &hints, &res);
     if (error) {
-        rs_log_error("failed to resolve host %s port %d: %s", host, port,
-                     gai_strerror(error));
+        if (!numeric_only)
+            rs_log_error("failed to resolve host %s port %d: %s", host, port,
+                         gai_strerror(error));
         return EXIT_CONNECT_FAILED;
     }
 
-    /* Try each of the hosts possible addresses. */
-    do {
-        ret = dcc_connect_by_addr(res->ai_addr, res->ai_addrlen, p_fd);
-    } while (ret != 0 && (res = res->ai_next));
+    *n_addrs = 0;
+    for (ai = res; ai && *n_addrs < max; ai = ai->ai_next) {
+        if (ai->ai_addrlen > sizeof addrs->ss)
+            continue;
+        memcpy(&addrs[*n_addrs].ss, ai->ai_addr, ai->ai_addrlen);
+        addrs[*n_addrs].len = ai->ai_addrlen;
+        (*n_addrs)++;
+    }
+    freeaddrinfo(res);
 
-    return ret;
+    return *n_addrs ? 0 : EXIT_CONNECT_FAILED;
+}
+
+
+/**
+ * Write the address part of @p addr in numeric form.
+ **/
+static int dcc_format_addr(const struct dcc_addr *addr,
+                           char *buf, size_t buf_len)
+{
+    return getnameinfo((const struct sockaddr *) &addr->ss, addr->len,
+                       buf, buf_len, NULL, 0, NI_NUMERICHOST) ? -1 : 0;
 }
 
 
 #else /* not ENABLE_RFC2553 */
 
 /**
- * Open a socket to a tcp remote host with the specified port.
- *
- * @todo Don't try for too long to connect.
+ * Look up @p host, returning up to @p max addresses.  If @p numeric_only
+ * is set, only succeed if @p host is already a numeric address, without
+ * consulting the resolver.
  **/
-int dcc_connect_by_name(const char *host, int port, int *p_fd)
+static int dcc_resolve_addrs(const char *host, int port, int numeric_only,
+                             struct dcc_addr *addrs, int max, int *n_addrs)
 {
     struct sockaddr_in sock_out;
     struct hostent *hp;
+    int i;
+
+    memset(&sock_out, 0, sizeof sock_out);
+    sock_out.sin_port = htons((in_port_t) port);
+    sock_out.sin_family = PF_INET;
+
+    if (numeric_only) {
+        if (!inet_aton(host, &sock_out.sin_addr))
+            return EXIT_CONNECT_FAILED;
+        memcpy(&addrs[0].ss, &sock_out, sizeof sock_out);
+        addrs[0].len = sizeof sock_out;
+        *n_addrs = 1;
+        return 0;
+    }
 
     /* FIXME: "warning: gethostbyname() leaks memory.  Use gethostbyname_r
      * instead!" (or indeed perhaps use getaddrinfo?) */
@@ -215,12 +274,442 @@ int dcc_connect_by_name(const char *host, int port, int *p_fd)
         return EXIT_CONNECT_FAILED;
     }
 
-    memcpy(&sock_out.sin_addr, hp->h_addr, (size_t) hp->h_length);
-    sock_out.sin_port = htons((in_port_t) port);
-    sock_out.sin_family = PF_INET;
+    *n_addrs = 0;
+    for (i = 0; hp->h_addr_list[i] && *n_addrs < max; i++) {
+        if (hp->h_addrtype != AF_INET
+            || hp->h_length != sizeof sock_out.sin_addr)
+            continue;
+        memcpy(&sock_out.sin_addr, hp->h_addr_list[i], (size_t) hp->h_length);
+        memcpy(&addrs[*n_addrs].ss, &sock_out, sizeof sock_out);
+        addrs[*n_addrs].len = sizeof sock_out;
+        (*n_addrs)++;
+    }
+
+    return *n_addrs ? 0 : EXIT_CONNECT_FAILED;
+}
+
+
+/**
+ * Write the address part of @p addr in numeric form.
+ **/
+static int dcc_format_addr(const struct dcc_addr *addr,
+                           char *buf, size_t buf_len)
+{
+    /* The double-cast here suppresses warnings from -Wcast-align. */
+    const struct sockaddr_in *sain =
+        (const struct sockaddr_in *) (const void *) &addr->ss;
 
-    return dcc_connect_by_addr((struct sockaddr *) &sock_out,
-                               sizeof sock_out, p_fd);
+    if (snprintf(buf, buf_len, "%s", inet_ntoa(sain->sin_addr))
+        >= (int) buf_len)
+        return -1;
+    return 0;
 }
 
 #endif /* not ENABLE_RFC2553 */
+
+
+static int dcc_get_addr_ttl(void)
+{
+    const char *ttl = getenv("DISTCC_ADDR_TTL");
+
+    return ttl ? atoi(ttl) : DCC_ADDR_CACHE_TTL;
+}
+
+
+static int dcc_addr_cache_filename(const char *host, int port,
+                                   char **fname_ret)
+{
+    char *dir;
+    int ret;
+
+    if ((ret = dcc_get_subdir("addrs", &dir)))
+        return ret;
+
+    ret = asprintf(fname_ret, "%s/%s_%d", dir, host, port);
+    free(dir);
+    return ret == -1 ? EXIT_OUT_OF_MEMORY : 0;
+}
+
+
+/**
+ * Read the cached addresses for a host.  The file holds one numeric
+ * address per line; its mtime is when they were looked up.
+ **/
+static int dcc_addr_cache_load(const char *fname, int port,
+                               struct dcc_addr *addrs, int *n_addrs,
+                               time_t *resolved)
+{
+    FILE *f;
+    struct stat st;
+    char line[256];
+    int n;
+
+    *n_addrs = 0;
+    if (!(f = fopen(fname, "r")))
+        return EXIT_CONNECT_FAILED;
+
+    if (fstat(fileno(f), &st) == -1) {
+        fclose(f);
+        return EXIT_CONNECT_FAILED;
+    }
+    *resolved = st.st_mtime;
+
+    while (*n_addrs < DCC_MAX_ADDRS && fgets(line, sizeof line, f)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (dcc_resolve_addrs(line, port, 1, &addrs[*n_addrs], 1, &n) == 0)
+            (*n_addrs)++;
+    }
+    fclose(f);
+
+    return *n_addrs ? 0 : EXIT_CONNECT_FAILED;
+}
+
+
+/* Several clients may be saving at once, so write a private file and
+ * rename it into place. */
+static void dcc_addr_cache_save(const char *fname,
+                                const struct dcc_addr *addrs, int n_addrs)
+{
+    char buf[256];
+    char *tmp;
+    FILE *f;
+    int i, ok = 1;
+
+    if (asprintf(&tmp, "%s.%ld", fname, (long) getpid()) == -1)
+        return;
+
+    if ((f = fopen(tmp, "w"))) {
+        for (i = 0; i < n_addrs; i++) {
+            if (dcc_format_addr(&addrs[i], buf, sizeof buf) == 0)
+                ok = ok && fprintf(f, "%s\n", buf) >= 0;
+        }
+        if (fclose(f) == 0 && ok && rename(tmp, fname) == 0)
+            rs_trace("saved addresses to %s", fname);
+        else
+            unlink(tmp);
+    }
+    free(tmp);
+}
+
+
+/**
+ * Look @p host up again in a detached process and update its cache
+ * entry, so that the compile that noticed the entry was old doesn't
+ * wait for the resolver.
+ *
+ * The entry's mtime is bumped first so that other clients keep using it
+ * rather than all starting refreshes of their own.  If the lookup fails
+ * the old addresses stay in use.
+ **/
+static void dcc_addr_cache_refresh(const char *host, int port,
+                                   const char *fname)
+{
+    struct dcc_addr addrs[DCC_MAX_ADDRS];
+    pid_t pid;
+    int fd, n;
+
+    if (utimes(fname, NULL) == -1)
+        return;
+
+    rs_trace("refreshing addresses for %s in the background", host);
+
+    if ((pid = fork()) == -1) {
+        rs_log_warning("fork failed: %s", strerror(errno));
+        return;
+    } else if (pid != 0) {
+        /* The child only lives long enough to start the grandchild. */
+        while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+            ;
+        return;
+    }
+
+    if (fork() != 0)
+        _exit(0);
+
+    /* Don't hold on to anything that belongs to the compile: its output
+     * pipes, its log, or its temporary files via the signal handlers. */
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    rs_remove_all_loggers();
+    if ((fd = open("/dev/null", O_RDWR)) != -1) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+    }
+    for (fd = STDERR_FILENO + 1; fd < 1024; fd++)
+        close(fd);
+
+    /* Don't linger if the resolver is hung. */
+    alarm(30);
+
+    if (dcc_resolve_addrs(host, port, 0, addrs, DCC_MAX_ADDRS, &n) == 0)
+        dcc_addr_cache_save(fname, addrs, n);
+
+    _exit(0);
+}
+
+
+/**
+ * Order addresses as RFC 8305 recommends: alternating between address
+ * families, starting with the resolver's first choice.
+ **/
+static void dcc_interleave_families(const struct dcc_addr *addrs, int n,
+                                    int *order)
+{
+    int first[DCC_MAX_ADDRS], other[DCC_MAX_ADDRS];
+    int n_first = 0, n_other = 0, i, j, k;
+
+    for (i = 0; i < n; i++) {
+        if (DCC_ADDR_FAMILY(&addrs[i]) == DCC_ADDR_FAMILY(&addrs[0]))
+            first[n_first++] = i;
+        else
+            other[n_other++] = i;
+    }
+
+    for (i = j = k = 0; k < n; ) {
+        if (i < n_first)
+            order[k++] = first[i++];
+        if (j < n_other)
+            order[k++] = other[j++];
+    }
+}
+
+
+static long dcc_now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+static int dcc_start_connect(const struct dcc_addr *addr, const char *s,
+                             int *p_fd)
+{
+    int fd;
+
+    rs_trace("started connecting to %s", s);
+
+    if ((fd = socket(DCC_ADDR_FAMILY(addr), SOCK_STREAM, 0)) == -1) {
+        rs_log_error("failed to create socket: %s", strerror(errno));
+        return EXIT_CONNECT_FAILED;
+    }
+
+    dcc_set_nonblocking(fd);
+
+    while (connect(fd, (const struct sockaddr *) &addr->ss, addr->len) == -1) {
+        if (errno == EINPROGRESS)
+            break;
+        if (errno != EINTR) {
+            rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+                   "failed to connect to %s: %s", s, strerror(errno));
+            close(fd);
+            return EXIT_CONNECT_FAILED;
+        }
+    }
+
+    *p_fd = fd;
+    return 0;
+}
+
+
+/**
+ * Connect to whichever of @p addrs answers first.
+ *
+ * Rather than waiting for each address to time out before trying the
+ * next, a new attempt is started every DCC_CONNECT_ATTEMPT_DELAY_MS (or
+ * as soon as one fails) while the earlier ones carry on, and the first
+ * to complete wins.  So a dead IPv6 route or a down first address costs
+ * a quarter of a second rather than the whole connect timeout.
+ **/
+static int dcc_connect_by_addrs(const struct dcc_addr *addrs, int n,
+                                int *p_fd)
+{
+    struct pollfd pfd[DCC_MAX_ADDRS];
+    char *names[DCC_MAX_ADDRS];
+    int fds[DCC_MAX_ADDRS], order[DCC_MAX_ADDRS], which[DCC_MAX_ADDRS];
+    long deadline[DCC_MAX_ADDRS];
+    long now, next_start, timeout;
+    int started = 0, live = 0, winner = -1, timed_out = 0;
+    int i, j, np;
+
+    dcc_interleave_families(addrs, n, order);
+    for (i = 0; i < n; i++) {
+        fds[i] = -1;
+        dcc_sockaddr_to_string((struct sockaddr *) &addrs[i].ss, addrs[i].len,
+                               &names[i]);
+    }
+
+    now = next_start = dcc_now_ms();
+
+    while (winner == -1) {
+        if (started < n && (live == 0 || now >= next_start)) {
+            i = order[started++];
+            if (!names[i])
+                continue;       /* out of memory; try the next one */
+            if (dcc_start_connect(&addrs[i], names[i], &fds[i]) == 0) {
+                deadline[i] = now + dcc_connect_timeout * 1000L;
+                next_start = now + DCC_CONNECT_ATTEMPT_DELAY_MS;
+                live++;
+            }
+            continue;
+        }
+
+        if (live == 0)
+            break;
+
+        timeout = -1;
+        for (i = 0, np = 0; i < n; i++) {
+            if (fds[i] == -1)
+                continue;
+            pfd[np].fd = fds[i];
+            pfd[np].events = POLLOUT;
+            pfd[np].revents = 0;
+            which[np++] = i;
+            if (timeout == -1 || deadline[i] - now < timeout)
+                timeout = deadline[i] - now;
+        }
+        if (started < n && next_start - now < timeout)
+            timeout = next_start - now;
+        if (timeout < 0)
+            timeout = 0;
+
+        if (poll(pfd, np, (int) timeout) == -1 && errno != EINTR) {
+            rs_log_error("poll failed: %s", strerror(errno));
+            break;
+        }
+        now = dcc_now_ms();
+
+        for (j = 0; j < np; j++) {
+            int connecterr = -1;
+            socklen_t len = sizeof(connecterr);
+
+            i = which[j];
+            if (pfd[j].revents) {
+                if (getsockopt(fds[i], SOL_SOCKET, SO_ERROR,
+                               (char *) &connecterr, &len) < 0) {
+                    rs_log_error("getsockopt SO_ERROR failed?!");
+                } else if (connecterr == 0) {
+                    winner = i;
+                    break;
+                } else if (connecterr == EINPROGRESS) {
+                    continue;
+                } else {
+                    rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+                           "nonblocking connect to %s failed: %s",
+                           names[i], strerror(connecterr));
+                }
+            } else if (now >= deadline[i]) {
+                rs_log(RS_LOG_ERR|RS_LOG_NONAME,
+                       "timeout while connecting to %s", names[i]);
+                timed_out = 1;
+            } else {
+                continue;
+            }
+            /* This one has failed; don't wait before trying the next. */
+            close(fds[i]);
+            fds[i] = -1;
+            live--;
+            next_start = now;
+        }
+    }
+
+    if (winner != -1) {
+        rs_trace("connected to %s", names[winner]);
+        *p_fd = fds[winner];
+    }
+
+    for (i = 0; i < n; i++) {
+        if (fds[i] != -1 && i != winner)
+            close(fds[i]);
+        free(names[i]);
+    }
+
+    if (winner == -1)
+        return timed_out ? EXIT_TIMEOUT : EXIT_CONNECT_FAILED;
+    return 0;
+}
+
+
+static int dcc_same_addrs(const struct dcc_addr *a, int n_a,
+                          const struct dcc_addr *b, int n_b)
+{
+    int i;
+
+    if (n_a != n_b)
+        return 0;
+    for (i = 0; i < n_a; i++) {
+        if (a[i].len != b[i].len || memcmp(&a[i].ss, &b[i].ss, a[i].len))
+            return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Open a socket to a tcp remote host with the specified port.
+ *
+ * Names are looked up through a cache in $DISTCC_DIR/addrs shared by
+ * all clients, so a slow resolver only delays one compile every
+ * DISTCC_ADDR_TTL seconds, and not at all while a stale entry is being
+ * refreshed.  If none of the cached addresses answer, the name is
+ * looked up afresh in case the server has moved.
+ **/
+int dcc_connect_by_name(const char *host, int port, int *p_fd)
+{
+    struct dcc_addr addrs[DCC_MAX_ADDRS], fresh[DCC_MAX_ADDRS];
+    char *fname = NULL;
+    int n = 0, n_fresh, ttl, cached = 0;
+    time_t resolved;
+    int ret;
+
+    rs_trace("connecting to %s port %d", host, port);
+
+    /* Numeric addresses need no lookup. */
+    if (dcc_resolve_addrs(host, port, 1, addrs, DCC_MAX_ADDRS, &n) == 0)
+        return dcc_connect_by_addrs(addrs, n, p_fd);
+
+    ttl = dcc_get_addr_ttl();
+    if (ttl > 0 && dcc_addr_cache_filename(host, port, &fname) == 0
+        && dcc_addr_cache_load(fname, port, addrs, &n, &resolved) == 0) {
+        time_t age = time(NULL) - resolved;
+
+        if (age >= 0 && age < ttl) {
+            cached = 1;
+        } else if (age >= 0 && age < (time_t) ttl * DCC_ADDR_CACHE_STALE_FACTOR) {
+            dcc_addr_cache_refresh(host, port, fname);
+            cached = 1;
+        }
+    }
+
+    if (cached) {
+        rs_trace("using cached addresses for %s", host);
+    } else if (dcc_resolve_addrs(host, port, 0, fresh, DCC_MAX_ADDRS,
+                                 &n_fresh) == 0) {
+        memcpy(addrs, fresh, sizeof fresh[0] * n_fresh);
+        n = n_fresh;
+        if (fname)
+            dcc_addr_cache_save(fname, addrs, n);
+    } else if (n > 0) {
+        rs_log_warning("using old addresses for %s", host);
+    } else {
+        free(fname);
+        return EXIT_CONNECT_FAILED;
+    }
+
+    ret = dcc_connect_by_addrs(addrs, n, p_fd);
+
+    if (ret != 0 && cached
+        && dcc_resolve_addrs(host, port, 0, fresh, DCC_MAX_ADDRS,
+                             &n_fresh) == 0
+        && !dcc_same_addrs(addrs, n, fresh, n_fresh)) {
+        rs_log_info("addresses of %s have changed; trying again", host);
+        dcc_addr_cache_save(fname, fresh, n_fresh);
+        ret = dcc_connect_by_addrs(fresh, n_fresh, p_fd);
+    }
+
+    free(fname);
+    return ret;
+}
@@ -54,12 +54,23 @@
  **/
 
 /*
- * Transmit header for whole request.
+ * Transmit header for whole request, preceded by the priority class from
+ * $DISTCC_PRIORITY if that is set.  Servers from before --fair-share don't
+ * understand the PRIO token, so it is only sent when asked for.
  */
 int dcc_x_req_header(int fd,
                      enum dcc_protover protover)
 {
-     return dcc_x_token_int(fd, "DIST", protover);
+    const char *name = getenv("DISTCC_PRIORITY");
+    int prio, ret;
+
+    if (name && *name) {
+        if ((prio = dcc_priority_parse(name)) == -1)
+            rs_log_warning("unknown DISTCC_PRIORITY \"%s\"; ignoring it", name);
+        else if ((ret = dcc_x_token_int(fd, "PRIO", (unsigned) prio)))
+            return ret;
+    }
+    return dcc_x_token_int(fd, "DIST", protover);
 }
 
 
@@ -111,10 +122,24 @@ int dcc_x_cwd(int fd)
 int dcc_r_result_header(int ifd,
                         enum dcc_protover expect_ver)
 {
+    char token[5];
     unsigned vers;
     int ret;
 
-    if ((ret = dcc_r_token_int(ifd, "DONE", &vers))) {
+    if ((ret = dcc_r_sometoken_int(ifd, token, &vers)) == 0
+        && strcmp(token, "OOMK") == 0) {
+        /* The server killed the compiler at its per-job memory limit,
+         * given here in MB. */
+        rs_log_warning("server killed the compiler for using more than "
+                       "%uMB", vers);
+        return EXIT_JOB_OOM;
+    }
+    if (ret == 0 && strcmp(token, "DONE") != 0) {
+        rs_log_error("protocol derailment: expected token \"DONE\", got "
+                     "\"%s\"", token);
+        ret = EXIT_PROTOCOL_ERROR;
+    }
+    if (ret) {
         rs_log_error("server provided no answer. "
                      "Is the server configured to allow access from your IP"
                      " address? Is the server performing authentication and"
@@ -689,7 +689,8 @@ dcc_build_somewhere(char *argv[],
                     int sg_level,
                     int *status)
 {
-    char *input_fname = NULL, *output_fname, *cpp_fname, *deps_fname = NULL;
+    char *input_fname = NULL, *output_fname, *cpp_fname = NULL;
+    char *deps_fname = NULL;
     char **files;
     char **server_side_argv = NULL;
     int server_side_argv_deep_copied = 0;
@@ -744,8 +745,8 @@ dcc_build_somewhere(char *argv[],
     /* turned off because we never spend long in this state. */
     dcc_note_state(DCC_PHASE_STARTUP, input_fname, NULL);
 #endif
-    if ((ret = dcc_make_tmpnam("distcc_server_stderr", ".txt",
-                               &server_stderr_fname))) {
+    if ((ret = dcc_make_mem_tmpnam("distcc_server_stderr", ".txt",
+                                   &server_stderr_fname))) {
         /* So we are failing locally to make a temp file to store the
          * server-side errors in; it's unlikely anything else will
          * work, but let's try the compilation locally.
@@ -763,7 +764,8 @@ dcc_build_somewhere(char *argv[],
     /* Choose the distcc server host (which could be either a remote
      * host or localhost) and acquire the lock for it.  */
   choose_host:
-    if ((ret = dcc_pick_host_from_list_and_lock_it(&host, &cpu_lock_fd)) != 0) {
+    if ((ret = dcc_pick_host_from_list_and_lock_it(input_fname, &host,
+                                                   &cpu_lock_fd)) != 0) {
         /* Doesn't happen at the moment: all failures are masked by
            returning localhost. */
         goto fallback;
@@ -823,7 +825,9 @@ dcc_build_somewhere(char *argv[],
     if (host->cpp_where == DCC_CPP_ON_CLIENT && !dist_lto) {
         files = NULL;
 
-        if ((ret = dcc_cpp_maybe(argv, input_fname, &cpp_fname, &cpp_pid) != 0))
+        /* On a retry, send what cpp wrote the first time. */
+        if (!cpp_fname
+            && (ret = dcc_cpp_maybe(argv, input_fname, &cpp_fname, &cpp_pid) != 0))
             goto fallback;
 
         if ((ret = dcc_strip_local_args(argv, &server_side_argv)))
@@ -831,8 +835,6 @@ dcc_build_somewhere(char *argv[],
 
     } else {
         char *dotd_target = NULL;
-        cpp_fname = NULL;
-        cpp_pid = 0;
         dcc_get_dotd_info(argv, &deps_fname, &needs_dotd,
                           &sets_dotd_target, &dotd_target);
         server_side_argv_deep_copied = 1;
@@ -847,24 +849,31 @@ dcc_build_somewhere(char *argv[],
         }
     }
 
-    if (dist_lto)
-      cpp_fname = input_fname;
-
     if ((ret = dcc_compile_remote(server_side_argv,
                                   input_fname,
-                                  cpp_fname,
+                                  dist_lto ? &input_fname : &cpp_fname,
                                   files,
                                   output_fname,
                                   needs_dotd ? deps_fname : NULL,
                                   server_stderr_fname,
-                                  cpp_pid, local_cpu_lock_fd,
+                                  &cpp_pid, local_cpu_lock_fd,
                   host, dist_lto, status)) != 0) {
         /* Returns zero if we successfully ran the compiler, even if
          * the compiler itself bombed out. */
 
         /* dcc_compile_remote() already unlocked local_cpu_lock_fd. */
         local_cpu_lock_fd = -1;
-        bad_host(host, &cpu_lock_fd, &local_cpu_lock_fd);
+        if (ret == EXIT_JOB_OOM
+            && (dcc_want_bigmem || dcc_hostlist_has_bigmem())) {
+            /* The job is too big for that server, which is not the server's
+             * fault unless it claimed to be big enough. */
+            rs_log_warning("retrying %s on a bigmem host", input_fname);
+            dcc_want_bigmem = 1;
+            bad_host(host->bigmem ? host : NULL,
+                     &cpu_lock_fd, &local_cpu_lock_fd);
+        } else {
+            bad_host(host, &cpu_lock_fd, &local_cpu_lock_fd);
+        }
         retry_count++;
         if (max_retries == 0 || retry_count < max_retries)
             goto choose_host;
@@ -25,12 +25,12 @@
 
 int dcc_compile_remote(char **argv,
                        char *input_fname,
-                       char *cpp_fname,
+                       char **cpp_fname,
                        char **file_names,
                        char *output_fname,
                        char *deps_fname,
                        char *server_stderr_fname,
-                       pid_t cpp_pid,
+                       pid_t *cpp_pid,
                        int local_cpu_lock_fd,
                        struct dcc_hostdef *host,
 		       int dist_lto,
@@ -74,7 +74,10 @@ static char work_mem[LZO1X_1_MEM_COMPRESS];
  * coming in.  So for the moment they remain separate.
  *
  * We used to use mmap here, but it complicated the code (and caused a bug in
- * 2.14) without being clearly any faster.  So it's out again.
+ * 2.14) without being clearly any faster.  So it's out again, except for
+ * files of DCC_LZO_SPILL_SIZE or more, such as LTO partitions.  Those are
+ * mapped, and compressed into or out of a mapped temporary file, so that a
+ * few of them in flight at once don't take all the memory.
  *
  * The chunk header gives the number of compressed bytes.  The number of
  * plaintext bytes isn't transmitted, and so for decompression we might need
@@ -115,6 +118,113 @@ int dcc_compress_file_lzo1x(int in_fd,
 }
 
 
+/**
+ * Open an anonymous temporary file to spill into.
+ **/
+static int dcc_lzo_spill_file(int *fd_ret)
+{
+    char *name;
+    int fd, ret;
+
+    if ((ret = dcc_make_tmpnam("distcc_lzo", ".tmp", &name)))
+        return ret;
+    fd = open(name, O_RDWR);
+    unlink(name);
+    if (fd == -1) {
+        rs_log_error("failed to open %s: %s", name, strerror(errno));
+        free(name);
+        return EXIT_IO_ERROR;
+    }
+    free(name);
+    *fd_ret = fd;
+    return 0;
+}
+
+
+/*
+ * Compress from a file to an anonymous temporary file, positioned at its
+ * start, without reading either into memory.
+ */
+int dcc_compress_file_lzo1x_spill(int in_fd,
+                                  size_t in_len,
+                                  int *out_fd,
+                                  size_t *out_len)
+{
+    char *buf = NULL;
+    int ret, fd = -1;
+#ifdef HAVE_SYS_MMAN_H
+    char *in_buf, *out_buf = MAP_FAILED;
+    size_t out_size = in_len + in_len/64 + 16 + 3;
+    lzo_uint lzo_len;
+    int lzo_ret;
+
+    if (in_len == 0 || lseek(in_fd, 0, SEEK_CUR) != 0)
+        goto no_map;
+    in_buf = mmap(NULL, in_len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    if (in_buf == MAP_FAILED)
+        goto no_map;
+
+    if ((ret = dcc_lzo_spill_file(&fd)))
+        goto out;
+    if (ftruncate(fd, (off_t) out_size) == -1) {
+        rs_log_error("failed to grow spill file: %s", strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    out_buf = mmap(NULL, out_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (out_buf == MAP_FAILED) {
+        rs_log_error("failed to map spill file: %s", strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+    lzo_len = out_size;
+    lzo_ret = lzo1x_1_compress((lzo_byte*)in_buf, in_len,
+                               (lzo_byte*)out_buf, &lzo_len,
+                               work_mem);
+    if (lzo_ret != LZO_E_OK) {
+        rs_log_error("LZO1X1 compression failed: %d", lzo_ret);
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+    if (ftruncate(fd, (off_t) lzo_len) == -1) {
+        rs_log_error("failed to truncate spill file: %s", strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+    rs_trace("compressed %ld bytes to %ld bytes through a spill file: %d%%",
+             (long) in_len, (long) lzo_len, (int) (100*lzo_len / in_len));
+    *out_len = lzo_len;
+    ret = 0;
+
+  out:
+    if (out_buf != MAP_FAILED)
+        munmap(out_buf, out_size);
+    munmap(in_buf, in_len);
+    goto done;
+
+  no_map:
+#endif
+    /* Do it in memory after all. */
+    if ((ret = dcc_compress_file_lzo1x(in_fd, in_len, &buf, out_len))
+        || (ret = dcc_lzo_spill_file(&fd))
+        || (ret = dcc_writex(fd, buf, *out_len)))
+        goto done;
+    if (lseek(fd, 0, SEEK_SET) == -1)
+        ret = EXIT_IO_ERROR;
+
+  done:
+    free(buf);
+    if (ret == 0) {
+        *out_fd = fd;
+    } else if (fd != -1) {
+        close(fd);
+    }
+    return ret;
+}
+
+
 /**
  * Send LZO-compressed bulk data.
  *
@@ -180,6 +290,77 @@ int dcc_compress_lzo1x_alloc(const char *in_buf,
  * get more output space, so our buffer needs to be big enough in the first
  * place or we would waste time repeatedly decompressing it.
  **/
+#ifdef HAVE_SYS_MMAN_H
+/**
+ * Like dcc_r_bulk_lzo1x(), but spill the compressed data to a temporary
+ * file and decompress straight into @p out_fd, which must be a regular
+ * file that's still empty.
+ **/
+static int dcc_r_bulk_lzo1x_spill(int out_fd, int in_fd, unsigned in_len)
+{
+    char *in_buf = MAP_FAILED, *out_buf;
+    size_t out_size = 8 * (size_t) in_len;
+    lzo_uint out_len;
+    int ret, lzo_ret, fd;
+
+    if ((ret = dcc_lzo_spill_file(&fd)))
+        return ret;
+    if ((ret = dcc_r_bulk(fd, in_fd, in_len, DCC_COMPRESS_NONE)))
+        goto out;
+    in_buf = mmap(NULL, in_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (in_buf == MAP_FAILED) {
+        rs_log_error("failed to map spill file: %s", strerror(errno));
+        ret = EXIT_IO_ERROR;
+        goto out;
+    }
+
+    while (1) {
+        if (ftruncate(out_fd, (off_t) out_size) == -1) {
+            rs_log_error("failed to grow output: %s", strerror(errno));
+            ret = EXIT_IO_ERROR;
+            goto out;
+        }
+        out_buf = mmap(NULL, out_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+                       out_fd, 0);
+        if (out_buf == MAP_FAILED) {
+            rs_log_error("failed to map output: %s", strerror(errno));
+            ret = EXIT_IO_ERROR;
+            goto out;
+        }
+
+        out_len = out_size;
+        lzo_ret = lzo1x_decompress_safe((lzo_byte*)in_buf, in_len,
+                                        (lzo_byte*)out_buf, &out_len,
+                                        work_mem);
+        munmap(out_buf, out_size);
+        if (lzo_ret != LZO_E_OUTPUT_OVERRUN)
+            break;
+        out_size *= 2;
+        rs_trace("LZO_E_OUTPUT_OVERRUN, trying again with %lu byte output",
+                 (unsigned long) out_size);
+    }
+
+    if (lzo_ret != LZO_E_OK) {
+        rs_log_error("LZO1X1 decompression failed: %d", lzo_ret);
+        ret = EXIT_IO_ERROR;
+    } else if (ftruncate(out_fd, (off_t) out_len) == -1
+               || lseek(out_fd, (off_t) out_len, SEEK_SET) == -1) {
+        rs_log_error("failed to truncate output: %s", strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else {
+        rs_trace("decompressed %ld bytes to %ld bytes through a spill file",
+                 (long) in_len, (long) out_len);
+    }
+
+  out:
+    if (in_buf != MAP_FAILED)
+        munmap(in_buf, in_len);
+    close(fd);
+    return ret;
+}
+#endif
+
+
 int dcc_r_bulk_lzo1x(int out_fd, int in_fd,
                      unsigned in_len)
 {
@@ -194,6 +375,17 @@ int dcc_r_bulk_lzo1x(int out_fd, int in_fd,
     if (in_len == 0)
         return 0;               /* just check */
 
+#ifdef HAVE_SYS_MMAN_H
+    if (in_len >= DCC_LZO_SPILL_SIZE) {
+        struct stat sb;
+
+        if (fstat(out_fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size == 0
+            && lseek(out_fd, 0, SEEK_CUR) == 0
+            && (fcntl(out_fd, F_GETFL) & O_ACCMODE) == O_RDWR)
+            return dcc_r_bulk_lzo1x_spill(out_fd, in_fd, in_len);
+    }
+#endif
+
     if ((in_buf = malloc(in_len)) == NULL) {
         rs_log_error("failed to allocate decompression input");
         ret = EXIT_OUT_OF_MEMORY;
@@ -76,7 +76,7 @@ int dcc_cpp_maybe(char **argv, char *input_fname, char **cpp_fname,
 
     input_exten = dcc_find_extension(input_fname);
     output_exten = dcc_preproc_exten(input_exten);
-    if ((ret = dcc_make_tmpnam("distcc", output_exten, cpp_fname)))
+    if ((ret = dcc_make_mem_tmpnam("distcc", output_exten, cpp_fname)))
         return ret;
 
     /* We strip the -o option and allow cpp to write to stdout, which is
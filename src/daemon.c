@@ -77,6 +77,9 @@
 #include "srvnet.h"
 #include "daemon.h"
 #include "types.h"
+#ifdef HAVE_TLS
+#include "tls.h"
+#endif
 #ifdef HAVE_GSSAPI
 #include "auth.h"
 #endif
@@ -191,6 +194,9 @@ int main(int argc, char *argv[])
     if (distccd_parse_options(argc, (const char **) argv))
         dcc_exit(EXIT_DISTCC_FAILED);
 
+    if (opt_drain)
+        dcc_exit(dcc_drain_command());
+
     /* check this before redirecting the logs, so that it's really obvious */
     if (!dcc_should_be_inetd())
         if (opt_allowed == NULL) {
@@ -210,6 +216,19 @@ int main(int argc, char *argv[])
         /* continue anyhow */
     }
 
+#ifdef HAVE_TLS
+    /* Load the key while we may still be able to read it. */
+    if (arg_tls_cert) {
+        if ((ret = dcc_tls_server_init(arg_tls_cert, arg_tls_key,
+                                       arg_tls_ca)) != 0)
+            dcc_exit(ret);
+        dcc_tls_enabled = 1;
+    } else if (arg_tls_key || arg_tls_ca) {
+        rs_log_error("--tls-key and --tls-ca need --tls-cert");
+        dcc_exit(EXIT_BAD_ARGUMENTS);
+    }
+#endif
+
     if ((ret = dcc_discard_root()) != 0)
         dcc_exit(ret);
 
@@ -241,6 +260,13 @@ int main(int argc, char *argv[])
             goto out;
         }
 
+        /* Tickets can only be resumed by a process sharing our secret. */
+        if (!dcc_should_be_inetd()) {
+            if ((ret = dcc_gssapi_ticket_init()) != 0) {
+                goto out;
+            }
+        }
+
         /* Read contents of list file into an array and apply qsort. */
         if (opt_blacklist_enabled || opt_whitelist_enabled) {
             if ((ret = dcc_gssapi_obtain_list((opt_blacklist_enabled) ? 1 : 0)) != 0) {
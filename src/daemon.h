@@ -20,6 +20,8 @@
  * USA.
  */
 
+#include <signal.h>     /* for sig_atomic_t */
+
 
 /* daemon.c */
 extern const char *dcc_daemon_wd;
@@ -40,7 +42,59 @@ void dcc_reap_kids(int must_reap);
 
 
 /* prefork.c */
+int dcc_prefork_init(void);
+int dcc_prefork_busy_kids(void);
 int dcc_preforking_parent(int listen_fd);
+int dcc_prefork_shards(const int *listen_fds, int n);
+void dcc_prefork_kid_exited(pid_t kid);
+void dcc_prefork_signal_kids(int whichsig);
+
+/** Most listeners --shards will open. */
+#define DCC_MAX_SHARDS 64
+
+
+/* cgroup.c */
+int dcc_cgroup_init(void);
+int dcc_job_cgroup_enter(void);
+int dcc_job_cgroup_leave(unsigned *limit_mb);
+
+
+/* placement.c */
+int dcc_placement_init(void);
+void dcc_placement_apply(void);
+void dcc_placement_release(void);
+void dcc_placement_kid_exited(pid_t kid);
+void dcc_placement_summary(void);
+
+
+/* fairshare.c */
+struct sockaddr;
+int dcc_fair_add_share(const char *spec);
+int dcc_fair_init(int run_slots, int n_kids);
+void dcc_fair_identify(const struct sockaddr *cli_addr, int cli_len);
+int dcc_fair_wait(int prio);
+void dcc_fair_done(void);
+void dcc_fair_kid_exited(pid_t kid);
+void dcc_fair_summary(void);
+void dcc_fair_stats(char *buf, size_t len);
+
+
+/* drain.c */
+enum dcc_drain_state {
+    DCC_RUNNING,
+    DCC_DRAINING,               /* finishing jobs, sockets shut down */
+    DCC_HANDED_OFF              /* finishing jobs, sockets given away */
+};
+
+extern volatile sig_atomic_t dcc_drain_state;
+void dcc_drain_catch_signals(const int *listen_fds, int n_fds);
+void dcc_drain_kid_idle(int idle);
+void dcc_drain_log(void);
+void dcc_drain_done(void);
+int dcc_drain_command(void);
+int dcc_handoff_take(int *listen_fds, int n_listen, int *stats_fd);
+void dcc_handoff_go(void);
+int dcc_handoff_serve(int stats_fd);
 
 
 /* serve.c */
@@ -53,6 +107,7 @@ extern const char *opt_user;
 
 
 extern int dcc_max_kids;
+extern int dcc_queue_kids;
 extern int dcc_nkids;
 
 extern volatile pid_t dcc_master_pid;
@@ -60,6 +60,8 @@
 #include "implicit.h"
 #include "compile.h"
 #include "emaillog.h"
+#include "agent.h"
+#include "batch.h"
 
 
 /* Name of this program, for trace.c */
@@ -88,7 +90,9 @@ static void dcc_show_usage(void)
     printf(
 "Usage:\n"
 "   distcc [--scan-includes] [COMPILER] [compile options] -o OBJECT -c SOURCE\n"
-"   distcc [--help|--version|--show-hosts|-j]\n"
+"   distcc [--help|--version|--show-hosts|-j|--agent]\n"
+"   distcc --batch [-k] [-j JOBS] compile_commands.json\n"
+"   distcc --lto-make -f MAKEFILE [-jN] all\n"
 "\n"
 "Options:\n"
 "   COMPILER                   Defaults to \"cc\".\n"
@@ -99,6 +103,13 @@ static void dcc_show_usage(void)
 "                              the host list, and exit.\n"
 "   --scan-includes            Show the files that distcc would send to the\n"
 "                              remote machine, and exit.  (Pump mode only.)\n"
+"   --agent                    Run the agent that DISTCC_AGENT=1 hands\n"
+"                              compilations to.\n"
+"   --batch FILE               Run all the compilations in a compilation\n"
+"                              database.  -k keeps going after a failure;\n"
+"                              -j sets how many run at once.\n"
+"   --lto-make                 Stand in for make under gcc's lto-wrapper, to\n"
+"                              run LTO partitions across the farm.\n"
 #ifdef HAVE_GSSAPI
 "   --show-principal           Show current distccd GSS-API principal and exit.\n"
 #endif
@@ -109,6 +120,7 @@ static void dcc_show_usage(void)
 "   DISTCC_LOG                 Send messages to file, not stderr.\n"
 "   DISTCC_SSH                 Command to run to open SSH connections.\n"
 "   DISTCC_DIR                 Directory for host list and locks.\n"
+"   DISTCC_AGENT=1             Pass compilations to a running agent.\n"
 #ifdef HAVE_GSSAPI
 "   DISTCC_PRINCIPAL	      The name of the server principal to connect to.\n"
 #endif
@@ -127,6 +139,7 @@ static void dcc_show_usage(void)
 "   HOSTSPEC,cpp,lzo           Use pump mode (remote preprocessing).\n"
 "   HOSTSPEC,auth              Enable GSS-API based mutual authenticaton.\n"
 "   --randomize                Randomize the server list before execution.\n"
+"   --affinity                 Send each source file to the same server.\n"
 "\n"
 "distcc distributes compilation jobs across volunteer machines running\n"
 "distccd.  Jobs that cannot be distributed, such as linking, are run locally.\n"
@@ -161,14 +174,6 @@ static void dcc_client_catch_signals(void)
     signal(SIGHUP, &dcc_client_signalled);
 }
 
-static void dcc_free_hostlist(struct dcc_hostdef *list) {
-    while (list) {
-        struct dcc_hostdef *l = list;
-        list = list->next;
-        dcc_free_hostdef(l);
-    }
-}
-
 static void dcc_show_hosts(void) {
     struct dcc_hostdef *list, *l;
     int nhosts;
@@ -218,28 +223,78 @@ static void dcc_gssapi_show_principal(void) {
 #endif
 
 /**
- * distcc client entry point.
- *
- * This is typically called by make in place of the real compiler.
- *
- * Performs basic setup and checks for distcc arguments, and then kicks off
- * dcc_build_somewhere().
+ * Work out the real compiler command from how distcc was invoked -- either
+ * as "distcc [COMPILER] ARGS" or masquerading as the compiler -- and run
+ * it somewhere.  The agent calls this directly for the compiles it is
+ * handed.
  **/
-int main(int argc, char **argv)
+static int dcc_client_compile(char **argv, int sg_level)
 {
-    int status, sg_level, tweaked_path = 0;
+    int status, tweaked_path = 0;
     char **compiler_args = NULL; /* dynamically allocated */
     char *compiler_name; /* points into argv[0] */
     int ret;
 
-    dcc_client_catch_signals();
-    atexit(dcc_cleanup_tempfiles);
-    atexit(dcc_remove_state_file);
+    compiler_name = (char *) dcc_find_basename(argv[0]);
 
-    dcc_set_trace_from_env();
-    dcc_setup_log_email();
+    if (strstr(compiler_name, "distcc") != NULL) {
+        if ((ret = dcc_find_compiler(argv, &compiler_args)) != 0) {
+            goto out;
+        }
+        /* compiler_args is now respectively either "cc -c hello.c" or
+         * "gcc -c hello.c" */
 
-    dcc_trace_version();
+#if 0
+        /* I don't think we need to call this: if we reached this
+         * line, our invocation name is something like 'distcc', and
+         * that's never a problem for masquerading loops. */
+        if ((ret = dcc_trim_path(compiler_name)) != 0)
+            goto out;
+#endif
+    } else {
+        /* Invoked as "cc -c hello.c", with masqueraded path */
+        if ((ret = dcc_support_masquerade(argv, compiler_name,
+                                          &tweaked_path)) != 0)
+            goto out;
+
+        if ((ret = dcc_copy_argv(argv, &compiler_args, 0)) != 0) {
+            goto out;
+        }
+        free(compiler_args[0]);
+        compiler_args[0] = strdup(compiler_name);
+        if (!compiler_args[0]) {
+            rs_log_error("strdup failed - out of memory?");
+            ret = EXIT_OUT_OF_MEMORY;
+            goto out;
+        }
+    }
+
+    if (sg_level - tweaked_path > 1) {
+        rs_log_crit("distcc seems to have invoked itself recursively! sg:%d, tw:%d ", sg_level, tweaked_path);
+        ret = EXIT_RECURSION;
+        goto out;
+    }
+
+    ret = dcc_build_somewhere_timed(compiler_args, sg_level, &status);
+    compiler_args = NULL; /* dcc_build_somewhere_timed already free'd it. */
+
+    out:
+    if (compiler_args) {
+      dcc_free_argv(compiler_args);
+    }
+    return ret;
+}
+
+
+/**
+ * Everything distcc does once its logging and cleanup are set up: handle
+ * distcc's own options, or else compile.
+ **/
+static int dcc_client_main(int argc, char **argv)
+{
+    int sg_level;
+    char *compiler_name; /* points into argv[0] */
+    int ret;
 
 #if HAVE_LIBIBERTY
     /* Expand @FILE arguments. */
@@ -256,6 +311,11 @@ int main(int argc, char **argv)
 
     rs_trace("compiler name is \"%s\"", compiler_name);
 
+    if (!strcmp(compiler_name, "distcc-lto-make")) {
+        ret = dcc_lto_make(argc, argv, dcc_client_main);
+        goto out;
+    }
+
     if (strstr(compiler_name, "distcc") != NULL) {
         /* Either "distcc -c hello.c" or "distcc gcc -c hello.c" */
         if (argc <= 1) {
@@ -291,6 +351,16 @@ int main(int argc, char **argv)
             goto out;
         }
 
+        if (!strcmp(argv[1], "--batch")) {
+            ret = dcc_batch_run(argc - 1, argv + 1, dcc_client_main);
+            goto out;
+        }
+
+        if (!strcmp(argv[1], "--lto-make")) {
+            ret = dcc_lto_make(argc - 1, argv + 1, dcc_client_main);
+            goto out;
+        }
+
         if (!strcmp(argv[1], "--scan-includes")) {
             if (argc <= 2) {
                 fprintf (stderr,
@@ -311,51 +381,66 @@ int main(int argc, char **argv)
 	        goto out;
 	    }
 #endif
+    }
 
-        if ((ret = dcc_find_compiler(argv, &compiler_args)) != 0) {
-            goto out;
-        }
-        /* compiler_args is now respectively either "cc -c hello.c" or
-         * "gcc -c hello.c" */
+    ret = dcc_client_compile(argv, sg_level);
 
-#if 0
-        /* I don't think we need to call this: if we reached this
-         * line, our invocation name is something like 'distcc', and
-         * that's never a problem for masquerading loops. */
-        if ((ret = dcc_trim_path(compiler_name)) != 0)
-            goto out;
+    out:
+    return ret;
+}
+
+
+/**
+ * What the agent runs in the child it forks for each compile.  The agent
+ * has already set up the environment, the host list and logging.
+ **/
+static int dcc_agent_compile(int argc, char **argv)
+{
+#if HAVE_LIBIBERTY
+    expandargv(&argc, &argv);
+#else
+    (void) argc;
 #endif
-    } else {
-        /* Invoked as "cc -c hello.c", with masqueraded path */
-        if ((ret = dcc_support_masquerade(argv, compiler_name,
-                                          &tweaked_path)) != 0)
-            goto out;
+    dcc_ignore_sigpipe(1);
+    return dcc_client_compile(argv, dcc_recursion_safeguard());
+}
 
-        if ((ret = dcc_copy_argv(argv, &compiler_args, 0)) != 0) {
-            goto out;
-        }
-        free(compiler_args[0]);
-        compiler_args[0] = strdup(compiler_name);
-        if (!compiler_args[0]) {
-            rs_log_error("strdup failed - out of memory?");
-            ret = EXIT_OUT_OF_MEMORY;
-            goto out;
-        }
-    }
 
-    if (sg_level - tweaked_path > 1) {
-        rs_log_crit("distcc seems to have invoked itself recursively! sg:%d, tw:%d ", sg_level, tweaked_path);
-        ret = EXIT_RECURSION;
-        goto out;
+/**
+ * distcc client entry point.
+ *
+ * This is typically called by make in place of the real compiler.
+ *
+ * With DISTCC_AGENT set, a compile is handed to the agent before anything
+ * else is set up, so that all this process does is wait for it.
+ * Otherwise, this performs basic setup and checks for distcc arguments,
+ * and then kicks off dcc_build_somewhere().
+ **/
+int main(int argc, char **argv)
+{
+    int ret;
+
+    if (dcc_agent_forward(argc, argv, &ret) == 0) {
+        /* The agent did all the work and sent any email. */
+        exit(ret);
     }
 
-    ret = dcc_build_somewhere_timed(compiler_args, sg_level, &status);
-    compiler_args = NULL; /* dcc_build_somewhere_timed already free'd it. */
+    dcc_client_catch_signals();
+    atexit(dcc_cleanup_tempfiles);
+    atexit(dcc_remove_state_file);
 
-    out:
-    if (compiler_args) {
-      dcc_free_argv(compiler_args);
+    dcc_set_trace_from_env();
+    dcc_setup_log_email();
+
+    dcc_trace_version();
+
+    if (argc > 1 && !strcmp(argv[1], "--agent")
+        && strstr(dcc_find_basename(argv[0]), "distcc") != NULL) {
+        ret = dcc_agent_serve(dcc_agent_compile);
+    } else {
+        ret = dcc_client_main(argc, argv);
     }
+
     dcc_maybe_send_email();
     dcc_exit(ret);
 }
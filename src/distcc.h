@@ -104,6 +104,20 @@ enum dcc_protover {
     DCC_VER_3   = 3             /**< server-side cpp */
 };
 
+/**
+ * Priority classes a client can ask for with $DISTCC_PRIORITY.  Under
+ * --fair-share, a server runs waiting jobs of a lower-numbered class first.
+ **/
+enum dcc_priority {
+    DCC_PRIO_INTERACTIVE = 0,
+    DCC_PRIO_CI = 1,
+    DCC_PRIO_BATCH = 2,
+    DCC_PRIO_MAX = 3
+};
+
+/** The class of a request that didn't name one. */
+#define DCC_PRIO_DEFAULT DCC_PRIO_CI
+
 
 
 
@@ -190,6 +204,7 @@ int dcc_support_masquerade(char *argv[], char *progname, int *);
 int dcc_enjoyed_host(const struct dcc_hostdef *host);
 int dcc_disliked_host(const struct dcc_hostdef *host);
 int dcc_remove_disliked(struct dcc_hostdef **hostlist);
+int dcc_check_backoff(struct dcc_hostdef *host);
 int dcc_backoff_is_enabled(void);
 
 
@@ -243,6 +258,15 @@ int dcc_compress_lzo1x_alloc(const char *in_buf,
                             char **out_buf_ret,
                             size_t *out_len_ret);
 
+/* Files at least this big are compressed and decompressed through
+ * temporary files, not the heap. */
+#define DCC_LZO_SPILL_SIZE (8 << 20)
+
+int dcc_compress_file_lzo1x_spill(int in_fd,
+                                  size_t in_len,
+                                  int *out_fd,
+                                  size_t *out_len);
+
 
 
 /* bulk.c */
@@ -272,6 +296,9 @@ void dcc_free_argv(char **argv);
 /* tempfile.c */
 int dcc_get_tempdir(const char **);
 int dcc_make_tmpnam(const char *, const char *suffix, char **);
+int dcc_make_mem_tmpnam(const char *, const char *suffix, char **);
+int dcc_mem_tmp_fd(const char *fname);
+long dcc_mem_tmp_limit(void);
 int dcc_make_tmp_dir_obj(const char *, char **);
 int make_temp_dir_and_chdir_for_users (void);
 int dcc_get_new_tmpdir(char **tmpdir);
@@ -350,6 +377,26 @@ int dcc_r_bulk(int ofd,
 
 int dcc_pump_readwrite(int ofd, int ifd, size_t n);
 
+/* uring.c */
+extern int dcc_io_uring;
+extern unsigned long dcc_uring_enters;
+int dcc_uring_usable(void);
+int dcc_pump_uring(int ofd, int ifd, size_t n);
+
+/* Smaller files are received with read/write even under --io-uring: they
+ * only fill a few buffers, and setting up the chains costs more than the
+ * syscalls it saves. */
+#define DCC_URING_MIN_SIZE (1 << 20)
+
+/* gcda.c */
+#define DCC_GCDA_HASH_LEN 64
+/* Value of the GCDA token when a hash and not the profile follows. */
+#define DCC_GCDA_BY_HASH 2
+int dcc_gcda_hash(const char *fname, char hex[DCC_GCDA_HASH_LEN + 1]);
+int dcc_gcda_cache_lookup(const char *dir, const char *hex, const char *dest);
+int dcc_gcda_cache_store(const char *dir, long limit_mb,
+                         const char *hex, const char *fname);
+
 /* mapfile.c */
 int dcc_map_input_file(int in_fd, off_t in_size, char **buf_ret);
 
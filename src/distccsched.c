@@ -0,0 +1,626 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * distccsched: an optional scheduler for a farm of distccd servers.
+ *
+ * Without it, every client picks a server using only its own lock files,
+ * so clients on different machines pile onto the same "free" server.  With
+ * it, servers report how many job slots they have, and clients ask it for
+ * a slot and are granted a lease on one.  Leases run out after a while, so
+ * that a client which dies holding one doesn't keep it forever, and servers
+ * that stop reporting are forgotten.
+ *
+ * The protocol is described in scheduler.c.  This is a single process that
+ * keeps everything in memory; if it restarts, servers report again within
+ * their interval, and clients do without it until then.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+
+#include "types.h"
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "netutil.h"
+#include "srvnet.h"
+#include "access.h"
+#include "scheduler.h"
+#include "popt.h"
+
+const char *rs_program_name = "distccsched";
+
+/** Most clients connected at once. */
+#define SCHED_MAX_CONNS 256
+
+/** Seconds a connection may sit idle before it is closed. */
+#define SCHED_IDLE_TIMEOUT 30
+
+struct sched_host {
+    char *name;                 /* HOST:PORT, as clients list it */
+    int slots;
+    time_t expires;
+};
+
+struct sched_lease {
+    char id[24];
+    int host;
+    int slot;
+    time_t expires;
+};
+
+struct sched_conn {
+    int fd;
+    time_t last;
+    size_t len;
+    char buf[DCC_SCHED_LINE_MAX];
+};
+
+static struct sched_host *sched_hosts;
+static int sched_n_hosts;
+
+static struct sched_lease *sched_leases;
+static int sched_n_leases, sched_leases_size;
+
+static struct sched_conn sched_conns[SCHED_MAX_CONNS];
+static int sched_n_conns;
+
+static unsigned long sched_next_lease;
+
+/* Options */
+static int arg_port = DCC_SCHED_DEFAULT_PORT;
+static char *arg_listen = NULL;
+static char *arg_socket = NULL;
+static char *arg_log_file = NULL;
+static int arg_lease_time = 600;
+static int arg_interval = DCC_SCHED_REPORT_INTERVAL;
+static int opt_verbose = 0;
+static int opt_no_tcp = 0;
+static struct dcc_allow_list *opt_allowed = NULL;
+
+static const struct poptOption sched_options[] = {
+    { "allow", 'a',       POPT_ARG_STRING, 0, 'a', 0, 0 },
+    { "help", 0,          POPT_ARG_NONE, 0, '?', 0, 0 },
+    { "interval", 0,      POPT_ARG_INT, &arg_interval, 0, 0, 0 },
+    { "lease-time", 0,    POPT_ARG_INT, &arg_lease_time, 0, 0, 0 },
+    { "listen", 0,        POPT_ARG_STRING, &arg_listen, 0, 0, 0 },
+    { "log-file", 0,      POPT_ARG_STRING, &arg_log_file, 0, 0, 0 },
+    { "no-tcp", 0,        POPT_ARG_NONE, &opt_no_tcp, 0, 0, 0 },
+    { "port", 'p',        POPT_ARG_INT, &arg_port, 0, 0, 0 },
+    { "socket", 0,        POPT_ARG_STRING, &arg_socket, 0, 0, 0 },
+    { "verbose", 0,       POPT_ARG_NONE, &opt_verbose, 0, 0, 0 },
+    { "version", 0,       POPT_ARG_NONE, 0, 'V', 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0 }
+};
+
+
+static void sched_show_usage(void)
+{
+    dcc_show_version("distccsched");
+    printf(
+"Usage:\n"
+"   distccsched [OPTIONS]\n"
+"\n"
+"Options:\n"
+"    --help                     explain usage and exit\n"
+"    --version                  show version and exit\n"
+"    -p, --port PORT            TCP port to listen on (default %d)\n"
+"    --listen ADDRESS           IP address to listen on\n"
+"    -a, --allow IP[/BITS]      only accept TCP connections from here\n"
+"    --socket PATH              also listen on this Unix socket\n"
+"    --no-tcp                   only listen on --socket\n"
+"    --lease-time SECONDS       how long a client may hold a slot (600)\n"
+"    --interval SECONDS         how often servers should report (%d)\n"
+"    --log-file FILE            send messages here instead of stderr\n"
+"    --verbose                  log every request\n"
+"\n"
+"distccsched hands out job slots on distccd servers to distcc clients.\n"
+"Run distccd with --scheduler, and distcc with DISTCC_SCHEDULER set.\n",
+           DCC_SCHED_DEFAULT_PORT, DCC_SCHED_REPORT_INTERVAL);
+}
+
+
+static int sched_parse_options(int argc, const char **argv)
+{
+    poptContext po;
+    struct dcc_allow_list *allow;
+    int po_err, ret = 0;
+
+    po = poptGetContext("distccsched", argc, argv, sched_options, 0);
+    while ((po_err = poptGetNextOpt(po)) != -1) {
+        switch (po_err) {
+        case '?':
+            sched_show_usage();
+            exit(0);
+        case 'V':
+            dcc_show_version("distccsched");
+            exit(0);
+        case 'a':
+            if (!(allow = malloc(sizeof *allow))) {
+                ret = EXIT_OUT_OF_MEMORY;
+                goto out;
+            }
+            allow->next = opt_allowed;
+            opt_allowed = allow;
+            if ((ret = dcc_parse_mask(poptGetOptArg(po), &allow->addr,
+                                      &allow->mask)))
+                goto out;
+            break;
+        default:
+            rs_log_error("%s: %s", poptBadOption(po, POPT_BADOPTION_NOALIAS),
+                         poptStrerror(po_err));
+            ret = EXIT_BAD_ARGUMENTS;
+            goto out;
+        }
+    }
+    if (arg_lease_time < 1 || arg_interval < 1) {
+        rs_log_error("--lease-time and --interval must be at least 1");
+        ret = EXIT_BAD_ARGUMENTS;
+    } else if (opt_no_tcp && !arg_socket) {
+        rs_log_error("--no-tcp needs --socket");
+        ret = EXIT_BAD_ARGUMENTS;
+    }
+out:
+    poptFreeContext(po);
+    return ret;
+}
+
+
+static int sched_listen_unix(const char *path, int *fd_ret)
+{
+    struct sockaddr_un sa;
+    int fd;
+
+    if (strlen(path) >= sizeof sa.sun_path) {
+        rs_log_error("socket name \"%s\" is too long", path);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    memset(&sa, 0, sizeof sa);
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        rs_log_error("socket failed: %s", strerror(errno));
+        return EXIT_BIND_FAILED;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &sa, sizeof sa) == -1
+        || listen(fd, 64) == -1) {
+        rs_log_error("failed to listen on %s: %s", path, strerror(errno));
+        close(fd);
+        return EXIT_BIND_FAILED;
+    }
+    *fd_ret = fd;
+    return 0;
+}
+
+
+/**
+ * Forget servers that have stopped reporting, with their leases, and
+ * leases that have run out.
+ **/
+static void sched_expire(time_t now)
+{
+    int i, j;
+
+    for (i = 0; i < sched_n_leases; ) {
+        struct sched_lease *l = &sched_leases[i];
+
+        if (l->expires <= now || sched_hosts[l->host].expires <= now) {
+            rs_trace("lease %s on %s slot %d expired", l->id,
+                     sched_hosts[l->host].name, l->slot);
+            sched_leases[i] = sched_leases[--sched_n_leases];
+        } else {
+            i++;
+        }
+    }
+
+    for (i = 0; i < sched_n_hosts; ) {
+        if (sched_hosts[i].expires > now) {
+            i++;
+            continue;
+        }
+        rs_log_info("%s stopped reporting", sched_hosts[i].name);
+        free(sched_hosts[i].name);
+        sched_hosts[i] = sched_hosts[--sched_n_hosts];
+        for (j = 0; j < sched_n_leases; j++)
+            if (sched_leases[j].host == sched_n_hosts)
+                sched_leases[j].host = i;
+    }
+}
+
+
+static int sched_find_host(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sched_n_hosts; i++)
+        if (strcmp(sched_hosts[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+
+static int sched_host_leases(int host)
+{
+    int i, n = 0;
+
+    for (i = 0; i < sched_n_leases; i++)
+        if (sched_leases[i].host == host)
+            n++;
+    return n;
+}
+
+
+static int sched_free_slot(int host)
+{
+    int slot, i;
+
+    for (slot = 0; slot < sched_hosts[host].slots; slot++) {
+        for (i = 0; i < sched_n_leases; i++)
+            if (sched_leases[i].host == host && sched_leases[i].slot == slot)
+                break;
+        if (i == sched_n_leases)
+            return slot;
+    }
+    return -1;
+}
+
+
+static void sched_do_host(char *args, time_t now, char *reply, size_t len)
+{
+    struct sched_host *h;
+    char *name = strtok(args, " "), *slots = strtok(NULL, " ");
+    int i, n;
+
+    if (!name || !slots || (n = atoi(slots)) < 0) {
+        snprintf(reply, len, "ERROR bad HOST request");
+        return;
+    }
+    if ((i = sched_find_host(name)) == -1) {
+        if (!(h = realloc(sched_hosts, (sched_n_hosts + 1) * sizeof *h))
+            || !(h[sched_n_hosts].name = strdup(name))) {
+            if (h)
+                sched_hosts = h;
+            snprintf(reply, len, "ERROR out of memory");
+            return;
+        }
+        sched_hosts = h;
+        i = sched_n_hosts++;
+        rs_log_info("%s reported %d slots", name, n);
+    } else if (sched_hosts[i].slots != n) {
+        rs_log_info("%s now has %d slots", name, n);
+    }
+    sched_hosts[i].slots = n;
+    sched_hosts[i].expires = now + 3 * arg_interval;
+    snprintf(reply, len, "OK %d", arg_interval);
+}
+
+
+/**
+ * Grant a slot on one of the hosts named in @p args: the one with the most
+ * slots free for its size, or with @p in_order the first with any free.
+ **/
+static void sched_do_lease(char *args, int in_order, time_t now,
+                           char *reply, size_t len)
+{
+    struct sched_lease *l;
+    char *name;
+    int best = -1, known = 0, i, slot;
+    double best_free = 0, free_frac;
+
+    for (name = strtok(args, " "); name; name = strtok(NULL, " ")) {
+        if ((i = sched_find_host(name)) == -1)
+            continue;
+        known++;
+        if (sched_hosts[i].slots == 0)
+            continue;
+        free_frac = 1.0 - (double) sched_host_leases(i) / sched_hosts[i].slots;
+        if (free_frac <= 0)
+            continue;
+        if (best == -1 || free_frac > best_free) {
+            best = i;
+            best_free = free_frac;
+        }
+        if (in_order)
+            break;
+    }
+
+    if (!known) {
+        snprintf(reply, len, "UNKNOWN");
+        return;
+    }
+    if (best == -1 || (slot = sched_free_slot(best)) == -1) {
+        snprintf(reply, len, "WAIT");
+        return;
+    }
+
+    if (sched_n_leases == sched_leases_size) {
+        int size = sched_leases_size ? 2 * sched_leases_size : 64;
+
+        if (!(l = realloc(sched_leases, size * sizeof *l))) {
+            snprintf(reply, len, "ERROR out of memory");
+            return;
+        }
+        sched_leases = l;
+        sched_leases_size = size;
+    }
+    l = &sched_leases[sched_n_leases++];
+    snprintf(l->id, sizeof l->id, "%lx", sched_next_lease++);
+    l->host = best;
+    l->slot = slot;
+    l->expires = now + arg_lease_time;
+    snprintf(reply, len, "GRANT %s %s %d %d", l->id, sched_hosts[best].name,
+             slot, arg_lease_time);
+}
+
+
+static void sched_do_release(char *args, char *reply, size_t len)
+{
+    char *id = strtok(args, " ");
+    int i;
+
+    for (i = 0; id && i < sched_n_leases; i++)
+        if (strcmp(sched_leases[i].id, id) == 0) {
+            sched_leases[i] = sched_leases[--sched_n_leases];
+            snprintf(reply, len, "OK");
+            return;
+        }
+    snprintf(reply, len, "UNKNOWN");
+}
+
+
+/**
+ * Keep a lease that is still in use from running out.
+ **/
+static void sched_do_renew(char *args, time_t now, char *reply, size_t len)
+{
+    char *id = strtok(args, " ");
+    int i;
+
+    for (i = 0; id && i < sched_n_leases; i++)
+        if (strcmp(sched_leases[i].id, id) == 0) {
+            sched_leases[i].expires = now + arg_lease_time;
+            snprintf(reply, len, "OK %d", arg_lease_time);
+            return;
+        }
+    snprintf(reply, len, "UNKNOWN");
+}
+
+
+static void sched_handle_line(int fd, char *line, time_t now)
+{
+    char reply[DCC_SCHED_LINE_MAX];
+    char *args = strchr(line, ' ');
+    size_t n;
+
+    if (args)
+        *args++ = '\0';
+    else
+        args = line + strlen(line);
+
+    sched_expire(now);
+    if (strcmp(line, "HOST") == 0)
+        sched_do_host(args, now, reply, sizeof reply);
+    else if (strcmp(line, "LEASE") == 0)
+        sched_do_lease(args, 0, now, reply, sizeof reply);
+    else if (strcmp(line, "PREFER") == 0)
+        sched_do_lease(args, 1, now, reply, sizeof reply);
+    else if (strcmp(line, "RELEASE") == 0)
+        sched_do_release(args, reply, sizeof reply);
+    else if (strcmp(line, "RENEW") == 0)
+        sched_do_renew(args, now, reply, sizeof reply);
+    else
+        snprintf(reply, sizeof reply, "ERROR unknown request");
+    rs_trace("%s -> %s", line, reply);
+
+    n = strlen(reply);
+    reply[n++] = '\n';
+    /* Replies are short, so a client that can't take one is gone. */
+    if (write(fd, reply, n) != (ssize_t) n)
+        rs_trace("failed to reply: %s", strerror(errno));
+}
+
+
+static void sched_close(int i)
+{
+    close(sched_conns[i].fd);
+    sched_conns[i] = sched_conns[--sched_n_conns];
+}
+
+
+/**
+ * Read what has arrived on connection @p i and answer each whole line.
+ * Returns 0 if the connection should be closed.
+ **/
+static int sched_read(int i, time_t now)
+{
+    struct sched_conn *c = &sched_conns[i];
+    char *line, *nl;
+    ssize_t n;
+
+    n = read(c->fd, c->buf + c->len, sizeof c->buf - 1 - c->len);
+    if (n <= 0)
+        return n == -1 && (errno == EINTR || errno == EAGAIN);
+    c->len += n;
+    c->buf[c->len] = '\0';
+    c->last = now;
+
+    line = c->buf;
+    while ((nl = strchr(line, '\n'))) {
+        *nl = '\0';
+        if (nl > line && nl[-1] == '\r')
+            nl[-1] = '\0';
+        sched_handle_line(c->fd, line, now);
+        line = nl + 1;
+    }
+    c->len -= line - c->buf;
+    memmove(c->buf, line, c->len);
+    /* no room for the rest of a line */
+    return c->len < sizeof c->buf - 1;
+}
+
+
+static int sched_allowed(const struct sockaddr *sa)
+{
+    struct dcc_allow_list *l;
+
+    if (!opt_allowed)
+        return 1;
+    for (l = opt_allowed; l; l = l->next)
+        if (dcc_check_address(sa, &l->addr, &l->mask) == 0)
+            return 1;
+    return 0;
+}
+
+
+static void sched_accept(int listen_fd, int is_tcp, time_t now)
+{
+    struct dcc_sockaddr_storage sa;
+    socklen_t len = sizeof sa;
+    int fd;
+
+    if ((fd = accept(listen_fd, (struct sockaddr *) &sa, &len)) == -1)
+        return;
+    if (is_tcp && !sched_allowed((struct sockaddr *) &sa)) {
+        rs_trace("rejected connection");
+        close(fd);
+        return;
+    }
+    if (sched_n_conns == SCHED_MAX_CONNS) {
+        rs_log_warning("too many connections; dropping one");
+        close(fd);
+        return;
+    }
+    dcc_set_nonblocking(fd);
+    sched_conns[sched_n_conns].fd = fd;
+    sched_conns[sched_n_conns].len = 0;
+    sched_conns[sched_n_conns].last = now;
+    sched_n_conns++;
+}
+
+
+static int sched_serve(int tcp_fd, int unix_fd)
+{
+    struct pollfd pfd[SCHED_MAX_CONNS + 2];
+    int n_listen = 0, n, i;
+    time_t now;
+
+    if (tcp_fd != -1) {
+        pfd[n_listen].fd = tcp_fd;
+        pfd[n_listen++].events = POLLIN;
+    }
+    if (unix_fd != -1) {
+        pfd[n_listen].fd = unix_fd;
+        pfd[n_listen++].events = POLLIN;
+    }
+
+    while (1) {
+        for (i = 0; i < sched_n_conns; i++) {
+            pfd[n_listen + i].fd = sched_conns[i].fd;
+            pfd[n_listen + i].events = POLLIN;
+            pfd[n_listen + i].revents = 0;
+        }
+        n = n_listen + sched_n_conns;
+        if (poll(pfd, n, 1000) == -1 && errno != EINTR) {
+            rs_log_error("poll failed: %s", strerror(errno));
+            return EXIT_IO_ERROR;
+        }
+        now = time(NULL);
+
+        /* Back to front, so closing one doesn't skip another. */
+        for (i = sched_n_conns - 1; i >= 0; i--) {
+            if (pfd[n_listen + i].revents) {
+                if (!sched_read(i, now))
+                    sched_close(i);
+            } else if (now - sched_conns[i].last > SCHED_IDLE_TIMEOUT) {
+                sched_close(i);
+            }
+        }
+        for (i = 0; i < n_listen; i++)
+            if (pfd[i].revents & POLLIN)
+                sched_accept(pfd[i].fd, pfd[i].fd == tcp_fd, now);
+        sched_expire(now);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    int tcp_fd = -1, unix_fd = -1, log_fd = STDERR_FILENO, ret;
+
+    rs_trace_set_level(RS_LOG_INFO);
+    rs_add_logger(rs_logger_file, RS_LOG_DEBUG, NULL, STDERR_FILENO);
+
+    if ((ret = sched_parse_options(argc, (const char **) argv)))
+        return ret;
+
+    if (arg_log_file) {
+        if ((log_fd = open(arg_log_file, O_CREAT|O_APPEND|O_WRONLY, 0666))
+            == -1) {
+            rs_log_error("failed to open %s: %s", arg_log_file,
+                         strerror(errno));
+            return EXIT_IO_ERROR;
+        }
+        rs_remove_all_loggers();
+        rs_add_logger(rs_logger_file, RS_LOG_DEBUG, NULL, log_fd);
+    }
+    if (opt_verbose)
+        rs_trace_set_level(RS_LOG_DEBUG);
+
+    dcc_ignore_sigpipe(1);
+    sched_next_lease = ((unsigned long) time(NULL) << 16) ^ getpid();
+
+    if (!opt_no_tcp) {
+        if ((ret = dcc_socket_listen(arg_port, &tcp_fd, arg_listen)))
+            return ret;
+        if (!opt_allowed)
+            rs_log_warning("accepting connections from anywhere; "
+                           "use --allow to restrict them");
+    }
+    if (arg_socket && (ret = sched_listen_unix(arg_socket, &unix_fd)))
+        return ret;
+
+    rs_log_info("scheduling with %ds leases; servers report every %ds",
+                arg_lease_time, arg_interval);
+    return sched_serve(tcp_fd, unix_fd);
+}
@@ -52,6 +52,33 @@ int opt_niceness = 5;           /* default */
 
 #ifdef HAVE_LINUX
 int opt_oom_score_adj = INT_MIN; /* default is not to change */
+
+/**
+ * Number of SO_REUSEPORT listeners, each with its own share of the
+ * children and of the CPUs.  1 means the usual single listener.
+ **/
+int arg_shards = 1;
+
+/** Steer each connection to the shard on the CPU that received it. */
+int opt_shard_steer = 0;
+
+/** Pin each child to a CPU and memory node by its job slot. */
+int opt_placement = 0;
+
+/** Delegated cgroup v2 directory to run each job in a cgroup under. */
+const char *arg_cgroup = NULL;
+
+/**
+ * Memory each job is expected to need, in MB: its memory.high, and what must
+ * be free before it starts.  0 means no admission control.
+ **/
+int arg_job_memory = 0;
+
+/** Memory at which a job is killed and sent elsewhere, in MB, or 0. */
+int arg_job_memory_max = 0;
+
+/** Memory all jobs together may use, in MB, or 0 for whatever is free. */
+int arg_memory_budget = 0;
 #endif
 
 /**
@@ -60,6 +87,41 @@ int opt_oom_score_adj = INT_MIN; /* default is not to change */
  **/
 int arg_max_jobs = 0;
 
+/**
+ * Share job slots fairly between clients by --share weight, and run
+ * higher priority classes first.
+ **/
+int opt_fair_share = 0;
+
+/**
+ * With --fair-share, how many jobs beyond --jobs may be accepted and
+ * wait for a slot.  -1 means as many as --jobs.
+ **/
+int arg_queue_jobs = -1;
+
+/**
+ * distccsched to report our job slots to, and the name clients know us by
+ * there.  The name defaults to HOSTNAME:PORT.
+ **/
+const char *arg_scheduler = NULL;
+const char *arg_scheduler_name = NULL;
+
+/**
+ * Unix socket to take the listening sockets over from a running daemon,
+ * and to offer ours to the next one.
+ **/
+const char *arg_handoff = NULL;
+
+/** Just ask the daemon in --pid-file to drain, and exit. */
+int opt_drain = 0;
+
+/**
+ * Where to keep -fprofile-use profiles sent by hash, and how many megabytes
+ * of them.  The default directory is under $TMPDIR.
+ **/
+const char *arg_gcda_cache = NULL;
+int arg_gcda_cache_size = 256;
+
 #ifdef HAVE_GSSAPI
 /* If true perform GSS-API based authentication. */
 int opt_auth_enabled = 0;
@@ -67,6 +129,16 @@ int opt_auth_enabled = 0;
 int opt_blacklist_enabled = 0;
 int opt_whitelist_enabled = 0;
 const char *arg_list_file = NULL;
+/* How long a client may resume its authenticated session; 0 disables. */
+int arg_ticket_lifetime = 3600;
+#endif
+
+#ifdef HAVE_TLS
+/* Certificate and key to use for TLS; if set, all clients must use TLS. */
+const char *arg_tls_cert = NULL;
+const char *arg_tls_key = NULL;
+/* If set, clients must have a certificate signed by one of these CAs. */
+const char *arg_tls_ca = NULL;
 #endif
 
 int arg_port = DISTCC_DEFAULT_PORT;
@@ -120,7 +192,8 @@ int opt_job_lifetime = 0;
  * must be numerically above all the ascii letters. */
 enum {
     opt_log_to_file = 300,
-    opt_log_level
+    opt_log_level,
+    opt_share
 };
 
 #ifdef HAVE_AVAHI
@@ -147,6 +220,11 @@ const struct poptOption options[] = {
 #endif
     { "jobs", 'j',       POPT_ARG_INT, &arg_max_jobs, 'j', 0, 0 },
     { "daemon", 0,       POPT_ARG_NONE, &opt_daemon_mode, 0, 0, 0 },
+    { "drain", 0,        POPT_ARG_NONE, &opt_drain, 0, 0, 0 },
+    { "fair-share", 0,   POPT_ARG_NONE, &opt_fair_share, 0, 0, 0 },
+    { "gcda-cache", 0,   POPT_ARG_STRING, &arg_gcda_cache, 0, 0, 0 },
+    { "gcda-cache-size", 0, POPT_ARG_INT, &arg_gcda_cache_size, 0, 0, 0 },
+    { "handoff", 0,      POPT_ARG_STRING, &arg_handoff, 0, 0, 0 },
     { "help", 0,         POPT_ARG_NONE, 0, '?', 0, 0 },
     { "inetd", 0,        POPT_ARG_NONE, &opt_inetd_mode, 0, 0, 0 },
     { "lifetime", 0,     POPT_ARG_INT, &opt_lifetime, 0, 0, 0 },
@@ -159,11 +237,27 @@ const struct poptOption options[] = {
     { "no-detach", 0,    POPT_ARG_NONE, &opt_no_detach, 0, 0, 0 },
     { "no-fifo", 0,      POPT_ARG_NONE, &opt_no_fifo, 0, 0, 0 },
     { "no-fork", 0,      POPT_ARG_NONE, &opt_no_fork, 0, 0, 0 },
+#ifdef HAVE_LINUX_IO_URING_H
+    { "io-uring", 0,     POPT_ARG_NONE, &dcc_io_uring, 0, 0, 0 },
+#endif
 #ifdef HAVE_LINUX
     { "oom-score-adj",0, POPT_ARG_INT,  &opt_oom_score_adj, 0, 0, 0 },
+    { "cgroup", 0,       POPT_ARG_STRING, &arg_cgroup, 0, 0, 0 },
+    { "job-memory", 0,   POPT_ARG_INT, &arg_job_memory, 0, 0, 0 },
+    { "job-memory-max", 0, POPT_ARG_INT, &arg_job_memory_max, 0, 0, 0 },
+    { "memory-budget", 0, POPT_ARG_INT, &arg_memory_budget, 0, 0, 0 },
+    { "placement", 0,    POPT_ARG_NONE, &opt_placement, 0, 0, 0 },
 #endif
     { "pid-file", 'P',   POPT_ARG_STRING, &arg_pid_file, 0, 0, 0 },
+#ifdef HAVE_LINUX
+    { "shards", 0,       POPT_ARG_INT, &arg_shards, 0, 0, 0 },
+    { "shard-steer", 0,  POPT_ARG_NONE, &opt_shard_steer, 0, 0, 0 },
+#endif
     { "port", 'p',       POPT_ARG_INT, &arg_port, 0, 0, 0 },
+    { "queue", 0,        POPT_ARG_INT, &arg_queue_jobs, 0, 0, 0 },
+    { "scheduler", 0,    POPT_ARG_STRING, &arg_scheduler, 0, 0, 0 },
+    { "scheduler-name", 0, POPT_ARG_STRING, &arg_scheduler_name, 0, 0, 0 },
+    { "share", 0,        POPT_ARG_STRING, 0, opt_share, 0, 0 },
 #ifdef HAVE_GSSAPI
     { "show-principal", 0,	 POPT_ARG_NONE, 0, 'P', 0, 0 },
 #endif
@@ -175,6 +269,14 @@ const struct poptOption options[] = {
 #endif
     { "wizard", 'W',     POPT_ARG_NONE, 0, 'W', 0, 0 },
     { "stats", 0,        POPT_ARG_NONE, &arg_stats, 0, 0, 0 },
+#ifdef HAVE_GSSAPI
+    { "ticket-lifetime", 0, POPT_ARG_INT, &arg_ticket_lifetime, 0, 0, 0 },
+#endif
+#ifdef HAVE_TLS
+    { "tls-ca", 0,       POPT_ARG_STRING, &arg_tls_ca, 0, 0, 0 },
+    { "tls-cert", 0,     POPT_ARG_STRING, &arg_tls_cert, 0, 0, 0 },
+    { "tls-key", 0,      POPT_ARG_STRING, &arg_tls_key, 0, 0, 0 },
+#endif
     { "stats-port", 0,   POPT_ARG_INT, &arg_stats_port, 0, 0, 0 },
 #ifdef HAVE_AVAHI
     { "zeroconf", 0,     POPT_ARG_NONE, &opt_zeroconf, 0, 0, 0 },
@@ -198,21 +300,48 @@ static void distccd_show_usage(void)
 "    --show-principal           show current GSS-API principal and exit\n"
 #endif
 "    -P, --pid-file FILE        save daemon process id to file\n"
+"    --drain                    tell the daemon in --pid-file to drain, and exit\n"
+"    --handoff PATH             take over sockets from the daemon at PATH\n"
 "    -N, --nice LEVEL           lower priority, 20=most nice\n"
 #ifdef HAVE_LINUX
 "    --oom-score-adj ADJ        set OOM score adjustment, -1000 to 1000\n"
+"    --placement                pin jobs to a CPU and memory node each\n"
+"    --cgroup DIR               run each job in a cgroup v2 under DIR\n"
+"    --job-memory MB            memory.high of a job, and free memory to start it\n"
+"    --job-memory-max MB        kill jobs above this and send them elsewhere\n"
+"    --memory-budget MB         memory all jobs together may use\n"
 #endif
 "    --user USER                if run by root, change to this persona\n"
 "    --jobs, -j LIMIT           maximum tasks at any time\n"
 "    --job-lifetime SECONDS     maximum lifetime of a compile request\n"
+"    --fair-share               share jobs between clients, by priority class\n"
+"    --queue N                  jobs that may wait for a slot (default: --jobs)\n"
+"    --share CLIENT=WEIGHT      weight of an IP[/BITS] or principal's jobs\n"
+"    --scheduler ADDRESS        report job slots to distccsched here\n"
+"    --scheduler-name HOST:PORT name clients use for us (default: hostname)\n"
+"    --gcda-cache DIR           keep profiles sent by hash here\n"
+"    --gcda-cache-size MB       limit on the profile cache, 0 to disable\n"
+#ifdef HAVE_LINUX_IO_URING_H
+"    --io-uring                 receive large files with io_uring\n"
+#endif
 "  Networking:\n"
 "    -p, --port PORT            TCP port to listen on\n"
 "    --listen ADDRESS           IP address to listen on\n"
+#ifdef HAVE_LINUX
+"    --shards N                 N listeners, each with its own CPUs\n"
+"    --shard-steer              accept on the shard of the receiving CPU\n"
+#endif
 "    -a, --allow IP[/BITS]      client address access control\n"
 #ifdef HAVE_GSSAPI
 "    --auth                     enable GSS-API based mutual authenticaton\n"
 "    --blacklist=FILE           control client access through a blacklist\n"
 "    --whitelist=FILE           control client access through a whitelist\n"
+"    --ticket-lifetime SECONDS  let clients resume authentication for this long\n"
+#endif
+#ifdef HAVE_TLS
+"    --tls-cert=FILE            require TLS, with this certificate chain\n"
+"    --tls-key=FILE             private key for --tls-cert\n"
+"    --tls-ca=FILE              require client certificates from these CAs\n"
 #endif
 "    --stats                    enable statistics reporting via HTTP server\n"
 "    --stats-port PORT          TCP port to listen on for statistics requests\n"
@@ -360,6 +489,11 @@ int distccd_parse_options(int argc, const char **argv)
             }
             break;
 
+        case opt_share:
+            if ((exitcode = dcc_fair_add_share(poptGetOptArg(po))))
+                goto out_exit;
+            break;
+
         case 'v':
             rs_trace_set_level(RS_LOG_DEBUG);
             opt_log_level_num = RS_LOG_DEBUG;
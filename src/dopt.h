@@ -32,6 +32,14 @@ extern int arg_stats;
 extern int arg_stats_port;
 extern int opt_log_level_num;
 extern int arg_max_jobs;
+extern int opt_fair_share;
+extern int arg_queue_jobs;
+extern const char *arg_scheduler;
+extern const char *arg_scheduler_name;
+extern const char *arg_handoff;
+extern int opt_drain;
+extern const char *arg_gcda_cache;
+extern int arg_gcda_cache_size;
 extern const char *arg_pid_file;
 extern int opt_no_fork;
 extern int opt_no_prefork;
@@ -48,6 +56,13 @@ extern int opt_niceness;
 
 #ifdef HAVE_LINUX
 extern int opt_oom_score_adj;
+extern int arg_shards;
+extern int opt_shard_steer;
+extern int opt_placement;
+extern const char *arg_cgroup;
+extern int arg_job_memory;
+extern int arg_job_memory_max;
+extern int arg_memory_budget;
 #endif
 
 #ifdef HAVE_AVAHI
@@ -63,4 +78,12 @@ extern int dcc_auth_enabled;
 extern int opt_blacklist_enabled;
 extern int opt_whitelist_enabled;
 extern const char *arg_list_file;
+extern int arg_ticket_lifetime;
+#endif
+
+#ifdef HAVE_TLS
+extern int dcc_tls_enabled;
+extern const char *arg_tls_cert;
+extern const char *arg_tls_key;
+extern const char *arg_tls_ca;
 #endif
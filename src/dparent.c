@@ -71,6 +71,8 @@
 #include "daemon.h"
 #include "netutil.h"
 #include "zeroconf.h"
+#include "scheduler.h"
+#include "stats.h"
 #ifdef HAVE_GSSAPI
 #include "auth.h"
 #endif
@@ -87,6 +89,12 @@ int dcc_nkids = 0;
  **/
 int dcc_max_kids = 0;
 
+/**
+ * With --fair-share, how many children beyond dcc_max_kids accept
+ * connections and queue for a job slot.
+ **/
+int dcc_queue_kids = 0;
+
 
 /**
  * Be a standalone server, with responsibility for sockets and forking
@@ -96,20 +104,18 @@ int dcc_max_kids = 0;
 int dcc_standalone_server(void)
 {
     int listen_fd;
+    int listen_fds[DCC_MAX_SHARDS];
+    int n_listen = 1, stats_fd = -1, taken = 0;
     int n_cpus;
     int ret;
+#ifdef HAVE_LINUX
+    int n_shards = 1, i;
+#endif
 #ifdef HAVE_AVAHI
     void *avahi = NULL;
 #endif
 
-    if ((ret = dcc_socket_listen(arg_port, &listen_fd, opt_listen_addr)) != 0)
-        return ret;
-
-    dcc_defer_accept(listen_fd);
-
-    set_cloexec_flag(listen_fd, 1);
-
-    if (dcc_ncpus(&n_cpus) == 0)
+    if ((ret = dcc_ncpus(&n_cpus)) == 0)
         rs_log_info("%d CPU%s online on this server", n_cpus, n_cpus == 1 ? "" : "s");
 
     /* By default, allow one job per CPU, plus two for the pot.  The extra
@@ -120,6 +126,90 @@ int dcc_standalone_server(void)
     else
         dcc_max_kids = 2 + n_cpus;
 
+    /* Under --fair-share, extra children accept connections and wait for
+     * a job slot, so that the next job can be picked from among them. */
+    if (opt_fair_share && opt_no_fork)
+        rs_log_warning("--fair-share is ignored with --no-fork");
+    else if (opt_fair_share)
+        dcc_queue_kids = arg_queue_jobs >= 0 ? arg_queue_jobs : dcc_max_kids;
+
+#ifdef HAVE_LINUX
+    /* Each shard needs at least one child, and there is no point in more
+     * shards than CPUs to pin them to. */
+    if (arg_shards > 1 && opt_no_fork) {
+        rs_log_warning("--shards is ignored with --no-fork");
+    } else if (arg_shards > 1) {
+        n_shards = arg_shards;
+        if (n_shards > DCC_MAX_SHARDS)
+            n_shards = DCC_MAX_SHARDS;
+        if (ret == 0 && n_shards > n_cpus)
+            n_shards = n_cpus;
+        if (n_shards > dcc_max_kids)
+            n_shards = dcc_max_kids;
+        if (n_shards != arg_shards)
+            rs_log_warning("using %d shards rather than %d",
+                           n_shards, arg_shards);
+    }
+    n_listen = n_shards;
+#endif
+
+    /* Take over the sockets of a daemon we are replacing, so that the port
+     * is never closed. */
+    if (arg_handoff) {
+        if ((ret = dcc_handoff_take(listen_fds, n_listen, &stats_fd)) == 0)
+            taken = 1;
+        else if (ret != EXIT_CONNECT_FAILED)
+            return ret;
+    }
+
+#ifdef HAVE_LINUX
+    if (n_shards > 1) {
+        for (i = 0; i < n_shards && !taken; i++) {
+            if ((ret = dcc_socket_listen_shared(arg_port, &listen_fds[i],
+                                                opt_listen_addr)) != 0)
+                return ret;
+            dcc_defer_accept(listen_fds[i]);
+            set_cloexec_flag(listen_fds[i], 1);
+        }
+        listen_fd = listen_fds[0];
+        if ((ret = dcc_prefork_shards(listen_fds, n_shards)) != 0)
+            return ret;
+    } else
+#endif
+    if (taken) {
+        listen_fd = listen_fds[0];
+    } else {
+        if ((ret = dcc_socket_listen(arg_port, &listen_fd, opt_listen_addr)) != 0)
+            return ret;
+
+        dcc_defer_accept(listen_fd);
+
+        set_cloexec_flag(listen_fd, 1);
+        listen_fds[0] = listen_fd;
+    }
+
+    if (arg_stats && !opt_no_fork) {
+        if ((ret = dcc_stats_listen(&stats_fd)) != 0)
+            return ret;
+    } else if (stats_fd != -1) {
+        close(stats_fd);
+        stats_fd = -1;
+    }
+
+#ifdef HAVE_LINUX
+    if (n_shards == 1 && opt_placement && !opt_no_fork
+        && (ret = dcc_prefork_shards(&listen_fd, 1)) != 0)
+        return ret;
+#endif
+
+    if (opt_fair_share && !opt_no_fork
+        && (ret = dcc_fair_init(dcc_max_kids,
+                                dcc_max_kids + dcc_queue_kids)) != 0)
+        return ret;
+
+    if (!opt_no_fork && (ret = dcc_prefork_init()) != 0)
+        return ret;
+
     rs_log_info("allowing up to %d active jobs", dcc_max_kids);
 
     if (!opt_no_detach) {
@@ -137,6 +227,10 @@ int dcc_standalone_server(void)
 
     /* Don't catch signals until we've detached or created a process group. */
     dcc_daemon_catch_signals();
+    dcc_drain_catch_signals(listen_fds, n_listen);
+
+    if ((ret = dcc_cgroup_init()) != 0)
+        return ret;
 
 #ifdef HAVE_AVAHI
     /* Zeroconf registration */
@@ -150,6 +244,28 @@ int dcc_standalone_server(void)
      * not.  */
     dcc_master_pid = getpid();
 
+    if (arg_scheduler) {
+        char name[256 + 16];
+        const char *sched_name = arg_scheduler_name;
+
+        if (!sched_name) {
+            if (gethostname(name, 256) == -1)
+                strcpy(name, "localhost");
+            name[255] = '\0';
+            snprintf(name + strlen(name), 16, ":%d", arg_port);
+            sched_name = name;
+        }
+        if ((ret = dcc_sched_start_reporter(arg_scheduler, sched_name,
+                                            dcc_max_kids)) != 0)
+            return ret;
+    }
+
+    if (arg_handoff && (ret = dcc_handoff_serve(stats_fd)) != 0)
+        return ret;
+
+    /* If we took over from another daemon, it can drain now. */
+    dcc_handoff_go();
+
     if (opt_no_fork) {
         dcc_log_daemon_started("non-forking daemon");
         dcc_nofork_parent(listen_fd);
@@ -214,6 +330,8 @@ void dcc_reap_kids(int must_reap)
             /* child exited */
             --dcc_nkids;
             rs_trace("down to %d children", dcc_nkids);
+            dcc_prefork_kid_exited(kid);
+            dcc_fair_kid_exited(kid);
 
             dcc_log_child_exited(kid, status);
         } else if (errno == ECHILD) {
@@ -224,7 +342,10 @@ void dcc_reap_kids(int must_reap)
             /* If we got a SIGTERM or something, then on the next pass
              * through the loop we'll find no children done, and we'll
              * return to the top loop at which point we'll exit.  So
-             * no special action is required here. */
+             * no special action is required here.  A drain is noted
+             * by the caller. */
+            if (dcc_drain_state != DCC_RUNNING)
+                break;
             continue;       /* loop again */
         } else {
             rs_log_error("wait failed: %s", strerror(errno));
@@ -252,12 +373,23 @@ static void dcc_nofork_parent(int listen_fd)
         struct dcc_sockaddr_storage cli_addr;
         socklen_t cli_len;
 
+        /* When draining, take what is queued first; see drain.c. */
+        dcc_drain_log();
+        if (dcc_drain_state == DCC_HANDED_OFF) {
+            dcc_drain_done();
+            dcc_exit(0);
+        }
+
         rs_log_info("waiting to accept connection");
 
         cli_len = sizeof cli_addr;
         acc_fd = accept(listen_fd,
                         (struct sockaddr *) &cli_addr, &cli_len);
-        if (acc_fd == -1 && errno == EINTR) {
+        if (acc_fd == -1 && dcc_drain_state != DCC_RUNNING
+            && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            dcc_drain_done();
+            dcc_exit(0);
+        } else if (acc_fd == -1 && errno == EINTR) {
             ;
         }  else if (acc_fd == -1) {
             rs_log_error("accept failed: %s", strerror(errno));
@@ -273,6 +405,8 @@ static void dcc_nofork_parent(int listen_fd)
 #endif
             dcc_exit(EXIT_CONNECT_FAILED);
         } else {
+            if (dcc_drain_state != DCC_RUNNING)
+                fcntl(acc_fd, F_SETFL, fcntl(acc_fd, F_GETFL) & ~O_NONBLOCK);
             dcc_service_job(acc_fd, acc_fd, (struct sockaddr *) &cli_addr, cli_len);
             dcc_close(acc_fd);
         }
@@ -0,0 +1,503 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Draining the daemon, and handing its listening sockets to a new one.
+ *
+ * SIGUSR1 (or "distccd --drain") asks the daemon to drain: it starts no new
+ * children, lets the jobs it has finish, and exits.  The listening sockets
+ * are made non-blocking and the parent closes its copies, so that once the
+ * children have taken every connection already queued and exited, the
+ * port is closed and new clients go elsewhere.  Nothing in the backlog is
+ * reset.
+ *
+ * With --handoff PATH, the daemon listens on the Unix socket PATH for the
+ * daemon that will replace it.  A new distccd started with the same
+ * --handoff first looks there, and if the old one answers it is sent the
+ * listening sockets (and the --stats one) rather than binding its own.
+ * Once the new daemon is about to start its children it says "GO", and the
+ * old one drains, but leaves the sockets open: the port is never closed,
+ * so clients see no gap.  The exchange is:
+ *
+ *    old -> new:  "DISTCCD-HANDOFF N_LISTEN HAVE_STATS\n" and the sockets
+ *    new -> old:  "GO\n"
+ *
+ * The children are told to finish with the signal the parent got.  They
+ * only let it through while they wait in accept(); while they run a job it
+ * stays pending until they are done.  On SIGUSR2 they exit at once, as the
+ * new daemon takes the queue; on SIGUSR1 they go on accepting until there
+ * is nothing waiting.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "dopt.h"
+#include "daemon.h"
+
+/** How long the old daemon waits for its successor to say "GO". */
+#define DCC_HANDOFF_TIMEOUT_MS 60000
+
+volatile sig_atomic_t dcc_drain_state = DCC_RUNNING;
+
+/* Set by a child while it waits in accept(), where it may simply exit. */
+static volatile sig_atomic_t dcc_drain_idle = 0;
+
+/* The sockets we accept jobs on, and the --stats one or -1. */
+static int dcc_drain_fds[DCC_MAX_SHARDS];
+static int dcc_drain_n_fds = 0;
+static int dcc_drain_stats_fd = -1;
+
+/* Our connection to the daemon we took the sockets from. */
+static int dcc_handoff_fd = -1;
+
+
+static RETSIGTYPE dcc_drain_handler(int whichsig)
+{
+    int was = dcc_drain_state, i;
+
+    if (dcc_drain_idle && whichsig == SIGUSR2)
+        _exit(0);
+
+    if (whichsig == SIGUSR2)
+        dcc_drain_state = DCC_HANDED_OFF;
+    else if (was == DCC_RUNNING)
+        dcc_drain_state = DCC_DRAINING;
+
+    if (was != DCC_RUNNING || getpid() != dcc_master_pid)
+        return;
+
+    /* Before the children hear of it, so that none of them blocks in
+     * accept() again.  This is shared with them, but not with a new
+     * daemon, which only has the sockets if we handed them off. */
+    if (dcc_drain_state == DCC_DRAINING)
+        for (i = 0; i < dcc_drain_n_fds; i++)
+            fcntl(dcc_drain_fds[i], F_SETFL,
+                  fcntl(dcc_drain_fds[i], F_GETFL) | O_NONBLOCK);
+    dcc_prefork_signal_kids(whichsig);
+}
+
+
+/**
+ * Drain on SIGUSR1, and SIGUSR2 from the handoff process.  Set up in the
+ * parent; its children inherit it.
+ **/
+void dcc_drain_catch_signals(const int *listen_fds, int n_fds)
+{
+    struct sigaction act;
+
+    memcpy(dcc_drain_fds, listen_fds, n_fds * sizeof listen_fds[0]);
+    dcc_drain_n_fds = n_fds;
+
+    /* Not SA_RESTART: a parent waiting for children should look again. */
+    memset(&act, 0, sizeof act);
+    act.sa_handler = dcc_drain_handler;
+    sigaction(SIGUSR1, &act, NULL);
+    sigaction(SIGUSR2, &act, NULL);
+}
+
+
+/**
+ * In a child, hold back SIGUSR1 and SIGUSR2 unless @p idle, so that a job
+ * is never cut short.  When idle, a handoff makes the child exit at once,
+ * and a drain interrupts accept().
+ **/
+void dcc_drain_kid_idle(int idle)
+{
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGUSR2);
+    if (idle) {
+        dcc_drain_idle = 1;
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+    } else {
+        sigprocmask(SIG_BLOCK, &set, NULL);
+        dcc_drain_idle = 0;
+    }
+}
+
+
+/**
+ * Log that we have started to drain, the first time the parent notices.
+ * A preforking parent then closes its listening sockets, leaving them to
+ * the children until they have emptied the queue.
+ **/
+void dcc_drain_log(void)
+{
+    static int logged = 0;
+    int i;
+
+    if (logged || dcc_drain_state == DCC_RUNNING)
+        return;
+    logged = 1;
+    if (dcc_drain_state == DCC_HANDED_OFF) {
+        rs_log_info("handed off to a new daemon; waiting for %d child%s",
+                    dcc_nkids, dcc_nkids == 1 ? "" : "ren");
+        /* The pid file is the new daemon's now. */
+        arg_pid_file = NULL;
+    } else {
+        rs_log_info("draining; waiting for %d child%s",
+                    dcc_nkids, dcc_nkids == 1 ? "" : "ren");
+        if (!opt_no_fork)
+            for (i = 0; i < dcc_drain_n_fds; i++)
+                close(dcc_drain_fds[i]);
+    }
+}
+
+
+/**
+ * Called by the parent when the last child has gone.  Unless the new
+ * daemon has it, the pid file goes: a detached daemon otherwise only
+ * removes it when it is killed.
+ **/
+void dcc_drain_done(void)
+{
+    rs_log_info("drained");
+    dcc_remove_pid();
+    arg_pid_file = NULL;
+}
+
+
+/**
+ * "distccd --drain": ask the daemon in --pid-file to drain.
+ **/
+int dcc_drain_command(void)
+{
+    FILE *f;
+    long pid;
+
+    if (!arg_pid_file) {
+        rs_log_error("--drain needs --pid-file");
+        return EXIT_BAD_ARGUMENTS;
+    }
+    if (!(f = fopen(arg_pid_file, "r"))) {
+        rs_log_error("failed to open %s: %s", arg_pid_file, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if (fscanf(f, "%ld", &pid) != 1 || pid <= 1) {
+        fclose(f);
+        rs_log_error("no process id in %s", arg_pid_file);
+        return EXIT_IO_ERROR;
+    }
+    fclose(f);
+    if (kill((pid_t) pid, SIGUSR1) == -1) {
+        rs_log_error("failed to signal %ld: %s", pid, strerror(errno));
+        return EXIT_DISTCC_FAILED;
+    }
+    rs_log_info("asked daemon %ld to drain", pid);
+    return 0;
+}
+
+
+static int dcc_handoff_addr(const char *path, struct sockaddr_un *sa)
+{
+    if (strlen(path) >= sizeof sa->sun_path) {
+        rs_log_error("handoff socket name \"%s\" is too long", path);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    memset(sa, 0, sizeof *sa);
+    sa->sun_family = AF_UNIX;
+    strcpy(sa->sun_path, path);
+    return 0;
+}
+
+
+/**
+ * Take the listening sockets from the daemon at --handoff, if there is
+ * one: @p n_listen of them into @p listen_fds, and the --stats socket, if
+ * it had one, into @p stats_fd.
+ *
+ * Returns EXIT_CONNECT_FAILED if nobody is there, and we should bind our
+ * own.
+ **/
+int dcc_handoff_take(int *listen_fds, int n_listen, int *stats_fd)
+{
+    struct sockaddr_un sa;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char header[64];
+    int fds[DCC_MAX_SHARDS + 1];
+    int fd, n_fds = 0, their_listen, their_stats, i, ret;
+    ssize_t len;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof fds)];
+    } control;
+
+    if ((ret = dcc_handoff_addr(arg_handoff, &sa)))
+        return ret;
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        rs_log_error("socket failed: %s", strerror(errno));
+        return EXIT_CONNECT_FAILED;
+    }
+    if (connect(fd, (struct sockaddr *) &sa, sizeof sa) == -1) {
+        rs_trace("no daemon to take over at %s: %s", arg_handoff,
+                 strerror(errno));
+        close(fd);
+        return EXIT_CONNECT_FAILED;
+    }
+
+    memset(&msg, 0, sizeof msg);
+    iov.iov_base = header;
+    iov.iov_len = sizeof header - 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+
+    if ((len = recvmsg(fd, &msg, 0)) <= 0) {
+        rs_log_error("daemon at %s sent nothing", arg_handoff);
+        close(fd);
+        return EXIT_PROTOCOL_ERROR;
+    }
+    header[len] = '\0';
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), n_fds * sizeof(int));
+        }
+
+    if (sscanf(header, "DISTCCD-HANDOFF %d %d", &their_listen,
+               &their_stats) != 2
+        || (msg.msg_flags & MSG_CTRUNC)
+        || n_fds != their_listen + !!their_stats) {
+        rs_log_error("bad handoff from %s", arg_handoff);
+        ret = EXIT_PROTOCOL_ERROR;
+        goto fail;
+    }
+    if (their_listen != n_listen) {
+        rs_log_error("the daemon at %s has %d listening socket%s and we want "
+                     "%d; give both the same --shards",
+                     arg_handoff, their_listen, their_listen == 1 ? "" : "s",
+                     n_listen);
+        ret = EXIT_BAD_ARGUMENTS;
+        goto fail;
+    }
+
+    for (i = 0; i < n_listen; i++) {
+        listen_fds[i] = fds[i];
+        set_cloexec_flag(fds[i], 1);
+    }
+    *stats_fd = their_stats ? fds[n_listen] : -1;
+    if (*stats_fd != -1)
+        set_cloexec_flag(*stats_fd, 1);
+    dcc_handoff_fd = fd;
+    rs_log_info("took over %d listening socket%s from %s", n_listen,
+                n_listen == 1 ? "" : "s", arg_handoff);
+    return 0;
+
+fail:
+    for (i = 0; i < n_fds; i++)
+        close(fds[i]);
+    close(fd);
+    return ret;
+}
+
+
+/**
+ * Tell the daemon we took the sockets from to drain, now that we are ready
+ * to accept on them.
+ **/
+void dcc_handoff_go(void)
+{
+    if (dcc_handoff_fd == -1)
+        return;
+    if (write(dcc_handoff_fd, "GO\n", 3) != 3)
+        rs_log_warning("failed to tell the old daemon to drain: %s",
+                       strerror(errno));
+    close(dcc_handoff_fd);
+    dcc_handoff_fd = -1;
+}
+
+
+static int dcc_handoff_check_peer(int fd)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof cred;
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+        return EXIT_ACCESS_DENIED;
+    if (cred.uid != getuid() && cred.uid != 0) {
+        rs_log_warning("refusing handoff to uid %d", (int) cred.uid);
+        return EXIT_ACCESS_DENIED;
+    }
+#else
+    (void) fd;
+#endif
+    return 0;
+}
+
+
+/**
+ * Give our sockets to the daemon on @p fd, and wait for it to say it is
+ * ready.
+ **/
+static int dcc_handoff_give(int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    struct pollfd pfd;
+    char header[64], reply[4];
+    int fds[DCC_MAX_SHARDS + 1];
+    int n_fds = dcc_drain_n_fds, ret;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof fds)];
+    } control;
+
+    if ((ret = dcc_handoff_check_peer(fd)))
+        return ret;
+
+    memcpy(fds, dcc_drain_fds, n_fds * sizeof fds[0]);
+    if (dcc_drain_stats_fd != -1)
+        fds[n_fds++] = dcc_drain_stats_fd;
+    snprintf(header, sizeof header, "DISTCCD-HANDOFF %d %d\n",
+             dcc_drain_n_fds, dcc_drain_stats_fd != -1);
+
+    memset(&msg, 0, sizeof msg);
+    memset(&control, 0, sizeof control);
+    iov.iov_base = header;
+    iov.iov_len = strlen(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+
+    if (sendmsg(fd, &msg, 0) != (ssize_t) iov.iov_len) {
+        rs_log_warning("failed to hand off sockets: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, DCC_HANDOFF_TIMEOUT_MS) != 1
+        || read(fd, reply, sizeof reply) < 2
+        || strncmp(reply, "GO", 2) != 0) {
+        rs_log_warning("new daemon didn't take over; carrying on");
+        return EXIT_PROTOCOL_ERROR;
+    }
+    return 0;
+}
+
+
+static void dcc_handoff_loop(int ctl_fd, pid_t master) NORETURN;
+
+static void dcc_handoff_loop(int ctl_fd, pid_t master)
+{
+    struct pollfd pfd;
+    int fd;
+
+    while (kill(master, 0) == 0) {
+        pfd.fd = ctl_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 1000) != 1)
+            continue;
+        if ((fd = accept(ctl_fd, NULL, NULL)) == -1)
+            continue;
+        if (dcc_handoff_give(fd) == 0) {
+            kill(master, SIGUSR2);
+            _exit(0);
+        }
+        close(fd);
+    }
+    _exit(0);
+}
+
+
+/**
+ * Listen at --handoff for the daemon that will replace this one.  The
+ * listening is done by a separate process, which lives as long as the
+ * caller, and hands over the sockets given to dcc_drain_catch_signals()
+ * and @p stats_fd.
+ **/
+int dcc_handoff_serve(int stats_fd)
+{
+    struct sockaddr_un sa;
+    pid_t master = getpid(), pid;
+    mode_t old_umask;
+    int ctl_fd, status, ret;
+
+    dcc_drain_stats_fd = stats_fd;
+    if ((ret = dcc_handoff_addr(arg_handoff, &sa)))
+        return ret;
+    if ((ctl_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        rs_log_error("socket failed: %s", strerror(errno));
+        return EXIT_BIND_FAILED;
+    }
+    unlink(arg_handoff);
+    old_umask = umask(077);
+    ret = bind(ctl_fd, (struct sockaddr *) &sa, sizeof sa);
+    umask(old_umask);
+    if (ret == -1 || listen(ctl_fd, 4) == -1) {
+        rs_log_error("failed to listen on %s: %s", arg_handoff,
+                     strerror(errno));
+        close(ctl_fd);
+        return EXIT_BIND_FAILED;
+    }
+
+    if ((pid = fork()) == -1) {
+        rs_log_error("fork failed: %s", strerror(errno));
+        close(ctl_fd);
+        return EXIT_DISTCC_FAILED;
+    }
+    if (pid == 0) {
+        /* Not our parent's child, so that it doesn't count us as one. */
+        if (fork() == 0)
+            dcc_handoff_loop(ctl_fd, master);
+        _exit(0);
+    }
+    close(ctl_fd);
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    rs_trace("listening for a successor on %s", arg_handoff);
+    return 0;
+}
@@ -368,6 +368,13 @@ int dcc_new_pgrp(void)
 }
 
 
+/**
+ * If set, the cgroup.procs file that dcc_spawn_child() moves the child into
+ * before it runs anything.
+ **/
+const char *dcc_child_cgroup = NULL;
+
+
 /**
  * Run @p argv in a child asynchronously.
  *
@@ -398,10 +405,23 @@ int dcc_spawn_child(char **argv, pid_t *pidptr,
          * the compiler has an infinite loop bug, the new group
          * will run forever until you kill it.
          */
+        sigset_t unblock;
+
         if (stdout_file != NULL) {
             if (dcc_new_pgrp() != 0)
                 rs_trace("Unable to start a new group\n");
         }
+        /* distccd holds back some signals while it runs a job. */
+        sigemptyset(&unblock);
+        sigprocmask(SIG_SETMASK, &unblock, NULL);
+        if (dcc_child_cgroup) {
+            int fd = open(dcc_child_cgroup, O_WRONLY);
+            if (fd == -1 || write(fd, "0", 1) != 1)
+                rs_log_warning("failed to join %s: %s", dcc_child_cgroup,
+                               strerror(errno));
+            if (fd != -1)
+                close(fd);
+        }
         dcc_inside_child(argv, stdin_file, stdout_file, stderr_file);
         /* !! NEVER RETURN FROM HERE !! */
     } else {
@@ -24,6 +24,7 @@
 /* exec.c */
 extern const int timeout_null_fd;
 extern int dcc_job_lifetime;
+extern const char *dcc_child_cgroup;
 
 int dcc_redirect_fds(const char *stdin_file,
                      const char *stdout_file,
@@ -0,0 +1,559 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Fair sharing of job slots between clients, for --fair-share.
+ *
+ * The daemon starts --queue more children than it has job slots, so that
+ * the extras can accept connections and wait.  Once a child has read the
+ * request header it queues for a slot in a table shared by all children,
+ * and the slot goes to the waiting job with the best priority class, then
+ * the earliest virtual start time.  That is start-time fair queueing: each
+ * job of a client starts 1/weight after the last one, or at the current
+ * virtual time if the client has been idle, so busy clients get slots in
+ * proportion to their --share weights.
+ *
+ * If every child is busy, a queued job has to give way so a new connection
+ * can be accepted: the one in the lowest class from the client with the
+ * most jobs for its weight.  Its client sees the server as busy and goes
+ * elsewhere.
+ *
+ * Clients are identified by their GSS-API principal if they authenticated,
+ * otherwise by address.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <netdb.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "dopt.h"
+#include "daemon.h"
+#include "access.h"
+#ifdef HAVE_GSSAPI
+#include "hosts.h"
+#include "auth.h"
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/** How often a queued job looks to see whether it can run. */
+#define DCC_FAIR_POLL_MS 10
+
+/** Clients remembered at once; the least recently seen is reused. */
+#define DCC_FAIR_CLIENTS 256
+
+enum dcc_fair_state {
+    DCC_FAIR_FREE = 0,
+    DCC_FAIR_WAITING,
+    DCC_FAIR_RUNNING
+};
+
+struct dcc_fair_job {
+    pid_t pid;
+    enum dcc_fair_state state;
+    int prio;
+    int client;
+    double tag;                 /* virtual start time */
+    struct timeval since;
+    int evict;
+};
+
+struct dcc_fair_client {
+    char id[128];
+    double weight;
+    double finish;              /* virtual finish time of its last job */
+    time_t seen;
+};
+
+struct dcc_fair_class_stats {
+    unsigned long jobs, evicted;
+    double wait_ms, max_wait_ms;
+};
+
+/* Shared between the parent and all children. */
+struct dcc_fair {
+    volatile pid_t lock;
+    int run_slots, n_jobs, running;
+    double vtime;
+    struct dcc_fair_class_stats stats[DCC_PRIO_MAX];
+    struct dcc_fair_client clients[DCC_FAIR_CLIENTS];
+    struct dcc_fair_job jobs[1];
+};
+
+/** A --share option. */
+struct dcc_fair_share {
+    char *principal;            /* or NULL to match by address */
+    dcc_address_t addr, mask;
+    double weight;
+    struct dcc_fair_share *next;
+};
+
+static struct dcc_fair *dcc_fair;
+static struct dcc_fair_share *dcc_fair_shares;
+
+/* This child's client and its entry in the shared table. */
+static char dcc_fair_id[128];
+static double dcc_fair_weight = 1.0;
+static struct dcc_fair_job *dcc_fair_job;
+static int dcc_fair_prio = -1;
+static long dcc_fair_wait_ms;
+
+
+/**
+ * Parse a --share option: ADDRESS[/BITS]=WEIGHT, or PRINCIPAL=WEIGHT for
+ * anything with an '@' in it.
+ **/
+int dcc_fair_add_share(const char *spec)
+{
+    struct dcc_fair_share *share;
+    const char *eq = strrchr(spec, '=');
+    char *who, *end;
+    int ret = 0;
+
+    if (!eq || eq == spec) {
+        rs_log_error("--share wants CLIENT=WEIGHT, not \"%s\"", spec);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    if (!(share = calloc(1, sizeof *share))
+        || !(who = strndup(spec, eq - spec))) {
+        free(share);
+        return EXIT_OUT_OF_MEMORY;
+    }
+    share->weight = strtod(eq + 1, &end);
+    if (*end != '\0' || share->weight <= 0) {
+        rs_log_error("bad weight in --share \"%s\"", spec);
+        free(who);
+        free(share);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    if (strchr(who, '@')) {
+        share->principal = who;
+    } else {
+        ret = dcc_parse_mask(who, &share->addr, &share->mask);
+        free(who);
+        if (ret) {
+            free(share);
+            return ret;
+        }
+    }
+    share->next = dcc_fair_shares;
+    dcc_fair_shares = share;
+    return 0;
+}
+
+
+/**
+ * Set up the table shared by the children, before any are started.
+ * @p run_slots jobs may run at once, out of @p n_kids children.
+ **/
+int dcc_fair_init(int run_slots, int n_kids)
+{
+    size_t size = sizeof *dcc_fair + (n_kids - 1) * sizeof dcc_fair->jobs[0];
+
+    dcc_fair = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (dcc_fair == MAP_FAILED) {
+        dcc_fair = NULL;
+        rs_log_error("failed to map fair-share table: %s", strerror(errno));
+        return EXIT_OUT_OF_MEMORY;
+    }
+    memset(dcc_fair, 0, size);
+    dcc_fair->run_slots = run_slots;
+    dcc_fair->n_jobs = n_kids;
+    rs_log_info("sharing %d job slots fairly, with %d more jobs queued",
+                run_slots, n_kids - run_slots);
+    return 0;
+}
+
+
+/*
+ * The table is locked by storing our pid in it.  Critical sections are
+ * short and make no system calls, but a child could still be killed in
+ * one, so a lock held by a process that no longer exists is taken over.
+ */
+static void dcc_fair_lock(void)
+{
+    pid_t me = getpid(), holder;
+
+    while (!__sync_bool_compare_and_swap(&dcc_fair->lock, 0, me)) {
+        holder = dcc_fair->lock;
+        if (holder != 0 && kill(holder, 0) == -1 && errno == ESRCH
+            && __sync_bool_compare_and_swap(&dcc_fair->lock, holder, me))
+            break;
+        sched_yield();
+    }
+}
+
+
+static void dcc_fair_unlock(void)
+{
+    __sync_lock_release(&dcc_fair->lock);
+}
+
+
+/**
+ * Work out who the client on this connection is, and its weight.
+ **/
+void dcc_fair_identify(const struct sockaddr *cli_addr, int cli_len)
+{
+    const struct dcc_fair_share *share;
+
+    if (!dcc_fair)
+        return;
+
+    dcc_fair_weight = 1.0;
+    strcpy(dcc_fair_id, "local");
+#ifdef HAVE_GSSAPI
+    if (dcc_auth_principal) {
+        strlcpy(dcc_fair_id, dcc_auth_principal, sizeof dcc_fair_id);
+        for (share = dcc_fair_shares; share; share = share->next)
+            if (share->principal
+                && strcmp(share->principal, dcc_auth_principal) == 0) {
+                dcc_fair_weight = share->weight;
+                break;
+            }
+        return;
+    }
+#endif
+    if (!cli_addr || cli_addr->sa_family == AF_UNIX)
+        return;
+    getnameinfo(cli_addr, (socklen_t) cli_len, dcc_fair_id,
+                sizeof dcc_fair_id, NULL, 0, NI_NUMERICHOST);
+    for (share = dcc_fair_shares; share; share = share->next)
+        if (!share->principal
+            && dcc_check_address(cli_addr, &share->addr, &share->mask) == 0) {
+            dcc_fair_weight = share->weight;
+            break;
+        }
+}
+
+
+/**
+ * The client table entry for this job's client, taking over the one seen
+ * least recently if it is new.  Called with the table locked.
+ **/
+static int dcc_fair_client(time_t now)
+{
+    struct dcc_fair_client *c;
+    int i, oldest = 0;
+
+    for (i = 0; i < DCC_FAIR_CLIENTS; i++) {
+        c = &dcc_fair->clients[i];
+        if (c->seen && strcmp(c->id, dcc_fair_id) == 0)
+            break;
+        if (c->seen < dcc_fair->clients[oldest].seen)
+            oldest = i;
+    }
+    if (i == DCC_FAIR_CLIENTS) {
+        i = oldest;
+        c = &dcc_fair->clients[i];
+        strlcpy(c->id, dcc_fair_id, sizeof c->id);
+        c->finish = 0;
+    }
+    c->weight = dcc_fair_weight;
+    c->seen = now;
+    return i;
+}
+
+
+/**
+ * How heavily the client of @p job is using the server: its jobs for each
+ * unit of weight.  Called with the table locked.
+ **/
+static double dcc_fair_load(const struct dcc_fair_job *job)
+{
+    int i, n = 0;
+
+    for (i = 0; i < dcc_fair->n_jobs; i++)
+        if (dcc_fair->jobs[i].state != DCC_FAIR_FREE
+            && dcc_fair->jobs[i].client == job->client)
+            n++;
+    return n / dcc_fair->clients[job->client].weight;
+}
+
+
+/**
+ * If every child now has a job, none is left to accept the next client.
+ * Pick a waiting job to give up: the lowest class, then the client using
+ * most for its weight, then the latest to have arrived.  Called with the
+ * table locked.
+ **/
+static void dcc_fair_evict(void)
+{
+    struct dcc_fair_job *job, *victim = NULL;
+    double load, victim_load = 0;
+    int i;
+
+    for (i = 0; i < dcc_fair->n_jobs; i++)
+        if (dcc_fair->jobs[i].state == DCC_FAIR_FREE
+            || dcc_fair->jobs[i].evict)
+            return;
+
+    for (i = 0; i < dcc_fair->n_jobs; i++) {
+        job = &dcc_fair->jobs[i];
+        if (job->state != DCC_FAIR_WAITING)
+            continue;
+        load = dcc_fair_load(job);
+        if (!victim
+            || job->prio > victim->prio
+            || (job->prio == victim->prio
+                && (load > victim_load
+                    || (load == victim_load && job->tag > victim->tag)))) {
+            victim = job;
+            victim_load = load;
+        }
+    }
+    if (victim)
+        victim->evict = 1;
+}
+
+
+/**
+ * Whether @p job is the one that should get the next free slot.  Called
+ * with the table locked.
+ **/
+static int dcc_fair_is_next(const struct dcc_fair_job *job)
+{
+    const struct dcc_fair_job *other;
+    int i;
+
+    for (i = 0; i < dcc_fair->n_jobs; i++) {
+        other = &dcc_fair->jobs[i];
+        if (other == job || other->state != DCC_FAIR_WAITING || other->evict)
+            continue;
+        if (other->prio < job->prio
+            || (other->prio == job->prio && other->tag < job->tag))
+            return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * Queue for a job slot, in priority class @p prio.  Returns EXIT_BUSY if
+ * this job was picked to make way for others.
+ **/
+int dcc_fair_wait(int prio)
+{
+    struct dcc_fair_job *job = NULL;
+    struct dcc_fair_client *c;
+    struct dcc_fair_class_stats *st;
+    struct timeval now;
+    double wait_ms;
+    int i, ret = 0;
+
+    if (!dcc_fair)
+        return 0;
+
+    gettimeofday(&now, NULL);
+    dcc_fair_prio = prio;
+    dcc_fair_lock();
+    for (i = 0; i < dcc_fair->n_jobs; i++)
+        if (dcc_fair->jobs[i].state == DCC_FAIR_FREE) {
+            job = &dcc_fair->jobs[i];
+            break;
+        }
+    if (!job) {
+        /* only if a child was killed and not yet reaped */
+        dcc_fair_unlock();
+        rs_log_warning("fair-share table is full; running job anyway");
+        return 0;
+    }
+    memset(job, 0, sizeof *job);
+    job->pid = getpid();
+    job->prio = prio;
+    job->since = now;
+    job->client = dcc_fair_client(now.tv_sec);
+    c = &dcc_fair->clients[job->client];
+    job->tag = c->finish > dcc_fair->vtime ? c->finish : dcc_fair->vtime;
+    c->finish = job->tag + 1.0 / c->weight;
+    job->state = DCC_FAIR_WAITING;
+    dcc_fair_evict();
+
+    while (1) {
+        if (job->evict) {
+            ret = EXIT_BUSY;
+            break;
+        }
+        if (dcc_fair->running < dcc_fair->run_slots && dcc_fair_is_next(job)) {
+            job->state = DCC_FAIR_RUNNING;
+            dcc_fair->running++;
+            if (job->tag > dcc_fair->vtime)
+                dcc_fair->vtime = job->tag;
+            break;
+        }
+        dcc_fair_unlock();
+        usleep(DCC_FAIR_POLL_MS * 1000);
+        dcc_fair_lock();
+    }
+
+    gettimeofday(&now, NULL);
+    wait_ms = (now.tv_sec - job->since.tv_sec) * 1000.0
+        + (now.tv_usec - job->since.tv_usec) / 1000.0;
+    st = &dcc_fair->stats[prio];
+    if (ret) {
+        st->evicted++;
+        job->state = DCC_FAIR_FREE;
+        job->pid = 0;
+        /* give back the virtual time it was charged */
+        if (c->finish == job->tag + 1.0 / c->weight)
+            c->finish = job->tag;
+    } else {
+        st->jobs++;
+        st->wait_ms += wait_ms;
+        if (wait_ms > st->max_wait_ms)
+            st->max_wait_ms = wait_ms;
+        dcc_fair_job = job;
+    }
+    dcc_fair_unlock();
+
+    dcc_fair_wait_ms = (long) wait_ms;
+    if (ret)
+        rs_log_warning("making way for other clients' jobs after %ldms",
+                       dcc_fair_wait_ms);
+    else if (dcc_fair_wait_ms >= DCC_FAIR_POLL_MS)
+        rs_trace("%s job from %s started after %ldms",
+                 dcc_priority_name(prio), dcc_fair_id, dcc_fair_wait_ms);
+    return ret;
+}
+
+
+static void dcc_fair_release(struct dcc_fair_job *job)
+{
+    if (job->state == DCC_FAIR_RUNNING)
+        dcc_fair->running--;
+    job->state = DCC_FAIR_FREE;
+    job->pid = 0;
+}
+
+
+/**
+ * Give up this child's job slot once the job is finished.
+ **/
+void dcc_fair_done(void)
+{
+    if (!dcc_fair_job)
+        return;
+    dcc_fair_lock();
+    dcc_fair_release(dcc_fair_job);
+    dcc_fair_unlock();
+    dcc_fair_job = NULL;
+}
+
+
+/**
+ * Called in the parent for each child collected, in case it died holding
+ * a slot.
+ **/
+void dcc_fair_kid_exited(pid_t kid)
+{
+    int i;
+
+    if (!dcc_fair)
+        return;
+    dcc_fair_lock();
+    for (i = 0; i < dcc_fair->n_jobs; i++)
+        if (dcc_fair->jobs[i].state != DCC_FAIR_FREE
+            && dcc_fair->jobs[i].pid == kid) {
+            rs_trace("releasing job slot of child %ld", (long) kid);
+            dcc_fair_release(&dcc_fair->jobs[i]);
+        }
+    dcc_fair_unlock();
+}
+
+
+/**
+ * Add this job's class and time spent queueing to the job summary line.
+ **/
+void dcc_fair_summary(void)
+{
+    char buf[64];
+
+    if (dcc_fair_prio == -1)
+        return;
+    snprintf(buf, sizeof buf, "class:%s wait:%ldms ",
+             dcc_priority_name(dcc_fair_prio), dcc_fair_wait_ms);
+    dcc_job_summary_append(buf);
+    dcc_fair_prio = -1;
+    dcc_fair_wait_ms = 0;
+}
+
+
+/**
+ * Write the queueing statistics of each class into @p buf for the stats
+ * server.
+ **/
+void dcc_fair_stats(char *buf, size_t len)
+{
+    struct dcc_fair_class_stats st[DCC_PRIO_MAX];
+    int waiting[DCC_PRIO_MAX];
+    size_t used = 0;
+    int i;
+
+    buf[0] = '\0';
+    if (!dcc_fair)
+        return;
+
+    memset(waiting, 0, sizeof waiting);
+    dcc_fair_lock();
+    memcpy(st, dcc_fair->stats, sizeof st);
+    for (i = 0; i < dcc_fair->n_jobs; i++)
+        if (dcc_fair->jobs[i].state == DCC_FAIR_WAITING)
+            waiting[dcc_fair->jobs[i].prio]++;
+    dcc_fair_unlock();
+
+    for (i = 0; i < DCC_PRIO_MAX && used < len; i++) {
+        const char *name = dcc_priority_name(i);
+
+        used += snprintf(buf + used, len - used,
+                         "dcc_queue_%s_waiting %d\n"
+                         "dcc_queue_%s_jobs %lu\n"
+                         "dcc_queue_%s_evicted %lu\n"
+                         "dcc_queue_%s_wait_avg_msecs %d\n"
+                         "dcc_queue_%s_wait_max_msecs %d\n",
+                         name, waiting[i],
+                         name, st[i].jobs,
+                         name, st[i].evicted,
+                         name, st[i].jobs ? (int) (st[i].wait_ms / st[i].jobs) : 0,
+                         name, (int) st[i].max_wait_ms);
+    }
+}
@@ -0,0 +1,197 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Content-addressed cache of -fprofile-use profiles on the server.
+ *
+ * For hosts with the ",gcda" option the client sends the SHA-256 of the
+ * .gcda file rather than the file itself.  If the server has a profile
+ * with that hash it is linked into the job's directory; otherwise the
+ * client sends the body, which is checked against the hash and kept for
+ * next time.
+ *
+ * The cache is a flat directory of HASH.gcda files, trimmed by oldest
+ * mtime when it grows past its limit.  A hit touches the file.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "bulk.h"
+#include "sha256.h"
+#include "cachedir.h"
+
+
+/**
+ * Put the SHA-256 of @p fname in @p hex as a lowercase hex string.
+ **/
+int dcc_gcda_hash(const char *fname, char hex[DCC_GCDA_HASH_LEN + 1])
+{
+    struct dcc_sha256 ctx;
+    unsigned char digest[DCC_SHA256_LEN];
+    char buf[65536];
+    ssize_t n;
+    int fd, i;
+
+    if ((fd = open(fname, O_RDONLY)) == -1) {
+        rs_log_error("failed to open %s: %s", fname, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    dcc_sha256_init(&ctx);
+    while ((n = read(fd, buf, sizeof buf)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            rs_log_error("failed to read %s: %s", fname, strerror(errno));
+            close(fd);
+            return EXIT_IO_ERROR;
+        }
+        dcc_sha256_update(&ctx, buf, (size_t) n);
+    }
+    close(fd);
+    dcc_sha256_final(&ctx, digest);
+
+    for (i = 0; i < DCC_SHA256_LEN; i++)
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    return 0;
+}
+
+
+/**
+ * True if @p hex looks like something dcc_gcda_hash() produced, so that it
+ * is safe to use as a file name.
+ **/
+static int dcc_gcda_valid_hash(const char *hex)
+{
+    int i;
+
+    for (i = 0; i < DCC_GCDA_HASH_LEN; i++)
+        if (!((hex[i] >= '0' && hex[i] <= '9')
+              || (hex[i] >= 'a' && hex[i] <= 'f')))
+            return 0;
+    return hex[i] == '\0';
+}
+
+
+/**
+ * Make sure @p dir exists and belongs to us, since anything in it is
+ * handed to the compiler.
+ **/
+static int dcc_gcda_check_dir(const char *dir)
+{
+    struct stat sb;
+
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+        rs_log_warning("failed to create profile cache %s: %s",
+                       dir, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    if (lstat(dir, &sb) == -1 || !S_ISDIR(sb.st_mode)
+        || sb.st_uid != geteuid() || (sb.st_mode & 022)) {
+        rs_log_warning("not using profile cache %s: it is not a private "
+                       "directory", dir);
+        return EXIT_IO_ERROR;
+    }
+    return 0;
+}
+
+
+/**
+ * If the cache in @p dir has the profile @p hex, put it at @p dest and
+ * return 0.
+ **/
+int dcc_gcda_cache_lookup(const char *dir, const char *hex, const char *dest)
+{
+    char *cached;
+    int ret;
+
+    if (!dcc_gcda_valid_hash(hex)) {
+        rs_log_error("bad profile hash \"%s\"", hex);
+        return EXIT_PROTOCOL_ERROR;
+    }
+    if (dcc_gcda_check_dir(dir))
+        return EXIT_IO_ERROR;
+    if (asprintf(&cached, "%s/%s.gcda", dir, hex) == -1)
+        return EXIT_OUT_OF_MEMORY;
+
+    if (access(cached, R_OK) == -1) {
+        free(cached);
+        return EXIT_NO_SUCH_FILE;
+    }
+    unlink(dest);
+    if ((ret = dcc_mk_tmp_ancestor_dirs(dest)) == 0
+        && (ret = dcc_cache_link_or_copy(cached, dest, 0600)) == 0) {
+        utimes(cached, NULL);
+        rs_trace("%s is %s from the profile cache", dest, hex);
+    }
+    free(cached);
+    return ret;
+}
+
+
+/**
+ * Add the profile just received into @p fname to the cache in @p dir, if
+ * it really does have the hash @p hex the client claimed, then trim the
+ * cache to @p limit_mb.
+ **/
+int dcc_gcda_cache_store(const char *dir, long limit_mb,
+                         const char *hex, const char *fname)
+{
+    char actual[DCC_GCDA_HASH_LEN + 1];
+    char *cached;
+    int ret;
+
+    if ((ret = dcc_gcda_hash(fname, actual)))
+        return ret;
+    if (strcmp(actual, hex) != 0) {
+        rs_log_warning("profile %s does not match its hash; not caching it",
+                       fname);
+        return 0;
+    }
+    if (dcc_gcda_check_dir(dir))
+        return 0;
+
+    if (asprintf(&cached, "%s/%s.gcda", dir, hex) == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if (dcc_cache_store(fname, cached, 0600) == 0)
+        rs_trace("added %s to the profile cache", hex);
+    free(cached);
+
+    dcc_cache_prune(dir, ".gcda", limit_mb, "profile");
+    return 0;
+}
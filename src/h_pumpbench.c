@@ -0,0 +1,414 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/*
+ * h_pumpbench.c:
+ * Compare the bulk transfer engines over loopback TCP.
+ *
+ * For each engine this does two runs.  The "stream" run sends one large
+ * file through a connection into a file, as distccd does with a big .i
+ * file.  The "jobs" run makes a new connection per job, sends a file,
+ * and gets the same number of bytes back, like a compile without the
+ * compiler.
+ *
+ * Syscalls are the read/write calls counted in /proc/self/io plus
+ * io_uring_enter() calls; CPU is user plus system time of both ends.
+ *
+ * Every file received is checked against what was sent, and the run fails
+ * if any of it is missing or wrong.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+
+const char *rs_program_name = "h_pumpbench";
+
+enum engine { ENGINE_READWRITE, ENGINE_SENDFILE, ENGINE_URING };
+
+static const char *engine_names[] = { "readwrite", "sendfile", "uring" };
+
+struct bench_stats {
+    double cpu;                 /* seconds */
+    unsigned long syscalls;
+    int have_syscalls;
+};
+
+
+static void get_stats(struct bench_stats *s)
+{
+    struct rusage ru;
+    char line[128];
+    FILE *f;
+
+    getrusage(RUSAGE_SELF, &ru);
+    s->cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6
+        + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+    s->syscalls = dcc_uring_enters;
+    s->have_syscalls = 0;
+    if ((f = fopen("/proc/self/io", "r")) != NULL) {
+        while (fgets(line, sizeof line, f)) {
+            unsigned long v;
+            if (sscanf(line, "syscr: %lu", &v) == 1
+                || sscanf(line, "syscw: %lu", &v) == 1) {
+                s->syscalls += v;
+                s->have_syscalls = 1;
+            }
+        }
+        fclose(f);
+    }
+}
+
+
+static void diff_stats(struct bench_stats *d, const struct bench_stats *a,
+                       const struct bench_stats *b)
+{
+    d->cpu = b->cpu - a->cpu;
+    d->syscalls = b->syscalls - a->syscalls;
+    d->have_syscalls = a->have_syscalls && b->have_syscalls;
+}
+
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static void die(const char *what)
+{
+    fprintf(stderr, "h_pumpbench: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+
+/* What every 64kB of a file from make_temp() holds. */
+static const char *pattern(void)
+{
+    static char buf[65536];
+    static int done = 0;
+    size_t i;
+
+    if (!done) {
+        for (i = 0; i < sizeof buf; i++)
+            buf[i] = (char) (i * 7);
+        done = 1;
+    }
+    return buf;
+}
+
+
+/*
+ * Check that @p fd holds exactly the @p size bytes make_temp() would have
+ * written.  It is mapped rather than read, so that the check doesn't add
+ * to the syscalls counted.
+ */
+static void check_data(int fd, size_t size, const char *what)
+{
+    const char *want = pattern(), *p;
+    struct stat sb;
+    size_t done, len, i;
+
+    if (fstat(fd, &sb) == -1)
+        die("fstat");
+    if ((size_t) sb.st_size != size) {
+        fprintf(stderr, "h_pumpbench: %s: got %lu bytes, expected %lu\n",
+                what, (unsigned long) sb.st_size, (unsigned long) size);
+        exit(1);
+    }
+    if (size == 0)
+        return;
+    p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        die("mmap");
+    for (done = 0; done < size; done += 65536) {
+        len = size - done < 65536 ? size - done : 65536;
+        if (memcmp(p + done, want, len) == 0)
+            continue;
+        for (i = 0; p[done + i] == want[i]; i++)
+            ;
+        fprintf(stderr, "h_pumpbench: %s: byte %lu is wrong\n", what,
+                (unsigned long) (done + i));
+        exit(1);
+    }
+    munmap((void *) p, size);
+}
+
+
+/* Copy n bytes the way the given engine would. */
+static void pump(enum engine e, int ofd, int ifd, size_t n)
+{
+    int ret;
+
+    if (e == ENGINE_URING)
+        ret = dcc_pump_uring(ofd, ifd, n);
+    else if (e == ENGINE_SENDFILE && lseek(ifd, 0, SEEK_CUR) != -1)
+        ret = dcc_pump_sendfile(ofd, ifd, n);
+    else
+        ret = dcc_pump_readwrite(ofd, ifd, n);
+    if (ret) {
+        fprintf(stderr, "h_pumpbench: %s transfer failed\n", engine_names[e]);
+        exit(1);
+    }
+}
+
+
+static int make_temp(size_t size)
+{
+    char path[] = "/tmp/h_pumpbench.XXXXXX";
+    const char *tmpdir = getenv("TMPDIR");
+    char *p;
+    size_t done;
+    int fd;
+
+    if (tmpdir && asprintf(&p, "%s/h_pumpbench.XXXXXX", tmpdir) != -1)
+        fd = mkstemp(p);
+    else
+        fd = mkstemp(p = path);
+    if (fd == -1)
+        die("mkstemp");
+    unlink(p);
+    if (p != path)
+        free(p);
+
+    for (done = 0; done < size; done += 65536) {
+        size_t len = size - done < 65536 ? size - done : 65536;
+        if (dcc_writex(fd, pattern(), len))
+            exit(1);
+    }
+    return fd;
+}
+
+
+static int listen_loopback(struct sockaddr_in *sa)
+{
+    socklen_t len = sizeof *sa;
+    int fd;
+
+    memset(sa, 0, sizeof *sa);
+    sa->sin_family = AF_INET;
+    sa->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1
+        || bind(fd, (struct sockaddr *) sa, sizeof *sa) == -1
+        || getsockname(fd, (struct sockaddr *) sa, &len) == -1
+        || listen(fd, 64) == -1)
+        die("listen");
+    return fd;
+}
+
+
+static int connect_loopback(const struct sockaddr_in *sa)
+{
+    int fd;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1
+        || connect(fd, (const struct sockaddr *) sa, sizeof *sa) == -1)
+        die("connect");
+    return fd;
+}
+
+
+/*
+ * The server end: accept @p jobs connections, read @p size bytes from each
+ * into a file and, if @p reply, send the file back.  Reports its own
+ * resource use down @p report_fd.
+ */
+static void serve(enum engine e, int listen_fd, int jobs, size_t size,
+                  int reply, int report_fd)
+{
+    struct bench_stats before, after, d;
+    int fd, sock, i;
+
+    fd = make_temp(0);
+    get_stats(&before);
+    for (i = 0; i < jobs; i++) {
+        if ((sock = accept(listen_fd, NULL, NULL)) == -1)
+            die("accept");
+        if (ftruncate(fd, 0) == -1 || lseek(fd, 0, SEEK_SET) == -1)
+            die("truncate");
+        pump(e, fd, sock, size);
+        if (reply) {
+            check_data(fd, size, "server received bad data");
+            lseek(fd, 0, SEEK_SET);
+            pump(e, sock, fd, size);
+        }
+        close(sock);
+    }
+    get_stats(&after);
+    diff_stats(&d, &before, &after);
+    if (!reply)
+        check_data(fd, size, "server received bad data");
+    if (dcc_writex(report_fd, &d, sizeof d))
+        exit(1);
+    exit(0);
+}
+
+
+static void run(enum engine e, int jobs, size_t size, int reply)
+{
+    struct sockaddr_in sa;
+    struct bench_stats before, after, d, sd;
+    int listen_fd, report[2], src, dst, sock, i, status;
+    double start, elapsed, bytes;
+    pid_t pid;
+
+    dcc_io_uring = (e == ENGINE_URING);
+    if (e == ENGINE_URING && !dcc_uring_usable()) {
+        printf("%-10s %-7s  io_uring is not available\n",
+               engine_names[e], reply ? "jobs" : "stream");
+        return;
+    }
+
+    listen_fd = listen_loopback(&sa);
+    if (pipe(report) == -1)
+        die("pipe");
+    fflush(stdout);
+    if ((pid = fork()) == -1)
+        die("fork");
+    if (pid == 0) {
+        close(report[0]);
+        serve(e, listen_fd, jobs, size, reply, report[1]);
+    }
+    close(report[1]);
+    close(listen_fd);
+
+    src = make_temp(size);
+    dst = make_temp(0);
+
+    get_stats(&before);
+    start = now();
+    for (i = 0; i < jobs; i++) {
+        sock = connect_loopback(&sa);
+        lseek(src, 0, SEEK_SET);
+        pump(e, sock, src, size);
+        if (reply) {
+            lseek(dst, 0, SEEK_SET);
+            pump(e, dst, sock, size);
+            check_data(dst, size, "client received bad data");
+        } else {
+            /* Wait for the server to have it all. */
+            shutdown(sock, SHUT_WR);
+            if (read(sock, &status, 1) == -1)
+                die("read");
+        }
+        close(sock);
+    }
+    elapsed = now() - start;
+    get_stats(&after);
+    diff_stats(&d, &before, &after);
+
+    if (dcc_readx(report[0], &sd, sizeof sd))
+        exit(1);
+    if (waitpid(pid, &status, 0) == -1 || status != 0) {
+        fprintf(stderr, "h_pumpbench: server failed\n");
+        exit(1);
+    }
+    close(report[0]);
+    close(src);
+    close(dst);
+
+    bytes = (double) size * jobs * (reply ? 2 : 1);
+    printf("%-10s %-7s %10.1f ", engine_names[e], reply ? "jobs" : "stream",
+           bytes / elapsed / (1 << 20));
+    if (reply)
+        printf("%10.1f ", jobs / elapsed);
+    else
+        printf("%10s ", "-");
+    printf("%10.3f ", (d.cpu + sd.cpu) / (bytes / (1 << 30)));
+    if (d.have_syscalls && sd.have_syscalls)
+        printf("%12lu\n", d.syscalls + sd.syscalls);
+    else
+        printf("%12s\n", "-");
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: h_pumpbench [-m MB] [-j JOBS] [-k KB] [ENGINE...]\n"
+            "  -m MB     size of the stream run (default 512)\n"
+            "  -j JOBS   number of jobs in the jobs run (default 2000)\n"
+            "  -k KB     bytes each way per job (default 256)\n"
+            "engines: readwrite sendfile uring (default all)\n");
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    long stream_mb = 512, jobs = 2000, job_kb = 256;
+    int i, c, any = 0;
+    enum engine e;
+
+    rs_trace_set_level(RS_LOG_WARNING);
+    rs_add_logger(rs_logger_file, RS_LOG_WARNING, NULL, STDERR_FILENO);
+
+    while ((c = getopt(argc, argv, "m:j:k:")) != -1) {
+        switch (c) {
+        case 'm': stream_mb = atol(optarg); break;
+        case 'j': jobs = atol(optarg); break;
+        case 'k': job_kb = atol(optarg); break;
+        default: usage();
+        }
+    }
+    if (stream_mb <= 0 || jobs <= 0 || job_kb <= 0)
+        usage();
+
+    printf("%-10s %-7s %10s %10s %10s %12s\n",
+           "engine", "run", "MiB/s", "jobs/s", "cpu s/GiB", "syscalls");
+    for (e = ENGINE_READWRITE; e <= ENGINE_URING; e++) {
+        int wanted = (optind == argc);
+        for (i = optind; i < argc; i++) {
+            if (strcmp(argv[i], engine_names[e]) == 0)
+                wanted = 1;
+        }
+        if (!wanted)
+            continue;
+        any = 1;
+        run(e, 1, (size_t) stream_mb << 20, 0);
+        run(e, (int) jobs, (size_t) job_kb << 10, 1);
+    }
+    if (!any)
+        usage();
+    return 0;
+}
@@ -0,0 +1,198 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* Test harness for SHA-256, HMAC-SHA-256 and GSS-API session tickets.
+ *
+ *   h_ticket sha256 HEX
+ *   h_ticket hmac KEYHEX DATAHEX
+ *   h_ticket ticket PRINCIPAL LIFETIME AGE [magic|keyid|expiry|principal]
+ *
+ * "ticket" issues a ticket that lasts LIFETIME seconds, optionally
+ * changes one of its fields, and presents it AGE seconds later.  It
+ * prints "accepted PRINCIPAL" if the server would let the client in,
+ * "refused" if the server would turn the ticket down, or "bad proof" if
+ * the two sides' proofs of the session key don't match. */
+
+#include <config.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "exitcode.h"
+#include "sha256.h"
+#include "ticket.h"
+
+static unsigned char *unhex(const char *hex, size_t *len) {
+    size_t i, n = strlen(hex);
+    unsigned char *buf;
+    unsigned byte;
+
+    if (n % 2 || (buf = malloc(n / 2 + 1)) == NULL)
+        return NULL;
+    for (i = 0; i < n / 2; i++) {
+        if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+            free(buf);
+            return NULL;
+        }
+        buf[i] = (unsigned char) byte;
+    }
+    *len = n / 2;
+    return buf;
+}
+
+static void print_hex(const unsigned char *buf, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        printf("%02x", buf[i]);
+    printf("\n");
+}
+
+/* Hash all at once and a byte at a time, which must agree. */
+static int test_sha256(const char *hex) {
+    struct dcc_sha256 ctx;
+    unsigned char whole[DCC_SHA256_LEN], bytewise[DCC_SHA256_LEN];
+    unsigned char *data;
+    size_t len, i;
+
+    if ((data = unhex(hex, &len)) == NULL)
+        return EXIT_BAD_ARGUMENTS;
+
+    dcc_sha256_init(&ctx);
+    dcc_sha256_update(&ctx, data, len);
+    dcc_sha256_final(&ctx, whole);
+
+    dcc_sha256_init(&ctx);
+    for (i = 0; i < len; i++)
+        dcc_sha256_update(&ctx, data + i, 1);
+    dcc_sha256_final(&ctx, bytewise);
+    free(data);
+
+    if (memcmp(whole, bytewise, sizeof whole) != 0) {
+        printf("mismatch\n");
+        return EXIT_DISTCC_FAILED;
+    }
+    print_hex(whole, sizeof whole);
+    return 0;
+}
+
+static int test_hmac(const char *key_hex, const char *data_hex) {
+    unsigned char mac[DCC_SHA256_LEN];
+    unsigned char *key, *data;
+    size_t key_len, data_len;
+
+    if ((key = unhex(key_hex, &key_len)) == NULL
+        || (data = unhex(data_hex, &data_len)) == NULL)
+        return EXIT_BAD_ARGUMENTS;
+
+    dcc_hmac_sha256(key, key_len, data, data_len, mac);
+    print_hex(mac, sizeof mac);
+    free(key);
+    free(data);
+    return 0;
+}
+
+static int test_ticket(const char *principal, int lifetime, int age,
+                       const char *field) {
+    static const unsigned char key_id[DCC_TICKET_KEY_ID_LEN] = "testkey";
+    const time_t issued = 1000000000;
+    unsigned char ticket_key[DCC_SHA256_LEN];
+    unsigned char ticket[DCC_TICKET_MAX_LEN + 1];
+    unsigned char client_key[DCC_SHA256_LEN], server_key[DCC_SHA256_LEN];
+    unsigned char client_nonce[DCC_TICKET_NONCE_LEN];
+    unsigned char server_nonce[DCC_TICKET_NONCE_LEN];
+    unsigned char proof[DCC_SHA256_LEN], expected[DCC_SHA256_LEN];
+    size_t len;
+    int i;
+
+    if (strlen(principal) > DCC_TICKET_MAX_LEN - DCC_TICKET_HEADER_LEN)
+        return EXIT_BAD_ARGUMENTS;
+
+    for (i = 0; i < DCC_SHA256_LEN; i++)
+        ticket_key[i] = (unsigned char) i;
+    memset(client_nonce, 'c', sizeof client_nonce);
+    memset(server_nonce, 's', sizeof server_nonce);
+
+    /* Issue: the client learns the session key with the ticket. */
+    len = dcc_ticket_make(key_id, principal,
+                          (uint32_t) (issued + lifetime), ticket);
+    dcc_ticket_session_key(ticket_key, ticket, len, client_key);
+
+    if (!field)
+        ;
+    else if (!strcmp(field, "magic"))
+        ticket[0] ^= 1;
+    else if (!strcmp(field, "keyid"))
+        ticket[4] ^= 1;
+    else if (!strcmp(field, "expiry"))
+        ticket[13] ^= 1;        /* about 18 hours later */
+    else if (!strcmp(field, "principal"))
+        ticket[len - 1] ^= 1;
+    else
+        return EXIT_BAD_ARGUMENTS;
+
+    /* Resume: the server checks the ticket and derives the key again,
+     * then each side proves it holds the key. */
+    ticket[len] = '\0';
+    if (!dcc_ticket_valid(key_id, ticket, len, issued + age)) {
+        printf("refused\n");
+        return 0;
+    }
+    dcc_ticket_session_key(ticket_key, ticket, len, server_key);
+
+    dcc_ticket_proof(server_key, "distccd", client_nonce, server_nonce,
+                     proof);
+    dcc_ticket_proof(client_key, "distccd", client_nonce, server_nonce,
+                     expected);
+    if (!dcc_mem_equal(proof, expected, sizeof proof)) {
+        printf("bad proof\n");
+        return 0;
+    }
+
+    dcc_ticket_proof(client_key, "distcc", server_nonce, client_nonce,
+                     proof);
+    dcc_ticket_proof(server_key, "distcc", server_nonce, client_nonce,
+                     expected);
+    if (!dcc_mem_equal(proof, expected, sizeof proof)) {
+        printf("bad proof\n");
+        return 0;
+    }
+
+    printf("accepted %s\n", (char *) ticket + DCC_TICKET_HEADER_LEN);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && !strcmp(argv[1], "sha256"))
+        return test_sha256(argv[2]);
+    if (argc == 4 && !strcmp(argv[1], "hmac"))
+        return test_hmac(argv[2], argv[3]);
+    if ((argc == 5 || argc == 6) && !strcmp(argv[1], "ticket"))
+        return test_ticket(argv[2], atoi(argv[3]), atoi(argv[4]),
+                           argc == 6 ? argv[5] : NULL);
+
+    fprintf(stderr, "usage: h_ticket sha256 HEX\n"
+            "       h_ticket hmac KEYHEX DATAHEX\n"
+            "       h_ticket ticket PRINCIPAL LIFETIME AGE [FIELD]\n");
+    return EXIT_BAD_ARGUMENTS;
+}
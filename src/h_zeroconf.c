@@ -0,0 +1,87 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* Test harness for reading zeroconf TXT records.
+ *
+ * Each argument is a server: its name, then the strings of its TXT
+ * record, separated by spaces.  The servers are printed in the order the
+ * zeroconf host file would list them, with what was read for each. */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "distcc.h"
+#include "exitcode.h"
+#include "hosts.h"
+#include "zeroconf.h"
+
+struct server {
+    char *name;
+    struct dcc_zeroconf_load load;
+};
+
+static int compare_servers(const void *a, const void *b) {
+    const struct server *sa = a, *sb = b;
+    int c = dcc_zeroconf_compare_load(&sa->load, &sb->load);
+
+    return c ? c : strcmp(sa->name, sb->name);
+}
+
+int main(int argc, char **argv) {
+    struct server *servers;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: h_zeroconf 'NAME KEY=VALUE...'...\n");
+        return EXIT_BAD_ARGUMENTS;
+    }
+
+    servers = calloc(argc - 1, sizeof *servers);
+    if (!servers)
+        return EXIT_OUT_OF_MEMORY;
+
+    for (i = 1; i < argc; i++) {
+        struct server *s = &servers[i - 1];
+        char *item, *eq;
+
+        s->name = strtok(argv[i], " ");
+        dcc_zeroconf_load_init(&s->load);
+        while ((item = strtok(NULL, " ")) != NULL) {
+            if ((eq = strchr(item, '=')) != NULL)
+                *eq++ = '\0';
+            dcc_zeroconf_load_pair(&s->load, item, eq);
+        }
+        dcc_zeroconf_load_done(&s->load);
+    }
+
+    qsort(servers, argc - 1, sizeof *servers, compare_servers);
+
+    for (i = 0; i < argc - 1; i++)
+        printf("%s/%d cpus=%d free=%d memfree=%d load=%d\n",
+               servers[i].name, servers[i].load.n_jobs,
+               servers[i].load.n_cpus, servers[i].load.free_slots,
+               servers[i].load.mem_free, servers[i].load.load);
+
+    free(servers);
+    return 0;
+}
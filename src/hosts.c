@@ -48,8 +48,8 @@
   OLDSTYLE_TCP_HOST = HOSTID[/LIMIT][:PORT][OPTIONS]
   HOSTID = HOSTNAME | IPV4
   OPTIONS = ,OPTION[OPTIONS]
-  OPTION = lzo | cpp
-  GLOBAL_OPTION = --randomize
+  OPTION = lzo | cpp | gcda | bigmem | tls
+  GLOBAL_OPTION = --randomize | --affinity
  *
  * Any amount of whitespace may be present between hosts.
  *
@@ -113,6 +113,21 @@
 
 const int dcc_default_port = DISTCC_DEFAULT_PORT;
 
+/** Set by the --affinity keyword; see dcc_lock_affine() in where.c. */
+int dcc_host_affinity = 0;
+
+/** Set by the --randomize keyword. */
+int dcc_host_randomize = 0;
+
+/** True if hosts in backoff have already been taken out of the list
+ * given to dcc_set_hostlist(). */
+int dcc_hostlist_checked = 0;
+
+/* A host list parsed earlier, by the agent, to be used instead of reading
+ * one; see dcc_set_hostlist(). */
+static const struct dcc_hostdef *dcc_preset_hosts = NULL;
+static int dcc_hostlist_preset = 0;
+
 /***
  * A simple container which would hold a host -> rand int pair
  ***/
@@ -148,25 +163,32 @@ char *strndup(const char *src, size_t size)
 #endif
 
 /**
- * Get a list of hosts to use.
+ * Get the text of the host list, and where it came from.
  *
  * Hosts are taken from DISTCC_HOSTS, if that exists.  Otherwise, they are
  * taken from $DISTCC_DIR/hosts, if that exists.  Otherwise, they are taken
  * from ${sysconfdir}/distcc/hosts, if that exists.  Otherwise, we fail.
+ *
+ * Both strings are newly allocated.
  **/
-int dcc_get_hostlist(struct dcc_hostdef **ret_list,
-                     int *ret_nhosts)
+int dcc_get_hostlist_text(char **ret_text, char **ret_source)
 {
     char *env;
     char *path, *top;
     int ret;
 
-    *ret_list = NULL;
-    *ret_nhosts = 0;
+    *ret_text = *ret_source = NULL;
 
     if ((env = getenv("DISTCC_HOSTS")) != NULL) {
         rs_trace("read hosts from environment");
-        return dcc_parse_hosts(env, "$DISTCC_HOSTS", ret_list, ret_nhosts, NULL);
+        if ((*ret_text = strdup(env)) == NULL
+            || (*ret_source = strdup("$DISTCC_HOSTS")) == NULL) {
+            rs_log_error("strdup failed");
+            free(*ret_text);
+            *ret_text = NULL;
+            return EXIT_OUT_OF_MEMORY;
+        }
+        return 0;
     }
 
     /* $DISTCC_DIR or ~/.distcc */
@@ -175,8 +197,11 @@ int dcc_get_hostlist(struct dcc_hostdef **ret_list,
 
         checked_asprintf(&path, "%s/hosts", top);
         if (path != NULL && access(path, R_OK) == 0) {
-            ret = dcc_parse_hosts_file(path, ret_list, ret_nhosts);
-            free(path);
+            rs_trace("load hosts from %s", path);
+            if ((ret = dcc_load_file_string(path, ret_text)) != 0)
+                free(path);
+            else
+                *ret_source = path;
             return ret;
         } else {
             rs_trace("not reading %s: %s", path, strerror(errno));
@@ -186,8 +211,11 @@ int dcc_get_hostlist(struct dcc_hostdef **ret_list,
 
     checked_asprintf(&path, "%s/distcc/hosts", SYSCONFDIR);
     if (path != NULL && access(path, R_OK) == 0) {
-        ret = dcc_parse_hosts_file(path, ret_list, ret_nhosts);
-        free(path);
+        rs_trace("load hosts from %s", path);
+        if ((ret = dcc_load_file_string(path, ret_text)) != 0)
+            free(path);
+        else
+            *ret_source = path;
         return ret;
     } else {
         rs_trace("not reading %s: %s", path, strerror(errno));
@@ -201,6 +229,98 @@ int dcc_get_hostlist(struct dcc_hostdef **ret_list,
 }
 
 
+/**
+ * Get a list of hosts to use, from wherever dcc_get_hostlist_text() finds
+ * it, or the one given to dcc_set_hostlist().
+ **/
+int dcc_get_hostlist(struct dcc_hostdef **ret_list,
+                     int *ret_nhosts)
+{
+    char *text, *source;
+    int ret;
+
+    *ret_list = NULL;
+    *ret_nhosts = 0;
+
+    if (dcc_hostlist_preset) {
+        rs_trace("using host list from the agent");
+        if ((ret = dcc_copy_hostlist(dcc_preset_hosts, ret_list,
+                                     ret_nhosts)) != 0)
+            return ret;
+        if (dcc_host_randomize && *ret_nhosts)
+            return dcc_randomize_host_list(ret_list, *ret_nhosts);
+        return 0;
+    }
+
+    if ((ret = dcc_get_hostlist_text(&text, &source)) != 0)
+        return ret;
+
+    ret = dcc_parse_hosts(text, source, ret_list, ret_nhosts, NULL);
+    free(text);
+    free(source);
+    return ret;
+}
+
+
+/**
+ * Use @p list, which the caller has already parsed, instead of reading
+ * the host list again.  The agent does this in the child it forks for
+ * each compile.  @p checked says whether hosts in backoff have been taken
+ * out of it.
+ **/
+void dcc_set_hostlist(const struct dcc_hostdef *list, int checked)
+{
+    dcc_preset_hosts = list;
+    dcc_hostlist_preset = 1;
+    dcc_hostlist_checked = checked;
+}
+
+
+/**
+ * Make a copy of @p list that can be changed and freed without touching
+ * the original.
+ **/
+int dcc_copy_hostlist(const struct dcc_hostdef *list,
+                      struct dcc_hostdef **ret_list, int *ret_nhosts)
+{
+    struct dcc_hostdef **tail = ret_list, *h;
+
+    *ret_list = NULL;
+    *ret_nhosts = 0;
+
+    for (; list; list = list->next) {
+        if ((h = malloc(sizeof *h)) == NULL) {
+            rs_log_crit("failed to allocate host definition");
+            dcc_free_hostlist(*ret_list);
+            *ret_list = NULL;
+            *ret_nhosts = 0;
+            return EXIT_OUT_OF_MEMORY;
+        }
+        *h = *list;
+        h->next = NULL;
+        *tail = h;
+        tail = &h->next;
+        (*ret_nhosts)++;
+
+        h->user = list->user ? strdup(list->user) : NULL;
+        h->hostname = list->hostname ? strdup(list->hostname) : NULL;
+        h->ssh_command = list->ssh_command ? strdup(list->ssh_command) : NULL;
+        h->hostdef_string = strdup(list->hostdef_string);
+        if ((list->user && !h->user) || (list->hostname && !h->hostname)
+            || (list->ssh_command && !h->ssh_command)
+            || !h->hostdef_string) {
+            rs_log_crit("failed to allocate host definition");
+            dcc_free_hostlist(*ret_list);
+            *ret_list = NULL;
+            *ret_nhosts = 0;
+            return EXIT_OUT_OF_MEMORY;
+        }
+    }
+
+    return 0;
+}
+
+
 /**
  * Parse an optionally present multiplier.
  *
@@ -243,9 +363,15 @@ static int dcc_parse_options(const char **psrc,
 
     host->compr = DCC_COMPRESS_NONE;
     host->cpp_where = DCC_CPP_ON_CLIENT;
+    host->gcda_cache = 0;
+    host->bigmem = 0;
 #ifdef HAVE_GSSAPI
     host->authenticate = 0;
     host->auth_name = NULL;
+    host->auth_ticket = 0;
+#endif
+#ifdef HAVE_TLS
+    host->tls = 0;
 #endif
 
     while (p[0] == ',') {
@@ -262,6 +388,14 @@ static int dcc_parse_options(const char **psrc,
             rs_trace("got CPP option");
             host->cpp_where = DCC_CPP_ON_SERVER;
             p += 3;
+        } else if (str_startswith("gcda", p)) {
+            rs_trace("got profile cache option");
+            host->gcda_cache = 1;
+            p += 4;
+        } else if (str_startswith("bigmem", p)) {
+            rs_trace("got big memory option");
+            host->bigmem = 1;
+            p += 6;
 #ifdef HAVE_GSSAPI
         } else if (str_startswith("auth", p)) {
             rs_trace("got GSSAPI option");
@@ -278,6 +412,17 @@ static int dcc_parse_options(const char **psrc,
                              "lookup for GSS-API auth", host->auth_name);
                 }
             }
+        } else if (str_startswith("ticket", p)) {
+            rs_trace("got GSSAPI session ticket option");
+            host->authenticate = 1;
+            host->auth_ticket = 1;
+            p += 6;
+#endif
+#ifdef HAVE_TLS
+        } else if (str_startswith("tls", p)) {
+            rs_trace("got TLS option");
+            host->tls = 1;
+            p += 3;
 #endif
         } else {
             rs_log_error("unrecognized option in host specification: %s",
@@ -334,6 +479,13 @@ static int dcc_parse_ssh_host(struct dcc_hostdef *hostdef,
     if ((ret = dcc_parse_options(&token, hostdef)))
         return ret;
 
+#ifdef HAVE_TLS
+    if (hostdef->tls) {
+        rs_log_error("TLS can't be used over SSH in \"%s\"", token_start);
+        return EXIT_BAD_HOSTSPEC;
+    }
+#endif
+
     hostdef->mode = DCC_MODE_SSH;
     return 0;
 }
@@ -532,6 +684,13 @@ int dcc_parse_hosts(const char *where, const char *source_name,
         /* intercept keywords which are not actually hosts */
         if (!strncmp(token_start, "--randomize", 11)) {
             flag_randomize = 1;
+            dcc_host_randomize = 1;
+            where = token_start + token_len;
+            continue;
+        }
+
+        if (!strncmp(token_start, "--affinity", 10)) {
+            dcc_host_affinity = 1;
             where = token_start + token_len;
             continue;
         }
@@ -718,3 +877,13 @@ int dcc_free_hostdef(struct dcc_hostdef *host)
 
     return 0;
 }
+
+
+void dcc_free_hostlist(struct dcc_hostdef *list)
+{
+    while (list) {
+        struct dcc_hostdef *l = list;
+        list = list->next;
+        dcc_free_hostdef(l);
+    }
+}
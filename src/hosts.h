@@ -59,10 +59,23 @@ struct dcc_hostdef {
     /** Where are we doing preprocessing? */
     enum dcc_cpp_where cpp_where;
 
+    /** Send -fprofile-use profiles by hash, for the server's cache? */
+    int gcda_cache;
+
+    /** Can this host take the jobs that ran out of memory elsewhere? */
+    int bigmem;
+
 #ifdef HAVE_GSSAPI
     /* Are we authenticating with this host? */
     int authenticate;
     char * auth_name;
+    /* Do we resume authenticated sessions with tickets? */
+    int auth_ticket;
+#endif
+
+#ifdef HAVE_TLS
+    /* Is the connection to this host encrypted with TLS? */
+    int tls;
 #endif
 
     struct dcc_hostdef *next;
@@ -72,11 +85,25 @@ struct dcc_hostdef {
 extern struct dcc_hostdef *dcc_hostdef_local;
 extern struct dcc_hostdef *dcc_hostdef_local_cpp;
 
+/** True if the host list asked for --affinity scheduling. **/
+extern int dcc_host_affinity;
+
+/** True if the host list asked for --randomize. **/
+extern int dcc_host_randomize;
+
+/** True if the list given to dcc_set_hostlist() has no hosts in backoff. **/
+extern int dcc_hostlist_checked;
+
 /* hosts.c */
 int dcc_get_hostlist(struct dcc_hostdef **ret_list,
                      int *ret_nhosts);
+int dcc_get_hostlist_text(char **ret_text, char **ret_source);
+void dcc_set_hostlist(const struct dcc_hostdef *list, int checked);
+int dcc_copy_hostlist(const struct dcc_hostdef *list,
+                      struct dcc_hostdef **ret_list, int *ret_nhosts);
 
 int dcc_free_hostdef(struct dcc_hostdef *host);
+void dcc_free_hostlist(struct dcc_hostdef *list);
 
 int dcc_get_features_from_protover(enum dcc_protover protover,
                                    enum dcc_compress *compr,
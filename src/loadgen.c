@@ -0,0 +1,794 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/*
+ * loadgen.c:
+ * distcc-loadgen, a synthetic load for distccd.
+ *
+ * Each simulated client is a process that sends jobs to one distccd, one
+ * after the other, for as long as it is told to.  A job is an ordinary
+ * distcc request for distcc-stubcc, which uses the CPU, memory and output
+ * size chosen for it, so that no real compiler or source is needed.  The
+ * sizes are drawn from distributions given on the command line as
+ * "VALUE[:WEIGHT],...".
+ *
+ * Without --pump, a job sends one preprocessed file.  With it, a job
+ * sends a source file and some number of compressed headers laid out as
+ * the include server would, and the server runs the "compiler" on them.
+ *
+ * Each job is timed in four phases: connecting; sending the request;
+ * waiting for the answer, which is queueing plus compiling; and receiving
+ * the results.  Jobs that can't connect are "refused"; those the server
+ * drops before answering, for example because it is too busy, are
+ * "dropped".
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <ftw.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netdb.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "rpc.h"
+#include "bulk.h"
+#include "clinet.h"
+#include "include_server_if.h"
+#include "popt.h"
+
+const char *rs_program_name = "distcc-loadgen";
+
+struct lg_dist {
+    long *values;
+    int *weights;
+    int n, total;
+};
+
+enum lg_outcome {
+    LG_OK, LG_REFUSED, LG_DROPPED, LG_OOM, LG_FAILED, LG_ERROR,
+    LG_N_OUTCOMES
+};
+
+static const char *lg_outcome_names[LG_N_OUTCOMES] = {
+    "ok", "refused", "dropped", "oom", "failed", "error"
+};
+
+enum lg_phase {
+    LG_CONNECT, LG_SEND, LG_COMPILE, LG_RECEIVE, LG_TOTAL, LG_N_PHASES
+};
+
+static const char *lg_phase_names[LG_N_PHASES] = {
+    "connect", "send", "compile", "receive", "total"
+};
+
+/* What one job did, as sent back from a client to the parent. */
+struct lg_job {
+    float phase[LG_N_PHASES];   /* seconds */
+    int outcome;
+};
+
+/* Options */
+static const char *arg_host = "127.0.0.1";
+static int arg_port = DISTCC_DEFAULT_PORT;
+static int arg_clients = 4;
+static int arg_duration = 10;
+static int arg_jobs = 0;
+static int arg_think = 0;
+static int arg_fail_rate = 0;
+static int arg_seed = 1;
+static const char *arg_compiler = "distcc-stubcc";
+static const char *arg_compress = "lzo";
+static const char *arg_sizes = "64";
+static const char *arg_cpu = "100";
+static const char *arg_mem = "16";
+static const char *arg_out = "32";
+static const char *arg_pump = NULL;
+static int opt_json = 0;
+static int opt_verbose = 0;
+
+static struct lg_dist lg_sizes, lg_cpu, lg_mem, lg_out, lg_pump;
+
+static struct sockaddr_storage lg_addr;
+static socklen_t lg_addr_len;
+static enum dcc_protover lg_protover;
+static enum dcc_compress lg_compr;
+
+static char *lg_work_dir;
+static char **lg_headers;       /* with --pump, the most any job sends */
+static long lg_max_headers;
+
+static const struct poptOption lg_options[] = {
+    { "clients", 'c',     POPT_ARG_INT, &arg_clients, 0, 0, 0 },
+    { "compiler", 0,      POPT_ARG_STRING, &arg_compiler, 0, 0, 0 },
+    { "compress", 0,      POPT_ARG_STRING, &arg_compress, 0, 0, 0 },
+    { "cpu", 0,           POPT_ARG_STRING, &arg_cpu, 0, 0, 0 },
+    { "duration", 't',    POPT_ARG_INT, &arg_duration, 0, 0, 0 },
+    { "fail-rate", 0,     POPT_ARG_INT, &arg_fail_rate, 0, 0, 0 },
+    { "help", 0,          POPT_ARG_NONE, 0, '?', 0, 0 },
+    { "host", 'H',        POPT_ARG_STRING, &arg_host, 0, 0, 0 },
+    { "jobs", 'n',        POPT_ARG_INT, &arg_jobs, 0, 0, 0 },
+    { "json", 0,          POPT_ARG_NONE, &opt_json, 0, 0, 0 },
+    { "mem", 0,           POPT_ARG_STRING, &arg_mem, 0, 0, 0 },
+    { "out", 0,           POPT_ARG_STRING, &arg_out, 0, 0, 0 },
+    { "port", 'p',        POPT_ARG_INT, &arg_port, 0, 0, 0 },
+    { "pump", 0,          POPT_ARG_STRING, &arg_pump, 0, 0, 0 },
+    { "seed", 0,          POPT_ARG_INT, &arg_seed, 0, 0, 0 },
+    { "sizes", 0,         POPT_ARG_STRING, &arg_sizes, 0, 0, 0 },
+    { "think", 0,         POPT_ARG_INT, &arg_think, 0, 0, 0 },
+    { "verbose", 'v',     POPT_ARG_NONE, &opt_verbose, 0, 0, 0 },
+    { "version", 0,       POPT_ARG_NONE, 0, 'V', 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0 }
+};
+
+
+static void lg_show_usage(void)
+{
+    dcc_show_version("distcc-loadgen");
+    printf(
+"Usage:\n"
+"   distcc-loadgen [OPTIONS]\n"
+"\n"
+"Options:\n"
+"    --help                     explain usage and exit\n"
+"    --version                  show version and exit\n"
+"    -H, --host HOST            distccd to load (default 127.0.0.1)\n"
+"    -p, --port PORT            its port (default %d)\n"
+"    -c, --clients N            simulated clients (default 4)\n"
+"    -t, --duration SECONDS     how long to run (default 10)\n"
+"    -n, --jobs N               stop each client after N jobs\n"
+"    --think MS                 pause between a client's jobs\n"
+"    --compress none|lzo        compression to ask for (default lzo)\n"
+"    --compiler NAME            compiler to run (default distcc-stubcc)\n"
+"    --sizes DIST               size of each job's source, in kB (64)\n"
+"    --pump DIST                send this many headers with each job,\n"
+"                               as pump mode does\n"
+"    --cpu DIST                 CPU time of each compile, in ms (100)\n"
+"    --mem DIST                 memory of each compile, in MB (16)\n"
+"    --out DIST                 size of each object file, in kB (32)\n"
+"    --fail-rate PERCENT        make this many compiles fail\n"
+"    --seed N                   seed for choosing job sizes\n"
+"    --json                     print the results as JSON\n"
+"    -v, --verbose              show the errors clients see\n"
+"\n"
+"A DIST is a list of VALUE[:WEIGHT], for example \"16:3,256:1\" for\n"
+"three 16s to every 256.\n"
+"\n"
+"Run distccd with distcc-stubcc on its PATH, and either list it in the\n"
+"masquerade directory or give distccd --enable-tcp-insecure.\n",
+           DISTCC_DEFAULT_PORT);
+}
+
+
+/* Parse "VALUE[:WEIGHT],..." into @p d. */
+static int lg_parse_dist(const char *name, const char *spec,
+                         struct lg_dist *d)
+{
+    const char *p = spec;
+    char *end;
+    long value, weight;
+
+    d->n = d->total = 0;
+    d->values = malloc((strlen(spec) / 2 + 1) * sizeof *d->values);
+    d->weights = malloc((strlen(spec) / 2 + 1) * sizeof *d->weights);
+    if (!d->values || !d->weights)
+        return EXIT_OUT_OF_MEMORY;
+
+    while (*p) {
+        value = strtol(p, &end, 10);
+        weight = 1;
+        if (end == p || value < 0)
+            goto bad;
+        if (*end == ':') {
+            p = end + 1;
+            weight = strtol(p, &end, 10);
+            if (end == p || weight < 1)
+                goto bad;
+        }
+        if (*end != ',' && *end != '\0')
+            goto bad;
+        d->values[d->n] = value;
+        d->weights[d->n] = (int) weight;
+        d->total += (int) weight;
+        d->n++;
+        p = *end ? end + 1 : end;
+    }
+    if (d->n > 0)
+        return 0;
+
+  bad:
+    rs_log_error("--%s: can't parse \"%s\"; expected VALUE[:WEIGHT],...",
+                 name, spec);
+    return EXIT_BAD_ARGUMENTS;
+}
+
+
+static long lg_dist_max(const struct lg_dist *d)
+{
+    long max = 0;
+    int i;
+
+    for (i = 0; i < d->n; i++)
+        if (d->values[i] > max)
+            max = d->values[i];
+    return max;
+}
+
+
+static unsigned lg_random(unsigned *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 16) & 0x7fff;
+}
+
+
+static long lg_choose(const struct lg_dist *d, unsigned *state)
+{
+    int r = (int) (((long) lg_random(state) << 15 | lg_random(state))
+                   % d->total);
+    int i;
+
+    for (i = 0; r >= d->weights[i]; i++)
+        r -= d->weights[i];
+    return d->values[i];
+}
+
+
+static double lg_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static int lg_parse_options(int argc, const char **argv)
+{
+    poptContext po;
+    int po_err, ret = 0;
+
+    po = poptGetContext("distcc-loadgen", argc, argv, lg_options, 0);
+    while ((po_err = poptGetNextOpt(po)) != -1) {
+        switch (po_err) {
+        case '?':
+            lg_show_usage();
+            exit(0);
+        case 'V':
+            dcc_show_version("distcc-loadgen");
+            exit(0);
+        default:
+            rs_log_error("%s: %s", poptBadOption(po, POPT_BADOPTION_NOALIAS),
+                         poptStrerror(po_err));
+            ret = EXIT_BAD_ARGUMENTS;
+            goto out;
+        }
+    }
+    if (poptGetArg(po)) {
+        rs_log_error("distcc-loadgen takes no arguments");
+        ret = EXIT_BAD_ARGUMENTS;
+        goto out;
+    }
+
+    if (arg_clients < 1 || arg_duration < 1 || arg_jobs < 0
+        || arg_think < 0 || arg_fail_rate < 0 || arg_fail_rate > 100) {
+        rs_log_error("--clients and --duration must be at least 1, and "
+                     "--fail-rate a percentage");
+        ret = EXIT_BAD_ARGUMENTS;
+    } else if (strcmp(arg_compress, "none") == 0) {
+        lg_compr = DCC_COMPRESS_NONE;
+        lg_protover = DCC_VER_1;
+    } else if (strcmp(arg_compress, "lzo") == 0) {
+        lg_compr = DCC_COMPRESS_LZO1X;
+        lg_protover = DCC_VER_2;
+    } else {
+        rs_log_error("--compress must be none or lzo");
+        ret = EXIT_BAD_ARGUMENTS;
+    }
+    if (ret == 0 && arg_pump) {
+        if (lg_compr != DCC_COMPRESS_LZO1X) {
+            rs_log_error("--pump needs --compress lzo");
+            ret = EXIT_BAD_ARGUMENTS;
+        }
+        lg_protover = DCC_VER_3;
+    }
+
+    if (ret == 0)
+        ret = lg_parse_dist("sizes", arg_sizes, &lg_sizes);
+    if (ret == 0)
+        ret = lg_parse_dist("cpu", arg_cpu, &lg_cpu);
+    if (ret == 0)
+        ret = lg_parse_dist("mem", arg_mem, &lg_mem);
+    if (ret == 0)
+        ret = lg_parse_dist("out", arg_out, &lg_out);
+    if (ret == 0 && arg_pump)
+        ret = lg_parse_dist("pump", arg_pump, &lg_pump);
+
+  out:
+    poptFreeContext(po);
+    return ret;
+}
+
+
+static int lg_resolve(void)
+{
+    struct addrinfo hints, *ai;
+    char port[16];
+    int err;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof port, "%d", arg_port);
+    if ((err = getaddrinfo(arg_host, port, &hints, &ai)) != 0) {
+        rs_log_error("can't resolve %s: %s", arg_host, gai_strerror(err));
+        return EXIT_CONNECT_FAILED;
+    }
+    memcpy(&lg_addr, ai->ai_addr, ai->ai_addrlen);
+    lg_addr_len = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    return 0;
+}
+
+
+/* Fill @p buf with something shaped like preprocessed C. */
+static void lg_fill_source(char *buf, size_t len, unsigned seed)
+{
+    char line[96];
+    size_t done = 0;
+    unsigned i;
+    int n;
+
+    for (i = seed; done < len; i++) {
+        n = snprintf(line, sizeof line,
+                     "static const int table_%u[] = { %u, %u, %u };\n",
+                     i, i * 7 % 1000, i * 13 % 1000, i * 31 % 1000);
+        if ((size_t) n > len - done)
+            n = (int) (len - done);
+        memcpy(buf + done, line, n);
+        done += n;
+    }
+}
+
+
+/*
+ * Write @p len bytes of source to @p path, compressed if @p compress, making
+ * the directories it needs.
+ */
+static int lg_write_source(const char *path, size_t len, unsigned seed,
+                           int compress)
+{
+    char *buf, *out = NULL, *copy, *p;
+    size_t out_len;
+    int fd, ret;
+
+    if (!(copy = strdup(path)))
+        return EXIT_OUT_OF_MEMORY;
+    for (p = copy + 1; (p = strchr(p, '/')) != NULL; p++) {
+        *p = '\0';
+        if (mkdir(copy, 0777) == -1 && errno != EEXIST) {
+            rs_log_error("mkdir %s failed: %s", copy, strerror(errno));
+            free(copy);
+            return EXIT_IO_ERROR;
+        }
+        *p = '/';
+    }
+    free(copy);
+
+    if (!(buf = malloc(len + 1)))
+        return EXIT_OUT_OF_MEMORY;
+    lg_fill_source(buf, len, seed);
+    out = buf;
+    out_len = len;
+    if (compress && (ret = dcc_compress_lzo1x_alloc(buf, len, &out,
+                                                    &out_len))) {
+        free(buf);
+        return ret;
+    }
+
+    if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1) {
+        rs_log_error("failed to create %s: %s", path, strerror(errno));
+        ret = EXIT_IO_ERROR;
+    } else {
+        ret = dcc_writex(fd, out, out_len);
+        close(fd);
+    }
+    if (out != buf)
+        free(out);
+    free(buf);
+    return ret;
+}
+
+
+static char *lg_source_name(long kb)
+{
+    char *path = NULL;
+
+    if (asprintf(&path, arg_pump ? "%s/mirror/src/job-%ld.c.lzo"
+                 : "%s/src/job-%ld.i", lg_work_dir, kb) == -1)
+        return NULL;
+    return path;
+}
+
+
+/*
+ * Make the files the jobs send: a source of each size in --sizes and,
+ * with --pump, as many headers as any job sends.  They are shared by all
+ * the clients.
+ */
+static int lg_make_files(void)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    char *path;
+    long i;
+    int ret;
+
+    if (asprintf(&lg_work_dir, "%s/distcc-loadgen.XXXXXX",
+                 tmpdir ? tmpdir : "/tmp") == -1)
+        return EXIT_OUT_OF_MEMORY;
+    if (!mkdtemp(lg_work_dir)) {
+        rs_log_error("mkdtemp %s failed: %s", lg_work_dir, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    for (i = 0; i < lg_sizes.n; i++) {
+        if (!(path = lg_source_name(lg_sizes.values[i])))
+            return EXIT_OUT_OF_MEMORY;
+        ret = lg_write_source(path, (size_t) lg_sizes.values[i] << 10,
+                              (unsigned) i, arg_pump != NULL);
+        free(path);
+        if (ret)
+            return ret;
+    }
+
+    if (!arg_pump)
+        return 0;
+    lg_max_headers = lg_dist_max(&lg_pump);
+    if (!(lg_headers = calloc(lg_max_headers + 2, sizeof *lg_headers)))
+        return EXIT_OUT_OF_MEMORY;
+    for (i = 0; i < lg_max_headers; i++) {
+        /* The job's source goes in front of its headers. */
+        if (asprintf(&lg_headers[i + 1], "%s/mirror/include/dir%02ld/"
+                     "h%04ld.h.lzo", lg_work_dir, i % 50, i) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        if ((ret = lg_write_source(lg_headers[i + 1],
+                                   512 + (i * 2654435761u) % 7680,
+                                   (unsigned) i, 1)))
+            return ret;
+    }
+    return 0;
+}
+
+
+static int lg_remove_one(const char *path, const struct stat *st, int flag,
+                         struct FTW *ftw)
+{
+    (void) st; (void) flag; (void) ftw;
+    remove(path);
+    return 0;
+}
+
+
+/* Send one job and read its results, timing each phase into @p job. */
+static void lg_run_job(struct lg_job *job, unsigned *rand_state,
+                       int null_fd)
+{
+    char cpu[32], mem[32], out[32], *source, *input = NULL;
+    const char *argv[12];
+    char *after_last = NULL;
+    long n_headers = 0;
+    unsigned len, o_len;
+    double start, t;
+    int fd, ret, status, i = 0;
+
+    snprintf(cpu, sizeof cpu, "-DSTUB_CPU_MS=%ld",
+             lg_choose(&lg_cpu, rand_state));
+    snprintf(mem, sizeof mem, "-DSTUB_MEM_MB=%ld",
+             lg_choose(&lg_mem, rand_state));
+    snprintf(out, sizeof out, "-DSTUB_OUT_KB=%ld",
+             lg_choose(&lg_out, rand_state));
+    if (!(source = lg_source_name(lg_choose(&lg_sizes, rand_state))))
+        _exit(EXIT_OUT_OF_MEMORY);
+    if (arg_pump) {
+        n_headers = lg_choose(&lg_pump, rand_state);
+        if (dcc_get_original_fname(source, &input))
+            _exit(EXIT_OUT_OF_MEMORY);
+        /* Cut the list off after this job's headers. */
+        lg_headers[0] = source;
+        after_last = lg_headers[n_headers + 1];
+        lg_headers[n_headers + 1] = NULL;
+    }
+
+    argv[i++] = arg_compiler;
+    argv[i++] = cpu;
+    argv[i++] = mem;
+    argv[i++] = out;
+    if (arg_fail_rate && (int) (lg_random(rand_state) % 100) < arg_fail_rate)
+        argv[i++] = "-DSTUB_FAIL=1";
+    argv[i++] = "-c";
+    argv[i++] = input ? input : "job.c";
+    argv[i++] = "-o";
+    argv[i++] = "job.o";
+    argv[i] = NULL;
+
+    memset(job, 0, sizeof *job);
+    start = t = lg_now();
+
+    if (dcc_connect_by_addr((struct sockaddr *) &lg_addr, lg_addr_len,
+                            &fd)) {
+        job->outcome = LG_REFUSED;
+        goto out;
+    }
+    job->phase[LG_CONNECT] = (float) (lg_now() - t);
+    t = lg_now();
+
+    tcp_cork_sock(fd, 1);
+    if ((ret = dcc_x_req_header(fd, lg_protover))
+        || (arg_pump && (ret = dcc_x_cwd(fd)))
+        || (ret = dcc_x_argv(fd, "ARGC", "ARGV", (char **) argv)))
+        goto dropped;
+    if (arg_pump)
+        ret = dcc_x_many_files(fd, (unsigned) n_headers + 1, lg_headers);
+    else
+        ret = dcc_x_file(fd, source, "DOTI", lg_compr, NULL);
+    if (ret)
+        goto dropped;
+    tcp_cork_sock(fd, 0);
+    job->phase[LG_SEND] = (float) (lg_now() - t);
+    t = lg_now();
+
+    if ((ret = dcc_r_result_header(fd, lg_protover))) {
+        job->outcome = (ret == EXIT_JOB_OOM) ? LG_OOM : LG_DROPPED;
+        goto close;
+    }
+    job->phase[LG_COMPILE] = (float) (lg_now() - t);
+    t = lg_now();
+
+    job->outcome = LG_ERROR;
+    if (dcc_r_cc_status(fd, &status)
+        || dcc_r_token_int(fd, "SERR", &len)
+        || dcc_r_file(fd, "stderr", len, lg_compr)
+        || dcc_r_token_int(fd, "SOUT", &len)
+        || dcc_r_bulk(null_fd, fd, len, lg_compr)
+        || dcc_r_token_int(fd, "DOTO", &o_len))
+        goto close;
+    if (status == 0) {
+        if (dcc_r_file(fd, "job.o", o_len, lg_compr))
+            goto close;
+        if (arg_pump && (dcc_r_token_int(fd, "DOTD", &len)
+                         || dcc_r_file(fd, "job.d", len, lg_compr)))
+            goto close;
+    }
+    job->phase[LG_RECEIVE] = (float) (lg_now() - t);
+    job->outcome = status ? LG_FAILED : LG_OK;
+    goto close;
+
+  dropped:
+    job->outcome = LG_DROPPED;
+  close:
+    dcc_close(fd);
+  out:
+    job->phase[LG_TOTAL] = (float) (lg_now() - start);
+    if (arg_pump)
+        lg_headers[n_headers + 1] = after_last;
+    free(source);
+    free(input);
+}
+
+
+/*
+ * One simulated client: run jobs until the time or --jobs is up, then
+ * write them down @p report_fd, preceded by their number.
+ */
+static void lg_client(int n, double deadline, int report_fd)
+{
+    struct lg_job *jobs = NULL;
+    long n_jobs = 0, size = 0;
+    unsigned rand_state = (unsigned) arg_seed * 7919u + (unsigned) n;
+    char *dir;
+    int null_fd;
+
+    signal(SIGPIPE, SIG_IGN);
+    rs_trace_set_level(opt_verbose ? RS_LOG_WARNING : RS_LOG_CRIT);
+
+    if (asprintf(&dir, "%s/client-%d", lg_work_dir, n) == -1
+        || mkdir(dir, 0777) == -1 || chdir(dir) == -1
+        || (null_fd = open("/dev/null", O_WRONLY)) == -1) {
+        rs_log_crit("failed to set up client %d: %s", n, strerror(errno));
+        _exit(EXIT_IO_ERROR);
+    }
+
+    while (lg_now() < deadline && (!arg_jobs || n_jobs < arg_jobs)) {
+        if (n_jobs == size) {
+            size = size ? size * 2 : 256;
+            if (!(jobs = realloc(jobs, size * sizeof *jobs)))
+                _exit(EXIT_OUT_OF_MEMORY);
+        }
+        lg_run_job(&jobs[n_jobs], &rand_state, null_fd);
+        /* Don't spin on a server that isn't there. */
+        if (jobs[n_jobs].outcome == LG_REFUSED && arg_think < 10)
+            usleep(10000);
+        n_jobs++;
+        if (arg_think)
+            usleep(arg_think * 1000);
+    }
+
+    if (dcc_writex(report_fd, &n_jobs, sizeof n_jobs)
+        || dcc_writex(report_fd, jobs, n_jobs * sizeof *jobs))
+        _exit(EXIT_IO_ERROR);
+    _exit(0);
+}
+
+
+static int lg_cmp_float(const void *a, const void *b)
+{
+    float x = *(const float *) a, y = *(const float *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* The @p q quantile of the sorted @p v, in milliseconds. */
+static double lg_quantile(const float *v, long n, double q)
+{
+    long i = (long) (q * n);
+
+    if (n == 0)
+        return 0;
+    return 1000.0 * v[i < n ? i : n - 1];
+}
+
+
+static void lg_report(struct lg_job *jobs, long n_jobs, double elapsed)
+{
+    static const double quantiles[] = { 0.5, 0.99, 0.999, 1.0 };
+    static const char *quantile_names[] = { "p50", "p99", "p999", "max" };
+    long counts[LG_N_OUTCOMES] = { 0 };
+    long i, n_ok, rejected;
+    float *v;
+    int p, q;
+
+    for (i = 0; i < n_jobs; i++)
+        counts[jobs[i].outcome]++;
+    n_ok = counts[LG_OK];
+    rejected = counts[LG_REFUSED] + counts[LG_DROPPED];
+    if (!(v = malloc((n_ok + 1) * sizeof *v)))
+        exit(EXIT_OUT_OF_MEMORY);
+
+    if (opt_json) {
+        printf("{\"clients\": %d, \"seconds\": %.3f, \"jobs\": %ld, "
+               "\"outcomes\": {", arg_clients, elapsed, n_jobs);
+        for (i = 0; i < LG_N_OUTCOMES; i++)
+            printf("%s\"%s\": %ld", i ? ", " : "", lg_outcome_names[i],
+                   counts[i]);
+        printf("}, \"accepted_per_sec\": %.2f, \"rejection_rate\": %.4f, "
+               "\"latency_ms\": {", n_ok / elapsed,
+               n_jobs ? (double) rejected / n_jobs : 0.0);
+    } else {
+        printf("%d clients, %.1fs, %ld jobs:", arg_clients, elapsed, n_jobs);
+        for (i = 0; i < LG_N_OUTCOMES; i++)
+            printf(" %ld %s%s", counts[i], lg_outcome_names[i],
+                   i < LG_N_OUTCOMES - 1 ? "," : "\n");
+        printf("accepted %.2f jobs/s, rejected %.2f%%\n\n",
+               n_ok / elapsed, n_jobs ? 100.0 * rejected / n_jobs : 0.0);
+        printf("%-10s %10s %10s %10s %10s\n", "ms", "p50", "p99", "p99.9",
+               "max");
+    }
+
+    /* Latencies are of the jobs that worked. */
+    for (p = 0; p < LG_N_PHASES; p++) {
+        long n = 0;
+        for (i = 0; i < n_jobs; i++)
+            if (jobs[i].outcome == LG_OK)
+                v[n++] = jobs[i].phase[p];
+        qsort(v, n, sizeof *v, lg_cmp_float);
+        if (opt_json)
+            printf("%s\"%s\": {", p ? ", " : "", lg_phase_names[p]);
+        else
+            printf("%-10s", lg_phase_names[p]);
+        for (q = 0; q < 4; q++) {
+            if (opt_json)
+                printf("%s\"%s\": %.3f", q ? ", " : "", quantile_names[q],
+                       lg_quantile(v, n, quantiles[q]));
+            else
+                printf(" %10.2f", lg_quantile(v, n, quantiles[q]));
+        }
+        printf(opt_json ? "}" : "\n");
+    }
+    if (opt_json)
+        printf("}}\n");
+    free(v);
+}
+
+
+int main(int argc, char **argv)
+{
+    struct lg_job *jobs = NULL;
+    long n_jobs = 0, n;
+    double start, deadline;
+    int *report_fds, fds[2], i, status, ret;
+    pid_t *pids;
+
+    rs_trace_set_level(RS_LOG_WARNING);
+    rs_add_logger(rs_logger_file, RS_LOG_DEBUG, NULL, STDERR_FILENO);
+
+    if ((ret = lg_parse_options(argc, (const char **) argv))
+        || (ret = lg_resolve())
+        || (ret = lg_make_files()))
+        goto out;
+
+    report_fds = calloc(arg_clients, sizeof *report_fds);
+    pids = calloc(arg_clients, sizeof *pids);
+    if (!report_fds || !pids) {
+        ret = EXIT_OUT_OF_MEMORY;
+        goto out;
+    }
+
+    fflush(stdout);
+    start = lg_now();
+    deadline = start + arg_duration;
+    for (i = 0; i < arg_clients; i++) {
+        if (pipe(fds) == -1 || (pids[i] = fork()) == -1) {
+            rs_log_error("failed to start client: %s", strerror(errno));
+            ret = EXIT_DISTCC_FAILED;
+            deadline = 0;
+            arg_clients = i;
+            break;
+        }
+        if (pids[i] == 0) {
+            close(fds[0]);
+            lg_client(i, deadline, fds[1]);
+        }
+        close(fds[1]);
+        report_fds[i] = fds[0];
+    }
+
+    for (i = 0; i < arg_clients; i++) {
+        if (dcc_readx(report_fds[i], &n, sizeof n) == 0
+            && (jobs = realloc(jobs, (n_jobs + n + 1) * sizeof *jobs))
+            && dcc_readx(report_fds[i], jobs + n_jobs, n * sizeof *jobs) == 0)
+            n_jobs += n;
+        else
+            rs_log_error("lost the results of client %d", i);
+        close(report_fds[i]);
+        waitpid(pids[i], &status, 0);
+    }
+
+    if (ret == 0)
+        lg_report(jobs, n_jobs, lg_now() - start);
+
+  out:
+    if (lg_work_dir)
+        nftw(lg_work_dir, lg_remove_one, 16, FTW_DEPTH|FTW_PHYS);
+    return ret;
+}
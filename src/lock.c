@@ -70,6 +70,7 @@
 #include "lock.h"
 #include "exitcode.h"
 #include "snprintf.h"
+#include "scheduler.h"
 
 /* Note that we use the _same_ lock file for
  * dcc_hostdef_local and dcc_hostdef_local_cpp,
@@ -101,9 +102,15 @@ struct dcc_hostdef _dcc_local = {
     DCC_VER_1,                  /* protocol (ignored) */
     DCC_COMPRESS_NONE,          /* compression (ignored) */
     DCC_CPP_ON_CLIENT,          /* where to cpp (ignored) */
+    0,                          /* profile cache (ignored) */
+    0,                          /* big memory (ignored) */
 #ifdef HAVE_GSSAPI
     0,                          /* Authentication? */
     NULL,                       /* Authentication name */
+    0,                          /* Session tickets? */
+#endif
+#ifdef HAVE_TLS
+    0,                          /* TLS? */
 #endif
     NULL
 };
@@ -122,9 +129,15 @@ struct dcc_hostdef _dcc_local_cpp = {
     DCC_VER_1,                  /* protocol (ignored) */
     DCC_COMPRESS_NONE,          /* compression (ignored) */
     DCC_CPP_ON_CLIENT,          /* where to cpp (ignored) */
+    0,                          /* profile cache (ignored) */
+    0,                          /* big memory (ignored) */
 #ifdef HAVE_GSSAPI
     0,                          /* Authentication? */
     NULL,                       /* Authentication name */
+    0,                          /* Session tickets? */
+#endif
+#ifdef HAVE_TLS
+    0,                          /* TLS? */
 #endif
     NULL
 };
@@ -202,6 +215,8 @@ static int sys_lock(int fd, int block)
 
 int dcc_unlock(int lock_fd)
 {
+    dcc_sched_unlocked(lock_fd);
+
 #if defined(F_SETLK)
     struct flock lockparam;
 
@@ -39,6 +39,12 @@
  * Or, in your Makefile, add the lines
  *   export DISTCC_HOSTS = $(shell lsdistcc)
  *
+ * With -a, every host is probed for its connect latency, its load and job
+ * limit (from the --stats port, if -s is given) and the time it takes to
+ * run a test compile (if -p is given).  Instead of a list of names, a single
+ * host list is printed, best host first, with a /LIMIT on every entry:
+ *   DISTCC_HOSTS=`lsdistcc -a -s3633 -pgcc`
+ *
  * Changelog:
  *
  * Wed Jun 20 2007 - Manos Renieris, Google
@@ -112,6 +118,9 @@ enum status_e { STATE_LOOKUP = 0,
                 STATE_READ_DONEPKT,
                 STATE_READ_STATPKT,
                 STATE_READ_REST,
+                STATE_STATS_CONNECT,
+                STATE_STATS_CONNECTING,
+                STATE_STATS_READ,
                 STATE_CLOSE,
                 STATE_DONE};
 
@@ -126,6 +135,17 @@ struct state_s {
     int ntries;
     int fd;
     int up;     /* default is 0, set to 1 on success */
+    int closed; /* set once the server has been probed, up or not */
+
+    /* Measurements for -a; -1 where unknown. */
+    struct timeval sent;
+    int rtt_ms;
+    int compile_ms;
+    int max_kids;
+    int cur_load;
+    int stats_done;
+    char statsline[128];
+    int statslinelen;
 };
 typedef struct state_s state_t;
 
@@ -142,8 +162,12 @@ typedef struct state_s state_t;
 #define DEFAULT_DNSGAP 0            /* number of missing hosts in DNS before
                                        we stop looking */
 #define DEFAULT_COMPILER "none"
+#define DEFAULT_STATS_PORT 0        /* distccd --stats port, 0 for none */
+#define DEFAULT_WORK 1              /* functions in the test compile */
+#define DEFAULT_SLOTS 4             /* job limit if the server won't say */
+#define MAX_WORK 100                /* keeps the query within one write() */
 
-char canned_query[1000];
+char *canned_query;
 size_t canned_query_len = 0;
 
 int opt_latency = 0;
@@ -160,6 +184,9 @@ int opt_verbose = 0;
 int opt_domain = 0;
 int opt_match = 0;
 int opt_bang_down = 0;
+int opt_rank = 0;
+int opt_stats_port = DEFAULT_STATS_PORT;
+int opt_work = DEFAULT_WORK;
 const char *opt_compiler = NULL;
 
 
@@ -177,6 +204,7 @@ const char *protocol_suffix[] = { NULL, /* to make the rest 1-based */
 int fd2state[MAXHOSTS+1000];    /* kludge - fragile */
 int nok;
 int ndone;
+volatile sig_atomic_t timed_out;
 
 /* globals used by other compilation units */
 const char *rs_program_name = "lsdistcc";
@@ -192,9 +220,11 @@ int detect_distcc_servers(const char **argv, int argc, int opti,
                           int overlap, int dnsgap);
 void server_read_packet_header(state_t *sp);
 void server_handle_event(state_t *sp);
+void print_host(const state_t *sp, int slots);
+void print_ranked_hosts(state_t states[], int n);
 
 void usage(void) {
-        printf("Usage: lsdistcc [-tTIMEOUT] [-mBITS] [-nvd] [format]\n\
+        printf("Usage: lsdistcc [-tTIMEOUT] [-mBITS] [-nvdax] [format]\n\
 Uses 'for i=1... sprintf(format, i)' to construct names of servers,\n\
 stops after %d seconds or at second server that doesn't resolve,\n\
 prints the names of all such servers listening on distcc's port.\n\
@@ -218,12 +248,17 @@ Options:\n\
 -rPORT     Port to connect to [%d]\n\
 -PPROTOCOL Protocol version to use (1-3) [%d]\n\
 -pCOMPILER Name of compiler to use [%s]\n\
+-a       Print one host list, best host first, with a /LIMIT for each\n\
+-sPORT     Port of the distccd --stats server to ask for load [%d]\n\
+           (0 to inhibit)\n\
+-wWORK     Number of functions in the test compile, 1-%d [%d]\n\
 -d       Append DNS domain name to format\n\
 -v       Verbose\n\
 \n\
 Example:\n\
 lsdistcc -l -p$COMPILER\n\
 lsdistcc -p$COMPILER hosta somehost hostx hosty\n\
+lsdistcc -a -s3633 -w20 -p$COMPILER\n\
 ", DEFAULT_BIGTIMEOUT,
    DEFAULT_FORMAT,
    DEFAULT_BIGTIMEOUT,
@@ -234,7 +269,10 @@ lsdistcc -p$COMPILER hosta somehost hostx hosty\n\
    DEFAULT_DNSGAP,
    DEFAULT_PORT,
    DEFAULT_PROTOCOL,
-   DEFAULT_COMPILER);
+   DEFAULT_COMPILER,
+   DEFAULT_STATS_PORT,
+   MAX_WORK,
+   DEFAULT_WORK);
         exit(1);
 }
 
@@ -277,11 +315,17 @@ main()
 #endif
 
 
-/* On timeout, silently terminate program  */
+/* On timeout, silently terminate program.  With -a, stop probing instead,
+ * so that the hosts measured so far can still be ranked and printed. */
 void timeout_handler(int x)
 {
     (void) x;
 
+    if (opt_rank) {
+        timed_out = 1;
+        return;
+    }
+
     if (opt_verbose > 0)
         fprintf(stderr, "Timeout!\n");
 
@@ -289,12 +333,38 @@ void timeout_handler(int x)
     exit(0);
 }
 
+/* Build the test compile.  With -w, the program gets WORK functions, each
+ * with a loop in it, so that the time a server takes to compile it says
+ * something about that server and not only about process startup. */
 static void generate_query(void)
 {
-    const char* program = "int foo(){return 0;}";
-    unsigned char lzod_program[1000];
+    char *program;
+    size_t program_size;
+    unsigned char *lzod_program;
     unsigned char lzo_work_mem[LZO1X_1_MEM_COMPRESS];
     lzo_uint lzod_program_len;
+    int i;
+
+    if (opt_work <= 1) {
+        program = strdup("int foo(){return 0;}");
+    } else {
+        program_size = (size_t) opt_work * 100 + 1;
+        program = malloc(program_size);
+        if (program) {
+            program[0] = '\0';
+            for (i = 0; i < opt_work; i++)
+                sprintf(program + strlen(program),
+                        "int foo%d(int n){int i,s=0;"
+                        "for(i=0;i<n;i++)s+=i*%d;return s;}\n", i, i);
+        }
+    }
+    lzod_program = malloc(strlen(program ? program : "") * 2 + 64);
+    canned_query = malloc(200 + strlen(opt_compiler) +
+                          strlen(program ? program : "") * 2 + 64);
+    if (!program || !lzod_program || !canned_query) {
+        fprintf(stderr, "lsdistcc: out of memory\n");
+        exit(1);
+    }
 
     lzo1x_1_compress((const unsigned char *)program, strlen(program),
                      lzod_program, &lzod_program_len,
@@ -368,6 +438,98 @@ static void generate_query(void)
         break;
       }
     }
+    free(program);
+    free(lzod_program);
+}
+
+/* Note one line of a --stats reply. */
+static void server_parse_stats_line(state_t *sp, const char *line)
+{
+    int val;
+
+    if (sscanf(line, "dcc_max_kids %d", &val) == 1)
+        sp->max_kids = val;
+    else if (sscanf(line, "dcc_current_load %d", &val) == 1)
+        sp->cur_load = val;
+}
+
+/* Read what is available of a --stats reply, one line at a time.  Only the
+ * short numeric lines are of interest, so longer ones are dropped. */
+static void server_read_stats(state_t *sp)
+{
+    char buf[512];
+    int nread;
+    int i;
+
+    nread = read(sp->fd, buf, sizeof buf);
+    if (nread == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (nread <= 0) {
+        sp->stats_done = 1;
+        sp->status = STATE_CLOSE;
+        return;
+    }
+    for (i = 0; i < nread; i++) {
+        if (buf[i] == '\n') {
+            if (sp->statslinelen >= 0) {
+                sp->statsline[sp->statslinelen] = '\0';
+                server_parse_stats_line(sp, sp->statsline);
+            }
+            sp->statslinelen = 0;
+        } else if (sp->statslinelen >= 0) {
+            if (sp->statslinelen < (int) sizeof sp->statsline - 1)
+                sp->statsline[sp->statslinelen++] = buf[i];
+            else
+                sp->statslinelen = -1;  /* skip to end of line */
+        }
+    }
+}
+
+/* Milliseconds from @p start to now. */
+static int ms_since(const struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, 0);
+    return (now.tv_usec - start->tv_usec) / 1000
+        + 1000 * (now.tv_sec - start->tv_sec);
+}
+
+/* Start a nonblocking connect to @p port on the server.
+ * Returns 0 if the connect is under way. */
+static int server_start_connect(state_t *sp, int port)
+{
+    struct sockaddr_in sa;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    memcpy(&sa.sin_addr, sp->res.addr, 4);
+
+    if ((sp->fd = socket(sa.sin_family, SOCK_STREAM, 0)) == -1) {
+        fprintf(stderr, "failed to create socket: %s", strerror(errno));
+        return -1;
+    }
+    dcc_set_nonblocking(sp->fd);
+    if (connect(sp->fd, (struct sockaddr *)&sa, sizeof(sa))
+        && errno != EINPROGRESS) {
+        if (opt_verbose > 0)
+            fprintf(stderr, "failed to connect socket: %s",
+            strerror(errno));
+        close(sp->fd);
+        sp->fd = -1;
+        return -1;
+    }
+    fd2state[sp->fd] = sp->res.id;
+    return 0;
+}
+
+static void set_deadline(state_t *sp, int timeout_ms)
+{
+    gettimeofday(&sp->deadline, 0);
+    sp->deadline.tv_usec += 1000 * timeout_ms;
+    sp->deadline.tv_sec += sp->deadline.tv_usec / 1000000;
+    sp->deadline.tv_usec = sp->deadline.tv_usec % 1000000;
 }
 
 /* Try reading a protocol packet header */
@@ -550,6 +712,7 @@ void server_handle_event(state_t *sp)
                     sp->status = STATE_CLOSE;   /* not listening */
                     break;
                 }
+                sp->rtt_ms = ms_since(&sp->start);
                 if (opt_comptimeout_ms == 0 || !opt_compiler) {
                     /* connect succeeded, don't need to compile */
                     sp->up = 1;
@@ -584,6 +747,7 @@ void server_handle_event(state_t *sp)
                 }
                 sp->status=STATE_READ_DONEPKT;
                 sp->curhdrlen = 0;
+                sp->sent = now;
                 sp->deadline = now;
                 sp->deadline.tv_usec += 1000 * opt_comptimeout_ms;
                 sp->deadline.tv_sec += sp->deadline.tv_usec / 1000000;
@@ -607,44 +771,69 @@ void server_handle_event(state_t *sp)
                  * poll said bytes were ready, so beware of false EOFs here?
                  */
                 sp->up = 1;
+                sp->compile_ms = ms_since(&sp->sent);
                 sp->status = STATE_CLOSE;
             }
           }
           break;
 
+        case STATE_STATS_CONNECT:
+            if (server_start_connect(sp, opt_stats_port) != 0) {
+                sp->status = STATE_CLOSE;
+            } else {
+                sp->status = STATE_STATS_CONNECTING;
+                set_deadline(sp, opt_conntimeout_ms);
+            }
+            break;
+
+        case STATE_STATS_CONNECTING:
+            {
+                int connecterr;
+                socklen_t len = sizeof(connecterr);
+
+                if (getsockopt(sp->fd, SOL_SOCKET, SO_ERROR,
+                               (char *)&connecterr, &len) < 0
+                    || connecterr) {
+                    if (opt_verbose > 0)
+                        fprintf(stderr, "%s: no stats server on port %d\n",
+                                sp->req.hname, opt_stats_port);
+                    sp->status = STATE_CLOSE;
+                    break;
+                }
+                /* The stats server replies without being asked. */
+                sp->status = STATE_STATS_READ;
+                sp->statslinelen = 0;
+                set_deadline(sp, opt_conntimeout_ms);
+            }
+            break;
+
+        case STATE_STATS_READ:
+            server_read_stats(sp);
+            break;
+
         case STATE_CLOSE:
             if (sp->fd != -1) {
                 close(sp->fd);
                 sp->fd = -1;
             }
 
-            if (opt_bang_down || sp->up) {
-                if (opt_numeric)
-                    printf("%d.%d.%d.%d", sp->res.addr[0], sp->res.addr[1],
-                           sp->res.addr[2], sp->res.addr[3]);
-                else
-                    printf("%s", sp->req.hname);
-
-                if (opt_port != DEFAULT_PORT)
-                    printf(":%d", opt_port);
-
-                printf("%s", protocol_suffix[opt_protocol]);
-
-                if (opt_bang_down && !sp->up)
-                    printf(",down");
+            if (opt_rank && sp->up && opt_stats_port && !sp->stats_done) {
+                /* One more connection, to ask how busy it is. */
+                sp->stats_done = 1;
+                sp->status = STATE_STATS_CONNECT;
+                break;
+            }
 
-                if (opt_latency) {
-                    int latency_ms;
-                    gettimeofday(&now, 0);
-                    latency_ms = (now.tv_usec - sp->start.tv_usec) /
-                                 1000 + 1000 * (now.tv_sec - sp->start.tv_sec);
-                    printf(" %d", latency_ms);
-                }
+            if ((opt_bang_down || sp->up) && !opt_rank) {
+                print_host(sp, 0);
+                if (opt_latency)
+                    printf(" %d", ms_since(&sp->start));
                 putchar('\n');
                 if (opt_verbose)
                     fflush(stdout);
             }
             nok++;
+            sp->closed = 1;
             sp->status = STATE_DONE;
             ndone++;
             break;
@@ -654,7 +843,105 @@ void server_handle_event(state_t *sp)
         default:
             ;
         }
-    } while (sp->status == STATE_CLOSE);
+    } while (sp->status == STATE_CLOSE
+             || sp->status == STATE_STATS_CONNECT);
+}
+
+/* Print the host list entry for one server, with a /LIMIT if @p slots. */
+void print_host(const state_t *sp, int slots)
+{
+    if (opt_numeric)
+        printf("%d.%d.%d.%d", sp->res.addr[0], sp->res.addr[1],
+               sp->res.addr[2], sp->res.addr[3]);
+    else
+        printf("%s", sp->req.hname);
+
+    if (opt_port != DEFAULT_PORT)
+        printf(":%d", opt_port);
+
+    if (slots)
+        printf("/%d", slots);
+
+    printf("%s", protocol_suffix[opt_protocol]);
+
+    if (opt_bang_down && !sp->up)
+        printf(",down");
+}
+
+struct ranked_host {
+    const state_t *sp;
+    int slots;
+    double capacity;    /* jobs per second it could take right now */
+    double throughput;  /* jobs per second with all slots busy */
+};
+
+static int compare_ranked_hosts(const void *a, const void *b)
+{
+    const struct ranked_host *i = a, *j = b;
+
+    if (i->sp->up != j->sp->up)
+        return j->sp->up - i->sp->up;
+    if (i->capacity != j->capacity)
+        return i->capacity < j->capacity ? 1 : -1;
+    if (i->throughput != j->throughput)
+        return i->throughput < j->throughput ? 1 : -1;
+    return i->sp->res.id - j->sp->res.id;
+}
+
+/* For -a: print the servers as a single host list, best first.
+ *
+ * A server's job limit is what its stats server reports as dcc_max_kids, or
+ * DEFAULT_SLOTS if it won't say.  Each slot is reckoned to finish one job
+ * every (compile time + connect time), so the expected capacity of a server
+ * is its free slots times that rate.  Servers that are up always come before
+ * down ones, and ties keep DNS order. */
+void print_ranked_hosts(state_t states[], int n)
+{
+    struct ranked_host *r;
+    int i, nr = 0;
+
+    r = calloc((size_t) n + 1, sizeof *r);
+    if (!r) {
+        fprintf(stderr, "lsdistcc: out of memory\n");
+        exit(1);
+    }
+    for (i = 1; i <= n; i++) {
+        const state_t *sp = &states[i];
+        int free_slots;
+        double job_ms;
+
+        if (!sp->up && !(opt_bang_down && sp->closed))
+            continue;
+
+        r[nr].sp = sp;
+        r[nr].slots = sp->max_kids > 0 ? sp->max_kids : DEFAULT_SLOTS;
+        free_slots = r[nr].slots;
+        if (sp->max_kids > 0 && sp->cur_load >= 0)
+            free_slots = sp->max_kids > sp->cur_load
+                ? sp->max_kids - sp->cur_load : 0;
+        job_ms = 1.0 + (sp->compile_ms > 0 ? sp->compile_ms : 0)
+            + (sp->rtt_ms > 0 ? sp->rtt_ms : 0);
+        r[nr].capacity = free_slots * 1000.0 / job_ms;
+        r[nr].throughput = r[nr].slots * 1000.0 / job_ms;
+
+        if (opt_verbose > 0)
+            fprintf(stderr, "%s: rtt %d ms, compile %d ms, "
+                    "load %d of %d, capacity %.1f jobs/s\n",
+                    sp->req.hname, sp->rtt_ms, sp->compile_ms,
+                    sp->cur_load, sp->max_kids, r[nr].capacity);
+        nr++;
+    }
+
+    qsort(r, (size_t) nr, sizeof *r, compare_ranked_hosts);
+
+    for (i = 0; i < nr; i++) {
+        if (i)
+            putchar(' ');
+        print_host(r[i].sp, r[i].slots);
+    }
+    if (nr)
+        putchar('\n');
+    free(r);
 }
 
 /* A helper function for detecting all listening distcc servers: this
@@ -703,12 +990,14 @@ static int one_poll_loop(struct rslave_s* rs, struct state_s states[],
     for (i=start_state; i<=end_state; i++) {
         switch (states[i].status) {
         case STATE_CONNECTING:
+        case STATE_STATS_CONNECTING:
             pollfds[nfds].fd = states[i].fd;
             pollfds[nfds++].events = POLLOUT;
             break;
         case STATE_READ_DONEPKT:
         case STATE_READ_STATPKT:
         case STATE_READ_REST:
+        case STATE_STATS_READ:
             pollfds[nfds].fd = states[i].fd;
             pollfds[nfds++].events = POLLIN;
             break;
@@ -722,6 +1011,8 @@ static int one_poll_loop(struct rslave_s* rs, struct state_s states[],
      * and make the program take longer than it should.
      */
     nready = poll(pollfds, (unsigned)nfds, 50);
+    if (nready == -1 && errno == EINTR && timed_out)
+        return end_state;
     if (nready == -1) {
 	fprintf(stderr, "lsdistcc: poll failed: %s\n", strerror(errno));
 	exit(1);
@@ -779,6 +1070,19 @@ static int one_poll_loop(struct rslave_s* rs, struct state_s states[],
                         (long long) now.tv_sec, (long) now.tv_usec/1000,
                         sp->req.hname);
         }
+        if ((sp->status == STATE_STATS_CONNECTING ||
+             sp->status == STATE_STATS_READ)
+            && (sp->deadline.tv_sec < now.tv_sec ||
+                (sp->deadline.tv_sec == now.tv_sec &&
+                 sp->deadline.tv_usec < now.tv_usec))) {
+            sp->status = STATE_CLOSE;
+            server_handle_event(sp);
+            if (opt_verbose > 0)
+                fprintf(stderr,
+                        "now %lld %ld: %s timed out while reading stats\n",
+                        (long long) now.tv_sec, (long) now.tv_usec/1000,
+                        sp->req.hname);
+        }
     }
     if (!found && (nwithtries[1] <= overlap) &&
         (pollfds[1].revents & POLLOUT)) {
@@ -984,6 +1288,10 @@ int detect_distcc_servers(const char **argv, int argc, int opti,
         rslave_request_init(req, thename, i);
         states[i].status = STATE_LOOKUP;
         states[i].ntries = 0;
+        states[i].rtt_ms = -1;
+        states[i].compile_ms = -1;
+        states[i].max_kids = -1;
+        states[i].cur_load = -1;
         nwithtries[0]++;
     }
 
@@ -1000,19 +1308,28 @@ int detect_distcc_servers(const char **argv, int argc, int opti,
         if (end_state > n)
             end_state = n;
         orig_end_state = end_state;
-        while (ndone < end_state) {
+        while (ndone < end_state && !timed_out) {
             end_state = one_poll_loop(&rs, states, start_state, end_state,
                                       nwithtries, &ngotaddr, &nbaddns,
                                       firstipaddr, dnstimeout_usec,
                                       matchbits, overlap, dnsgap);
         }
-        if (end_state < orig_end_state) {
+        if (end_state < orig_end_state || timed_out) {
             /* If we lowered end_state, it means we decided to stop
              * searching early.
              */
             break;
         }
     }
+
+    if (opt_rank) {
+        if (timed_out && opt_verbose > 0)
+            fprintf(stderr, "Timeout!\n");
+        print_ranked_hosts(states, n);
+        nok = 0;
+        for (i = 1; i <= n; i++)
+            nok += states[i].up;
+    }
     return nok;
 }
 
@@ -1083,6 +1400,19 @@ int main(int argc, char **argv)
         case 'x':
             opt_bang_down = 1;
             break;
+        case 'a':
+            opt_rank = 1;
+            break;
+        case 's':
+            opt_stats_port = atoi(argv[opti]+2);
+            if (opt_stats_port < 0)
+                usage();
+            break;
+        case 'w':
+            opt_work = atoi(argv[opti]+2);
+            if (opt_work < 1 || opt_work > MAX_WORK)
+                usage();
+            break;
         case 'v':
             opt_verbose++;
             break;
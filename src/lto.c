@@ -0,0 +1,452 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Run the ltrans stage of a gcc LTO link across the farm.
+ *
+ * For -flto=N, -flto=auto and -flto=jobserver, gcc's lto-wrapper writes a
+ * makefile with one rule per ltrans partition and runs $MAKE on it.  With
+ * MAKE=distcc-lto-make (or "distcc --lto-make"), we read that makefile and
+ * run the partitions through the --batch scheduler.  That way they are
+ * limited by the slots on the farm, not by the number of CPUs here.  Each
+ * object is written out as soon as its partition finishes.
+ *
+ * Partitions whose bytes and options haven't changed since an earlier link
+ * are taken from a cache in $DISTCC_DIR/lto, so they aren't uploaded or
+ * compiled again.
+ *
+ * Anything that isn't an lto-wrapper makefile is handed to the real make,
+ * so it does no harm if MAKE is picked up by other parts of the build.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "bulk.h"
+#include "sha256.h"
+#include "batch.h"
+#include "cachedir.h"
+
+
+/* Default size of the ltrans cache, in megabytes. */
+#define DCC_LTO_CACHE_DEFAULT_MB 1024
+
+struct dcc_lto_rule {
+    const char *output;         /* point into the entry's argv */
+    const char *input;
+    int truncate_input;
+};
+
+static struct dcc_lto_rule *rules;
+static int n_rules;
+static dcc_batch_main_fn *real_client_main;
+
+
+/**
+ * Hand everything to the real make.  Only returns if that fails.
+ **/
+static int dcc_lto_exec_make(char **argv)
+{
+    argv[0] = (char *) "make";
+    execvp(argv[0], argv);
+    rs_log_error("failed to exec make: %s", strerror(errno));
+    return EXIT_COMPILER_MISSING;
+}
+
+
+/**
+ * Find the output and input of an ltrans command, which lto-wrapper always
+ * writes as "... -o OUTPUT INPUT".
+ **/
+static int dcc_lto_find_files(char **argv, const char **output,
+                              const char **input)
+{
+    int i, n = dcc_argv_len(argv);
+
+    *output = *input = NULL;
+    for (i = 1; i < n - 1; i++)
+        if (!strcmp(argv[i], "-o"))
+            *output = argv[i + 1];
+    if (n > 0 && argv[n - 1][0] != '-' && argv[n - 1] != *output)
+        *input = argv[n - 1];
+    return *output && *input ? 0 : EXIT_BAD_ARGUMENTS;
+}
+
+
+/**
+ * Parse the makefile lto-wrapper writes: for each partition,
+ *
+ *   OUTPUT:
+ *   	@COMPILER 'ARG' ... '-o' 'OUTPUT' 'INPUT'
+ *   	@-touch -r INPUT INPUT.tem > /dev/null 2>&1 && mv INPUT.tem INPUT
+ *
+ * where the second command, which empties the input, is missing with
+ * -save-temps; then ".PHONY: all" and "all:" listing every output.
+ *
+ * @returns 0, or nonzero if this isn't such a makefile.
+ **/
+static int dcc_lto_parse(char *mk, struct dcc_batch_entry **entries_ret,
+                         int *n_ret)
+{
+    struct dcc_batch_entry *entries = NULL;
+    struct dcc_lto_rule *r = NULL;
+    char *line, *next, *cwd;
+    int n = 0, size = 0, in_all = 0, ret;
+
+    if ((cwd = getcwd(NULL, 0)) == NULL) {
+        rs_log_error("getcwd failed: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    for (line = mk; line && *line; line = next) {
+        size_t len;
+
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+        len = strlen(line);
+        if (len == 0)
+            continue;
+
+        if (line[0] == '\t') {
+            if (in_all)
+                continue;
+            if (!r)
+                goto not_ours;
+            if (!entries[n - 1].argv) {
+                if (line[1] != '@')
+                    goto not_ours;
+                if ((ret = dcc_batch_split_command(line + 2,
+                                                   &entries[n - 1].argv)))
+                    goto fail;
+                if (dcc_lto_find_files(entries[n - 1].argv, &r->output,
+                                       &r->input)
+                    || strcmp(r->output, entries[n - 1].file))
+                    goto not_ours;
+                continue;
+            }
+            if (strstr(line, "touch -r") && strstr(line, "&& mv")
+                && strstr(line, r->input)) {
+                r->truncate_input = 1;
+                continue;
+            }
+            goto not_ours;
+        }
+
+        /* Every rule needs its command before the next one starts. */
+        if (n > 0 && !entries[n - 1].argv)
+            goto not_ours;
+        r = NULL;
+        if (!strncmp(line, ".PHONY:", 7)) {
+            continue;
+        } else if (!strncmp(line, "all:", 4)) {
+            in_all = 1;
+            continue;
+        }
+
+        /* A new rule, with no prerequisites. */
+        if (line[len - 1] != ':' || strchr(line, ':') != line + len - 1)
+            goto not_ours;
+        line[len - 1] = '\0';
+        in_all = 0;
+        if (n == size) {
+            struct dcc_batch_entry *e;
+            struct dcc_lto_rule *nr;
+
+            size = size ? size * 2 : 64;
+            if ((e = realloc(entries, size * sizeof entries[0])))
+                entries = e;
+            if ((nr = realloc(rules, size * sizeof rules[0])))
+                rules = nr;
+            if (!e || !nr) {
+                ret = EXIT_OUT_OF_MEMORY;
+                goto fail;
+            }
+        }
+        memset(&entries[n], 0, sizeof entries[n]);
+        memset(&rules[n], 0, sizeof rules[n]);
+        if (!(entries[n].directory = strdup(cwd))
+            || !(entries[n].file = strdup(line))) {
+            n++;
+            ret = EXIT_OUT_OF_MEMORY;
+            goto fail;
+        }
+        r = &rules[n++];
+    }
+
+    if (n == 0 || !entries[n - 1].argv)
+        goto not_ours;
+
+    free(cwd);
+    n_rules = n;
+    *entries_ret = entries;
+    *n_ret = n;
+    return 0;
+
+  not_ours:
+    rs_trace("not an lto-wrapper makefile");
+    ret = EXIT_BAD_ARGUMENTS;
+  fail:
+    free(cwd);
+    dcc_batch_free(entries, n);
+    free(rules);
+    rules = NULL;
+    return ret;
+}
+
+
+static long dcc_lto_cache_limit(void)
+{
+    const char *e = getenv("DISTCC_LTO_CACHE_SIZE");
+
+    if (e && *e)
+        return atol(e);
+    return DCC_LTO_CACHE_DEFAULT_MB;
+}
+
+
+/**
+ * Find the compiler the way execvp() would, so that upgrading it changes
+ * the cache key.
+ **/
+static int dcc_lto_stat_compiler(const char *name, struct stat *sb)
+{
+    const char *path, *p, *end;
+    char *full;
+    int found = 0;
+
+    if (strchr(name, '/'))
+        return stat(name, sb);
+    if (!(path = getenv("PATH")))
+        return -1;
+    for (p = path; !found; p = end + 1) {
+        if (!(end = strchr(p, ':')))
+            end = p + strlen(p);
+        if (asprintf(&full, "%.*s/%s", (int) (end - p), p, name) == -1)
+            return -1;
+        found = stat(full, sb) == 0 && S_ISREG(sb->st_mode);
+        free(full);
+        if (!*end)
+            break;
+    }
+    return found ? 0 : -1;
+}
+
+
+/**
+ * The cache key of a partition: the compiler, every option except the ones
+ * that only name files, and the partition itself.
+ **/
+static int dcc_lto_key(char **argv, const char *input, char hex[])
+{
+    static const char output_list[] = "-fltrans-output-list=";
+    struct dcc_sha256 ctx;
+    unsigned char digest[DCC_SHA256_LEN];
+    struct stat sb;
+    int i, fd;
+
+    dcc_sha256_init(&ctx);
+    dcc_sha256_update(&ctx, "distcc-ltrans-1", 16);
+    if (dcc_lto_stat_compiler(argv[0], &sb) == 0) {
+        dcc_sha256_update(&ctx, &sb.st_size, sizeof sb.st_size);
+        dcc_sha256_update(&ctx, &sb.st_mtime, sizeof sb.st_mtime);
+        dcc_sha256_update(&ctx, &sb.st_ino, sizeof sb.st_ino);
+    }
+    for (i = 0; argv[i]; i++) {
+        if (argv[i] == input)
+            continue;
+        if ((!strcmp(argv[i], "-o") || !strcmp(argv[i], "-dumpdir")
+             || !strcmp(argv[i], "-dumpbase")) && argv[i + 1]) {
+            i++;
+            continue;
+        }
+        dcc_sha256_update(&ctx, argv[i], strlen(argv[i]) + 1);
+    }
+
+    /* The partition records the options the link was run with, and one
+     * of those names a temporary file.  Leave it out. */
+    if ((fd = open(input, O_RDONLY)) == -1)
+        return EXIT_NO_SUCH_FILE;
+    if (fstat(fd, &sb) == -1) {
+        close(fd);
+        return EXIT_IO_ERROR;
+    }
+    if (sb.st_size > 0) {
+        const char *p, *end, *opt;
+        void *map;
+
+        map = mmap(NULL, (size_t) sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return EXIT_IO_ERROR;
+        }
+        p = map;
+        end = p + sb.st_size;
+        while ((opt = memmem(p, (size_t) (end - p), output_list,
+                             sizeof output_list - 1))) {
+            dcc_sha256_update(&ctx, p, (size_t) (opt - p));
+            for (p = opt; p < end && *p != '\'' && *p != '\0'; p++)
+                ;
+        }
+        dcc_sha256_update(&ctx, p, (size_t) (end - p));
+        munmap(map, (size_t) sb.st_size);
+    }
+    close(fd);
+    dcc_sha256_final(&ctx, digest);
+
+    for (i = 0; i < DCC_SHA256_LEN; i++)
+        sprintf(hex + 2 * i, "%02x", digest[i]);
+    return 0;
+}
+
+
+/**
+ * What each batch child runs in place of the client: answer from the
+ * cache if we can, otherwise compile and remember the result.
+ *
+ * @p argv is "distcc COMPILER ARGS".
+ **/
+static int dcc_lto_ltrans_main(int argc, char **argv)
+{
+    struct dcc_lto_rule *r = NULL;
+    const char *output, *input;
+    char hex[2 * DCC_SHA256_LEN + 1], *dir, *cached = NULL;
+    struct stat sb;
+    int i, ret, have_stat;
+
+    if (dcc_lto_find_files(argv + 1, &output, &input) == 0) {
+        for (i = 0; i < n_rules; i++)
+            if (!strcmp(rules[i].output, output))
+                r = &rules[i];
+    }
+    if (!r)
+        return real_client_main(argc, argv);
+
+    if (dcc_lto_cache_limit() > 0
+        && dcc_get_subdir("lto", &dir) == 0) {
+        if (dcc_lto_key(argv + 1, input, hex) == 0
+            && asprintf(&cached, "%s/%s.o", dir, hex) == -1)
+            cached = NULL;
+        free(dir);
+    }
+
+    have_stat = stat(input, &sb) == 0;
+
+    if (cached && access(cached, R_OK) == 0
+        && dcc_cache_copy(cached, output, 0666) == 0) {
+        rs_log_info("%s unchanged since an earlier link", input);
+        utimes(cached, NULL);
+        ret = 0;
+    } else {
+        ret = real_client_main(argc, argv);
+        if (ret == 0 && cached)
+            dcc_cache_store(output, cached, 0666);
+    }
+
+    /* lto-wrapper empties each partition once it's done with it, to save
+     * space in /tmp. */
+    if (ret == 0 && r->truncate_input && have_stat) {
+        struct timeval tv[2];
+
+        tv[0].tv_sec = sb.st_atime;
+        tv[0].tv_usec = 0;
+        tv[1].tv_sec = sb.st_mtime;
+        tv[1].tv_usec = 0;
+        if (truncate(input, 0) == 0)
+            utimes(input, tv);
+    }
+
+    free(cached);
+    return ret;
+}
+
+
+/**
+ * distcc --lto-make MAKE-ARGS, or distcc-lto-make MAKE-ARGS.
+ *
+ * lto-wrapper runs "$MAKE -f FILE [-jN] all", after checking for make with
+ * "$MAKE --version".
+ **/
+int dcc_lto_make(int argc, char **argv, dcc_batch_main_fn *client_main)
+{
+    struct dcc_batch_entry *entries = NULL;
+    const char *fname = NULL;
+    char *mk = NULL, *dir;
+    int n = 0, i, ret;
+    long limit;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            fname = argv[++i];
+        } else if (!strncmp(argv[i], "-j", 2)
+                   && strspn(argv[i] + 2, "0123456789") == strlen(argv[i] + 2)) {
+            /* That's how many CPUs there are here, which doesn't matter:
+             * we go by the number of slots on the farm. */
+        } else if (!strcmp(argv[i], "all")) {
+            ;
+        } else {
+            return dcc_lto_exec_make(argv);
+        }
+    }
+    if (!fname || dcc_batch_load(fname, &mk))
+        return dcc_lto_exec_make(argv);
+    ret = dcc_lto_parse(mk, &entries, &n);
+    free(mk);
+    if (ret == EXIT_BAD_ARGUMENTS)
+        return dcc_lto_exec_make(argv);
+    if (ret)
+        return ret;
+
+    rs_trace("%d ltrans partitions from %s", n, fname);
+
+    real_client_main = client_main;
+    ret = dcc_batch_schedule(entries, n, 0,
+                             DCC_BATCH_UNORDERED | DCC_BATCH_QUIET,
+                             dcc_lto_ltrans_main);
+
+    if ((limit = dcc_lto_cache_limit()) > 0
+        && dcc_get_subdir("lto", &dir) == 0) {
+        dcc_cache_prune(dir, ".o", limit, "ltrans");
+        free(dir);
+    }
+
+    dcc_batch_free(entries, n);
+    free(rules);
+    rules = NULL;
+    return ret;
+}
@@ -0,0 +1,331 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Placement of jobs on CPUs and memory nodes, for --placement.
+ *
+ * When a preforked child accepts a job, it takes the first CPU that no
+ * other job is running on.  CPUs are handed out first-thread-of-each-core
+ * first, so that two compilers only share a core's caches once every core
+ * is busy.  The child also prefers memory from that CPU's NUMA node.  The
+ * compiler inherits both, and since the page cache follows the allocating
+ * task's policy, so do the temporary files and buffers the child receives
+ * into.  Once the job is done the child gives the CPU back.
+ *
+ * There are a couple more children than CPUs.  A job that arrives when
+ * every CPU has one is not pinned, and the scheduler runs it wherever it
+ * can, rather than doubling up on a CPU that may stay busy for minutes.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_LINUX
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "daemon.h"
+
+/* The CPU and node this child's jobs run on, or -1. */
+static int dcc_job_cpu = -1, dcc_job_node = -1;
+
+#ifdef HAVE_LINUX
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/** Largest NUMA node number we look for. */
+#define DCC_MAX_NODES 1024
+
+struct dcc_place_cpu {
+    int cpu;
+    int node;
+    int rank;                   /* hyperthreads of the core before this one */
+};
+
+static struct dcc_place_cpu *dcc_place_cpus;
+static int dcc_n_place_cpus;
+static int dcc_n_nodes;
+
+/**
+ * The child running a job on each of dcc_place_cpus, or 0.  This is shared
+ * between all the children, and the parent clears the entry of a child that
+ * dies.
+ **/
+static volatile pid_t *dcc_place_owner;
+
+/* In a child, the CPUs it may run on when it has no job, and the index in
+ * dcc_place_cpus of the CPU its job has, or -1. */
+static cpu_set_t dcc_place_home;
+static int dcc_place_have_home = 0;
+static int dcc_place_claim = -1;
+
+
+/**
+ * Parse a kernel CPU or node list such as "0-3,8-11" into @p set.
+ **/
+static int dcc_parse_cpulist(const char *s, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    while (*s && *s != '\n') {
+        char *end;
+        long lo, hi;
+
+        lo = hi = strtol(s, &end, 10);
+        if (end == s)
+            return EXIT_DISTCC_FAILED;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s)
+                return EXIT_DISTCC_FAILED;
+        }
+        for (; lo <= hi && lo < CPU_SETSIZE; lo++)
+            CPU_SET(lo, set);
+        s = end;
+        if (*s == ',')
+            s++;
+    }
+    return 0;
+}
+
+
+static int dcc_read_cpulist(const char *fname, cpu_set_t *set)
+{
+    char buf[4096];
+    FILE *f;
+    int ret = EXIT_DISTCC_FAILED;
+
+    if ((f = fopen(fname, "r"))) {
+        if (fgets(buf, sizeof buf, f))
+            ret = dcc_parse_cpulist(buf, set);
+        fclose(f);
+    }
+    return ret;
+}
+
+
+static int dcc_place_cpu_cmp(const void *a, const void *b)
+{
+    const struct dcc_place_cpu *x = a, *y = b;
+
+    if (x->rank != y->rank)
+        return x->rank - y->rank;
+    return x->cpu - y->cpu;
+}
+
+
+/**
+ * Build the slot map from the CPUs we may run on, and the node and core of
+ * each from sysfs.  Machines without NUMA information are one node.
+ **/
+int dcc_placement_init(void)
+{
+    cpu_set_t allowed, nodes, set;
+    char fname[128];
+    void *map;
+    int c, n, i;
+
+    if (sched_getaffinity(0, sizeof allowed, &allowed) == -1) {
+        rs_log_error("sched_getaffinity failed: %s", strerror(errno));
+        return EXIT_DISTCC_FAILED;
+    }
+    if (!(dcc_place_cpus = calloc(CPU_COUNT(&allowed),
+                                  sizeof dcc_place_cpus[0]))) {
+        rs_log_error("failed to allocate CPU map");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    for (c = 0; c < CPU_SETSIZE; c++) {
+        struct dcc_place_cpu *p;
+
+        if (!CPU_ISSET(c, &allowed))
+            continue;
+        p = &dcc_place_cpus[dcc_n_place_cpus++];
+        p->cpu = c;
+        snprintf(fname, sizeof fname,
+                 "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+                 c);
+        if (dcc_read_cpulist(fname, &set) == 0)
+            for (i = 0; i < c; i++)
+                if (CPU_ISSET(i, &set))
+                    p->rank++;
+    }
+
+    dcc_n_nodes = 1;
+    if (dcc_read_cpulist("/sys/devices/system/node/online", &nodes) == 0) {
+        dcc_n_nodes = 0;
+        for (n = 0; n < DCC_MAX_NODES && n < CPU_SETSIZE; n++) {
+            if (!CPU_ISSET(n, &nodes))
+                continue;
+            dcc_n_nodes++;
+            snprintf(fname, sizeof fname,
+                     "/sys/devices/system/node/node%d/cpulist", n);
+            if (dcc_read_cpulist(fname, &set) != 0)
+                continue;
+            for (i = 0; i < dcc_n_place_cpus; i++)
+                if (CPU_ISSET(dcc_place_cpus[i].cpu, &set))
+                    dcc_place_cpus[i].node = n;
+        }
+    }
+
+    qsort(dcc_place_cpus, dcc_n_place_cpus, sizeof dcc_place_cpus[0],
+          dcc_place_cpu_cmp);
+
+    map = mmap(NULL, dcc_n_place_cpus * sizeof dcc_place_owner[0],
+               PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        rs_log_error("mmap of %d CPUs failed: %s", dcc_n_place_cpus,
+                     strerror(errno));
+        dcc_n_place_cpus = 0;
+        return EXIT_OUT_OF_MEMORY;
+    }
+    dcc_place_owner = map;
+    rs_log_info("placing jobs on %d CPU%s in %d memory node%s",
+                dcc_n_place_cpus, dcc_n_place_cpus == 1 ? "" : "s",
+                dcc_n_nodes, dcc_n_nodes == 1 ? "" : "s");
+    return 0;
+}
+
+
+/**
+ * Called in a child that has just accepted a job, to move it to the first
+ * CPU it is allowed that has no job, and to prefer that CPU's node for
+ * memory.  If they all have one, the job runs unpinned.
+ **/
+void dcc_placement_apply(void)
+{
+    cpu_set_t one;
+    pid_t me = getpid();
+    int i;
+    const struct dcc_place_cpu *p = NULL;
+
+    if (!dcc_n_place_cpus)
+        return;
+    if (!dcc_place_have_home) {
+        if (sched_getaffinity(0, sizeof dcc_place_home,
+                              &dcc_place_home) == -1)
+            return;
+        dcc_place_have_home = 1;
+    }
+    for (i = 0; i < dcc_n_place_cpus; i++)
+        if (CPU_ISSET(dcc_place_cpus[i].cpu, &dcc_place_home)
+            && __sync_bool_compare_and_swap(&dcc_place_owner[i], 0, me)) {
+            p = &dcc_place_cpus[i];
+            break;
+        }
+    if (!p) {
+        rs_trace("every CPU has a job; not placing this one");
+        return;
+    }
+
+    CPU_ZERO(&one);
+    CPU_SET(p->cpu, &one);
+    if (sched_setaffinity(0, sizeof one, &one) == -1) {
+        rs_log_warning("failed to move to CPU %d: %s", p->cpu,
+                       strerror(errno));
+        dcc_place_owner[i] = 0;
+        return;
+    }
+    dcc_place_claim = i;
+    dcc_job_cpu = p->cpu;
+
+    if (dcc_n_nodes > 1) {
+        unsigned long mask[DCC_MAX_NODES / (8 * sizeof (unsigned long))];
+
+        memset(mask, 0, sizeof mask);
+        mask[p->node / (8 * sizeof mask[0])] |=
+            1UL << (p->node % (8 * sizeof mask[0]));
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                    (unsigned long) (8 * sizeof mask)) == -1)
+            rs_log_warning("failed to prefer memory node %d: %s", p->node,
+                           strerror(errno));
+        else
+            dcc_job_node = p->node;
+    } else {
+        dcc_job_node = p->node;
+    }
+    rs_trace("running job on CPU %d, node %d", dcc_job_cpu, dcc_job_node);
+}
+
+
+/**
+ * Called in a child when its job is done, to give back its CPU.
+ **/
+void dcc_placement_release(void)
+{
+    if (dcc_place_claim == -1)
+        return;
+    if (sched_setaffinity(0, sizeof dcc_place_home, &dcc_place_home) == -1)
+        rs_log_warning("failed to leave CPU %d: %s", dcc_job_cpu,
+                       strerror(errno));
+    if (dcc_n_nodes > 1)
+        syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0UL);
+    dcc_place_owner[dcc_place_claim] = 0;
+    dcc_place_claim = -1;
+    dcc_job_cpu = dcc_job_node = -1;
+}
+
+
+/**
+ * Called in the parent for each child collected, in case it died with a
+ * CPU.
+ **/
+void dcc_placement_kid_exited(pid_t kid)
+{
+    int i;
+
+    for (i = 0; i < dcc_n_place_cpus; i++)
+        if (dcc_place_owner[i] == kid)
+            dcc_place_owner[i] = 0;
+}
+
+#endif /* HAVE_LINUX */
+
+
+/**
+ * Add where this job ran to the job summary line.
+ **/
+void dcc_placement_summary(void)
+{
+    char buf[64];
+
+    if (dcc_job_cpu == -1)
+        return;
+    snprintf(buf, sizeof buf, "cpu:%d node:%d ", dcc_job_cpu, dcc_job_node);
+    dcc_job_summary_append(buf);
+}
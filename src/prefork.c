@@ -46,6 +46,12 @@
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/mman.h>
+
+#ifdef HAVE_LINUX
+#include <sched.h>
+#include <linux/filter.h>
+#endif
 
 #include "exitcode.h"
 #include "distcc.h"
@@ -64,6 +70,285 @@ static void dcc_sigchld_handler(int sig);
 static void dcc_create_kids(int listen_fd);
 static int dcc_preforked_child(int listen_fd);
 
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/** Our children, so that they can be told to drain. */
+static pid_t *dcc_kid_pids;
+static int dcc_n_kid_pids;
+
+/**
+ * Which of our children are running a job, indexed like dcc_kid_pids.  This
+ * is shared with them, so that the parent can tell how many slots are free.
+ **/
+static volatile int *dcc_kid_busy;
+
+/** In a child, its index in dcc_kid_pids and dcc_kid_busy. */
+static int dcc_kid_index = -1;
+
+#ifdef HAVE_LINUX
+/**
+ * With --shards, one of the listening sockets sharing our port, with the
+ * children that accept on it and the CPUs they run on.  Without it, but
+ * with --placement, there is just one.
+ *
+ * Each shard owns the job slots first_slot to first_slot + max_kids - 1.
+ **/
+struct dcc_shard {
+    int listen_fd;
+    int n_kids, max_kids;
+    int first_slot;
+    int first_cpu;              /* lowest CPU number in the group */
+    cpu_set_t cpus;
+};
+
+static struct dcc_shard *dcc_shards;
+static int dcc_n_shards;
+
+/** The child in each job slot, and its shard, so it can be replaced. */
+static struct dcc_shard_kid {
+    pid_t pid;
+    int shard;
+} *dcc_shard_kids;
+
+
+static void dcc_shard_log(int i)
+{
+    char buf[256];
+    size_t len = 0;
+    int c, start = -1;
+
+    buf[0] = '\0';
+    for (c = 0; c <= CPU_SETSIZE && len < sizeof buf - 24; c++) {
+        int in = c < CPU_SETSIZE && CPU_ISSET(c, &dcc_shards[i].cpus);
+        if (in && start == -1) {
+            start = c;
+        } else if (!in && start != -1) {
+            len += snprintf(buf + len, sizeof buf - len,
+                            c - 1 == start ? "%s%d" : "%s%d-%d",
+                            len ? "," : "", start, c - 1);
+            start = -1;
+        }
+    }
+    rs_log_info("shard %d: up to %d jobs on CPUs %s",
+                i, dcc_shards[i].max_kids, buf);
+}
+
+
+/**
+ * Have the kernel hand each connection to the shard whose CPUs received
+ * it, rather than hashing it to any of them.  The program compares the
+ * receiving CPU against the first CPU of each group; the socket index it
+ * returns is the order in which the listeners were opened.
+ **/
+static void dcc_shard_steer(void)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    struct sock_filter code[2 * DCC_MAX_SHARDS];
+    struct sock_fprog prog;
+    int i, k = 0;
+
+    code[k++] = (struct sock_filter)
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    for (i = 1; i < dcc_n_shards; i++) {
+        code[k++] = (struct sock_filter)
+            BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,
+                     (unsigned) dcc_shards[i].first_cpu, 1, 0);
+        code[k++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, i - 1);
+    }
+    code[k++] = (struct sock_filter)
+        BPF_STMT(BPF_RET | BPF_K, dcc_n_shards - 1);
+
+    prog.len = k;
+    prog.filter = code;
+    if (setsockopt(dcc_shards[0].listen_fd, SOL_SOCKET,
+                   SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) == -1)
+        rs_log_warning("failed to attach shard steering program: %s",
+                       strerror(errno));
+    else
+        rs_trace("steering connections to shards by receiving CPU");
+#else
+    rs_log_warning("--shard-steer is not supported on this system");
+#endif
+}
+
+
+/**
+ * Split the children and the CPUs we may run on between the @p n sockets
+ * in @p listen_fds, which all listen on the same port.
+ *
+ * The allowed CPUs are cut into @p n contiguous groups in numerical order,
+ * which on most machines keeps a group on one package.  dcc_max_kids and
+ * dcc_queue_kids must already be set.
+ **/
+int dcc_prefork_shards(const int *listen_fds, int n)
+{
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    int n_kids = dcc_max_kids + dcc_queue_kids;
+    int n_cpus = 0, c, i;
+
+    if (sched_getaffinity(0, sizeof allowed, &allowed) == -1) {
+        rs_log_error("sched_getaffinity failed: %s", strerror(errno));
+        return EXIT_DISTCC_FAILED;
+    }
+    for (c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, &allowed))
+            cpus[n_cpus++] = c;
+
+    dcc_shards = calloc(n, sizeof dcc_shards[0]);
+    dcc_shard_kids = calloc(n_kids, sizeof dcc_shard_kids[0]);
+    if (!dcc_shards || !dcc_shard_kids) {
+        rs_log_error("failed to allocate shards");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct dcc_shard *sh = &dcc_shards[i];
+
+        sh->listen_fd = listen_fds[i];
+        sh->first_slot = n_kids * i / n;
+        sh->max_kids = n_kids * (i + 1) / n - sh->first_slot;
+        sh->first_cpu = cpus[n_cpus * i / n];
+        CPU_ZERO(&sh->cpus);
+        for (c = n_cpus * i / n; c < n_cpus * (i + 1) / n; c++)
+            CPU_SET(cpus[c], &sh->cpus);
+        if (CPU_COUNT(&sh->cpus) == 0)
+            /* more shards than CPUs: share one */
+            CPU_SET(sh->first_cpu, &sh->cpus);
+    }
+    dcc_n_shards = n;
+
+    if (n > 1) {
+        for (i = 0; i < n; i++)
+            dcc_shard_log(i);
+        if (opt_shard_steer)
+            dcc_shard_steer();
+    }
+    if (opt_placement)
+        return dcc_placement_init();
+    return 0;
+}
+
+
+/**
+ * Pick the shard for the next child: the one furthest below its share, or
+ * -1 if they are all full.
+ **/
+static int dcc_shard_for_kid(void)
+{
+    int i, best = -1;
+
+    for (i = 0; i < dcc_n_shards; i++) {
+        int room = dcc_shards[i].max_kids - dcc_shards[i].n_kids;
+        if (room > 0
+            && (best == -1
+                || room > dcc_shards[best].max_kids - dcc_shards[best].n_kids))
+            best = i;
+    }
+    return best;
+}
+
+
+/** An empty job slot in @p shard. */
+static int dcc_shard_free_slot(int shard)
+{
+    const struct dcc_shard *sh = &dcc_shards[shard];
+    int i;
+
+    for (i = sh->first_slot; i < sh->first_slot + sh->max_kids; i++)
+        if (dcc_shard_kids[i].pid == 0)
+            return i;
+    return -1;
+}
+#endif
+
+
+/**
+ * Set up the table of children.  Called before the first child is started,
+ * and before anything asks dcc_prefork_busy_kids().
+ **/
+int dcc_prefork_init(void)
+{
+    void *p;
+
+    dcc_n_kid_pids = dcc_max_kids + dcc_queue_kids;
+    if (!(dcc_kid_pids = calloc(dcc_n_kid_pids, sizeof dcc_kid_pids[0]))) {
+        rs_log_error("failed to allocate children");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    p = mmap(NULL, dcc_n_kid_pids * sizeof dcc_kid_busy[0],
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        rs_log_error("mmap of %d job slots failed: %s", dcc_n_kid_pids,
+                     strerror(errno));
+        return EXIT_OUT_OF_MEMORY;
+    }
+    dcc_kid_busy = p;
+    return 0;
+}
+
+
+/**
+ * The number of children running a job right now.
+ **/
+int dcc_prefork_busy_kids(void)
+{
+    int i, n = 0;
+
+    if (!dcc_kid_busy)
+        return 0;
+    for (i = 0; i < dcc_n_kid_pids; i++)
+        n += dcc_kid_busy[i] != 0;
+    return n;
+}
+
+
+/**
+ * Called by dcc_reap_kids() for each child collected, so that its shard can
+ * be refilled.
+ **/
+void dcc_prefork_kid_exited(pid_t kid)
+{
+    int i;
+
+    for (i = 0; i < dcc_n_kid_pids; i++)
+        if (dcc_kid_pids[i] == kid) {
+            dcc_kid_pids[i] = 0;
+            /* in case it died in the middle of a job */
+            dcc_kid_busy[i] = 0;
+        }
+
+#ifdef HAVE_LINUX
+    if (opt_placement)
+        dcc_placement_kid_exited(kid);
+    if (!dcc_n_shards)
+        return;
+    for (i = 0; i < dcc_max_kids + dcc_queue_kids; i++)
+        if (dcc_shard_kids[i].pid == kid) {
+            dcc_shards[dcc_shard_kids[i].shard].n_kids--;
+            dcc_shard_kids[i].pid = 0;
+            return;
+        }
+#endif
+}
+
+
+/**
+ * Send @p whichsig to all our children.  Called from a signal handler.
+ **/
+void dcc_prefork_signal_kids(int whichsig)
+{
+    int i;
+
+    for (i = 0; i < dcc_n_kid_pids; i++)
+        if (dcc_kid_pids[i] > 0)
+            kill(dcc_kid_pids[i], whichsig);
+}
+
+
 /**
  * Main loop for the parent process with the new preforked implementation.
  * The parent is just responsible for keeping a pool of children and they
@@ -91,6 +376,12 @@ int dcc_preforking_parent(int listen_fd)
         while (1) {
             dcc_create_kids(listen_fd);
 
+            dcc_drain_log();
+            if (dcc_drain_state != DCC_RUNNING && dcc_nkids == 0) {
+                dcc_drain_done();
+                return 0;
+            }
+
             /* wait for any children to exit, and then start some more */
             dcc_reap_kids(TRUE);
         }
@@ -114,21 +405,53 @@ void dcc_manage_kids(int listen_fd) {
 }
 
 /**
- * Fork children until we have dcc_max_kids of them
+ * Fork children until we have dcc_max_kids of them, and dcc_queue_kids more
+ * for --fair-share
  **/
 static void dcc_create_kids(int listen_fd) {
     pid_t kid;
+    int shard = -1, slot = -1, i;
 
-    while (dcc_nkids < dcc_max_kids) {
+    while (dcc_drain_state == DCC_RUNNING
+           && dcc_nkids < dcc_max_kids + dcc_queue_kids) {
+        for (i = 0; i < dcc_n_kid_pids; i++)
+            if (dcc_kid_pids[i] == 0)
+                break;
+#ifdef HAVE_LINUX
+        if (dcc_n_shards) {
+            if ((shard = dcc_shard_for_kid()) == -1
+                || (slot = dcc_shard_free_slot(shard)) == -1)
+                break;
+        }
+#endif
         if ((kid = fork()) == -1) {
             rs_log_error("fork failed: %s", strerror(errno));
             dcc_exit(EXIT_OUT_OF_MEMORY); /* probably */
         } else if (kid == 0) {
+            dcc_kid_index = i < dcc_n_kid_pids ? i : -1;
+#ifdef HAVE_LINUX
+            if (shard != -1) {
+                if (sched_setaffinity(0, sizeof dcc_shards[shard].cpus,
+                                      &dcc_shards[shard].cpus) == -1)
+                    rs_log_warning("sched_setaffinity failed: %s",
+                                   strerror(errno));
+                listen_fd = dcc_shards[shard].listen_fd;
+            }
+#endif
             dcc_stats_init_kid();
             dcc_exit(dcc_preforked_child(listen_fd));
         } else {
             /* in parent */
             ++dcc_nkids;
+            if (i < dcc_n_kid_pids)
+                dcc_kid_pids[i] = kid;
+#ifdef HAVE_LINUX
+            if (shard != -1) {
+                dcc_shard_kids[slot].pid = kid;
+                dcc_shard_kids[slot].shard = shard;
+                dcc_shards[shard].n_kids++;
+            }
+#endif
             rs_trace("up to %d children", dcc_nkids);
         }
     }
@@ -150,6 +473,11 @@ static int dcc_preforked_child(int listen_fd)
     const time_t child_lifetime = 60 /* seconds */;
     start = now = time(NULL);
 
+    /* Don't let a drain interrupt a job; see dcc_drain_kid_idle(). */
+    dcc_drain_kid_idle(0);
+    if (dcc_drain_state != DCC_RUNNING)
+        return 0;
+
 #ifdef HAVE_LINUX
     if (opt_oom_score_adj != INT_MIN) {
         FILE *f = fopen("/proc/self/oom_score_adj", "w");
@@ -171,10 +499,21 @@ static int dcc_preforked_child(int listen_fd)
         if (dcc_job_lifetime)
             alarm(0);
 
+        dcc_drain_kid_idle(1);
         do {
             acc_fd = accept(listen_fd, (struct sockaddr *) &cli_addr,
                             &cli_len);
         } while (acc_fd == -1 && errno == EINTR);
+        dcc_drain_kid_idle(0);
+
+        if (dcc_drain_state != DCC_RUNNING) {
+            /* The listening socket is non-blocking now: stop once nothing
+             * is queued, and don't pass that on to the job. */
+            if (acc_fd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+            if (acc_fd != -1)
+                fcntl(acc_fd, F_SETFL, fcntl(acc_fd, F_GETFL) & ~O_NONBLOCK);
+        }
 
         /* Kill this process if the compile job takes too long.
          * The synchronous timeout should happen first, so this alarm
@@ -191,10 +530,23 @@ static int dcc_preforked_child(int listen_fd)
 
         dcc_stats_event(STATS_TCP_ACCEPT);
 
+        if (dcc_kid_index != -1)
+            dcc_kid_busy[dcc_kid_index] = 1;
+#ifdef HAVE_LINUX
+        if (opt_placement)
+            dcc_placement_apply();
+#endif
+
         dcc_service_job(acc_fd, acc_fd,
                            (struct sockaddr *) &cli_addr, cli_len);
 
         dcc_close(acc_fd);
+#ifdef HAVE_LINUX
+        if (opt_placement)
+            dcc_placement_release();
+#endif
+        if (dcc_kid_index != -1)
+            dcc_kid_busy[dcc_kid_index] = 0;
         now = time(NULL);
     }
 
@@ -65,6 +65,8 @@ int dcc_r_bulk(int ofd,
         return 0;               /* don't decompress nothing */
 
     if (compression == DCC_COMPRESS_NONE) {
+        if (f_size >= DCC_URING_MIN_SIZE && dcc_uring_usable())
+            return dcc_pump_uring(ofd, ifd, f_size);
         return dcc_pump_readwrite(ofd, ifd, f_size);
     } else if (compression == DCC_COMPRESS_LZO1X) {
         return dcc_r_bulk_lzo1x(ofd, ifd, f_size);
@@ -50,6 +50,9 @@
 #include "lock.h"
 #include "compile.h"
 #include "bulk.h"
+#ifdef HAVE_TLS
+#include "tls.h"
+#endif
 #ifdef HAVE_GSSAPI
 #include "auth.h"
 
@@ -198,6 +201,44 @@ static int max (int a, int b) {
       return b;
 }
 
+
+/**
+ * Send the -fprofile-use profile @p fname straight from where it lies.
+ *
+ * For hosts with the ",gcda" option, send its hash first and then the
+ * body only if the server doesn't already have it in its profile cache.
+ **/
+static int dcc_x_gcda(int to_net_fd, int from_net_fd, const char *fname,
+                      struct dcc_hostdef *host)
+{
+    char hex[DCC_GCDA_HASH_LEN + 1];
+    unsigned hit;
+    int ret;
+
+    if (!host->gcda_cache) {
+        if ((ret = dcc_x_token_int(to_net_fd, "GCDA", 1)))
+            return ret;
+        return dcc_x_file(to_net_fd, fname, "DOTI", host->compr, NULL);
+    }
+
+    if ((ret = dcc_gcda_hash(fname, hex))
+        || (ret = dcc_x_token_int(to_net_fd, "GCDA", DCC_GCDA_BY_HASH))
+        || (ret = dcc_x_token_string(to_net_fd, "GSUM", hex)))
+        return ret;
+
+    /* Push the request out before waiting for the answer. */
+    tcp_cork_sock(to_net_fd, 0);
+    if ((ret = dcc_r_token_int(from_net_fd, "GHIT", &hit)))
+        return ret;
+    tcp_cork_sock(to_net_fd, 1);
+
+    if (hit) {
+        rs_trace("%s already has profile %s", host->hostname, fname);
+        return 0;
+    }
+    return dcc_x_file(to_net_fd, fname, "DOTI", host->compr, NULL);
+}
+
 /**
  * Pass a compilation across the network.
  *
@@ -213,7 +254,8 @@ static int max (int a, int b) {
  * @param argv Compiler command to run.
  *
  * @param cpp_fname Filename of preprocessed source.  May not be complete yet,
- * depending on @p cpp_pid.
+ * depending on @p cpp_pid.  If it is moved out of memory, this is updated
+ * to its new name.
  *
  * @param files If we are doing preprocessing on the server, the names of
  * all the files needed; otherwise, NULL.
@@ -221,7 +263,8 @@ static int max (int a, int b) {
  * @param output_fname File that the object code should be delivered to.
  *
  * @param cpp_pid If nonzero, the pid of the preprocessor.  Must be
- * allowed to complete before we send the input file.
+ * allowed to complete before we send the input file.  Set to 0 once it
+ * has been collected, so that a retry can send the same file again.
  *
  * @param local_cpu_lock_fd If != -1, file descriptor for the lock file.
  * Should be != -1 iff (host->cpp_where != DCC_CPP_ON_SERVER).
@@ -242,12 +285,12 @@ static int max (int a, int b) {
  */
 int dcc_compile_remote(char **argv,
                        char *input_fname,
-                       char *cpp_fname,
+                       char **cpp_fname,
                        char **files,
                        char *output_fname,
                        char *deps_fname,
                        char *server_stderr_fname,
-                       pid_t cpp_pid,
+                       pid_t *cpp_pid,
                        int local_cpu_lock_fd,
                        struct dcc_hostdef *host,
 		       int dist_lto,
@@ -257,12 +300,12 @@ int dcc_compile_remote(char **argv,
     int ret;
     pid_t ssh_pid = 0;
     int ssh_status;
+    pid_t tls_pid = 0;
+    int tls_status;
     off_t doti_size;
-    off_t doti_gcda_size;
     struct timeval before, after;
     unsigned int n_files;
     char *gcda_fname = NULL;
-    char *gcda_tmp_fname = NULL;
     char *mangle_filename = NULL;
     char *profile_use_path = NULL;
     int profile_use_gcda = 0;
@@ -282,6 +325,16 @@ int dcc_compile_remote(char **argv,
     if ((ret = dcc_remote_connect(host, &to_net_fd, &from_net_fd, &ssh_pid)))
         goto out;
 
+#ifdef HAVE_TLS
+    if (host->tls) {
+        if ((ret = dcc_tls_client_start(host, &to_net_fd, &from_net_fd,
+                                        &tls_pid)) != 0) {
+            rs_log_error("failed to set up TLS with %s", host->hostname);
+            goto out;
+        }
+    }
+#endif
+
 #ifdef HAVE_GSSAPI
     /* Perform requested security. */
     if(host->authenticate) {
@@ -319,8 +372,9 @@ int dcc_compile_remote(char **argv,
         if ((ret = dcc_send_header(to_net_fd, argv, host)))
             goto out;
 
-        if ((ret = dcc_wait_for_cpp(cpp_pid, status, input_fname)))
+        if ((ret = dcc_wait_for_cpp(*cpp_pid, status, input_fname)))
             goto out;
+        *cpp_pid = 0;
 
         /* We are done with local preprocessing.  Unlock to allow someone
          * else to start preprocessing. */
@@ -332,7 +386,12 @@ int dcc_compile_remote(char **argv,
         if (*status != 0)
             goto out;
 
-        if ((ret = dcc_x_file(to_net_fd, cpp_fname, "DOTI", host->compr,
+        /* If cpp wrote more than we want to keep in memory, move it out
+         * before we wait on the network. */
+        if ((ret = dcc_mem_tmp_spill(cpp_fname)))
+            goto out;
+
+        if ((ret = dcc_x_file(to_net_fd, *cpp_fname, "DOTI", host->compr,
                               &doti_size)))
             goto out;
 
@@ -355,15 +414,6 @@ int dcc_compile_remote(char **argv,
 
         if (profile_use_gcda && output_fname)
 	{
-	   const char *tempdir;
-	   if ((ret = dcc_get_tmp_top(&tempdir)))
-	     return ret;
-
-	   if (access(tempdir, W_OK|X_OK) == -1) {
-	     rs_log_error("can't use TMPDIR \"%s\": %s", tempdir, strerror(errno));
-	     return EXIT_IO_ERROR;
-	   }
-
 	    char cwd[PATH_MAX];
 	    getcwd(cwd, sizeof(cwd));
 	   const char *dot = dcc_find_extension_const(output_fname);
@@ -409,66 +459,13 @@ int dcc_compile_remote(char **argv,
 	   strcat (gcda_fname, ".gcda");
 	   rs_trace("gcda_fname:%s", gcda_fname);
 
-	   int fd;
-	   const char * dot2 = dcc_find_extension_const(cpp_fname);
-	   size_t temp_len = strlen(cpp_fname) - strlen(dot2) + strlen(".gcda") + 1;
-	   gcda_tmp_fname = malloc (temp_len);
-	   memset(gcda_tmp_fname, 0, temp_len);
-
-	   strncpy(gcda_tmp_fname, cpp_fname, strlen(cpp_fname) - strlen(dot2));
-	   strcat (gcda_tmp_fname, ".gcda");
-	   rs_trace("gcda_tmp_fname:%s", gcda_tmp_fname);
-
-	   do {
-	     int fd_src = open(gcda_fname, O_RDONLY, 0600);
-	     if (fd_src == -1) {
-	       rs_trace("gcda file doesn't exist %s: %s", gcda_fname, strerror(errno));
-	       goto gcda_early_out;
-	     }
-
-	     fd = open(gcda_tmp_fname, O_WRONLY | O_CREAT | O_EXCL, 0600);
-	     if (fd == -1) {
-	       /* try again */
-	       rs_trace("failed to create %s: %s", gcda_tmp_fname, strerror(errno));
-	       continue;
-	     }
-
-	     char buff[1024];
-	     int len;
-             while ((len = read(fd_src, buff, 1024)) != 0)
-	     {
-	       if (len == -1)
-		 goto gcda_early_out;
-               write(fd, buff, len);
-             }
-
-             if (close(fd) == -1) {  /* huh? */
-	       rs_log_warning("failed to close %s: %s", gcda_tmp_fname, strerror(errno));
-	       goto gcda_early_out;
-	     }
-
-	     if (close(fd_src) == -1) {  /* huh? */
-	       rs_log_warning("failed to close %s: %s", gcda_fname, strerror(errno));
-	       goto gcda_early_out;
-	     }
-
-	     break;
-	   } while (1);
-
-	   if ((ret = dcc_add_cleanup(gcda_tmp_fname))) {
-	     /* bailing out */
-	     unlink(gcda_tmp_fname);
+	   if (access(gcda_fname, R_OK) == -1) {
+	     rs_trace("gcda file doesn't exist %s: %s", gcda_fname, strerror(errno));
 	     goto gcda_early_out;
 	   }
 
 	   gcda_exist = 1;
-           if ((ret = dcc_x_token_int(to_net_fd, "GCDA", gcda_exist)) != 0) {
-             rs_trace("fail to send token %s", strerror(errno));
-             goto out;
-           }
-
-          if ((ret = dcc_x_file(to_net_fd, gcda_tmp_fname, "DOTI", host->compr,
-		  &doti_gcda_size)))
+	   if ((ret = dcc_x_gcda(to_net_fd, from_net_fd, gcda_fname, host)))
 	    goto out;
 	}
     }
@@ -532,12 +529,14 @@ gcda_early_out:
         dcc_collect_child("ssh", ssh_pid, &ssh_status, timeout_null_fd); /* ignore failure */
     }
 
+    /* Likewise the TLS relay, which exits once we close our end. */
+    if (tls_pid) {
+        dcc_collect_child("tls", tls_pid, &tls_status, timeout_null_fd); /* ignore failure */
+    }
+
     if (gcda_fname)
       free (gcda_fname);
 
-    if (gcda_tmp_fname)
-      free (gcda_tmp_fname);
-
     if (mangle_filename)
       free (mangle_filename);
 
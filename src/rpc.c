@@ -104,6 +104,16 @@ int dcc_x_result_header(int ofd,
 }
 
 
+/**
+ * Send instead of a result, when the compiler was killed for going over the
+ * per-job memory limit of @p limit_mb.
+ **/
+int dcc_x_job_oom(int ofd, unsigned limit_mb)
+{
+    return dcc_x_token_int(ofd, "OOMK", limit_mb);
+}
+
+
 int dcc_x_cc_status(int ofd, int status)
 {
     return dcc_x_token_int(ofd, "STAT", (unsigned) status);
@@ -28,6 +28,7 @@
 #define __DISTCC_RPC_H__
 
 int dcc_x_result_header(int ofd, enum dcc_protover);
+int dcc_x_job_oom(int ofd, unsigned limit_mb);
 int dcc_r_result_header(int ofd, enum dcc_protover);
 
 int dcc_x_cc_status(int, int);
@@ -47,7 +48,7 @@ int dcc_r_sometoken_int(int ifd, char *token, unsigned *val);
 int dcc_explain_mismatch(const char *buf, size_t buflen, int ifd);
 
 /* srvrpc.c */
-int dcc_r_request_header(int ifd, enum dcc_protover *);
+int dcc_r_request_header(int ifd, enum dcc_protover *, int *prio);
 int dcc_r_argv(int ifd,
                const char *argc_token,
                const char *argv_token,
@@ -0,0 +1,1182 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/*
+ * schedsim.c:
+ * distcc-schedsim, a discrete-event simulation of host selection.
+ *
+ * This is linked with the client's own where.c, backoff.c and hosts.c, so
+ * that it is dcc_pick_host_from_list_and_lock_it(), dcc_remove_disliked()
+ * and friends that decide where each job goes.  What they would do to the
+ * outside world is done to the simulation instead:
+ *
+ *  - CPU locks are slots in a table here rather than files under
+ *    $DISTCC_DIR; see dcc_lock_host().
+ *
+ *  - Backoff marks record simulated time, and dcc_check_timefile() turns
+ *    them back into the mtimes backoff.c expects.
+ *
+ *  - When every slot is busy dcc_lock_one() sleeps in usleep(); ours jumps
+ *    back to the event loop, which tries the job again when the pause
+ *    would have ended.
+ *
+ *  - getpid() gives each job a process id of its own, since each would be
+ *    a separate client, and --randomize orders hosts by it.
+ *
+ * There is no farm scheduler; dcc_sched_lease() always says so.
+ *
+ * Jobs run as if from "make -jN": N are started at once and each one that
+ * finishes starts the next.  A job is connected to its host after one
+ * round trip, sends its input, queues for one of the host's CPUs, compiles
+ * in its cost divided by the host's speed, and sends its output back.  A
+ * host that fails a job does so after one round trip, and the job falls
+ * back to localhost as the real client's would.  A file compiled again on
+ * the same host takes --cache-factor of the time, as with a warm ccache
+ * or include cache, which is what --affinity is for.
+ *
+ * The jobs come either from --trace, or are made up from the --cost,
+ * --in and --out distributions.  A trace can be a distcc client log
+ * (DISTCC_LOG with DISTCC_VERBOSE=1), whose "N bytes from FILE compiled on
+ * HOST in Ss" lines are replayed scaled by that host's speed, or lines of
+ * "FILE SECONDS [IN_KB [OUT_KB]]".
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "hosts.h"
+#include "lock.h"
+#include "where.h"
+#include "timefile.h"
+#include "scheduler.h"
+#include "state.h"
+#include "popt.h"
+
+const char *rs_program_name = "distcc-schedsim";
+
+struct ss_dist {
+    double *values;
+    int *weights;
+    int n, total;
+};
+
+/* A modelled machine, and what happened to it in the current run. */
+struct ss_host {
+    char *name;
+    double speed;               /* relative to the job costs */
+    int cpus;                   /* compiles it runs at once */
+    double fail;                /* chance of failing a job */
+    double rtt;                 /* seconds */
+    double mbps;
+
+    int listed;                 /* in the host list */
+    int n_slots;
+    int running;
+    long *queue, queue_head, queue_len;
+    unsigned char *compiled;    /* by file number, for --cache-factor */
+
+    long jobs, failures, cache_hits;
+    double slot_busy, cpu_busy; /* slot-seconds and CPU-seconds */
+
+    struct ss_host *next;
+};
+
+struct ss_job {
+    char *file;
+    long file_no;
+    double cost;                /* seconds on a host of speed 1 */
+    double in_kb, out_kb;
+
+    double ready;               /* when it last wanted a slot */
+    double locked;              /* when it got one */
+    double wait;
+    struct dcc_hostdef *hostdef;
+    struct ss_host *host;
+    int lock_fd;
+    int local;                  /* falling back to localhost */
+};
+
+enum ss_event_type {
+    SS_START, SS_START_LOCAL, SS_ARRIVE, SS_COMPILED, SS_FAILED, SS_DONE
+};
+
+struct ss_event {
+    double when;
+    long seq;
+    enum ss_event_type type;
+    long job;
+};
+
+enum ss_policy {
+    SS_FIRST_FREE, SS_RANDOM, SS_WEIGHTED, SS_AFFINITY, SS_N_POLICIES
+};
+
+static const char *ss_policy_names[SS_N_POLICIES] = {
+    "first-free", "random", "weighted", "affinity"
+};
+
+/* Options */
+static const char *arg_hosts = NULL;
+static const char *arg_policy = "all";
+static const char *arg_trace = NULL;
+static const char *arg_cost = "500:6,2000:3,8000:1";
+static const char *arg_in = "200";
+static const char *arg_out = "50";
+static int arg_parallel = 8;
+static int arg_jobs = 200;
+static int arg_files = 0;
+static int arg_pause = 1000;
+static int arg_backoff = 60;
+static int arg_seed = 1;
+static double arg_cache_factor = 1.0;
+static int opt_json = 0;
+
+static struct ss_dist ss_cost, ss_in, ss_out;
+
+static struct ss_host *ss_hosts;
+static struct ss_job *ss_jobs;
+static long ss_n_jobs, ss_n_files;
+
+/* The host list as given, split into its options and its hosts. */
+static char *ss_hostlist_options;
+static struct dcc_hostdef *ss_hostlist;
+
+/* The state of the current run. */
+static double ss_now;
+static struct ss_event *ss_events;
+static long ss_n_events, ss_max_events, ss_event_seq;
+static long ss_next_job, ss_done;
+static long ss_pauses, ss_fallbacks, ss_no_hosts;
+static unsigned ss_rand_state;
+
+static const struct poptOption ss_options[] = {
+    { "backoff", 0,       POPT_ARG_INT, &arg_backoff, 0, 0, 0 },
+    { "cache-factor", 0,  POPT_ARG_DOUBLE, &arg_cache_factor, 0, 0, 0 },
+    { "cost", 0,          POPT_ARG_STRING, &arg_cost, 0, 0, 0 },
+    { "files", 0,         POPT_ARG_INT, &arg_files, 0, 0, 0 },
+    { "help", 0,          POPT_ARG_NONE, 0, '?', 0, 0 },
+    { "hosts", 'H',       POPT_ARG_STRING, &arg_hosts, 0, 0, 0 },
+    { "in", 0,            POPT_ARG_STRING, &arg_in, 0, 0, 0 },
+    { "jobs", 'n',        POPT_ARG_INT, &arg_jobs, 0, 0, 0 },
+    { "json", 0,          POPT_ARG_NONE, &opt_json, 0, 0, 0 },
+    { "model", 'm',       POPT_ARG_STRING, 0, 'm', 0, 0 },
+    { "out", 0,           POPT_ARG_STRING, &arg_out, 0, 0, 0 },
+    { "parallel", 'j',    POPT_ARG_INT, &arg_parallel, 0, 0, 0 },
+    { "pause", 0,         POPT_ARG_INT, &arg_pause, 0, 0, 0 },
+    { "policy", 'p',      POPT_ARG_STRING, &arg_policy, 0, 0, 0 },
+    { "seed", 0,          POPT_ARG_INT, &arg_seed, 0, 0, 0 },
+    { "trace", 't',       POPT_ARG_STRING, &arg_trace, 0, 0, 0 },
+    { "version", 0,       POPT_ARG_NONE, 0, 'V', 0, 0 },
+    { 0, 0, 0, 0, 0, 0, 0 }
+};
+
+
+static void ss_show_usage(void)
+{
+    dcc_show_version("distcc-schedsim");
+    printf(
+"Usage:\n"
+"   distcc-schedsim [OPTIONS]\n"
+"\n"
+"Options:\n"
+"    --help                     explain usage and exit\n"
+"    --version                  show version and exit\n"
+"    -H, --hosts HOSTLIST       as in DISTCC_HOSTS (default $DISTCC_HOSTS)\n"
+"    -m, --model HOST,KEY=VALUE,...\n"
+"                               describe a host; the keys are speed (1),\n"
+"                               cpus (its slots), fail (0, a fraction),\n"
+"                               rtt (0.2 ms) and mbps (1000)\n"
+"    -p, --policy NAME          first-free, random, weighted, affinity or\n"
+"                               all (default all)\n"
+"    -j, --parallel N           jobs at once, as in make -j (default 8)\n"
+"    -t, --trace FILE           replay jobs from a client log or a list of\n"
+"                               \"FILE SECONDS [IN_KB [OUT_KB]]\"\n"
+"    -n, --jobs N               without --trace, make up N jobs (default 200)\n"
+"    --files N                  ... over N source files (default N jobs)\n"
+"    --cost MS[:WEIGHT],...     compile time on a host of speed 1\n"
+"    --in KB[:WEIGHT],...       size of preprocessed source (default 200)\n"
+"    --out KB[:WEIGHT],...      size of object file (default 50)\n"
+"    --cache-factor F           time for a file the host compiled before\n"
+"                               (default 1)\n"
+"    --pause MS                 DISTCC_PAUSE_TIME_MSEC (default 1000)\n"
+"    --backoff SECONDS          DISTCC_BACKOFF_PERIOD (default 60)\n"
+"    --seed N                   seed for the random choices (default 1)\n"
+"    --json                     report as JSON, one line per policy\n"
+"\n"
+"The policies are run over the same jobs.  \"weighted\" lists the hosts\n"
+"fastest first, by speed times usable slots, as lsdistcc -a would.\n");
+}
+
+
+/*
+ * The client's view of the world, simulated.
+ */
+
+struct ss_lock {
+    char *name;
+    int held;
+};
+
+static struct ss_lock *ss_locks;
+static int ss_n_locks;
+
+struct ss_mark {
+    char *name;
+    double when;
+};
+
+static struct ss_mark *ss_marks;
+static int ss_n_marks;
+
+static jmp_buf ss_pause_env;
+static int ss_picking;
+static pid_t ss_client_pid;
+
+static struct dcc_hostdef ss_local, ss_local_cpp;
+struct dcc_hostdef *dcc_hostdef_local = &ss_local;
+struct dcc_hostdef *dcc_hostdef_local_cpp = &ss_local_cpp;
+
+
+static void ss_host_key(char *buf, size_t len, const char *lockname,
+                        const struct dcc_hostdef *host, int slot)
+{
+    if (host->mode == DCC_MODE_LOCAL)
+        snprintf(buf, len, "%s_localhost_%d", lockname, slot);
+    else
+        snprintf(buf, len, "%s_%s@%s_%d_%d", lockname,
+                 host->user ? host->user : "", host->hostname, host->port,
+                 slot);
+}
+
+
+int dcc_lock_host(const char *lockname,
+                  const struct dcc_hostdef *host, int slot, int block,
+                  int *lock_fd)
+{
+    char key[512];
+    int i;
+
+    (void) block;
+    ss_host_key(key, sizeof key, lockname, host, slot);
+    for (i = 0; i < ss_n_locks; i++)
+        if (strcmp(ss_locks[i].name, key) == 0)
+            break;
+    if (i == ss_n_locks) {
+        ss_locks = realloc(ss_locks, (ss_n_locks + 1) * sizeof *ss_locks);
+        if (!ss_locks || !(ss_locks[i].name = strdup(key)))
+            return EXIT_OUT_OF_MEMORY;
+        ss_locks[i].held = 0;
+        ss_n_locks++;
+    }
+    if (ss_locks[i].held)
+        return EXIT_BUSY;
+    ss_locks[i].held = 1;
+    *lock_fd = i;
+    return 0;
+}
+
+
+int dcc_unlock(int lock_fd)
+{
+    ss_locks[lock_fd].held = 0;
+    return 0;
+}
+
+
+static struct ss_mark *ss_find_mark(const struct dcc_hostdef *host)
+{
+    char key[512];
+    int i;
+
+    ss_host_key(key, sizeof key, "backoff", host, 0);
+    for (i = 0; i < ss_n_marks; i++)
+        if (strcmp(ss_marks[i].name, key) == 0)
+            return &ss_marks[i];
+    ss_marks = realloc(ss_marks, (ss_n_marks + 1) * sizeof *ss_marks);
+    if (!ss_marks || !(ss_marks[i].name = strdup(key))) {
+        rs_log_crit("out of memory");
+        exit(EXIT_OUT_OF_MEMORY);
+    }
+    ss_marks[i].when = -1;
+    ss_n_marks++;
+    return &ss_marks[i];
+}
+
+
+int dcc_mark_timefile(const char *lockname, const struct dcc_hostdef *host)
+{
+    (void) lockname;
+    ss_find_mark(host)->when = ss_now;
+    return 0;
+}
+
+
+int dcc_remove_timefile(const char *lockname, const struct dcc_hostdef *host)
+{
+    (void) lockname;
+    ss_find_mark(host)->when = -1;
+    return 0;
+}
+
+
+int dcc_check_timefile(const char *lockname,
+                       const struct dcc_hostdef *host,
+                       time_t *mtime)
+{
+    struct ss_mark *m = ss_find_mark(host);
+
+    (void) lockname;
+    if (m->when < 0)
+        *mtime = 0;
+    else
+        *mtime = time(NULL) - (time_t) (ss_now - m->when);
+    return 0;
+}
+
+
+int dcc_sched_lease(struct dcc_hostdef *hostlist, int prefer_order,
+                    struct dcc_hostdef **host, int *slot)
+{
+    (void) hostlist;
+    (void) prefer_order;
+    (void) host;
+    (void) slot;
+    return EXIT_CONNECT_FAILED;
+}
+
+
+void dcc_sched_hold(int lock_fd)
+{
+    (void) lock_fd;
+}
+
+
+void dcc_sched_release(void)
+{
+}
+
+
+int dcc_note_state(enum dcc_phase state, const char *source_file,
+                   const char *host, enum dcc_host target)
+{
+    (void) state;
+    (void) source_file;
+    (void) host;
+    (void) target;
+    return 0;
+}
+
+
+void dcc_note_state_slot(int slot, enum dcc_host target)
+{
+    (void) slot;
+    (void) target;
+}
+
+
+/* dcc_lock_pause() would sleep here; go back to the event loop instead. */
+int usleep(useconds_t usec)
+{
+    (void) usec;
+    if (ss_picking)
+        longjmp(ss_pause_env, 1);
+    return 0;
+}
+
+
+pid_t getpid(void)
+{
+    if (ss_picking)
+        return ss_client_pid;
+    return (pid_t) syscall(SYS_getpid);
+}
+
+
+/*
+ * Models and jobs.
+ */
+
+static unsigned ss_random(void)
+{
+    ss_rand_state = ss_rand_state * 1103515245 + 12345;
+    return (ss_rand_state >> 16) & 0x7fff;
+}
+
+
+static double ss_uniform(void)
+{
+    return (ss_random() * 32768.0 + ss_random()) / (32768.0 * 32768.0);
+}
+
+
+/* Parse "VALUE[:WEIGHT],..." into @p d. */
+static int ss_parse_dist(const char *name, const char *spec,
+                         struct ss_dist *d)
+{
+    const char *p = spec;
+    char *end;
+    int n = 1;
+
+    for (; *p; p++)
+        if (*p == ',')
+            n++;
+    d->values = calloc(n, sizeof *d->values);
+    d->weights = calloc(n, sizeof *d->weights);
+    if (!d->values || !d->weights)
+        return EXIT_OUT_OF_MEMORY;
+    d->n = d->total = 0;
+
+    for (p = spec; d->n < n; p = end + 1) {
+        d->values[d->n] = strtod(p, &end);
+        d->weights[d->n] = 1;
+        if (end == p || d->values[d->n] < 0)
+            goto bad;
+        if (*end == ':') {
+            p = end + 1;
+            d->weights[d->n] = (int) strtol(p, &end, 10);
+            if (end == p || d->weights[d->n] < 1)
+                goto bad;
+        }
+        d->total += d->weights[d->n++];
+        if (*end != ',' && *end != '\0')
+            goto bad;
+    }
+    return 0;
+
+  bad:
+    rs_log_error("--%s: can't parse \"%s\"; expected VALUE[:WEIGHT],...",
+                 name, spec);
+    return EXIT_BAD_ARGUMENTS;
+}
+
+
+static double ss_choose(const struct ss_dist *d)
+{
+    int r = (int) (ss_random() % d->total), i;
+
+    for (i = 0; r >= d->weights[i]; i++)
+        r -= d->weights[i];
+    return d->values[i];
+}
+
+
+static struct ss_host *ss_find_host(const char *name)
+{
+    struct ss_host *m;
+
+    for (m = ss_hosts; m; m = m->next)
+        if (strcmp(m->name, name) == 0)
+            return m;
+    if (!(m = calloc(1, sizeof *m)) || !(m->name = strdup(name))) {
+        rs_log_crit("out of memory");
+        exit(EXIT_OUT_OF_MEMORY);
+    }
+    m->speed = 1.0;
+    m->rtt = 0.0002;
+    m->mbps = 1000;
+    m->next = ss_hosts;
+    ss_hosts = m;
+    return m;
+}
+
+
+/* Parse "HOST,KEY=VALUE,..." from --model. */
+static int ss_parse_model(const char *spec)
+{
+    char *copy, *p, *key, *value, *end;
+    struct ss_host *m;
+    double v;
+    int ret = 0;
+
+    if (!(copy = strdup(spec)))
+        return EXIT_OUT_OF_MEMORY;
+    p = strchr(copy, ',');
+    if (p)
+        *p++ = '\0';
+    m = ss_find_host(copy);
+
+    while (p && *p && ret == 0) {
+        key = p;
+        if ((p = strchr(p, ',')))
+            *p++ = '\0';
+        if (!(value = strchr(key, '='))) {
+            ret = EXIT_BAD_ARGUMENTS;
+            break;
+        }
+        *value++ = '\0';
+        v = strtod(value, &end);
+        if (end == value || *end || v < 0)
+            ret = EXIT_BAD_ARGUMENTS;
+        else if (strcmp(key, "speed") == 0 && v > 0)
+            m->speed = v;
+        else if (strcmp(key, "cpus") == 0 && v >= 1)
+            m->cpus = (int) v;
+        else if (strcmp(key, "fail") == 0 && v <= 1)
+            m->fail = v;
+        else if (strcmp(key, "rtt") == 0)
+            m->rtt = v / 1000;
+        else if (strcmp(key, "mbps") == 0 && v > 0)
+            m->mbps = v;
+        else
+            ret = EXIT_BAD_ARGUMENTS;
+    }
+    if (ret)
+        rs_log_error("--model: can't parse \"%s\"; expected "
+                     "HOST,KEY=VALUE,... with keys speed, cpus, fail, rtt "
+                     "and mbps", spec);
+    free(copy);
+    return ret;
+}
+
+
+static long ss_file_no(const char *file)
+{
+    long i;
+
+    for (i = 0; i < ss_n_jobs; i++)
+        if (strcmp(ss_jobs[i].file, file) == 0)
+            return ss_jobs[i].file_no;
+    return ss_n_files++;
+}
+
+
+static int ss_add_job(const char *file, double cost, double in_kb,
+                      double out_kb)
+{
+    struct ss_job *j;
+
+    if (!(ss_jobs = realloc(ss_jobs, (ss_n_jobs + 1) * sizeof *ss_jobs)))
+        return EXIT_OUT_OF_MEMORY;
+    j = &ss_jobs[ss_n_jobs];
+    memset(j, 0, sizeof *j);
+    j->file_no = ss_file_no(file);
+    if (!(j->file = strdup(file)))
+        return EXIT_OUT_OF_MEMORY;
+    j->cost = cost;
+    j->in_kb = in_kb;
+    j->out_kb = out_kb;
+    ss_n_jobs++;
+    return 0;
+}
+
+
+static int ss_make_jobs(void)
+{
+    char file[64];
+    long i, files = arg_files > 0 ? arg_files : arg_jobs;
+    int ret;
+
+    for (i = 0; i < arg_jobs; i++) {
+        snprintf(file, sizeof file, "src/file%ld.c", i % files);
+        if ((ret = ss_add_job(file, ss_choose(&ss_cost) / 1000,
+                              ss_choose(&ss_in), ss_choose(&ss_out))))
+            return ret;
+    }
+    return 0;
+}
+
+
+static int ss_read_trace(const char *path)
+{
+    char line[4096], file[1024], host[256];
+    const char *p;
+    unsigned long bytes;
+    double secs, in_kb, out_kb;
+    FILE *f;
+    int n, ret = 0;
+
+    if (!(f = fopen(path, "r"))) {
+        rs_log_error("failed to open %s: %s", path, strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+    while (ret == 0 && fgets(line, sizeof line, f)) {
+        if ((p = strstr(line, " bytes from "))) {
+            /* distcc[PID] N bytes from FILE compiled on HOST in Ss, ... */
+            while (p > line && p[-1] >= '0' && p[-1] <= '9')
+                p--;
+            if (sscanf(p, "%lu bytes from %1023s compiled on %255s in %lfs",
+                       &bytes, file, host, &secs) == 4)
+                ret = ss_add_job(file, secs * ss_find_host(host)->speed,
+                                 bytes / 1024.0, ss_choose(&ss_out));
+        } else if (line[0] != '#') {
+            in_kb = ss_choose(&ss_in);
+            out_kb = ss_choose(&ss_out);
+            n = sscanf(line, "%1023s %lf %lf %lf", file, &secs, &in_kb,
+                       &out_kb);
+            if (n >= 2)
+                ret = ss_add_job(file, secs, in_kb, out_kb);
+        }
+    }
+    fclose(f);
+    if (ret == 0 && ss_n_jobs == 0) {
+        rs_log_error("no jobs found in %s", path);
+        ret = EXIT_BAD_ARGUMENTS;
+    }
+    return ret;
+}
+
+
+/*
+ * Policies.  Each is a way of writing the host list, which the client's
+ * own code then works from.
+ */
+
+static int ss_parse_hostlist(const char *hosts)
+{
+    const char *p, *end;
+    size_t len = 0;
+    int n_hosts = 0, ret;
+
+    /* Keep global options, apart from those the policies choose. */
+    if (!(ss_hostlist_options = calloc(1, strlen(hosts) + 2)))
+        return EXIT_OUT_OF_MEMORY;
+    for (p = hosts; *p; p = end) {
+        while (*p == ' ' || *p == '\t' || *p == '\n')
+            p++;
+        for (end = p; *end && *end != ' ' && *end != '\t' && *end != '\n';)
+            end++;
+        if (end - p > 2 && p[0] == '-' && p[1] == '-'
+            && strncmp(p, "--randomize", 11) && strncmp(p, "--affinity", 10)) {
+            memcpy(ss_hostlist_options + len, p, end - p);
+            len += end - p;
+            ss_hostlist_options[len++] = ' ';
+        }
+    }
+
+    if ((ret = dcc_parse_hosts(hosts, "--hosts", &ss_hostlist, &n_hosts,
+                               NULL)))
+        return ret;
+    if (!ss_hostlist) {
+        rs_log_error("no hosts in \"%s\"", hosts);
+        return EXIT_NO_HOSTS;
+    }
+    return 0;
+}
+
+
+static double ss_capacity(const struct dcc_hostdef *h)
+{
+    struct ss_host *m = ss_find_host(h->hostname);
+    int slots = h->n_slots;
+
+    if (m->cpus && m->cpus < slots)
+        slots = m->cpus;
+    return m->speed * slots;
+}
+
+
+static int ss_compare_capacity(const void *a, const void *b)
+{
+    double x = ss_capacity(*(struct dcc_hostdef *const *) a);
+    double y = ss_capacity(*(struct dcc_hostdef *const *) b);
+
+    return (x < y) - (x > y);
+}
+
+
+static char *ss_policy_hostlist(enum ss_policy policy)
+{
+    struct dcc_hostdef *h, **order;
+    size_t len;
+    char *s;
+    int n = 0, i;
+
+    len = strlen(ss_hostlist_options) + 16;
+    for (h = ss_hostlist; h; h = h->next, n++)
+        len += strlen(h->hostdef_string) + 1;
+    if (!(s = malloc(len)) || !(order = malloc(n * sizeof *order))) {
+        rs_log_crit("out of memory");
+        exit(EXIT_OUT_OF_MEMORY);
+    }
+    for (i = 0, h = ss_hostlist; h; h = h->next)
+        order[i++] = h;
+    if (policy == SS_WEIGHTED)
+        qsort(order, n, sizeof *order, ss_compare_capacity);
+
+    strcpy(s, ss_hostlist_options);
+    if (policy == SS_RANDOM)
+        strcat(s, "--randomize ");
+    else if (policy == SS_AFFINITY)
+        strcat(s, "--affinity ");
+    for (i = 0; i < n; i++) {
+        strcat(s, order[i]->hostdef_string);
+        strcat(s, i < n - 1 ? " " : "");
+    }
+    free(order);
+    return s;
+}
+
+
+/*
+ * The simulation.
+ */
+
+static void ss_schedule(double when, enum ss_event_type type, long job)
+{
+    struct ss_event e, t;
+    long i;
+
+    if (ss_n_events == ss_max_events) {
+        ss_max_events = ss_max_events ? 2 * ss_max_events : 256;
+        if (!(ss_events = realloc(ss_events,
+                                  ss_max_events * sizeof *ss_events))) {
+            rs_log_crit("out of memory");
+            exit(EXIT_OUT_OF_MEMORY);
+        }
+    }
+    e.when = when;
+    e.seq = ss_event_seq++;
+    e.type = type;
+    e.job = job;
+
+    /* Binary heap on (when, seq), so that ties go first come first served. */
+    i = ss_n_events++;
+    ss_events[i] = e;
+    while (i > 0) {
+        long parent = (i - 1) / 2;
+        if (ss_events[parent].when < ss_events[i].when
+            || (ss_events[parent].when == ss_events[i].when
+                && ss_events[parent].seq < ss_events[i].seq))
+            break;
+        t = ss_events[parent];
+        ss_events[parent] = ss_events[i];
+        ss_events[i] = t;
+        i = parent;
+    }
+}
+
+
+static struct ss_event ss_next_event(void)
+{
+    struct ss_event top = ss_events[0], t;
+    long i = 0, child;
+
+    ss_events[0] = ss_events[--ss_n_events];
+    while ((child = 2 * i + 1) < ss_n_events) {
+        if (child + 1 < ss_n_events
+            && (ss_events[child + 1].when < ss_events[child].when
+                || (ss_events[child + 1].when == ss_events[child].when
+                    && ss_events[child + 1].seq < ss_events[child].seq)))
+            child++;
+        if (ss_events[i].when < ss_events[child].when
+            || (ss_events[i].when == ss_events[child].when
+                && ss_events[i].seq < ss_events[child].seq))
+            break;
+        t = ss_events[child];
+        ss_events[child] = ss_events[i];
+        ss_events[i] = t;
+        i = child;
+    }
+    return top;
+}
+
+
+/* Seconds to send @p kb over the link to @p m, after half a round trip. */
+static double ss_transfer(const struct ss_host *m, double kb)
+{
+    return m->rtt / 2 + kb * 1024 * 8 / (m->mbps * 1e6);
+}
+
+
+static void ss_run_on_cpu(struct ss_host *m, long j_no)
+{
+    struct ss_job *j = &ss_jobs[j_no];
+    double secs;
+
+    if (m->cpus && m->running >= m->cpus) {
+        m->queue[(m->queue_head + m->queue_len++) % ss_n_jobs] = j_no;
+        return;
+    }
+    m->running++;
+    secs = j->cost / m->speed;
+    if (m->compiled[j->file_no]) {
+        secs *= arg_cache_factor;
+        m->cache_hits++;
+    }
+    m->compiled[j->file_no] = 1;
+    m->cpu_busy += secs;
+    ss_schedule(ss_now + secs, SS_COMPILED, j_no);
+}
+
+
+/* Ask the client's code for a slot for job @p j_no; or for a local one. */
+static int ss_pick(long j_no, int local)
+{
+    struct ss_job *j = &ss_jobs[j_no];
+    struct dcc_hostdef *h = NULL;
+    int fd = -1, ret;
+
+    ss_client_pid = (pid_t) (1000 + j_no);
+    ss_picking = 1;
+    if (setjmp(ss_pause_env)) {
+        ss_picking = 0;
+        ss_pauses++;
+        ss_schedule(ss_now + arg_pause / 1000.0,
+                    local ? SS_START_LOCAL : SS_START, j_no);
+        return 0;
+    }
+    if (local) {
+        ret = dcc_lock_local(&fd);
+        h = dcc_hostdef_local;
+    } else {
+        ret = dcc_pick_host_from_list_and_lock_it(j->file, &h, &fd);
+    }
+    ss_picking = 0;
+
+    if (ret == EXIT_NO_HOSTS && !local) {
+        /* Everything is backed off; the client compiles locally. */
+        ss_no_hosts++;
+        return ss_pick(j_no, 1);
+    } else if (ret) {
+        return ret;
+    }
+
+    j->wait += ss_now - j->ready;
+    j->locked = ss_now;
+    j->lock_fd = fd;
+    j->hostdef = h;
+    j->local = local;
+    j->host = ss_find_host(h->hostname);
+    j->host->jobs++;
+
+    if (h->mode == DCC_MODE_LOCAL)
+        ss_run_on_cpu(j->host, j_no);
+    else if (ss_uniform() < j->host->fail)
+        ss_schedule(ss_now + j->host->rtt, SS_FAILED, j_no);
+    else
+        ss_schedule(ss_now + j->host->rtt + ss_transfer(j->host, j->in_kb),
+                    SS_ARRIVE, j_no);
+    return 0;
+}
+
+
+static void ss_release(struct ss_job *j)
+{
+    dcc_unlock(j->lock_fd);
+    j->host->slot_busy += ss_now - j->locked;
+}
+
+
+static int ss_start_next(void)
+{
+    struct ss_job *j;
+
+    if (ss_next_job >= ss_n_jobs)
+        return 0;
+    j = &ss_jobs[ss_next_job];
+    j->ready = ss_now;
+    return ss_pick(ss_next_job++, 0);
+}
+
+
+static int ss_handle(struct ss_event *e)
+{
+    struct ss_job *j = &ss_jobs[e->job];
+    struct ss_host *m = j->host;
+
+    switch (e->type) {
+    case SS_START:
+        return ss_pick(e->job, 0);
+    case SS_START_LOCAL:
+        return ss_pick(e->job, 1);
+    case SS_ARRIVE:
+        ss_run_on_cpu(m, e->job);
+        return 0;
+    case SS_COMPILED:
+        m->running--;
+        if (m->queue_len) {
+            long next = m->queue[m->queue_head];
+            m->queue_head = (m->queue_head + 1) % ss_n_jobs;
+            m->queue_len--;
+            ss_run_on_cpu(m, next);
+        }
+        if (j->hostdef->mode == DCC_MODE_LOCAL)
+            ss_schedule(ss_now, SS_DONE, e->job);
+        else
+            ss_schedule(ss_now + ss_transfer(m, j->out_kb), SS_DONE, e->job);
+        return 0;
+    case SS_FAILED:
+        m->failures++;
+        ss_fallbacks++;
+        dcc_disliked_host(j->hostdef);
+        ss_release(j);
+        j->ready = ss_now;
+        return ss_pick(e->job, 1);
+    case SS_DONE:
+        if (j->hostdef->mode != DCC_MODE_LOCAL)
+            dcc_enjoyed_host(j->hostdef);
+        ss_release(j);
+        ss_done++;
+        return ss_start_next();
+    }
+    return 0;
+}
+
+
+static void ss_reset(void)
+{
+    struct ss_host *m;
+    int i;
+
+    ss_now = 0;
+    ss_n_events = ss_event_seq = 0;
+    ss_next_job = ss_done = 0;
+    ss_pauses = ss_fallbacks = ss_no_hosts = 0;
+    ss_rand_state = (unsigned) arg_seed;
+    dcc_host_affinity = 0;
+    for (i = 0; i < ss_n_locks; i++)
+        ss_locks[i].held = 0;
+    for (i = 0; i < ss_n_marks; i++)
+        ss_marks[i].when = -1;
+    for (i = 0; i < ss_n_jobs; i++)
+        ss_jobs[i].wait = 0;
+    for (m = ss_hosts; m; m = m->next) {
+        m->running = 0;
+        m->queue_head = m->queue_len = 0;
+        memset(m->compiled, 0, ss_n_files);
+        m->jobs = m->failures = m->cache_hits = 0;
+        m->slot_busy = m->cpu_busy = 0;
+    }
+}
+
+
+static int ss_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+
+static void ss_report(enum ss_policy policy)
+{
+    struct ss_host *m;
+    double *waits, total_wait = 0, makespan = ss_now;
+    long i;
+    int first = 1;
+
+    if (!(waits = malloc(ss_n_jobs * sizeof *waits)))
+        exit(EXIT_OUT_OF_MEMORY);
+    for (i = 0; i < ss_n_jobs; i++) {
+        waits[i] = ss_jobs[i].wait;
+        total_wait += waits[i];
+    }
+    qsort(waits, ss_n_jobs, sizeof *waits, ss_cmp_double);
+
+    if (opt_json) {
+        printf("{\"policy\": \"%s\", \"jobs\": %ld, \"makespan\": %.3f, "
+               "\"pauses\": %ld, \"fallbacks\": %ld, \"no_hosts\": %ld, "
+               "\"wait\": {\"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, "
+               "\"max\": %.3f}, \"hosts\": {",
+               ss_policy_names[policy], ss_done, makespan, ss_pauses,
+               ss_fallbacks, ss_no_hosts, total_wait / ss_n_jobs,
+               waits[ss_n_jobs / 2], waits[(long) (ss_n_jobs * 0.99)],
+               waits[ss_n_jobs - 1]);
+    } else {
+        printf("%-10s %ld jobs in %.2fs; waited %.3fs mean, %.3fs max; "
+               "%ld pauses, %ld fallbacks, %ld with no hosts\n",
+               ss_policy_names[policy], ss_done, makespan,
+               total_wait / ss_n_jobs, waits[ss_n_jobs - 1], ss_pauses,
+               ss_fallbacks, ss_no_hosts);
+    }
+
+    for (m = ss_hosts; m; m = m->next) {
+        double slot_util = m->n_slots && makespan > 0
+            ? m->slot_busy / (m->n_slots * makespan) : 0;
+        double cpu_util = m->cpus && makespan > 0
+            ? m->cpu_busy / (m->cpus * makespan) : 0;
+
+        if (!m->jobs && !m->listed)
+            continue;
+        if (opt_json)
+            printf("%s\"%s\": {\"jobs\": %ld, \"failures\": %ld, "
+                   "\"cache_hits\": %ld, \"slot_util\": %.4f, "
+                   "\"cpu_util\": %.4f}", first ? "" : ", ", m->name,
+                   m->jobs, m->failures, m->cache_hits, slot_util, cpu_util);
+        else
+            printf("    %-20s %6ld jobs %4ld failed %6ld cached  "
+                   "slots %5.1f%%  cpus %5.1f%%\n", m->name, m->jobs,
+                   m->failures, m->cache_hits, 100 * slot_util,
+                   100 * cpu_util);
+        first = 0;
+    }
+    printf(opt_json ? "}}\n" : "\n");
+    free(waits);
+}
+
+
+static int ss_run(enum ss_policy policy)
+{
+    struct ss_event e;
+    char *hosts;
+    int i, ret = 0;
+
+    ss_reset();
+    hosts = ss_policy_hostlist(policy);
+    setenv("DISTCC_HOSTS", hosts, 1);
+    free(hosts);
+
+    for (i = 0; i < arg_parallel && ret == 0; i++)
+        ret = ss_start_next();
+    while (ret == 0 && ss_n_events) {
+        e = ss_next_event();
+        ss_now = e.when;
+        ret = ss_handle(&e);
+    }
+    if (ret == 0 && ss_done != ss_n_jobs) {
+        rs_log_error("only %ld of %ld jobs finished", ss_done, ss_n_jobs);
+        ret = EXIT_DISTCC_FAILED;
+    }
+    if (ret == 0)
+        ss_report(policy);
+    return ret;
+}
+
+
+static int ss_parse_options(int argc, const char **argv)
+{
+    poptContext po;
+    int po_err, ret = 0;
+
+    po = poptGetContext("distcc-schedsim", argc, argv, ss_options, 0);
+    while ((po_err = poptGetNextOpt(po)) != -1) {
+        switch (po_err) {
+        case '?':
+            ss_show_usage();
+            exit(0);
+        case 'V':
+            dcc_show_version("distcc-schedsim");
+            exit(0);
+        case 'm':
+            if ((ret = ss_parse_model(poptGetOptArg(po))))
+                goto out;
+            break;
+        default:
+            rs_log_error("%s: %s", poptBadOption(po, POPT_BADOPTION_NOALIAS),
+                         poptStrerror(po_err));
+            ret = EXIT_BAD_ARGUMENTS;
+            goto out;
+        }
+    }
+    if (poptGetArg(po)) {
+        rs_log_error("distcc-schedsim takes no arguments");
+        ret = EXIT_BAD_ARGUMENTS;
+        goto out;
+    }
+
+    if (!arg_hosts && !(arg_hosts = getenv("DISTCC_HOSTS"))) {
+        rs_log_error("give a host list with --hosts or $DISTCC_HOSTS");
+        ret = EXIT_NO_HOSTS;
+    } else if (arg_parallel < 1 || arg_jobs < 1 || arg_files < 0
+               || arg_pause < 0 || arg_backoff < 0
+               || arg_cache_factor < 0) {
+        rs_log_error("--parallel and --jobs must be at least 1, and "
+                     "the other numbers not negative");
+        ret = EXIT_BAD_ARGUMENTS;
+    } else if ((ret = ss_parse_dist("cost", arg_cost, &ss_cost))
+               || (ret = ss_parse_dist("in", arg_in, &ss_in))
+               || (ret = ss_parse_dist("out", arg_out, &ss_out))) {
+        ;
+    }
+
+  out:
+    poptFreeContext(po);
+    return ret;
+}
+
+
+int main(int argc, char **argv)
+{
+    struct dcc_hostdef *h;
+    struct ss_host *m;
+    char buf[32];
+    int policy, ret;
+
+    rs_trace_set_level(RS_LOG_WARNING);
+    rs_add_logger(rs_logger_file, RS_LOG_DEBUG, NULL, STDERR_FILENO);
+
+    ss_local.mode = ss_local_cpp.mode = DCC_MODE_LOCAL;
+    ss_local.hostname = ss_local_cpp.hostname = (char *) "localhost";
+    ss_local.hostdef_string = ss_local_cpp.hostdef_string
+        = (char *) "localhost";
+    ss_local.is_up = ss_local_cpp.is_up = 1;
+    ss_local.n_slots = ss_local_cpp.n_slots = 32;
+
+    if ((ret = ss_parse_options(argc, (const char **) argv))
+        || (ret = ss_parse_hostlist(arg_hosts)))
+        return ret;
+
+    /* The client's code reads these as it goes. */
+    snprintf(buf, sizeof buf, "%d", arg_pause);
+    setenv("DISTCC_PAUSE_TIME_MSEC", buf, 1);
+    snprintf(buf, sizeof buf, "%d", arg_backoff);
+    setenv("DISTCC_BACKOFF_PERIOD", buf, 1);
+
+    ss_rand_state = (unsigned) arg_seed;
+    if ((ret = arg_trace ? ss_read_trace(arg_trace) : ss_make_jobs()))
+        return ret;
+
+    /* Hosts the list doesn't model get a CPU per slot.  Fallbacks can use
+     * all the --localslots on localhost. */
+    ss_find_host("localhost")->n_slots = dcc_hostdef_local->n_slots;
+    for (h = ss_hostlist; h; h = h->next) {
+        m = ss_find_host(h->hostname);
+        m->listed = 1;
+        if (h->n_slots > m->n_slots)
+            m->n_slots = h->n_slots;
+    }
+    for (m = ss_hosts; m; m = m->next) {
+        if (!m->cpus)
+            m->cpus = m->n_slots;
+        m->queue = calloc(ss_n_jobs, sizeof *m->queue);
+        m->compiled = calloc(ss_n_files + 1, 1);
+        if (!m->queue || !m->compiled)
+            return EXIT_OUT_OF_MEMORY;
+    }
+
+    for (policy = 0; policy < SS_N_POLICIES; policy++) {
+        if (strcmp(arg_policy, "all") != 0
+            && strcmp(arg_policy, ss_policy_names[policy]) != 0)
+            continue;
+        if ((ret = ss_run((enum ss_policy) policy)))
+            return ret;
+        fflush(stdout);
+        if (strcmp(arg_policy, "all") != 0)
+            return 0;
+    }
+    if (strcmp(arg_policy, "all") != 0) {
+        rs_log_error("unknown --policy \"%s\"", arg_policy);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    return 0;
+}
@@ -0,0 +1,468 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Talking to distccsched, the optional farm scheduler.
+ *
+ * The protocol is one line of text per request and one per reply:
+ *
+ *   HOST NAME SLOTS           ->  OK SECONDS
+ *   LEASE NAME...             ->  GRANT ID NAME SLOT SECONDS | WAIT | UNKNOWN
+ *   PREFER NAME...            ->  (as LEASE)
+ *   RENEW ID                  ->  OK SECONDS | UNKNOWN
+ *   RELEASE ID                ->  OK | UNKNOWN
+ *
+ * distccd reports its name and number of job slots with HOST, and again
+ * after however many seconds the scheduler says.  A client lists the hosts
+ * it could use, as HOST:PORT, and is granted a slot on one for a while:
+ * with LEASE the one with the fewest leases, with PREFER the first in its
+ * list with a slot free.  While the job runs it renews the lease with
+ * RENEW, well before the SECONDS it was granted for are up, and it gives
+ * the slot back with RELEASE once the job is done.
+ *
+ * Whenever the scheduler can't be reached, or doesn't know any of the
+ * hosts, the client picks a host by itself as usual.
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "netutil.h"
+#include "hosts.h"
+#include "scheduler.h"
+
+/* The lease this client holds, how long it was granted for, the lock fd
+ * it goes with, and the process renewing it. */
+static char dcc_sched_lease_id[64];
+static int dcc_sched_lease_secs;
+static int dcc_sched_lease_fd = -1;
+static pid_t dcc_sched_renewer;
+
+
+static int dcc_sched_connect_unix(const char *path, int *fd_ret)
+{
+    struct sockaddr_un sa;
+    int fd;
+
+    if (strlen(path) >= sizeof sa.sun_path) {
+        rs_log_warning("scheduler socket name \"%s\" is too long", path);
+        return EXIT_BAD_ARGUMENTS;
+    }
+    memset(&sa, 0, sizeof sa);
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        rs_log_error("socket failed: %s", strerror(errno));
+        return EXIT_CONNECT_FAILED;
+    }
+    if (connect(fd, (struct sockaddr *) &sa, sizeof sa) == -1) {
+        rs_trace("failed to connect to scheduler %s: %s", path,
+                 strerror(errno));
+        close(fd);
+        return EXIT_CONNECT_FAILED;
+    }
+    *fd_ret = fd;
+    return 0;
+}
+
+
+static int dcc_sched_connect_tcp(const char *addr, int *fd_ret)
+{
+    struct addrinfo hints, *res, *ai;
+    struct pollfd pfd;
+    char *host, *colon, port[16];
+    int fd = -1, err;
+    socklen_t len = sizeof err;
+
+    if (!(host = strdup(addr)))
+        return EXIT_OUT_OF_MEMORY;
+    snprintf(port, sizeof port, "%d", DCC_SCHED_DEFAULT_PORT);
+    if (host[0] == '[' && (colon = strchr(host, ']'))) {
+        /* [ADDRESS]:PORT, for IPv6 */
+        *colon++ = '\0';
+        memmove(host, host + 1, strlen(host));
+        if (*colon == ':')
+            strlcpy(port, colon + 1, sizeof port);
+    } else if ((colon = strrchr(host, ':')) && !strchr(colon + 1, ':')
+               && colon == strchr(host, ':')) {
+        *colon = '\0';
+        strlcpy(port, colon + 1, sizeof port);
+    }
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((err = getaddrinfo(host, port, &hints, &res)) != 0) {
+        rs_log_warning("failed to look up scheduler %s: %s", addr,
+                       gai_strerror(err));
+        free(host);
+        return EXIT_CONNECT_FAILED;
+    }
+    free(host);
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        if ((fd = socket(ai->ai_family, ai->ai_socktype,
+                         ai->ai_protocol)) == -1)
+            continue;
+        dcc_set_nonblocking(fd);
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        if (errno == EINPROGRESS) {
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            if (poll(&pfd, 1, DCC_SCHED_TIMEOUT_MS) == 1
+                && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0
+                && err == 0)
+                break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd == -1) {
+        rs_trace("failed to connect to scheduler %s", addr);
+        return EXIT_CONNECT_FAILED;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    *fd_ret = fd;
+    return 0;
+}
+
+
+/**
+ * Connect to the scheduler at @p addr: a Unix socket if it has a '/' in
+ * it, otherwise HOST[:PORT].  Gives up quickly, since the caller always
+ * has something else it can do.
+ **/
+int dcc_sched_connect(const char *addr, int *fd_ret)
+{
+    if (strchr(addr, '/'))
+        return dcc_sched_connect_unix(addr, fd_ret);
+    return dcc_sched_connect_tcp(addr, fd_ret);
+}
+
+
+/**
+ * Send the line @p request and read the scheduler's one-line reply into
+ * @p reply, without its newline.
+ **/
+int dcc_sched_request(int fd, const char *request,
+                      char *reply, size_t reply_len)
+{
+    struct pollfd pfd;
+    size_t len = strlen(request), got = 0;
+    ssize_t n;
+    char *nl;
+
+    if (len + 1 > DCC_SCHED_LINE_MAX) {
+        rs_log_warning("scheduler request is too long");
+        return EXIT_PROTOCOL_ERROR;
+    }
+    if (dcc_writex(fd, request, len) || dcc_writex(fd, "\n", 1))
+        return EXIT_IO_ERROR;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (got < reply_len - 1) {
+        if (poll(&pfd, 1, DCC_SCHED_TIMEOUT_MS) != 1) {
+            rs_log_warning("timeout waiting for the scheduler");
+            return EXIT_TIMEOUT;
+        }
+        if ((n = read(fd, reply + got, reply_len - 1 - got)) <= 0) {
+            if (n == -1 && errno == EINTR)
+                continue;
+            rs_log_warning("scheduler closed the connection");
+            return EXIT_IO_ERROR;
+        }
+        got += n;
+        reply[got] = '\0';
+        if ((nl = strchr(reply, '\n'))) {
+            *nl = '\0';
+            rs_trace("scheduler: %s -> %s", request, reply);
+            return 0;
+        }
+    }
+    rs_log_warning("scheduler reply is too long");
+    return EXIT_PROTOCOL_ERROR;
+}
+
+
+/**
+ * Ask the scheduler in $DISTCC_SCHEDULER for a slot on one of the TCP
+ * hosts in @p hostlist: the least used, or if @p prefer_order is set the
+ * first with a slot free.
+ *
+ * @returns 0 with the host and slot granted, EXIT_BUSY if they are all
+ * full, or EXIT_CONNECT_FAILED if the caller should pick a host without
+ * the scheduler.
+ **/
+int dcc_sched_lease(struct dcc_hostdef *hostlist, int prefer_order,
+                    struct dcc_hostdef **host_ret, int *slot_ret)
+{
+    const char *addr = getenv("DISTCC_SCHEDULER");
+    char request[DCC_SCHED_LINE_MAX], reply[DCC_SCHED_LINE_MAX];
+    char id[64], name[1024];
+    struct dcc_hostdef *h;
+    size_t len;
+    int fd, ret, slot, secs = 0, n_hosts = 0;
+
+    if (!addr || !*addr)
+        return EXIT_CONNECT_FAILED;
+
+    len = strlcpy(request, prefer_order ? "PREFER" : "LEASE", sizeof request);
+    for (h = hostlist; h; h = h->next) {
+        if (h->mode != DCC_MODE_TCP)
+            continue;
+        len += snprintf(request + len, sizeof request - len, " %s:%d",
+                        h->hostname, h->port);
+        if (len >= sizeof request)
+            return EXIT_CONNECT_FAILED;
+        n_hosts++;
+    }
+    if (n_hosts == 0)
+        return EXIT_CONNECT_FAILED;
+
+    if ((ret = dcc_sched_connect(addr, &fd)))
+        return EXIT_CONNECT_FAILED;
+    ret = dcc_sched_request(fd, request, reply, sizeof reply);
+    close(fd);
+    if (ret)
+        return EXIT_CONNECT_FAILED;
+
+    if (strcmp(reply, "WAIT") == 0)
+        return EXIT_BUSY;
+    if (sscanf(reply, "GRANT %63s %1023s %d %d", id, name, &slot,
+               &secs) < 3) {
+        if (strcmp(reply, "UNKNOWN") != 0)
+            rs_log_warning("unexpected reply from scheduler: \"%s\"", reply);
+        return EXIT_CONNECT_FAILED;
+    }
+
+    for (h = hostlist; h; h = h->next) {
+        char this[1024];
+
+        if (h->mode != DCC_MODE_TCP)
+            continue;
+        snprintf(this, sizeof this, "%s:%d", h->hostname, h->port);
+        if (strcmp(this, name) == 0)
+            break;
+    }
+    if (!h) {
+        rs_log_warning("scheduler granted %s, which we didn't ask for", name);
+        return EXIT_CONNECT_FAILED;
+    }
+
+    strlcpy(dcc_sched_lease_id, id, sizeof dcc_sched_lease_id);
+    dcc_sched_lease_secs = secs;
+    dcc_sched_lease_fd = -1;
+    *host_ret = h;
+    *slot_ret = slot;
+    return 0;
+}
+
+
+static void dcc_sched_renew_loop(const char *addr, pid_t client) NORETURN;
+
+static void dcc_sched_renew_loop(const char *addr, pid_t client)
+{
+    char request[128], reply[128];
+    int fd, secs = dcc_sched_lease_secs, devnull, waited = 0;
+
+    /* This is a copy of the client: it mustn't clean up the client's
+     * temporary files if it is signalled, nor hold its stdin and stdout
+     * open after it exits. */
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+    if ((devnull = open("/dev/null", O_RDWR)) != -1) {
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        if (devnull > STDERR_FILENO)
+            close(devnull);
+    }
+
+    snprintf(request, sizeof request, "RENEW %s", dcc_sched_lease_id);
+    /* Check every second that the client is still there, so that a lease
+     * it left behind runs out. */
+    while (getppid() == client) {
+        sleep(1);
+        if (++waited < (secs / 3 > 0 ? secs / 3 : 1))
+            continue;
+        waited = 0;
+        if (dcc_sched_connect(addr, &fd))
+            continue;
+        if (dcc_sched_request(fd, request, reply, sizeof reply) == 0
+            && sscanf(reply, "OK %d", &secs) != 1) {
+            rs_log_warning("lease %s on the scheduler has run out",
+                           dcc_sched_lease_id);
+            close(fd);
+            break;
+        }
+        close(fd);
+    }
+    _exit(0);
+}
+
+
+/**
+ * Tie the lease just granted to the lock @p lock_fd taken for it, so that
+ * it is given back when that is unlocked.  Until then a child process
+ * renews it, so that a job that runs longer than the lease doesn't have
+ * its slot given to someone else.
+ **/
+void dcc_sched_hold(int lock_fd)
+{
+    const char *addr = getenv("DISTCC_SCHEDULER");
+    pid_t client = getpid(), pid;
+
+    dcc_sched_lease_fd = lock_fd;
+    dcc_sched_renewer = 0;
+    if (!addr || dcc_sched_lease_secs <= 0)
+        return;
+    if ((pid = fork()) == -1) {
+        rs_log_warning("fork failed: %s; lease %s won't be renewed",
+                       strerror(errno), dcc_sched_lease_id);
+        return;
+    }
+    if (pid == 0)
+        dcc_sched_renew_loop(addr, client);
+    dcc_sched_renewer = pid;
+}
+
+
+/**
+ * Give back the lease just granted, having not used it.  If that fails
+ * the lease simply runs out.
+ **/
+void dcc_sched_release(void)
+{
+    const char *addr = getenv("DISTCC_SCHEDULER");
+    char request[128], reply[128];
+    int fd, status;
+
+    if (dcc_sched_renewer > 0) {
+        kill(dcc_sched_renewer, SIGTERM);
+        while (waitpid(dcc_sched_renewer, &status, 0) == -1
+               && errno == EINTR)
+            ;
+        dcc_sched_renewer = 0;
+    }
+    if (!addr || dcc_sched_connect(addr, &fd))
+        return;
+    snprintf(request, sizeof request, "RELEASE %s", dcc_sched_lease_id);
+    dcc_sched_request(fd, request, reply, sizeof reply);
+    close(fd);
+}
+
+
+/**
+ * Called by dcc_unlock(): if @p lock_fd goes with a lease, give the lease
+ * back.
+ **/
+void dcc_sched_unlocked(int lock_fd)
+{
+    if (lock_fd == -1 || lock_fd != dcc_sched_lease_fd)
+        return;
+    dcc_sched_lease_fd = -1;
+    dcc_sched_release();
+}
+
+
+static void dcc_sched_report_loop(const char *addr, const char *name,
+                                  int slots, pid_t master) NORETURN;
+
+static void dcc_sched_report_loop(const char *addr, const char *name,
+                                  int slots, pid_t master)
+{
+    char request[DCC_SCHED_LINE_MAX], reply[128];
+    int fd, interval, ok, was_ok = -1;
+
+    snprintf(request, sizeof request, "HOST %s %d", name, slots);
+    while (kill(master, 0) == 0) {
+        interval = DCC_SCHED_REPORT_INTERVAL;
+        ok = 0;
+        if (dcc_sched_connect(addr, &fd) == 0) {
+            ok = dcc_sched_request(fd, request, reply, sizeof reply) == 0
+                && sscanf(reply, "OK %d", &interval) == 1;
+            close(fd);
+        }
+        if (ok != was_ok) {
+            if (ok)
+                rs_log_info("reporting %d slots as %s to scheduler %s",
+                            slots, name, addr);
+            else
+                rs_log_warning("can't report to scheduler %s; will keep "
+                               "trying", addr);
+            was_ok = ok;
+        }
+        sleep(interval > 0 ? interval : 1);
+    }
+    _exit(0);
+}
+
+
+/**
+ * Start a process that tells the scheduler at @p addr that this daemon is
+ * host @p name with @p slots job slots, for as long as the calling process
+ * is alive.  It is detached from the caller, so that the daemon's count of
+ * its children isn't upset.
+ **/
+int dcc_sched_start_reporter(const char *addr, const char *name, int slots)
+{
+    pid_t master = getpid(), pid;
+    int status;
+
+    if ((pid = fork()) == -1) {
+        rs_log_error("fork failed: %s", strerror(errno));
+        return EXIT_DISTCC_FAILED;
+    }
+    if (pid == 0) {
+        if (fork() == 0)
+            dcc_sched_report_loop(addr, name, slots, master);
+        _exit(0);
+    }
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+        ;
+    return 0;
+}
@@ -0,0 +1,49 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __DISTCC_SCHEDULER_H__
+#define __DISTCC_SCHEDULER_H__
+
+/* TCP port distccsched listens on by default. */
+#define DCC_SCHED_DEFAULT_PORT 3634
+
+/* Longest line in the scheduler protocol, including the newline. */
+#define DCC_SCHED_LINE_MAX 4096
+
+/* How long to wait for the scheduler before doing without it. */
+#define DCC_SCHED_TIMEOUT_MS 1000
+
+/* Seconds between capacity reports, unless the scheduler asks otherwise. */
+#define DCC_SCHED_REPORT_INTERVAL 10
+
+struct dcc_hostdef;
+
+/* scheduler.c */
+int dcc_sched_connect(const char *addr, int *fd_ret);
+int dcc_sched_request(int fd, const char *request,
+                      char *reply, size_t reply_len);
+int dcc_sched_lease(struct dcc_hostdef *hostlist, int prefer_order,
+                    struct dcc_hostdef **host_ret, int *slot_ret);
+void dcc_sched_hold(int lock_fd);
+void dcc_sched_release(void);
+void dcc_sched_unlocked(int lock_fd);
+int dcc_sched_start_reporter(const char *addr, const char *name, int slots);
+
+#endif /* __DISTCC_SCHEDULER_H__ */
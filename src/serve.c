@@ -98,6 +98,13 @@ extern gss_ctx_id_t distccd_ctx_handle;
 int dcc_auth_enabled = 0;
 #endif
 
+#ifdef HAVE_TLS
+#include "tls.h"
+
+/* True if --tls-cert was given and loaded. */
+int dcc_tls_enabled = 0;
+#endif
+
 /**
  * We copy all serious distccd messages to this file, as well as sending the
  * compiler errors there, so they're visible to the client.
@@ -162,6 +169,10 @@ int dcc_service_job(int in_fd,
                     int cli_len)
 {
     int ret;
+#ifdef HAVE_TLS
+    pid_t tls_pid = 0;
+    int net_in_fd = in_fd, net_out_fd = out_fd;
+#endif
 
     dcc_job_summary_clear();
 
@@ -171,6 +182,13 @@ int dcc_service_job(int in_fd,
     if ((ret = dcc_check_client(cli_addr, cli_len, opt_allowed)) != 0)
         goto out;
 
+#ifdef HAVE_TLS
+    if (dcc_tls_enabled) {
+        if ((ret = dcc_tls_server_start(&in_fd, &out_fd, &tls_pid)) != 0)
+            goto out;
+    }
+#endif
+
 #ifdef HAVE_GSSAPI
     /* If requested perform authentication. */
     if (dcc_auth_enabled) {
@@ -190,11 +208,25 @@ int dcc_service_job(int in_fd,
     }
 #endif
 
+    dcc_fair_identify(cli_addr, cli_len);
     ret = dcc_run_job(in_fd, out_fd);
 
     dcc_job_summary();
 
 out:
+#ifdef HAVE_TLS
+    /* Closing our end of the relay lets it finish sending and exit.  The
+     * network fds themselves belong to our caller. */
+    if (tls_pid) {
+        int status;
+
+        if (out_fd != net_in_fd && out_fd != net_out_fd && out_fd != in_fd)
+            dcc_close(out_fd);
+        if (in_fd != net_in_fd && in_fd != net_out_fd)
+            dcc_close(in_fd);
+        dcc_collect_child("tls", tls_pid, &status, timeout_null_fd);
+    }
+#endif
     return ret;
 }
 
@@ -638,6 +670,55 @@ static int make_temp_dir_and_chdir_for_cpp(int in_fd,
         return ret;
 }
 
+/**
+ * Receive a -fprofile-use profile that the client sent by hash into
+ * @p fname.  We say whether the profile cache has it, and only if it
+ * doesn't does the client send the body.
+ **/
+static int dcc_r_gcda_by_hash(int in_fd, int out_fd, const char *fname,
+                              enum dcc_compress compr)
+{
+    char *hex = NULL, *dir = NULL;
+    const char *tmp_top;
+    int ret, hit = 0;
+
+    if ((ret = dcc_r_token_string(in_fd, "GSUM", &hex)))
+        return ret;
+
+    if (arg_gcda_cache_size > 0) {
+        if (arg_gcda_cache)
+            dir = strdup(arg_gcda_cache);
+        else if (dcc_get_tmp_top(&tmp_top) == 0
+                 && asprintf(&dir, "%s/distccd-gcda", tmp_top) == -1)
+            dir = NULL;
+    }
+    if (dir) {
+        ret = dcc_gcda_cache_lookup(dir, hex, fname);
+        if (ret == EXIT_PROTOCOL_ERROR)
+            goto out;
+        hit = (ret == 0);
+    }
+
+    /* The client waits for this, so it mustn't sit in the cork. */
+    if ((ret = dcc_x_token_int(out_fd, "GHIT", (unsigned) hit)))
+        goto out;
+    tcp_cork_sock(out_fd, 0);
+    tcp_cork_sock(out_fd, 1);
+
+    if (!hit) {
+        if ((ret = dcc_r_token_file(in_fd, "DOTI", fname, compr)))
+            goto out;
+        if (dir)
+            ret = dcc_gcda_cache_store(dir, arg_gcda_cache_size, hex, fname);
+    }
+
+  out:
+    free(hex);
+    free(dir);
+    return ret;
+}
+
+
 /**
  * Read a request, run the compiler, and send a response.
  **/
@@ -652,11 +733,13 @@ static int dcc_run_job(int in_fd,
     char *err_fname = NULL, *out_fname = NULL, *deps_fname = NULL;
     char *temp_dir = NULL; /* for receiving multiple files */
     int ret = 0, compile_ret = 0;
+    unsigned oom_limit = 0;
     char *orig_input = NULL, *orig_output = NULL;
     char *orig_input_tmp, *orig_output_tmp;
     char *dotd_target = NULL;
     pid_t cc_pid;
     enum dcc_protover protover;
+    int prio;
     enum dcc_compress compr;
     struct timeval start, end;
     int time_ms;
@@ -693,7 +776,8 @@ static int dcc_run_job(int in_fd,
     /* Allow output to accumulate into big packets. */
     tcp_cork_sock(out_fd, 1);
 
-    if ((ret = dcc_r_request_header(in_fd, &protover)))
+    if ((ret = dcc_r_request_header(in_fd, &protover, &prio))
+        || (ret = dcc_fair_wait(prio)))
         goto out_cleanup;
 
     dcc_get_features_from_protover(protover, &compr, &cpp_where);
@@ -856,7 +940,11 @@ static int dcc_run_job(int in_fd,
             goto out_cleanup;
           }
 
-          if ((ret = dcc_r_token_file(in_fd, "DOTI", temp_gcda, compr)))
+          if (gcda_exist == DCC_GCDA_BY_HASH)
+            ret = dcc_r_gcda_by_hash(in_fd, out_fd, temp_gcda, compr);
+          else
+            ret = dcc_r_token_file(in_fd, "DOTI", temp_gcda, compr);
+          if (ret)
             goto out_cleanup;
         }
     }
@@ -883,6 +971,9 @@ static int dcc_run_job(int in_fd,
             goto out_cleanup;
     }
 
+    if ((ret = dcc_job_cgroup_enter()))
+        goto out_cleanup;
+
     if ((compile_ret = dcc_spawn_child(argv, &cc_pid,
                                        "/dev/null", out_fname, err_fname))
         || (compile_ret = dcc_collect_child("cc", cc_pid, &status, in_fd))) {
@@ -891,7 +982,12 @@ static int dcc_run_job(int in_fd,
         status = W_EXITCODE(compile_ret, 0);
     }
 
-    if ((ret = dcc_x_result_header(out_fd, protover))
+    if (dcc_job_cgroup_leave(&oom_limit) == EXIT_JOB_OOM) {
+        /* Not the source's fault, so don't send the compiler's errors;
+         * tell the client to find a host with more memory. */
+        ret = dcc_x_job_oom(out_fd, oom_limit);
+        job_result = STATS_REJ_OVERLOAD;
+    } else if ((ret = dcc_x_result_header(out_fd, protover))
         || (ret = dcc_x_cc_status(out_fd, status))
         || (ret = dcc_x_file(out_fd, err_fname, "SERR", compr, NULL))
         || (ret = dcc_x_file(out_fd, out_fname, "SOUT", compr, NULL))) {
@@ -952,6 +1048,7 @@ static int dcc_run_job(int in_fd,
     rs_log(RS_LOG_INFO|RS_LOG_NONAME, "job complete");
 
 out_cleanup:
+    dcc_fair_done();
 
     /* Restore the working directory, if needed. */
     if (changed_directory) {
@@ -997,6 +1094,8 @@ out_cleanup:
                      ret, time_ms);
     if (time_str != NULL) dcc_job_summary_append(time_str);
     free(time_str);
+    dcc_placement_summary();
+    dcc_fair_summary();
 
     /* append compiler and input file info */
     if (job_result == STATS_COMPILE_ERROR
@@ -0,0 +1,213 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * SHA-256 (FIPS 180-4) and HMAC-SHA-256 (RFC 2104).
+ *
+ * This is here so that distcc can sign and fingerprint things without
+ * depending on a crypto library, which most builds are configured
+ * without.
+ **/
+
+
+#include <config.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "sha256.h"
+
+
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+
+static void dcc_sha256_block(struct dcc_sha256 *ctx, const unsigned char *p)
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = (uint32_t) p[4*i] << 24 | (uint32_t) p[4*i+1] << 16
+            | (uint32_t) p[4*i+2] << 8 | p[4*i+3];
+    for (; i < 64; i++)
+        w[i] = w[i-16] + w[i-7]
+            + (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15] >> 3))
+            + (ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2] >> 10));
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2];
+    d = ctx->state[3]; e = ctx->state[4]; f = ctx->state[5];
+    g = ctx->state[6]; h = ctx->state[7];
+
+    for (i = 0; i < 64; i++) {
+        t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25))
+            + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22))
+            + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c;
+    ctx->state[3] += d; ctx->state[4] += e; ctx->state[5] += f;
+    ctx->state[6] += g; ctx->state[7] += h;
+}
+
+
+void dcc_sha256_init(struct dcc_sha256 *ctx)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(ctx->state, iv, sizeof iv);
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+
+void dcc_sha256_update(struct dcc_sha256 *ctx, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+
+    ctx->length += len;
+
+    if (ctx->used) {
+        size_t n = DCC_SHA256_BLOCK - ctx->used;
+
+        if (n > len)
+            n = len;
+        memcpy(ctx->buf + ctx->used, p, n);
+        ctx->used += n;
+        p += n;
+        len -= n;
+        if (ctx->used < DCC_SHA256_BLOCK)
+            return;
+        dcc_sha256_block(ctx, ctx->buf);
+        ctx->used = 0;
+    }
+
+    for (; len >= DCC_SHA256_BLOCK; p += DCC_SHA256_BLOCK,
+             len -= DCC_SHA256_BLOCK)
+        dcc_sha256_block(ctx, p);
+
+    memcpy(ctx->buf, p, len);
+    ctx->used = len;
+}
+
+
+void dcc_sha256_final(struct dcc_sha256 *ctx,
+                      unsigned char digest[DCC_SHA256_LEN])
+{
+    uint64_t bits = ctx->length * 8;
+    int i;
+
+    ctx->buf[ctx->used++] = 0x80;
+    if (ctx->used > DCC_SHA256_BLOCK - 8) {
+        memset(ctx->buf + ctx->used, 0, DCC_SHA256_BLOCK - ctx->used);
+        dcc_sha256_block(ctx, ctx->buf);
+        ctx->used = 0;
+    }
+    memset(ctx->buf + ctx->used, 0, DCC_SHA256_BLOCK - 8 - ctx->used);
+    for (i = 0; i < 8; i++)
+        ctx->buf[DCC_SHA256_BLOCK - 1 - i] = (unsigned char) (bits >> (8 * i));
+    dcc_sha256_block(ctx, ctx->buf);
+
+    for (i = 0; i < 8; i++) {
+        digest[4*i] = (unsigned char) (ctx->state[i] >> 24);
+        digest[4*i+1] = (unsigned char) (ctx->state[i] >> 16);
+        digest[4*i+2] = (unsigned char) (ctx->state[i] >> 8);
+        digest[4*i+3] = (unsigned char) ctx->state[i];
+    }
+    memset(ctx, 0, sizeof *ctx);
+}
+
+
+void dcc_hmac_sha256(const void *key, size_t key_len,
+                     const void *data, size_t data_len,
+                     unsigned char mac[DCC_SHA256_LEN])
+{
+    struct dcc_sha256 ctx;
+    unsigned char pad[DCC_SHA256_BLOCK];
+    unsigned char inner[DCC_SHA256_LEN];
+    int i;
+
+    memset(pad, 0, sizeof pad);
+    if (key_len > DCC_SHA256_BLOCK) {
+        dcc_sha256_init(&ctx);
+        dcc_sha256_update(&ctx, key, key_len);
+        dcc_sha256_final(&ctx, pad);
+    } else {
+        memcpy(pad, key, key_len);
+    }
+
+    for (i = 0; i < DCC_SHA256_BLOCK; i++)
+        pad[i] ^= 0x36;
+    dcc_sha256_init(&ctx);
+    dcc_sha256_update(&ctx, pad, sizeof pad);
+    dcc_sha256_update(&ctx, data, data_len);
+    dcc_sha256_final(&ctx, inner);
+
+    for (i = 0; i < DCC_SHA256_BLOCK; i++)
+        pad[i] ^= 0x36 ^ 0x5c;
+    dcc_sha256_init(&ctx);
+    dcc_sha256_update(&ctx, pad, sizeof pad);
+    dcc_sha256_update(&ctx, inner, sizeof inner);
+    dcc_sha256_final(&ctx, mac);
+
+    memset(pad, 0, sizeof pad);
+}
+
+
+/**
+ * Compare two secrets in time that doesn't depend on where they differ.
+ **/
+int dcc_mem_equal(const void *a, const void *b, size_t len)
+{
+    const unsigned char *x = a, *y = b;
+    unsigned char diff = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        diff |= x[i] ^ y[i];
+    return diff == 0;
+}
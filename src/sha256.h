@@ -0,0 +1,44 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __DISTCC_SHA256_H__
+#define __DISTCC_SHA256_H__
+
+#define DCC_SHA256_LEN 32
+#define DCC_SHA256_BLOCK 64
+
+struct dcc_sha256 {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char buf[DCC_SHA256_BLOCK];
+    size_t used;
+};
+
+/* sha256.c */
+void dcc_sha256_init(struct dcc_sha256 *ctx);
+void dcc_sha256_update(struct dcc_sha256 *ctx, const void *data, size_t len);
+void dcc_sha256_final(struct dcc_sha256 *ctx,
+                      unsigned char digest[DCC_SHA256_LEN]);
+void dcc_hmac_sha256(const void *key, size_t key_len,
+                     const void *data, size_t data_len,
+                     unsigned char mac[DCC_SHA256_LEN]);
+int dcc_mem_equal(const void *a, const void *b, size_t len);
+
+#endif /* __DISTCC_SHA256_H__ */
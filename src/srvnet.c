@@ -74,17 +74,30 @@
 
 /*
  * Listen on a predetermined address (often the passive address).  The way in
- * which we get the address depends on the resolver API in use.
+ * which we get the address depends on the resolver API in use.  With
+ * @p reuseport, other sockets may listen on the same port.
  **/
 static int dcc_listen_by_addr(int fd,
                               struct sockaddr *sa,
-                              size_t salen)
+                              size_t salen,
+                              int reuseport)
 {
     int one = 1;
     char *sa_buf = NULL;
 
     setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *) &one, sizeof(one));
 
+#ifdef SO_REUSEPORT
+    if (reuseport
+        && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) == -1) {
+        rs_log_error("failed to set SO_REUSEPORT: %s", strerror(errno));
+        close(fd);
+        return EXIT_BIND_FAILED;
+    }
+#else
+    (void) reuseport;
+#endif
+
     dcc_sockaddr_to_string(sa, salen, &sa_buf);
     if (sa_buf == NULL) {
       return EXIT_OUT_OF_MEMORY;
@@ -117,7 +130,8 @@ static int dcc_listen_by_addr(int fd,
 #if defined(ENABLE_RFC2553)
 /* This version uses getaddrinfo.  It will probably use IPv6 if that's
  * supported by your configuration, kernel, and library. */
-int dcc_socket_listen(int port, int *fd_out, const char *listen_addr)
+static int dcc_listen_on_port(int port, int *fd_out, const char *listen_addr,
+                              int reuseport)
 {
     char portname[20];
     struct addrinfo hints;
@@ -164,7 +178,8 @@ int dcc_socket_listen(int port, int *fd_out, const char *listen_addr)
                 return EXIT_BIND_FAILED;
             }
         } else {
-            ret = dcc_listen_by_addr(*fd_out, res->ai_addr, res->ai_addrlen);
+            ret = dcc_listen_by_addr(*fd_out, res->ai_addr, res->ai_addrlen,
+                                     reuseport);
             freeaddrinfo(res);
             return ret;
         }
@@ -177,7 +192,8 @@ int dcc_socket_listen(int port, int *fd_out, const char *listen_addr)
 #else /* ndef ENABLE_RFC2553 */
 
 /* This version uses inet_aton */
-int dcc_socket_listen(int port, int *listen_fd, const char *listen_addr)
+static int dcc_listen_on_port(int port, int *listen_fd,
+                              const char *listen_addr, int reuseport)
 {
     struct sockaddr_in sock;
 
@@ -207,11 +223,17 @@ int dcc_socket_listen(int port, int *listen_fd, const char *listen_addr)
     }
 
     return dcc_listen_by_addr(*listen_fd, (struct sockaddr *) &sock,
-                              sizeof sock);
+                              sizeof sock, reuseport);
 }
 #endif  /* ndef ENABLE_RFC2553 */
 
 
+int dcc_socket_listen(int port, int *fd_out, const char *listen_addr)
+{
+    return dcc_listen_on_port(port, fd_out, listen_addr, 0);
+}
+
+
 /**
  * Determine if a file descriptor is in fact a socket
  **/
@@ -268,3 +290,19 @@ int dcc_check_client(struct sockaddr *psa,
     free(client_ip);
     return ret;
 }
+
+
+/**
+ * Like dcc_socket_listen(), but with SO_REUSEPORT set so that several
+ * sockets can listen on the same port and the kernel spreads incoming
+ * connections between them.
+ **/
+int dcc_socket_listen_shared(int port, int *fd_out, const char *listen_addr)
+{
+#ifdef SO_REUSEPORT
+    return dcc_listen_on_port(port, fd_out, listen_addr, 1);
+#else
+    rs_log_error("SO_REUSEPORT is not supported on this system");
+    return EXIT_BAD_ARGUMENTS;
+#endif
+}
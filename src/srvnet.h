@@ -22,6 +22,7 @@
 
 /* srvnet.c */
 int dcc_socket_listen(int port, int *fd, const char *listen_addr);
+int dcc_socket_listen_shared(int port, int *fd, const char *listen_addr);
 int is_a_socket(int fd);
 struct dcc_allow_list;
 int dcc_check_client(struct sockaddr *, int, struct dcc_allow_list *);
@@ -50,12 +50,26 @@
 #include "snprintf.h"
 
 int dcc_r_request_header(int ifd,
-                         enum dcc_protover *ver_ret)
+                         enum dcc_protover *ver_ret,
+                         int *prio_ret)
 {
+    char token[5];
     unsigned vers;
     int ret;
 
-    if ((ret = dcc_r_token_int(ifd, "DIST", &vers)) != 0) {
+    *prio_ret = DCC_PRIO_DEFAULT;
+    if ((ret = dcc_r_sometoken_int(ifd, token, &vers)) == 0
+        && strcmp(token, "PRIO") == 0) {
+        if (vers >= DCC_PRIO_MAX) {
+            rs_log_error("unknown priority class %u", vers);
+            return EXIT_PROTOCOL_ERROR;
+        }
+        *prio_ret = (int) vers;
+        ret = dcc_r_sometoken_int(ifd, token, &vers);
+    }
+    if (ret == 0 && strcmp(token, "DIST") != 0)
+        ret = EXIT_PROTOCOL_ERROR;
+    if (ret != 0) {
         rs_log_error("client did not provide distcc magic fairy dust");
         return ret;
     }
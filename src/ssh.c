@@ -38,6 +38,12 @@
  * rsync has a configuration option for that, but I don't support it here,
  * because there's no point using rsh, you might as well use the native
  * protocol.
+ *
+ * With OpenSSH, connections to each host are multiplexed over one master
+ * connection which stays up for a while after the last compile finishes.
+ * Each compile still runs its own ssh process and gets its own distccd
+ * --inetd on the far end, but only the first pays for the key exchange and
+ * authentication.
  */
 
 
@@ -54,6 +60,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 
 #include "distcc.h"
 #include "trace.h"
@@ -65,6 +72,13 @@
 
 const char *dcc_default_ssh = "ssh";
 
+/* Seconds the multiplexing master connection stays up once idle. */
+#define DCC_SSH_CONTROL_PERSIST "120"
+
+/* ssh puts the control socket in a sockaddr_un, and while creating it
+ * appends a random suffix of this length to the path. */
+#define DCC_SSH_CONTROL_SUFFIX_LEN 17
+
 
 
 
@@ -167,6 +181,69 @@ static int dcc_run_piped_cmd(char **argv,
 
 
 
+/**
+ * Add options to make OpenSSH share one master connection per host, with
+ * the control sockets in the lock directory.
+ *
+ * This is skipped if DISTCC_SSH_MULTIPLEX is false, if the tunnel command
+ * doesn't look like OpenSSH, if the user already chose a control socket, or
+ * if the path would be too long for a Unix socket.
+ *
+ * @returns the number of arguments added to @p argv, which must have room
+ * for six.
+ **/
+static int dcc_ssh_multiplex_args(const char *ssh_cmd,
+                                  char **ssh_args, int num_ssh_args,
+                                  char **argv)
+{
+    static char *control_path;
+    const char *base;
+    char *lockdir;
+    int i;
+
+    if (!dcc_getenv_bool("DISTCC_SSH_MULTIPLEX", 1))
+        return 0;
+
+    base = strrchr(ssh_cmd, '/');
+    base = base ? base + 1 : ssh_cmd;
+    if (strcmp(base, "ssh") != 0)
+        return 0;
+
+    for (i = 0; i < num_ssh_args; i++) {
+        if (!strcmp(ssh_args[i], "-S") || strstr(ssh_args[i], "ControlPath")
+            || strstr(ssh_args[i], "ControlMaster")) {
+            rs_trace("ssh control options given in DISTCC_SSH; not adding ours");
+            return 0;
+        }
+    }
+
+    if (!control_path) {
+        struct sockaddr_un addr;
+
+        if (dcc_get_lock_dir(&lockdir) != 0)
+            return 0;
+        /* %C is a 40 character hash of the local host, remote host,
+         * port and user. */
+        if (strlen(lockdir) + strlen("/ssh_") + 40 + DCC_SSH_CONTROL_SUFFIX_LEN
+            >= sizeof addr.sun_path) {
+            rs_trace("lock directory %s is too long for ssh control sockets",
+                     lockdir);
+            return 0;
+        }
+        if (asprintf(&control_path, "ControlPath=%s/ssh_%%C", lockdir) == -1)
+            return 0;
+    }
+
+    argv[0] = (char *) "-o";
+    argv[1] = (char *) "ControlMaster=auto";
+    argv[2] = (char *) "-o";
+    argv[3] = control_path;
+    argv[4] = (char *) "-o";
+    argv[5] = (char *) "ControlPersist=" DCC_SSH_CONTROL_PERSIST;
+    return 6;
+}
+
+
 /**
  * Open a connection to a remote machine over ssh.
  *
@@ -195,7 +272,7 @@ int dcc_ssh_connect(char *ssh_cmd,
     pid_t ret;
     const int max_ssh_args = 12;
     char *ssh_args[max_ssh_args];
-    char *child_argv[11+max_ssh_args];
+    char *child_argv[17+max_ssh_args];
     int i,j;
     int num_ssh_args = 0;
     char *ssh_cmd_in;
@@ -228,6 +305,8 @@ int dcc_ssh_connect(char *ssh_cmd,
     for (j=0; j<num_ssh_args; ) {
         child_argv[i++] = ssh_args[j++];
     }
+    i += dcc_ssh_multiplex_args(ssh_cmd, ssh_args, num_ssh_args,
+                                &child_argv[i]);
 
     if (user) {
         child_argv[i++] = (char *) "-l";
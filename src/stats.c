@@ -49,6 +49,9 @@
 
 int dcc_statspipe[2];
 
+/* The socket the stats are served on. */
+static int dcc_stats_http_fd = -1;
+
 #define MAX_FILENAME_LEN 1024
 
 /* in prefork.c */
@@ -358,7 +361,8 @@ static void dcc_service_stats_request(int http_fd) {
     char *max_RSS_name;
     size_t reply_len;
     char challenge[1024];
-    char reply[2048];
+    char reply[4096];
+    char fair[1024];
     struct dcc_sockaddr_storage cli_addr;
     socklen_t cli_len = sizeof(cli_addr);
     double loadavg[3];
@@ -398,6 +402,8 @@ dcc_max_RSS %d\n\
 dcc_max_RSS_name %s\n\
 dcc_io_rate %d\n\
 dcc_free_space %d MB\n\
+dcc_state %s\n\
+%s\
 </distccstats>\n";
 
     dcc_stats_minutely_update(); /* force update to get fresh disk io data */
@@ -406,6 +412,7 @@ dcc_free_space %d MB\n\
 
     free_space_mb = dcc_get_tmpdirinfo();
     dcc_get_proc_stats(&num_D, &max_RSS, &max_RSS_name);
+    dcc_fair_stats(fair, sizeof fair);
 
     if (dcc_stats.longest_job_name[0] == 0)
         strcpy(dcc_stats.longest_job_name, "none");
@@ -416,7 +423,7 @@ dcc_free_space %d MB\n\
     if (dcc_check_client((struct sockaddr *)&cli_addr,
                          (int) cli_len,
                          opt_allowed) == 0) {
-        reply_len = snprintf(reply, 2048, replytemplate,
+        reply_len = snprintf(reply, sizeof reply, replytemplate,
                                dcc_stats.counters[STATS_TCP_ACCEPT],
                                dcc_stats.counters[STATS_REJ_BAD_REQ],
                                dcc_stats.counters[STATS_REJ_OVERLOAD],
@@ -437,7 +444,10 @@ dcc_free_space %d MB\n\
                                ct[0], ct[1], ct[2],
                                num_D, max_RSS, max_RSS_name,
                                dcc_stats.io_rate,
-                               free_space_mb);
+                               free_space_mb,
+                               dcc_drain_state == DCC_RUNNING
+                               ? "running" : "draining",
+                               fair);
         dcc_set_nonblocking(acc_fd);
         ret = read(acc_fd, challenge, 1024); /* empty the receive queue */
         if (ret < 0) rs_log_info("read on acc_fd failed");
@@ -483,6 +493,25 @@ static void dcc_stats_process(struct statsdata *sd) {
 }
 
 
+/**
+ * Bind the stats port, unless @p *fd is already a socket we were handed.
+ * Done before the daemon detaches, like the main port.
+ **/
+int dcc_stats_listen(int *fd)
+{
+    int ret;
+
+    if (*fd == -1
+        && (ret = dcc_socket_listen(arg_stats_port, fd, opt_listen_addr)) != 0)
+        return ret;
+
+    /* We don't want children to inherit this FD */
+    fcntl(*fd, F_SETFD, FD_CLOEXEC);
+    dcc_stats_http_fd = *fd;
+    return 0;
+}
+
+
 /**
  * Collect runtime statistics from kids and serve them via HTTP
  * Also, maintains the pool of kids.
@@ -502,15 +531,9 @@ int dcc_stats_server(int listen_fd)
     dcc_stats.longest_job_name[0] = 0;
     dcc_stats.io_rate = -1;
 
-    if ((ret = dcc_socket_listen(arg_stats_port, &http_fd,
-                                    opt_listen_addr)) != 0) {
-        return ret;
-    }
+    http_fd = dcc_stats_http_fd;
     rs_log_info("HTTP server started on port %d\n", arg_stats_port);
 
-    /* We don't want children to inherit this FD */
-    fcntl(http_fd, F_SETFD, FD_CLOEXEC);
-
     max_fd = (http_fd > dcc_statspipe[0]) ? (http_fd + 1)
                                            : (dcc_statspipe[0] + 1);
 
@@ -534,7 +557,7 @@ int dcc_stats_server(int listen_fd)
                 }
             }
 
-            if (FD_ISSET(http_fd, &fds)) {
+            if (http_fd != -1 && FD_ISSET(http_fd, &fds)) {
                 /* Received request on stats reporting port */
                 dcc_service_stats_request(http_fd);
             }
@@ -545,5 +568,17 @@ int dcc_stats_server(int listen_fd)
         }
 
         dcc_manage_kids(listen_fd);
+
+        dcc_drain_log();
+        if (dcc_drain_state == DCC_HANDED_OFF && http_fd != -1) {
+            /* the new daemon answers from now on */
+            FD_CLR(http_fd, &fds_master);
+            dcc_close(http_fd);
+            http_fd = -1;
+        }
+        if (dcc_drain_state != DCC_RUNNING && dcc_nkids == 0) {
+            dcc_drain_done();
+            return 0;
+        }
     }
 }
@@ -37,6 +37,7 @@ extern const char *stats_text[20];
 
 int  dcc_stats_init(void);
 void dcc_stats_init_kid(void);
+int  dcc_stats_listen(int *fd);
 int  dcc_stats_server(int listen_fd);
 void dcc_stats_event(enum stats_e e);
 void dcc_stats_compile_ok(char *compiler, char *filename, struct timeval start,
@@ -0,0 +1,178 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/*
+ * stubcc.c:
+ * A pretend compiler for load-testing distccd.
+ *
+ * distcc-stubcc takes arguments like "cc -c x.i -o x.o", reads the input,
+ * and writes an output of the size it is asked for, after using as much
+ * CPU time and memory as it is asked for.  distcc-loadgen asks with
+ * -D options, which distccd passes through:
+ *
+ *   -DSTUB_CPU_MS=N    CPU time to use, in milliseconds
+ *   -DSTUB_MEM_MB=N    memory to allocate and touch
+ *   -DSTUB_OUT_KB=N    size of the object file
+ *   -DSTUB_FAIL=1      fail, with a message on stderr
+ *
+ * If given -MF FILE, it writes a dependency file there, as gcc would.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+
+static double cpu_seconds(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == -1)
+        return (double) clock() / CLOCKS_PER_SEC;
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void die(const char *what)
+{
+    fprintf(stderr, "distcc-stubcc: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+
+/* Read the whole of @p path, folding it into a checksum. */
+static unsigned long read_input(const char *path)
+{
+    char buf[65536];
+    unsigned long sum = 0;
+    ssize_t n, i;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        die(path);
+    while ((n = read(fd, buf, sizeof buf)) > 0) {
+        for (i = 0; i < n; i += 64)
+            sum = sum * 31 + (unsigned char) buf[i];
+    }
+    if (n == -1)
+        die(path);
+    close(fd);
+    return sum;
+}
+
+
+static void write_output(const char *path, size_t size, unsigned long seed)
+{
+    char buf[65536];
+    size_t i, done, len;
+    int fd;
+
+    /* Half text, half noise, so that it compresses about as well as an
+     * object file does. */
+    for (i = 0; i < sizeof buf; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = (i & 64) ? "distcc object "[i % 14] : (char) (seed >> 16);
+    }
+    if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666)) == -1)
+        die(path);
+    for (done = 0; done < size; done += len) {
+        len = size - done < sizeof buf ? size - done : sizeof buf;
+        if (write(fd, buf, len) != (ssize_t) len)
+            die(path);
+    }
+    if (close(fd) == -1)
+        die(path);
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *input = NULL, *output = "a.out", *deps = NULL;
+    long cpu_ms = 0, mem_mb = 0, out_kb = 4, fail = 0;
+    unsigned long sum;
+    double until;
+    char *mem = NULL;
+    FILE *f;
+    long i;
+
+    for (i = 1; i < argc; i++) {
+        const char *a = argv[i];
+
+        if (strcmp(a, "--version") == 0) {
+            printf("distcc-stubcc " PACKAGE_VERSION "\n");
+            return 0;
+        } else if (strcmp(a, "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(a, "-MF") == 0 && i + 1 < argc) {
+            deps = argv[++i];
+        } else if (sscanf(a, "-DSTUB_CPU_MS=%ld", &cpu_ms) == 1
+                   || sscanf(a, "-DSTUB_MEM_MB=%ld", &mem_mb) == 1
+                   || sscanf(a, "-DSTUB_OUT_KB=%ld", &out_kb) == 1
+                   || sscanf(a, "-DSTUB_FAIL=%ld", &fail) == 1) {
+            ;
+        } else if (a[0] != '-') {
+            input = a;
+        }
+    }
+    if (!input) {
+        fprintf(stderr, "distcc-stubcc: no input file\n");
+        return 1;
+    }
+
+    until = cpu_seconds() + cpu_ms / 1000.0;
+    sum = read_input(input);
+
+    if (mem_mb > 0) {
+        size_t size = (size_t) mem_mb << 20;
+        if ((mem = malloc(size)) == NULL)
+            die("malloc");
+        for (i = 0; (size_t) i < size; i += 4096)
+            mem[i] = (char) i;
+    }
+
+    /* Spin until we have used our share of CPU, a few thousand
+     * iterations at a time. */
+    while (cpu_seconds() < until) {
+        for (i = 0; i < 4096; i++)
+            sum = sum * 6364136223846793005UL + 1442695040888963407UL;
+    }
+    free(mem);
+
+    if (fail) {
+        fprintf(stderr, "%s:1:1: error: failed on purpose\n", input);
+        return 1;
+    }
+
+    write_output(output, (size_t) out_kb << 10, sum);
+    if (deps) {
+        if ((f = fopen(deps, "w")) == NULL)
+            die(deps);
+        fprintf(f, "%s: %s\n", output, input);
+        if (fclose(f) == EOF)
+            die(deps);
+    }
+    return 0;
+}
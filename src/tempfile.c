@@ -35,6 +35,9 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 
 #include <time.h>
 #include <stdio.h>
@@ -453,6 +456,82 @@ int dcc_make_tmpnam(const char *prefix,
     return 0;
 }
 
+
+/* Prefix of the names dcc_make_mem_tmpnam() gives in-memory files. */
+static const char dcc_mem_tmp_prefix[] = "/proc/self/fd/";
+
+/* Only keep temporary files in memory while there is at least this many
+ * times the largest one available. */
+#define DCC_MEM_TMP_HEADROOM 8
+
+/**
+ * Return the largest in-memory temporary file, in megabytes, from
+ * $DISTCC_MEM_TEMP_SIZE.  0 means not to use them.
+ **/
+long dcc_mem_tmp_limit(void)
+{
+    const char *s = getenv("DISTCC_MEM_TEMP_SIZE");
+
+    if (s && *s)
+        return atol(s) > 0 ? atol(s) : 0;
+    return 64;
+}
+
+
+/**
+ * Like dcc_make_tmpnam(), but keep the file in memory if we can.
+ *
+ * The file is a memfd, and the name returned is its /proc/self/fd path.
+ * Anything that takes a file name can open that, including the children
+ * we start, because they inherit the descriptor.  It goes away when we
+ * exit, so it isn't added to the cleanup list.
+ *
+ * If memfds aren't available, if memory is short, or if the user wants to
+ * see the temporary files with $DISTCC_SAVE_TEMPS, this makes a real file
+ * with dcc_make_tmpnam().
+ **/
+int dcc_make_mem_tmpnam(const char *prefix,
+                        const char *suffix,
+                        char **name_ret)
+{
+#ifdef HAVE_MEMFD_CREATE
+    long limit = dcc_mem_tmp_limit();
+    int avail = dcc_get_mem_available();
+    char *label;
+    int fd;
+
+    if (limit > 0 && avail >= limit * DCC_MEM_TMP_HEADROOM
+        && !dcc_getenv_bool("DISTCC_SAVE_TEMPS", 0)) {
+        if (asprintf(&label, "%s%s", prefix, suffix) == -1)
+            return EXIT_OUT_OF_MEMORY;
+        fd = memfd_create(label, MFD_CLOEXEC);
+        free(label);
+        if (fd != -1) {
+            if (asprintf(name_ret, "%s%d", dcc_mem_tmp_prefix, fd) == -1) {
+                close(fd);
+                return EXIT_OUT_OF_MEMORY;
+            }
+            return 0;
+        }
+        rs_trace("memfd_create failed: %s", strerror(errno));
+    }
+#endif
+    return dcc_make_tmpnam(prefix, suffix, name_ret);
+}
+
+
+/**
+ * If @p fname came from dcc_make_mem_tmpnam() and is in memory, return its
+ * descriptor, otherwise -1.
+ **/
+int dcc_mem_tmp_fd(const char *fname)
+{
+    if (!str_startswith(dcc_mem_tmp_prefix, fname))
+        return -1;
+    return atoi(fname + sizeof dcc_mem_tmp_prefix - 1);
+}
+
+
 static int dcc_make_dirs(char *dir)
 {
   int ret = 0;
@@ -512,7 +591,9 @@ int dcc_make_tmp_dir_obj(const char *orig_output,
       return ret;
     }
 
-    char *rel_s = strdup (s+14);
+    /* The compiler runs in this directory, so give it the name relative
+     * to it. */
+    char *rel_s = strdup (s + strlen(temp_random_dir) + 1);
     *name_ret = rel_s;
     return 0;
 }
@@ -0,0 +1,128 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* The format of GSS-API session tickets, and the keys and proofs made
+ * from them.  None of this needs the GSS-API, so that it can be tested
+ * anywhere. */
+
+#include <config.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "sha256.h"
+#include "ticket.h"
+
+
+/**
+ * Lay out a ticket for @p principal, expiring at @p expiry, issued under
+ * the server key @p key_id.  @p ticket must have room for
+ * DCC_TICKET_HEADER_LEN plus the length of the principal.
+ *
+ * Returns the length of the ticket.
+ **/
+size_t dcc_ticket_make(const unsigned char *key_id, const char *principal,
+                       uint32_t expiry, unsigned char *ticket)
+{
+    size_t name_len = strlen(principal);
+
+    memcpy(ticket, DCC_TICKET_MAGIC, 4);
+    memcpy(ticket + 4, key_id, DCC_TICKET_KEY_ID_LEN);
+    ticket[12] = (unsigned char) (expiry >> 24);
+    ticket[13] = (unsigned char) (expiry >> 16);
+    ticket[14] = (unsigned char) (expiry >> 8);
+    ticket[15] = (unsigned char) expiry;
+    memcpy(ticket + DCC_TICKET_HEADER_LEN, principal, name_len);
+
+    return DCC_TICKET_HEADER_LEN + name_len;
+}
+
+
+/**
+ * Check that a ticket was issued under the server key @p key_id and has
+ * not expired by @p now.  This says nothing about whether the ticket
+ * was tampered with: that shows up when the peer's proof made with the
+ * session key doesn't match.
+ *
+ * Returns 1 if the ticket may be used, otherwise 0.
+ **/
+int dcc_ticket_valid(const unsigned char *key_id,
+                     const unsigned char *ticket, size_t len, time_t now)
+{
+    uint32_t expiry;
+
+    if (len < DCC_TICKET_HEADER_LEN || len > DCC_TICKET_MAX_LEN
+        || memcmp(ticket, DCC_TICKET_MAGIC, 4) != 0
+        || memcmp(ticket + 4, key_id, DCC_TICKET_KEY_ID_LEN) != 0)
+        return 0;
+
+    expiry = (uint32_t) ticket[12] << 24 | (uint32_t) ticket[13] << 16
+        | (uint32_t) ticket[14] << 8 | ticket[15];
+
+    return (time_t) expiry > now;
+}
+
+
+/**
+ * Derive a ticket's session key from the server's secret, so that the
+ * server needn't remember the tickets it has issued.  The key changes
+ * if any byte of the ticket does.
+ *
+ * @param session_key Receives DCC_SHA256_LEN bytes.
+ **/
+void dcc_ticket_session_key(const unsigned char *ticket_key,
+                            const unsigned char *ticket, size_t len,
+                            unsigned char *session_key)
+{
+    dcc_hmac_sha256(ticket_key, DCC_SHA256_LEN, ticket, len, session_key);
+}
+
+
+/**
+ * Compute one side's proof that it holds the session key of a ticket.
+ * The label keeps the client's and server's proofs distinct, and the
+ * nonces tie them to this connection so that they can't be replayed.
+ *
+ * @param session_key The key derived from the ticket.
+ *
+ * @param label "distcc" or "distccd", for whoever is proving.
+ *
+ * @param nonce_one The prover's peer's nonce.
+ *
+ * @param nonce_two The prover's own nonce.
+ *
+ * @param proof Receives DCC_SHA256_LEN bytes.
+ **/
+void dcc_ticket_proof(const unsigned char *session_key, const char *label,
+                      const unsigned char *nonce_one,
+                      const unsigned char *nonce_two,
+                      unsigned char *proof)
+{
+    unsigned char msg[16 + 2 * DCC_TICKET_NONCE_LEN];
+    size_t label_len = strlen(label);
+
+    memset(msg, 0, sizeof msg);
+    memcpy(msg, label, label_len < 16 ? label_len : 16);
+    memcpy(msg + 16, nonce_one, DCC_TICKET_NONCE_LEN);
+    memcpy(msg + 16 + DCC_TICKET_NONCE_LEN, nonce_two, DCC_TICKET_NONCE_LEN);
+
+    dcc_hmac_sha256(session_key, DCC_SHA256_LEN, msg, sizeof msg, proof);
+}
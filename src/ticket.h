@@ -0,0 +1,47 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef __DISTCC_TICKET_H__
+#define __DISTCC_TICKET_H__
+
+/* Session tickets: the ticket starts with this magic and the id of the
+ * server key that issued it, then the expiry time and principal name. */
+#define DCC_TICKET_MAGIC "DTK1"
+#define DCC_TICKET_KEY_ID_LEN 8
+#define DCC_TICKET_HEADER_LEN (4 + DCC_TICKET_KEY_ID_LEN + 4)
+#define DCC_TICKET_MAX_LEN 4096
+#define DCC_TICKET_NONCE_LEN 16
+/* Clients treat their ticket as expired this many seconds early. */
+#define DCC_TICKET_SLACK 30
+
+/* ticket.c */
+size_t dcc_ticket_make(const unsigned char *key_id, const char *principal,
+                       uint32_t expiry, unsigned char *ticket);
+int dcc_ticket_valid(const unsigned char *key_id,
+                     const unsigned char *ticket, size_t len, time_t now);
+void dcc_ticket_session_key(const unsigned char *ticket_key,
+                            const unsigned char *ticket, size_t len,
+                            unsigned char *session_key);
+void dcc_ticket_proof(const unsigned char *session_key, const char *label,
+                      const unsigned char *nonce_one,
+                      const unsigned char *nonce_two,
+                      unsigned char *proof);
+
+#endif /* __DISTCC_TICKET_H__ */
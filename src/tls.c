@@ -0,0 +1,651 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * TLS 1.3 transport for TCP connections.
+ *
+ * Everything else in distcc reads and writes plain file descriptors, and
+ * sends files with sendfile() where it can.  So once the handshake is done
+ * we try to hand the connection over to the kernel (kTLS): if the socket
+ * can encrypt and decrypt by itself, the rest of the job uses it exactly
+ * as if it were a plain TCP connection.
+ *
+ * If the kernel can't do one or both directions, a relay child is forked
+ * to do them in userspace, and the job talks to it over a socketpair, much
+ * as it talks to the ssh child in SSH mode.  Commonly only transmission is
+ * offloaded, in which case the socket is still written directly and only
+ * the receiving side goes through the relay.
+ *
+ * Clients keep the last session ticket for each server under
+ * $DISTCC_DIR/tls, so later connections resume rather than doing a full
+ * handshake.  Tickets are encrypted with a key held by the daemon's
+ * listening process, so they are honoured by all of its children.
+ */
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+#include "util.h"
+#include "netutil.h"
+#include "hosts.h"
+#include "tls.h"
+
+/* One buffer each way in the relay. */
+#define DCC_TLS_RELAY_BUFSIZE (64 * 1024)
+
+static SSL_CTX *dcc_tls_server_ctx;
+static SSL_CTX *dcc_tls_client_ctx;
+
+
+static int dcc_tls_log_error(const char *str, size_t len, void *UNUSED(u))
+{
+    if (len && str[len - 1] == '\n')
+        len--;
+    rs_log_error("%.*s", (int) len, str);
+    return 1;
+}
+
+
+static void dcc_tls_log_errors(const char *what)
+{
+    rs_log_error("%s failed", what);
+    ERR_print_errors_cb(dcc_tls_log_error, NULL);
+}
+
+
+static SSL_CTX *dcc_tls_new_ctx(const SSL_METHOD *method)
+{
+    SSL_CTX *ctx;
+
+    if (!(ctx = SSL_CTX_new(method))) {
+        dcc_tls_log_errors("SSL_CTX_new");
+        return NULL;
+    }
+
+    SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+                     | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+    return ctx;
+}
+
+
+/**
+ * Set up the daemon's TLS context.  Called once, before forking, while we
+ * may still be root and able to read the key.
+ *
+ * @param ca_file If not NULL, clients must present a certificate signed
+ * by one of these CAs.
+ **/
+int dcc_tls_server_init(const char *cert_file, const char *key_file,
+                        const char *ca_file)
+{
+    static const unsigned char sid_ctx[] = "distccd";
+    SSL_CTX *ctx;
+
+    if (!(ctx = dcc_tls_new_ctx(TLS_server_method())))
+        return EXIT_DISTCC_FAILED;
+
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1) {
+        dcc_tls_log_errors(cert_file);
+        goto fail;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, key_file ? key_file : cert_file,
+                                    SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(ctx) != 1) {
+        dcc_tls_log_errors(key_file ? key_file : cert_file);
+        goto fail;
+    }
+
+    if (ca_file) {
+        STACK_OF(X509_NAME) *names;
+
+        if (SSL_CTX_load_verify_locations(ctx, ca_file, NULL) != 1
+            || !(names = SSL_load_client_CA_file(ca_file))) {
+            dcc_tls_log_errors(ca_file);
+            goto fail;
+        }
+        SSL_CTX_set_client_CA_list(ctx, names);
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER
+                           | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+    }
+
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof sid_ctx - 1);
+    SSL_CTX_set_num_tickets(ctx, 1);
+
+    dcc_tls_server_ctx = ctx;
+    return 0;
+
+fail:
+    SSL_CTX_free(ctx);
+    return EXIT_DISTCC_FAILED;
+}
+
+
+/**
+ * Set up the client's TLS context from the environment.
+ **/
+static int dcc_tls_client_init(void)
+{
+    const char *ca_file = getenv("DISTCC_TLS_CA");
+    const char *cert_file = getenv("DISTCC_TLS_CERT");
+    const char *key_file = getenv("DISTCC_TLS_KEY");
+    SSL_CTX *ctx;
+
+    if (!(ctx = dcc_tls_new_ctx(TLS_client_method())))
+        return EXIT_DISTCC_FAILED;
+
+    if (ca_file) {
+        if (SSL_CTX_load_verify_locations(ctx, ca_file, NULL) != 1) {
+            dcc_tls_log_errors(ca_file);
+            goto fail;
+        }
+    } else if (SSL_CTX_set_default_verify_paths(ctx) != 1) {
+        dcc_tls_log_errors("SSL_CTX_set_default_verify_paths");
+        goto fail;
+    }
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+
+    if (cert_file) {
+        if (SSL_CTX_use_certificate_chain_file(ctx, cert_file) != 1
+            || SSL_CTX_use_PrivateKey_file(ctx, key_file ? key_file : cert_file,
+                                           SSL_FILETYPE_PEM) != 1) {
+            dcc_tls_log_errors(cert_file);
+            goto fail;
+        }
+    }
+
+    dcc_tls_client_ctx = ctx;
+    return 0;
+
+fail:
+    SSL_CTX_free(ctx);
+    return EXIT_DISTCC_FAILED;
+}
+
+
+/**
+ * Wait until a nonblocking TLS operation which returned @p ret can make
+ * progress.
+ *
+ * @returns 0 to try again, or an error code.
+ **/
+static int dcc_tls_wait(SSL *ssl, int ret, const char *what)
+{
+    switch (SSL_get_error(ssl, ret)) {
+    case SSL_ERROR_WANT_READ:
+        return dcc_select_for_read(SSL_get_rfd(ssl), dcc_get_io_timeout());
+    case SSL_ERROR_WANT_WRITE:
+        return dcc_select_for_write(SSL_get_wfd(ssl), dcc_get_io_timeout());
+    default:
+        dcc_tls_log_errors(what);
+        return EXIT_IO_ERROR;
+    }
+}
+
+
+static int dcc_tls_session_filename(const struct dcc_hostdef *host,
+                                    char **fname_ret)
+{
+    char *dir;
+    int ret;
+
+    if ((ret = dcc_get_subdir("tls", &dir)))
+        return ret;
+
+    ret = asprintf(fname_ret, "%s/%s_%d.pem", dir, host->hostname,
+                   host->port);
+    free(dir);
+    return ret == -1 ? EXIT_OUT_OF_MEMORY : 0;
+}
+
+
+static void dcc_tls_load_session(SSL *ssl, const char *fname)
+{
+    SSL_SESSION *sess;
+    FILE *f;
+
+    if (!(f = fopen(fname, "r")))
+        return;
+
+    if ((sess = PEM_read_SSL_SESSION(f, NULL, NULL, NULL))) {
+        SSL_set_session(ssl, sess);
+        SSL_SESSION_free(sess);
+    }
+    ERR_clear_error();
+    fclose(f);
+}
+
+
+/* Several clients may be saving at once, so write a private file and
+ * rename it into place.  The session holds the resumption secret, so
+ * only we may read it. */
+static void dcc_tls_save_session(SSL *ssl, const char *fname)
+{
+    SSL_SESSION *sess;
+    char *tmp;
+    FILE *f;
+    int fd;
+
+    if (!(sess = SSL_get1_session(ssl)))
+        return;
+
+    if (SSL_SESSION_is_resumable(sess)
+        && asprintf(&tmp, "%s.%ld", fname, (long) getpid()) != -1) {
+        unlink(tmp);            /* left by an earlier process of ours */
+        if ((fd = open(tmp, O_WRONLY|O_CREAT|O_EXCL, 0600)) == -1) {
+            rs_trace("failed to create %s: %s", tmp, strerror(errno));
+        } else if (!(f = fdopen(fd, "w"))) {
+            close(fd);
+            unlink(tmp);
+        } else {
+            int ok = PEM_write_SSL_SESSION(f, sess);
+
+            if (fclose(f) == 0 && ok && rename(tmp, fname) == 0)
+                rs_trace("saved TLS session to %s", fname);
+            else
+                unlink(tmp);
+        }
+        free(tmp);
+    }
+    SSL_SESSION_free(sess);
+}
+
+
+/**
+ * Copy data between the TLS connection and @p local_fd until the job
+ * closes its end.
+ *
+ * If @p tx_offloaded, the job writes to the socket itself and nothing
+ * will come up from @p local_fd.
+ **/
+static int dcc_tls_relay(SSL *ssl, int local_fd, int tx_offloaded)
+{
+    char *up, *down;
+    size_t up_len = 0, up_off = 0, down_len = 0, down_off = 0;
+    int local_eof = 0, net_eof = 0;
+    int timeout = dcc_get_io_timeout();
+    int ret = 0;
+
+    up = malloc(DCC_TLS_RELAY_BUFSIZE);
+    down = malloc(DCC_TLS_RELAY_BUFSIZE);
+    if (!up || !down) {
+        rs_log_error("failed to allocate relay buffers");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    dcc_set_nonblocking(local_fd);
+    dcc_set_nonblocking(SSL_get_rfd(ssl));
+    dcc_set_nonblocking(SSL_get_wfd(ssl));
+
+    while (1) {
+        struct pollfd pfd[3];
+        int net_want_read = 0, net_want_write = 0;
+        int progress = 0;
+        int n, r, err;
+
+        if (up_len == 0 && !local_eof) {
+            ssize_t got = read(local_fd, up, DCC_TLS_RELAY_BUFSIZE);
+
+            if (got > 0) {
+                up_len = (size_t) got;
+                up_off = 0;
+                progress = 1;
+            } else if (got == 0) {
+                local_eof = 1;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK
+                       && errno != EINTR) {
+                rs_log_error("relay read failed: %s", strerror(errno));
+                ret = EXIT_IO_ERROR;
+                break;
+            }
+        }
+
+        if (up_off < up_len) {
+            r = SSL_write(ssl, up + up_off, (int) (up_len - up_off));
+            if (r > 0) {
+                up_off += (size_t) r;
+                if (up_off == up_len)
+                    up_off = up_len = 0;
+                progress = 1;
+            } else if ((err = SSL_get_error(ssl, r)) == SSL_ERROR_WANT_READ) {
+                net_want_read = 1;
+            } else if (err == SSL_ERROR_WANT_WRITE) {
+                net_want_write = 1;
+            } else {
+                dcc_tls_log_errors("SSL_write");
+                ret = EXIT_IO_ERROR;
+                break;
+            }
+        }
+
+        /* The job has finished with the connection. */
+        if (local_eof && up_len == 0)
+            break;
+
+        if (down_len == 0 && !net_eof) {
+            r = SSL_read(ssl, down, DCC_TLS_RELAY_BUFSIZE);
+            if (r > 0) {
+                down_len = (size_t) r;
+                down_off = 0;
+                progress = 1;
+            } else if ((err = SSL_get_error(ssl, r)) == SSL_ERROR_WANT_READ) {
+                net_want_read = 1;
+            } else if (err == SSL_ERROR_WANT_WRITE) {
+                net_want_write = 1;
+            } else if (err == SSL_ERROR_ZERO_RETURN
+                       || (err == SSL_ERROR_SYSCALL && r == 0)) {
+                rs_trace("TLS peer closed the connection");
+                net_eof = 1;
+                shutdown(local_fd, SHUT_WR);
+                progress = 1;
+            } else {
+                dcc_tls_log_errors("SSL_read");
+                ret = EXIT_IO_ERROR;
+                break;
+            }
+        }
+
+        if (down_off < down_len) {
+            ssize_t put = write(local_fd, down + down_off,
+                                down_len - down_off);
+
+            if (put > 0) {
+                down_off += (size_t) put;
+                if (down_off == down_len)
+                    down_off = down_len = 0;
+                progress = 1;
+            } else if (errno == EPIPE) {
+                /* job went away without reading everything */
+                break;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK
+                       && errno != EINTR) {
+                rs_log_error("relay write failed: %s", strerror(errno));
+                ret = EXIT_IO_ERROR;
+                break;
+            }
+        }
+
+        if (progress)
+            continue;
+
+        n = 0;
+        pfd[n].fd = local_fd;
+        pfd[n].events = 0;
+        if (up_len == 0 && !local_eof)
+            pfd[n].events |= POLLIN;
+        if (down_off < down_len)
+            pfd[n].events |= POLLOUT;
+        n++;
+        if (net_want_read) {
+            pfd[n].fd = SSL_get_rfd(ssl);
+            pfd[n++].events = POLLIN;
+        }
+        if (net_want_write) {
+            pfd[n].fd = SSL_get_wfd(ssl);
+            pfd[n++].events = POLLOUT;
+        }
+
+        r = poll(pfd, n, timeout * 1000);
+        if (r == 0) {
+            rs_log_error("IO timeout in TLS relay");
+            ret = EXIT_IO_ERROR;
+            break;
+        } else if (r == -1 && errno != EINTR) {
+            rs_log_error("poll failed: %s", strerror(errno));
+            ret = EXIT_IO_ERROR;
+            break;
+        }
+    }
+
+    /* If the job was writing to the socket itself, we can't add a
+     * close_notify behind its back; the peer will just see the FIN. */
+    if (ret == 0 && !tx_offloaded && !net_eof)
+        SSL_shutdown(ssl);
+
+    free(up);
+    free(down);
+    return ret;
+}
+
+
+/**
+ * Fork a child to relay between the TLS connection and a new socketpair.
+ **/
+static int dcc_tls_start_relay(SSL *ssl, int tx_offloaded,
+                               int *local_fd, pid_t *relay_pid)
+{
+    int sv[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+        rs_log_error("socketpair failed: %s", strerror(errno));
+        return EXIT_IO_ERROR;
+    }
+
+    pid = fork();
+    if (pid == -1) {
+        rs_log_error("fork failed: %s", strerror(errno));
+        dcc_close(sv[0]);
+        dcc_close(sv[1]);
+        return EXIT_IO_ERROR;
+    } else if (pid == 0) {
+        /* Leave temporary files and the like to the parent. */
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGHUP, SIG_DFL);
+        signal(SIGPIPE, SIG_IGN);
+        close(sv[0]);
+        _exit(dcc_tls_relay(ssl, sv[1], tx_offloaded));
+    }
+
+    dcc_close(sv[1]);
+    *local_fd = sv[0];
+    *relay_pid = pid;
+    return 0;
+}
+
+
+/**
+ * After the handshake, arrange for the job's fds to carry plaintext:
+ * either they stay as they are because the kernel does the work, or
+ * some or all of them are replaced by a relay.
+ **/
+static int dcc_tls_attach(SSL *ssl, int *to_net_fd, int *from_net_fd,
+                          pid_t *relay_pid)
+{
+    int tx = 0, rx = 0;
+    int local_fd;
+    int ret;
+
+#ifdef SSL_OP_ENABLE_KTLS
+    tx = BIO_get_ktls_send(SSL_get_wbio(ssl));
+    rx = BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#endif
+
+    if (tx && rx) {
+        rs_trace("using kernel TLS in both directions");
+        SSL_free(ssl);
+        return 0;
+    }
+
+    rs_trace("kernel TLS: transmit %s, receive %s", tx ? "yes" : "no",
+             rx ? "yes" : "no");
+
+    ret = dcc_tls_start_relay(ssl, tx, &local_fd, relay_pid);
+    SSL_free(ssl);
+    if (ret)
+        return ret;
+
+    if (!tx)
+        *to_net_fd = local_fd;
+    *from_net_fd = local_fd;
+    return 0;
+}
+
+
+/**
+ * Do the server side of the handshake.  On success @p in_fd and @p
+ * out_fd may have been replaced, and if @p relay_pid is set, the caller
+ * must close them and then wait for it.
+ **/
+int dcc_tls_server_start(int *in_fd, int *out_fd, pid_t *relay_pid)
+{
+    SSL *ssl;
+    int r, ret;
+
+    *relay_pid = 0;
+
+    if (!(ssl = SSL_new(dcc_tls_server_ctx))) {
+        dcc_tls_log_errors("SSL_new");
+        return EXIT_DISTCC_FAILED;
+    }
+    SSL_set_rfd(ssl, *in_fd);
+    SSL_set_wfd(ssl, *out_fd);
+
+    while ((r = SSL_accept(ssl)) != 1) {
+        if ((ret = dcc_tls_wait(ssl, r, "TLS handshake")))
+            goto fail;
+    }
+
+    rs_log_info("TLS connection established%s",
+                SSL_session_reused(ssl) ? " (resumed)" : "");
+
+    /* Let the client know the handshake is over, so that it has dealt
+     * with our session ticket before it stops using the library. */
+    while ((r = SSL_write(ssl, DCC_TLS_READY, DCC_TLS_READY_LEN)) <= 0) {
+        if ((ret = dcc_tls_wait(ssl, r, "TLS write")))
+            goto fail;
+    }
+
+    return dcc_tls_attach(ssl, out_fd, in_fd, relay_pid);
+
+fail:
+    SSL_free(ssl);
+    return ret;
+}
+
+
+/**
+ * Open a TLS session over a freshly connected socket to @p host.
+ *
+ * On success @p to_net_fd and @p from_net_fd may have been replaced by
+ * the socketpair to a relay; in that case @p relay_pid is set and should
+ * be collected after they are closed.
+ **/
+int dcc_tls_client_start(const struct dcc_hostdef *host,
+                         int *to_net_fd, int *from_net_fd,
+                         pid_t *relay_pid)
+{
+    char buf[DCC_TLS_READY_LEN];
+    char *session_fname = NULL;
+    int net_fd = *to_net_fd;
+    int got = 0;
+    SSL *ssl;
+    int r, ret;
+
+    *relay_pid = 0;
+
+    if (!dcc_tls_client_ctx && (ret = dcc_tls_client_init()))
+        return ret;
+
+    if (!(ssl = SSL_new(dcc_tls_client_ctx))) {
+        dcc_tls_log_errors("SSL_new");
+        return EXIT_DISTCC_FAILED;
+    }
+    SSL_set_fd(ssl, net_fd);
+
+    /* Check the certificate is for the host we meant; if it was given as
+     * an address, it must be in the certificate as one. */
+    if (!X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host->hostname)) {
+        SSL_set_tlsext_host_name(ssl, host->hostname);
+        if (SSL_set1_host(ssl, host->hostname) != 1) {
+            dcc_tls_log_errors("SSL_set1_host");
+            ret = EXIT_DISTCC_FAILED;
+            goto fail;
+        }
+    }
+
+    if (dcc_tls_session_filename(host, &session_fname) == 0)
+        dcc_tls_load_session(ssl, session_fname);
+
+    while ((r = SSL_connect(ssl)) != 1) {
+        if ((ret = dcc_tls_wait(ssl, r, "TLS handshake")))
+            goto fail;
+    }
+
+    while (got < DCC_TLS_READY_LEN) {
+        r = SSL_read(ssl, buf + got, DCC_TLS_READY_LEN - got);
+        if (r > 0)
+            got += r;
+        else if ((ret = dcc_tls_wait(ssl, r, "TLS read")))
+            goto fail;
+    }
+    if (memcmp(buf, DCC_TLS_READY, DCC_TLS_READY_LEN) != 0) {
+        rs_log_error("unexpected greeting from TLS server %s", host->hostname);
+        ret = EXIT_PROTOCOL_ERROR;
+        goto fail;
+    }
+
+    rs_trace("TLS connection to %s established%s", host->hostname,
+             SSL_session_reused(ssl) ? " (resumed)" : "");
+
+    if (session_fname)
+        dcc_tls_save_session(ssl, session_fname);
+    free(session_fname);
+
+    ret = dcc_tls_attach(ssl, to_net_fd, from_net_fd, relay_pid);
+
+    /* If both directions go through the relay, it alone needs the socket. */
+    if (ret == 0 && *to_net_fd != net_fd && *from_net_fd != net_fd)
+        dcc_close(net_fd);
+    return ret;
+
+fail:
+    free(session_fname);
+    SSL_free(ssl);
+    return ret;
+}
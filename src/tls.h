@@ -0,0 +1,33 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* Sent by the server once the handshake is complete. */
+#define DCC_TLS_READY "DTLS"
+#define DCC_TLS_READY_LEN 4
+
+struct dcc_hostdef;
+
+/* tls.c */
+int dcc_tls_server_init(const char *cert_file, const char *key_file,
+                        const char *ca_file);
+int dcc_tls_server_start(int *in_fd, int *out_fd, pid_t *relay_pid);
+int dcc_tls_client_start(const struct dcc_hostdef *host,
+                         int *to_net_fd, int *from_net_fd,
+                         pid_t *relay_pid);
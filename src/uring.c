@@ -0,0 +1,465 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * distcc -- A simple distributed compiler system
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/**
+ * @file
+ *
+ * Bulk data transfer through io_uring.
+ *
+ * dcc_pump_uring() does the same job as dcc_pump_readwrite(): copy @p n
+ * bytes between two descriptors, either of which may be a socket.  It
+ * splits the transfer into chunks, one per registered buffer, and submits
+ * each chunk as a read linked to a write.  When either side is a stream the
+ * chunks are linked together too, so they stay in order.  A whole batch of
+ * chunks then costs one io_uring_enter() rather than a read() and a write()
+ * each.  That only pays off on big transfers, so dcc_r_bulk() uses it for
+ * files of DCC_URING_MIN_SIZE or more.
+ *
+ * Socket reads are submitted as recv(MSG_WAITALL), so they normally fill
+ * the buffer and don't break the chain.  If a chain is broken anyway by a
+ * short read or write, whatever was read is written out by hand and the
+ * next batch starts from there.
+ *
+ * The ring is set up on first use in each process, since distccd's
+ * children must not share one.  If io_uring isn't there, or the kernel is
+ * too old to wait with a timeout, we fall back to dcc_pump_readwrite().
+ **/
+
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#  include <stdint.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/uio.h>
+#  include <linux/io_uring.h>
+#endif
+
+#include "distcc.h"
+#include "trace.h"
+#include "exitcode.h"
+
+
+/** Set by distccd --io-uring. */
+int dcc_io_uring = 0;
+
+/** Number of io_uring_enter() calls made, for h_pumpbench. */
+unsigned long dcc_uring_enters = 0;
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#define DCC_URING_BUFS 8
+#define DCC_URING_BUF_SIZE (64 * 1024)
+
+static struct {
+    pid_t pid;                  /* 0 if not set up in this process */
+    int failed;
+    int fd;
+    int fixed;                  /* buffers are registered */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sq_local_tail;
+    char *bufs;
+} ring;
+
+
+static int dcc_uring_setup(void)
+{
+    struct io_uring_params p;
+    struct iovec iov[DCC_URING_BUFS];
+    size_t sq_size, cq_size;
+    char *sq, *cq;
+    int i;
+
+    memset(&p, 0, sizeof p);
+    ring.fd = (int) syscall(__NR_io_uring_setup, DCC_URING_BUFS * 2, &p);
+    if (ring.fd == -1) {
+        rs_log_info("io_uring not available (%s); using read/write",
+                    strerror(errno));
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        rs_log_info("io_uring can't wait with a timeout; using read/write");
+        goto fail;
+    }
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size > sq_size)
+            sq_size = cq_size;
+        cq_size = sq_size;
+    }
+
+    sq = mmap(NULL, sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+              ring.fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED)
+        goto fail_mmap;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    } else {
+        cq = mmap(NULL, cq_size, PROT_READ|PROT_WRITE,
+                  MAP_SHARED|MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED)
+            goto fail_mmap;
+    }
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                     PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                     ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED)
+        goto fail_mmap;
+
+    ring.sq_head = (unsigned *) (sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring.cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    ring.sq_local_tail = *ring.sq_tail;
+
+    ring.bufs = mmap(NULL, DCC_URING_BUFS * DCC_URING_BUF_SIZE,
+                     PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (ring.bufs == MAP_FAILED)
+        goto fail_mmap;
+
+    /* Registering the buffers saves mapping them on every request, but
+     * needs locked memory; we can cope without. */
+    for (i = 0; i < DCC_URING_BUFS; i++) {
+        iov[i].iov_base = ring.bufs + i * DCC_URING_BUF_SIZE;
+        iov[i].iov_len = DCC_URING_BUF_SIZE;
+    }
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS,
+                iov, DCC_URING_BUFS) == 0) {
+        ring.fixed = 1;
+    } else {
+        rs_trace("couldn't register io_uring buffers: %s", strerror(errno));
+        ring.fixed = 0;
+    }
+
+    rs_trace("io_uring set up on fd%d, %d buffers of %d bytes%s", ring.fd,
+             DCC_URING_BUFS, DCC_URING_BUF_SIZE,
+             ring.fixed ? ", registered" : "");
+    return 0;
+
+  fail_mmap:
+    rs_log_warning("io_uring mmap failed: %s; using read/write",
+                   strerror(errno));
+  fail:
+    /* Closing the ring takes its mappings with it. */
+    close(ring.fd);
+    ring.fd = -1;
+    return -1;
+}
+
+
+/**
+ * True if transfers in this process should go through io_uring.
+ **/
+int dcc_uring_usable(void)
+{
+    pid_t pid;
+
+    if (!dcc_io_uring)
+        return 0;
+
+    pid = getpid();
+    if (ring.pid != pid) {
+        /* Anything we have is our parent's. */
+        ring.pid = pid;
+        ring.failed = dcc_uring_setup() != 0;
+    }
+    return !ring.failed;
+}
+
+
+static struct io_uring_sqe *dcc_uring_get_sqe(void)
+{
+    unsigned idx = ring.sq_local_tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[idx];
+
+    memset(sqe, 0, sizeof *sqe);
+    ring.sq_array[idx] = idx;
+    ring.sq_local_tail++;
+    return sqe;
+}
+
+
+static void dcc_uring_prep(struct io_uring_sqe *sqe, int write, int fd,
+                           int is_sock, int buf, size_t len, off_t off,
+                           int link)
+{
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) (ring.bufs + buf * DCC_URING_BUF_SIZE);
+    sqe->len = (unsigned) len;
+    sqe->user_data = (uint64_t) (buf * 2 + write);
+    if (link)
+        sqe->flags |= IOSQE_IO_LINK;
+
+    if (is_sock) {
+        sqe->opcode = write ? IORING_OP_SEND : IORING_OP_RECV;
+        sqe->msg_flags = MSG_WAITALL | (write ? MSG_NOSIGNAL : 0);
+    } else {
+        if (ring.fixed) {
+            sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->buf_index = (uint16_t) buf;
+        } else {
+            sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        }
+        /* -1 means the current position, for pipes and the like. */
+        sqe->off = (off == (off_t) -1) ? (uint64_t) -1 : (uint64_t) off;
+    }
+}
+
+
+/**
+ * Submit everything queued and collect @p want completions into @p res,
+ * indexed by user_data.
+ **/
+static int dcc_uring_submit_and_wait(unsigned want, int res[])
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned to_submit, got = 0;
+
+    to_submit = ring.sq_local_tail - *ring.sq_tail;
+    __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+
+    memset(&arg, 0, sizeof arg);
+    ts.tv_sec = dcc_get_io_timeout();
+    ts.tv_nsec = 0;
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t) (uintptr_t) &ts;
+
+    while (got < want) {
+        unsigned head, tail;
+        long r;
+
+        dcc_uring_enters++;
+        r = syscall(__NR_io_uring_enter, ring.fd, to_submit, want - got,
+                    IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                    &arg, sizeof arg);
+        if (r >= 0) {
+            to_submit -= (unsigned) r;
+        } else if (errno == ETIME) {
+            rs_log_error("IO timeout");
+            /* Requests are still in flight on our buffers, so this ring
+             * is finished. */
+            ring.failed = 1;
+            return EXIT_IO_ERROR;
+        } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            rs_log_error("io_uring_enter failed: %s", strerror(errno));
+            ring.failed = 1;
+            return EXIT_IO_ERROR;
+        }
+
+        head = *ring.cq_head;
+        tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            res[cqe->user_data] = cqe->res;
+            got++;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+
+static int dcc_is_socket(int fd)
+{
+    struct stat sb;
+
+    return fstat(fd, &sb) == 0 && S_ISSOCK(sb.st_mode);
+}
+
+
+/**
+ * Write out the part of a chunk that was read but whose linked write
+ * didn't happen or was short.
+ **/
+static int dcc_uring_finish_write(int ofd, off_t off, const char *p,
+                                  size_t len)
+{
+    ssize_t w;
+
+    if (off == (off_t) -1)
+        return dcc_writex(ofd, p, len);
+
+    while (len > 0) {
+        w = pwrite(ofd, p, len, off);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            rs_log_error("failed to write: %s", strerror(errno));
+            return EXIT_IO_ERROR;
+        }
+        p += w;
+        off += w;
+        len -= (size_t) w;
+    }
+    return 0;
+}
+
+
+/**
+ * Copy @p n bytes from @p ifd to @p ofd through io_uring.
+ **/
+int dcc_pump_uring(int ofd, int ifd, size_t n)
+{
+    off_t in_off, out_off;
+    int in_sock, out_sock, in_stream, out_stream, ret;
+    int res[DCC_URING_BUFS * 2];
+    size_t moved_total = 0;
+
+    if (!dcc_uring_usable())
+        return dcc_pump_readwrite(ofd, ifd, n);
+
+    in_off = lseek(ifd, 0, SEEK_CUR);
+    out_off = lseek(ofd, 0, SEEK_CUR);
+    in_stream = (in_off == (off_t) -1);
+    out_stream = (out_off == (off_t) -1);
+    in_sock = in_stream && dcc_is_socket(ifd);
+    out_sock = out_stream && dcc_is_socket(ofd);
+
+    while (n > 0) {
+        size_t len[DCC_URING_BUFS], queued = 0, moved = 0;
+        int k, j, again = 0;
+
+        for (k = 0; k < DCC_URING_BUFS && queued < n; k++) {
+            int more;
+
+            len[k] = n - queued;
+            if (len[k] > DCC_URING_BUF_SIZE)
+                len[k] = DCC_URING_BUF_SIZE;
+            more = (k + 1 < DCC_URING_BUFS && queued + len[k] < n);
+
+            dcc_uring_prep(dcc_uring_get_sqe(), 0, ifd, in_sock, k, len[k],
+                           in_stream ? (off_t) -1 : in_off + (off_t) queued, 1);
+            dcc_uring_prep(dcc_uring_get_sqe(), 1, ofd, out_sock, k, len[k],
+                           out_stream ? (off_t) -1 : out_off + (off_t) queued,
+                           more && (in_stream || out_stream));
+            queued += len[k];
+        }
+
+        if ((ret = dcc_uring_submit_and_wait((unsigned) k * 2, res)))
+            return ret;
+
+        for (j = 0; j < k; j++) {
+            int r = res[j * 2], w = res[j * 2 + 1];
+            size_t done;
+
+            if (r == (int) len[j] && w == (int) len[j]) {
+                moved += len[j];
+                continue;
+            }
+
+            if (r == -ECANCELED) {
+                break;
+            } else if (r == -EAGAIN) {
+                again = 1;
+                break;
+            } else if (r == -EINVAL && moved_total + moved == 0) {
+                /* Presumably an operation this kernel doesn't have. */
+                rs_log_info("io_uring can't do this transfer; "
+                            "using read/write");
+                ring.failed = 1;
+                return dcc_pump_readwrite(ofd, ifd, n);
+            } else if (r < 0) {
+                rs_log_error("failed to read %ld bytes: %s",
+                             (long) len[j], strerror(-r));
+                return EXIT_IO_ERROR;
+            } else if (r == 0 || (r < (int) len[j] && !in_stream)) {
+                rs_log_error("unexpected eof on fd%d", ifd);
+                return EXIT_IO_ERROR;
+            }
+
+            /* Some data was read: make sure all of it gets written. */
+            if (w < 0 && w != -ECANCELED && w != -EAGAIN) {
+                rs_log_error("failed to write: %s", strerror(-w));
+                return EXIT_IO_ERROR;
+            }
+            done = w > 0 ? (size_t) w : 0;
+            if (done < (size_t) r
+                && (ret = dcc_uring_finish_write(
+                        ofd, out_stream ? (off_t) -1
+                                   : out_off + (off_t) (moved + done),
+                        ring.bufs + j * DCC_URING_BUF_SIZE + done,
+                        (size_t) r - done)))
+                return ret;
+            moved += r;
+
+            /* Anything after this in the chain has been cancelled. */
+            if (in_stream || out_stream)
+                break;
+        }
+
+        n -= moved;
+        moved_total += moved;
+        if (!in_stream)
+            in_off += moved;
+        if (!out_stream)
+            out_off += moved;
+
+        if (again && moved == 0
+            && (ret = dcc_select_for_read(ifd, dcc_get_io_timeout())))
+            return ret;
+    }
+
+    /* Leave the file positions where read() and write() would have. */
+    if (!in_stream)
+        lseek(ifd, in_off, SEEK_SET);
+    if (!out_stream)
+        lseek(ofd, out_off, SEEK_SET);
+
+    return 0;
+}
+
+#else /* !HAVE_LINUX_IO_URING_H */
+
+int dcc_uring_usable(void)
+{
+    return 0;
+}
+
+
+int dcc_pump_uring(int ofd, int ifd, size_t n)
+{
+    return dcc_pump_readwrite(ofd, ifd, n);
+}
+
+#endif /* !HAVE_LINUX_IO_URING_H */
@@ -513,6 +513,33 @@ int dcc_getcurrentload(void) {
 #endif
 }
 
+/**
+ * Return the memory available for new work, in megabytes, or -1 if it
+ * cannot be determined on this platform.
+ **/
+int dcc_get_mem_available(void) {
+#if defined(linux)
+    char line[256];
+    long kb = -1;
+    FILE *f = fopen("/proc/meminfo", "r");
+
+    if (NULL == f)
+        return -1;
+
+    while (fgets(line, sizeof line, f)) {
+        if (sscanf(line, "MemAvailable: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+
+    if (kb < 0)
+        return -1;
+    return (int) (kb / 1024);
+#else
+    return -1;
+#endif
+}
+
 /**
  *  Wrapper for getloadavg() that tries to return all 3 samples, and reports
  *  -1 for those samples that are not available.
@@ -1014,3 +1041,30 @@ int not_sd_is_socket(int fd, int family, int type, int listening) {
 
         return 1;
 }
+
+
+static const char *const dcc_priority_names[DCC_PRIO_MAX] = {
+    "interactive", "ci", "batch"
+};
+
+
+/**
+ * Look up a priority class by name, returning -1 if there is no such class.
+ **/
+int dcc_priority_parse(const char *name)
+{
+    int i;
+
+    for (i = 0; i < DCC_PRIO_MAX; i++)
+        if (strcmp(name, dcc_priority_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+
+const char *dcc_priority_name(int prio)
+{
+    if (prio < 0 || prio >= DCC_PRIO_MAX)
+        return "unknown";
+    return dcc_priority_names[prio];
+}
@@ -30,6 +30,7 @@
 int dcc_timecmp(struct timeval a, struct timeval b);
 int dcc_getcurrentload(void);
 void dcc_getloadavg(double loadavg[3]);
+int dcc_get_mem_available(void);
 int argv_contains(char **argv, const char *s);
 int dcc_redirect_fd(int, const char *fname, int);
 int str_startswith(const char *head, const char *worm);
@@ -43,6 +44,8 @@ int dcc_trim_path(const char *compiler_name);
 int dcc_set_path(const char *newpath);
 char *dcc_abspath(const char *path, int path_len);
 int dcc_get_dns_domain(const char **domain_name);
+int dcc_priority_parse(const char *name);
+const char *dcc_priority_name(int prio);
 
 #define str_equal(a, b) (!strcmp((a), (b)))
 
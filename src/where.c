@@ -51,6 +51,12 @@
  * cpp is probably cheap enough that we can allow it to run unlocked.  However
  * that is not true for local compilation or linking.
  *
+ * If the host list contains --affinity, the hosts are instead ranked per
+ * source file by rendezvous hashing, so that the same translation unit keeps
+ * going to the same server and can benefit from whatever that server has
+ * cached.  A busy preferred host spills over to the next host in its
+ * ranking; the slot limits bound how much any one host is given.
+ *
  * @todo Write a test harness for the host selection algorithm.  Perhaps a
  * really simple simulation of machines taking different amounts of time to
  * build stuff?
@@ -76,12 +82,30 @@
 #include "lock.h"
 #include "where.h"
 #include "exitcode.h"
+#include "scheduler.h"
 
 
 static int dcc_lock_one(struct dcc_hostdef *hostlist,
                         struct dcc_hostdef **buildhost,
                         int *cpu_lock_fd);
 
+static int dcc_lock_affine(struct dcc_hostdef **hostlist,
+                           const char *input_fname,
+                           struct dcc_hostdef **buildhost,
+                           int *cpu_lock_fd);
+
+static int dcc_lock_scheduled(struct dcc_hostdef *hostlist,
+                              int prefer_order,
+                              struct dcc_hostdef **buildhost,
+                              int *cpu_lock_fd);
+
+
+/**
+ * Set once a server has killed this job for running out of memory, so that
+ * it only goes to hosts marked ",bigmem" from then on.
+ **/
+int dcc_want_bigmem = 0;
+
 
 void dcc_read_localslots_configuration()
 {
@@ -99,8 +123,44 @@ void dcc_read_localslots_configuration()
 }
 
 
-int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **buildhost,
-                            int *cpu_lock_fd)
+/**
+ * True if any host in the list is marked ",bigmem".
+ **/
+int dcc_hostlist_has_bigmem(void)
+{
+    struct dcc_hostdef *hostlist, *h;
+    int n_hosts, found = 0;
+
+    if (dcc_get_hostlist(&hostlist, &n_hosts) != 0)
+        return 0;
+    while ((h = hostlist) != NULL) {
+        found |= h->bigmem;
+        hostlist = h->next;
+        dcc_free_hostdef(h);
+    }
+    return found;
+}
+
+
+static void dcc_keep_bigmem(struct dcc_hostdef **hostlist)
+{
+    struct dcc_hostdef *h;
+
+    while ((h = *hostlist) != NULL) {
+        if (!h->bigmem) {
+            rs_trace("remove %s from list: not bigmem", h->hostdef_string);
+            *hostlist = h->next;
+            dcc_free_hostdef(h);
+        } else {
+            hostlist = &h->next;
+        }
+    }
+}
+
+
+int dcc_pick_host_from_list_and_lock_it(const char *input_fname,
+                                        struct dcc_hostdef **buildhost,
+                                        int *cpu_lock_fd)
 {
     struct dcc_hostdef *hostlist;
     int ret;
@@ -113,10 +173,20 @@ int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **buildhost,
     if ((ret = dcc_remove_disliked(&hostlist)))
         return ret;
 
+    if (dcc_want_bigmem)
+        dcc_keep_bigmem(&hostlist);
+
     if (!hostlist) {
         return EXIT_NO_HOSTS;
     }
 
+    if (dcc_host_affinity && input_fname)
+        return dcc_lock_affine(&hostlist, input_fname, buildhost, cpu_lock_fd);
+
+    if ((ret = dcc_lock_scheduled(hostlist, 0, buildhost, cpu_lock_fd))
+        != EXIT_CONNECT_FAILED)
+        return ret;
+
     return dcc_lock_one(hostlist, buildhost, cpu_lock_fd);
 
     /* FIXME: Host list is leaked? */
@@ -155,6 +225,81 @@ static void dcc_lock_pause(void)
 }
 
 
+/**
+ * Try to lock slot @p i_cpu of @p h, and make it the build host if that
+ * works.  Returns EXIT_BUSY if someone else has it.
+ **/
+static int dcc_lock_slot(struct dcc_hostdef *h,
+                         int i_cpu,
+                         struct dcc_hostdef **buildhost,
+                         int *cpu_lock_fd)
+{
+    int ret;
+
+    ret = dcc_lock_host("cpu", h, i_cpu, 0, cpu_lock_fd);
+    if (ret == 0) {
+        *buildhost = h;
+        dcc_note_state_slot(i_cpu, strcmp(h->hostname, "localhost") == 0 ? DCC_LOCAL : DCC_REMOTE);
+    } else if (ret != EXIT_BUSY) {
+        rs_log_error("failed to lock");
+    }
+    return ret;
+}
+
+
+/**
+ * Make one pass over the slots of @p hostlist, and lock the first free one.
+ *
+ * Normally slot 0 of every host is tried, then slot 1 of every host, and so
+ * on, which spreads jobs evenly over the hosts.  With @p by_host, all the
+ * slots of each host are tried before moving on to the next, so that the
+ * hosts at the front of the list get as much as they can take.
+ *
+ * Returns EXIT_BUSY if every slot is taken.
+ **/
+static int dcc_lock_free_slot(struct dcc_hostdef *hostlist,
+                              int by_host,
+                              struct dcc_hostdef **buildhost,
+                              int *cpu_lock_fd)
+{
+    struct dcc_hostdef *h;
+    int i_cpu;
+    int ret;
+
+    if (by_host) {
+        for (h = hostlist; h; h = h->next) {
+            for (i_cpu = 0; i_cpu < h->n_slots; i_cpu++) {
+                ret = dcc_lock_slot(h, i_cpu, buildhost, cpu_lock_fd);
+                if (ret != EXIT_BUSY)
+                    return ret;
+            }
+            if (h == hostlist)
+                rs_trace("preferred host %s is busy", h->hostdef_string);
+        }
+        return EXIT_BUSY;
+    }
+
+    for (i_cpu = 0; i_cpu < 10000; i_cpu++) {
+        char i_cpu_is_usable = 0;
+
+        for (h = hostlist; h; h = h->next) {
+            if (i_cpu >= h->n_slots)
+                continue;
+
+            i_cpu_is_usable = 1;
+
+            ret = dcc_lock_slot(h, i_cpu, buildhost, cpu_lock_fd);
+            if (ret != EXIT_BUSY)
+                return ret;
+        }
+
+        if (!i_cpu_is_usable)
+            break;
+    }
+    return EXIT_BUSY;
+}
+
+
 /**
  * Find a host that can run a distributed compilation by examining local state.
  * It can be either a remote server or localhost (if that is in the list).
@@ -168,36 +313,74 @@ static int dcc_lock_one(struct dcc_hostdef *hostlist,
                         struct dcc_hostdef **buildhost,
                         int *cpu_lock_fd)
 {
-    struct dcc_hostdef *h;
-    int i_cpu;
     int ret;
 
-    while (1) {
-        for (i_cpu = 0; i_cpu < 10000; i_cpu++) {
-            char i_cpu_is_usable = 0;
+    while ((ret = dcc_lock_free_slot(hostlist, 0, buildhost, cpu_lock_fd))
+           == EXIT_BUSY)
+        dcc_lock_pause();
+    return ret;
+}
 
-            for (h = hostlist; h; h = h->next) {
-                if (i_cpu >= h->n_slots)
-                    continue;
 
-                i_cpu_is_usable = 1;
+/**
+ * Find a host by asking the farm scheduler in $DISTCC_SCHEDULER, and lock
+ * it as dcc_lock_one() would.  Local hosts don't go through the scheduler,
+ * but are used if it has nothing free.
+ *
+ * Returns EXIT_CONNECT_FAILED if there is no scheduler to ask, or it
+ * doesn't know any of our hosts, and the caller should choose for itself.
+ **/
+static int dcc_lock_scheduled(struct dcc_hostdef *hostlist,
+                              int prefer_order,
+                              struct dcc_hostdef **buildhost,
+                              int *cpu_lock_fd)
+{
+    struct dcc_hostdef *h;
+    int slot, i_cpu, k, ret;
 
+    while (1) {
+        ret = dcc_sched_lease(hostlist, prefer_order, &h, &slot);
+        if (ret == 0) {
+            /* The scheduler's slots are farm-wide; take any of ours for
+             * the local bookkeeping, starting from the one granted.  If
+             * this client already has all of them, give the lease back
+             * and wait as for any other busy host. */
+            for (k = 0; k < h->n_slots; k++) {
+                i_cpu = (slot + k) % h->n_slots;
                 ret = dcc_lock_host("cpu", h, i_cpu, 0, cpu_lock_fd);
-
                 if (ret == 0) {
+                    dcc_sched_hold(*cpu_lock_fd);
                     *buildhost = h;
-                    dcc_note_state_slot(i_cpu, strcmp(h->hostname, "localhost") == 0 ? DCC_LOCAL : DCC_REMOTE);
+                    dcc_note_state_slot(i_cpu, DCC_REMOTE);
                     return 0;
-                } else if (ret == EXIT_BUSY) {
-                    continue;
-                } else {
+                } else if (ret != EXIT_BUSY) {
                     rs_log_error("failed to lock");
+                    dcc_sched_release();
                     return ret;
                 }
             }
+            rs_trace("scheduler granted %s slot %d, but all %d of our "
+                     "slots on it are busy", h->hostdef_string, slot,
+                     h->n_slots);
+            dcc_sched_release();
+        } else if (ret != EXIT_BUSY) {
+            return ret;
+        }
 
-            if (!i_cpu_is_usable)
-                break;
+        for (h = hostlist; h; h = h->next) {
+            if (h->mode != DCC_MODE_LOCAL)
+                continue;
+            for (i_cpu = 0; i_cpu < h->n_slots; i_cpu++) {
+                ret = dcc_lock_host("cpu", h, i_cpu, 0, cpu_lock_fd);
+                if (ret == 0) {
+                    *buildhost = h;
+                    dcc_note_state_slot(i_cpu, DCC_LOCAL);
+                    return 0;
+                } else if (ret != EXIT_BUSY) {
+                    rs_log_error("failed to lock");
+                    return ret;
+                }
+            }
         }
 
         dcc_lock_pause();
@@ -206,6 +389,146 @@ static int dcc_lock_one(struct dcc_hostdef *hostlist,
 
 
 
+/**
+ * Hash @p key together with one slot of @p host.
+ *
+ * This is FNV-1a followed by the splitmix64 finalizer, which is plenty for
+ * spreading keys; nothing here needs to resist an adversary.
+ **/
+static uint64_t dcc_affinity_hash(const char *key,
+                                  const struct dcc_hostdef *host,
+                                  int slot)
+{
+    uint64_t h = 14695981039346656037ULL;
+    const unsigned char *p;
+    int i;
+
+    for (p = (const unsigned char *) key; *p; p++)
+        h = (h ^ *p) * 1099511628211ULL;
+    h = (h ^ 0xff) * 1099511628211ULL;
+    for (p = (const unsigned char *) host->hostname; *p; p++)
+        h = (h ^ *p) * 1099511628211ULL;
+    for (i = 0; i < 4; i++)
+        h = (h ^ ((unsigned) host->port >> (8 * i) & 0xff)) * 1099511628211ULL;
+    for (i = 0; i < 4; i++)
+        h = (h ^ ((unsigned) slot >> (8 * i) & 0xff)) * 1099511628211ULL;
+
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+
+struct affinity_container {
+    struct dcc_hostdef *host;
+    uint64_t score;
+};
+
+static int dcc_compare_affinity(const void *a, const void *b)
+{
+    const struct affinity_container *i = a, *j = b;
+
+    /* highest score first */
+    if (i->score == j->score)
+        return 0;
+    else if (i->score < j->score)
+        return 1;
+    else
+        return -1;
+}
+
+
+/**
+ * Reorder @p hostlist so that the hosts preferred for @p key come first.
+ *
+ * This is rendezvous (highest random weight) hashing: each host scores the
+ * key independently, so adding or removing a host only moves the keys that
+ * host wins or loses.  A host with /N slots draws N scores and keeps the
+ * best, which weights it N times as heavily as a single-slot host.  Hosts
+ * in backoff have already been dropped by dcc_remove_disliked(), but
+ * since no host's score depends on the others, only the keys they would
+ * have won go elsewhere while they are away; the rest stay put.
+ **/
+static int dcc_rank_hosts_by_affinity(struct dcc_hostdef **hostlist,
+                                      const char *key)
+{
+    struct dcc_hostdef *h;
+    struct affinity_container *c;
+    int n_hosts = 0, i, slot;
+
+    for (h = *hostlist; h; h = h->next)
+        n_hosts++;
+
+    c = malloc(n_hosts * sizeof *c);
+    if (!c) {
+        rs_log_error("failed to allocate affinity ranking");
+        return EXIT_OUT_OF_MEMORY;
+    }
+
+    for (i = 0, h = *hostlist; h; h = h->next, i++) {
+        c[i].host = h;
+        c[i].score = 0;
+        for (slot = 0; slot < h->n_slots; slot++) {
+            uint64_t s = dcc_affinity_hash(key, h, slot);
+            if (s > c[i].score)
+                c[i].score = s;
+        }
+    }
+
+    qsort(c, n_hosts, sizeof *c, &dcc_compare_affinity);
+
+    for (i = 0; i < n_hosts - 1; i++)
+        c[i].host->next = c[i+1].host;
+    c[n_hosts - 1].host->next = NULL;
+    *hostlist = c[0].host;
+
+    free(c);
+    return 0;
+}
+
+
+/**
+ * Like dcc_lock_one(), but for --affinity host lists.
+ *
+ * The hosts are ranked for the absolute path of @p input_fname, and all
+ * slots of the preferred host are tried before spilling over to the next
+ * host in the ranking.  The spillover only takes as many jobs as that host
+ * has free slots, so a hot file can never push more than /LIMIT jobs onto
+ * any one machine.
+ **/
+static int dcc_lock_affine(struct dcc_hostdef **hostlist,
+                           const char *input_fname,
+                           struct dcc_hostdef **buildhost,
+                           int *cpu_lock_fd)
+{
+    char *key;
+    int ret;
+
+    if ((key = strdup(dcc_abspath(input_fname, 0))) == NULL) {
+        rs_log_error("failed to allocate affinity key");
+        return EXIT_OUT_OF_MEMORY;
+    }
+    ret = dcc_rank_hosts_by_affinity(hostlist, key);
+    if (ret == 0)
+        rs_trace("%s prefers %s", key, (*hostlist)->hostdef_string);
+    free(key);
+    if (ret)
+        return ret;
+
+    if ((ret = dcc_lock_scheduled(*hostlist, 1, buildhost, cpu_lock_fd))
+        != EXIT_CONNECT_FAILED)
+        return ret;
+
+    while ((ret = dcc_lock_free_slot(*hostlist, 1, buildhost, cpu_lock_fd))
+           == EXIT_BUSY)
+        dcc_lock_pause();
+    return ret;
+}
+
+
 /**
  * Lock localhost.  Used to get the right balance of jobs when some of
  * them must be local.
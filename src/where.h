@@ -23,9 +23,13 @@
 
 /* where.c */
 void dcc_read_localslots_configuration(void);
-int dcc_pick_host_from_list_and_lock_it(struct dcc_hostdef **,
+int dcc_pick_host_from_list_and_lock_it(const char *input_fname,
+                                        struct dcc_hostdef **,
                                         int *cpu_lock_fd);
 
+int dcc_hostlist_has_bigmem(void);
+extern int dcc_want_bigmem;
+
 int dcc_lock_local(int *cpu_lock_fd);
 
 int dcc_lock_local_cpp(int *cpu_lock_fd);
@@ -33,8 +33,11 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <dirent.h>
 
 #include <avahi-common/thread-watch.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/strlst.h>
 #include <avahi-common/error.h>
 #include <avahi-common/alternative.h>
 #include <avahi-common/malloc.h>
@@ -43,27 +46,175 @@
 #include "distcc.h"
 #include "zeroconf.h"
 #include "trace.h"
+#include "util.h"
 #include "exitcode.h"
+#include "daemon.h"
+
+/* How often, in seconds, the load figures in the TXT record are
+ * re-examined.  The record is only re-announced if one of them changed,
+ * so this is also the upper bound on the mDNS traffic we cause. */
+#define DCC_ZEROCONF_UPDATE_INTERVAL 10
+
+/* Granularity of the advertised memory headroom, in megabytes, so that
+ * normal fluctuation does not cause a re-announcement every interval. */
+#define DCC_ZEROCONF_MEM_GRANULARITY 256
+
+#ifndef ENABLE_RFC2553
+static const AvahiProtocol dcc_proto = AVAHI_PROTO_INET;
+#else
+static const AvahiProtocol dcc_proto = AVAHI_PROTO_UNSPEC;
+#endif
 
 struct context {
     char *name;
     AvahiThreadedPoll *threaded_poll;
     AvahiClient *client;
     AvahiEntryGroup *group;
+    AvahiTimeout *timeout;
     uint16_t port;
     int n_cpus;
     int n_jobs;
+    char *cc_version;           /* NULL if unknown */
+    char *cc_machine;           /* NULL if unknown */
+
+    /* Load figures as last announced */
+    int free_slots;
+    int mem_free;               /* megabytes, -1 if unknown */
+    int load;                   /* 1-minute load average * 10, -1 if unknown */
 };
 
 static void publish_reply(AvahiEntryGroup *g, AvahiEntryGroupState state, void *userdata);
 
-static void register_stuff(struct context *ctx) {
-#ifndef ENABLE_RFC2553
-    static const AvahiProtocol dcc_proto = AVAHI_PROTO_INET;
-#else
-    static const AvahiProtocol dcc_proto = AVAHI_PROTO_UNSPEC;
-#endif
+/* How many more jobs this server can take right now: its job slots less
+ * the children that are running a job. */
+static int current_free_slots(int n_jobs) {
+    int free_slots = n_jobs - dcc_prefork_busy_kids();
+
+    return free_slots < 0 ? 0 : free_slots;
+}
 
+/* Sample the load figures into ctx.  Returns non-zero if any of them
+ * differs from what was there before. */
+static int sample_load(struct context *ctx) {
+    double loadavg[3];
+    int free_slots, mem_free, load;
+
+    free_slots = current_free_slots(ctx->n_jobs);
+
+    mem_free = dcc_get_mem_available();
+    if (mem_free > 0)
+        mem_free -= mem_free % DCC_ZEROCONF_MEM_GRANULARITY;
+
+    dcc_getloadavg(loadavg);
+    load = loadavg[0] < 0 ? -1 : (int) (loadavg[0] * 10 + 0.5);
+
+    if (free_slots == ctx->free_slots && mem_free == ctx->mem_free &&
+        load == ctx->load)
+        return 0;
+
+    ctx->free_slots = free_slots;
+    ctx->mem_free = mem_free;
+    ctx->load = load;
+    return 1;
+}
+
+/* Make a "compilers=gcc,g++,..." entry from the masquerade directory
+ * used for the compiler whitelist.  TXT strings are limited to 255
+ * bytes, so names that don't fit are left out.  Returns NULL if no
+ * masquerade directory was found. */
+static char *get_compiler_inventory(char *buf, size_t size) {
+    static const char *const dirs[] = { LIBDIR "/distcc", "/usr/lib/distcc" };
+    size_t prefix, len, i;
+
+    prefix = len = (size_t) snprintf(buf, size, "compilers=");
+
+    for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]) && len == prefix; i++) {
+        DIR *dir;
+        struct dirent *ent;
+
+        if (!(dir = opendir(dirs[i])))
+            continue;
+
+        while ((ent = readdir(dir))) {
+            size_t n = strlen(ent->d_name);
+
+            if (ent->d_name[0] == '.')
+                continue;
+            if (len + n + 2 > size)
+                break;
+            if (len > prefix)
+                buf[len++] = ',';
+            memcpy(buf + len, ent->d_name, n + 1);
+            len += n;
+        }
+
+        closedir(dir);
+    }
+
+    return len > prefix ? buf : NULL;
+}
+
+/* Build the TXT record for our service from the static data and the
+ * load figures currently held in ctx. */
+static AvahiStringList *make_txt(struct context *ctx) {
+    AvahiStringList *txt = NULL;
+    char compilers[256];
+
+    txt = avahi_string_list_add(txt, "txtvers=1");
+    txt = avahi_string_list_add_printf(txt, "cpus=%i", ctx->n_cpus);
+    txt = avahi_string_list_add_printf(txt, "jobs=%i", ctx->n_jobs);
+    txt = avahi_string_list_add(txt, "distcc="PACKAGE_VERSION);
+    txt = avahi_string_list_add(txt, "gnuhost="GNU_HOST);
+    if (ctx->cc_version)
+        txt = avahi_string_list_add_printf(txt, "cc_version=%s", ctx->cc_version);
+    if (ctx->cc_machine)
+        txt = avahi_string_list_add_printf(txt, "cc_machine=%s", ctx->cc_machine);
+    if (get_compiler_inventory(compilers, sizeof(compilers)))
+        txt = avahi_string_list_add(txt, compilers);
+
+    txt = avahi_string_list_add_printf(txt, "free=%i", ctx->free_slots);
+    if (ctx->mem_free >= 0)
+        txt = avahi_string_list_add_printf(txt, "memfree=%i", ctx->mem_free);
+    if (ctx->load >= 0)
+        txt = avahi_string_list_add_printf(txt, "load=%i.%i",
+                                           ctx->load / 10, ctx->load % 10);
+
+    return txt;
+}
+
+/* Timer callback: re-announce the TXT record if the load changed. */
+static void update_txt(AvahiTimeout *t, void *userdata) {
+    struct context *ctx = userdata;
+    const AvahiPoll *poll_api = avahi_threaded_poll_get(ctx->threaded_poll);
+    struct timeval tv;
+
+    if (ctx->group && !avahi_entry_group_is_empty(ctx->group) &&
+        sample_load(ctx)) {
+        AvahiStringList *txt = make_txt(ctx);
+
+        rs_trace("updating zeroconf TXT record: free=%d memfree=%d load=%d",
+                 ctx->free_slots, ctx->mem_free, ctx->load);
+
+        if (avahi_entry_group_update_service_txt_strlst(
+                    ctx->group,
+                    AVAHI_IF_UNSPEC,
+                    dcc_proto,
+                    0,
+                    ctx->name,
+                    DCC_DNS_SERVICE_TYPE,
+                    NULL,
+                    txt) < 0)
+            rs_log_warning("Failed to update TXT record: %s\n",
+                           avahi_strerror(avahi_client_errno(ctx->client)));
+
+        avahi_string_list_free(txt);
+    }
+
+    avahi_elapse_time(&tv, 1000 * DCC_ZEROCONF_UPDATE_INTERVAL, 0);
+    poll_api->timeout_update(t, &tv);
+}
+
+static void register_stuff(struct context *ctx) {
     if (!ctx->group) {
 
         if (!(ctx->group = avahi_entry_group_new(ctx->client, publish_reply, ctx))) {
@@ -74,16 +225,15 @@ static void register_stuff(struct context *ctx) {
     }
 
     if (avahi_entry_group_is_empty(ctx->group)) {
-        char cpus[32], jobs[32], machine[64] = "cc_machine=", version[64] = "cc_version=", *m, *v;
+        AvahiStringList *txt;
+        int ret;
 
-        snprintf(cpus, sizeof(cpus), "cpus=%i", ctx->n_cpus);
-        snprintf(jobs, sizeof(jobs), "jobs=%i", ctx->n_jobs);
-        v = dcc_get_gcc_version(version+11, sizeof(version)-11);
-        m = dcc_get_gcc_machine(machine+11, sizeof(machine)-11);
+        sample_load(ctx);
+        txt = make_txt(ctx);
 
         /* Register our service */
 
-        if (avahi_entry_group_add_service(
+        ret = avahi_entry_group_add_service_strlst(
                     ctx->group,
                     AVAHI_IF_UNSPEC,
                     dcc_proto,
@@ -93,22 +243,18 @@ static void register_stuff(struct context *ctx) {
                     NULL,
                     NULL,
                     ctx->port,
-                    "txtvers=1",
-                    cpus,
-                    jobs,
-                    "distcc="PACKAGE_VERSION,
-                    "gnuhost="GNU_HOST,
-                    v ? version : NULL,
-                    m ? machine : NULL,
-                    (void*)NULL) < 0) {
+                    txt);
+        avahi_string_list_free(txt);
+
+        if (ret < 0) {
             rs_log_crit("Failed to add service: %s\n", avahi_strerror(avahi_client_errno(ctx->client)));
             goto fail;
         }
 
-        if (v && m) {
+        if (ctx->cc_version && ctx->cc_machine) {
             char stype[128];
 
-            dcc_make_dnssd_subtype(stype, sizeof(stype), v, m);
+            dcc_make_dnssd_subtype(stype, sizeof(stype), ctx->cc_version, ctx->cc_machine);
 
             if (avahi_entry_group_add_service_subtype(
                         ctx->group,
@@ -229,6 +375,9 @@ static void client_callback(AvahiClient *client, AvahiClientState state, void *u
 void* dcc_zeroconf_register(uint16_t port, int n_cpus, int n_jobs) {
     struct context *ctx = NULL;
     char service[256] = "distcc@";
+    char version[64], machine[64];
+    const AvahiPoll *poll_api;
+    struct timeval tv;
     int error;
 
     ctx = malloc(sizeof(struct context));
@@ -236,9 +385,16 @@ void* dcc_zeroconf_register(uint16_t port, int n_cpus, int n_jobs) {
     ctx->client = NULL;
     ctx->group = NULL;
     ctx->threaded_poll = NULL;
+    ctx->timeout = NULL;
     ctx->port = port;
     ctx->n_cpus = n_cpus;
     ctx->n_jobs = n_jobs;
+    ctx->free_slots = n_jobs;
+    ctx->mem_free = ctx->load = -1;
+
+    /* Running the compiler is slow, so only ask it once */
+    ctx->cc_version = dcc_get_gcc_version(version, sizeof(version)) ? strdup(version) : NULL;
+    ctx->cc_machine = dcc_get_gcc_machine(machine, sizeof(machine)) ? strdup(machine) : NULL;
 
     /* Prepare service name */
     gethostname(service+7, sizeof(service)-8);
@@ -257,6 +413,11 @@ void* dcc_zeroconf_register(uint16_t port, int n_cpus, int n_jobs) {
         goto fail;
     }
 
+    /* Periodically refresh the load figures in our TXT record */
+    poll_api = avahi_threaded_poll_get(ctx->threaded_poll);
+    avahi_elapse_time(&tv, 1000 * DCC_ZEROCONF_UPDATE_INTERVAL, 0);
+    ctx->timeout = poll_api->timeout_new(poll_api, &tv, update_txt, ctx);
+
     /* Create the mDNS event handler */
     if (avahi_threaded_poll_start(ctx->threaded_poll) < 0) {
         rs_log_crit("Failed to create thread.\n");
@@ -280,6 +441,9 @@ int dcc_zeroconf_unregister(void *u) {
     if (ctx->threaded_poll)
         avahi_threaded_poll_stop(ctx->threaded_poll);
 
+    if (ctx->timeout)
+        avahi_threaded_poll_get(ctx->threaded_poll)->timeout_free(ctx->timeout);
+
     if (ctx->client)
         avahi_client_free(ctx->client);
 
@@ -287,6 +451,8 @@ int dcc_zeroconf_unregister(void *u) {
         avahi_threaded_poll_free(ctx->threaded_poll);
 
     avahi_free(ctx->name);
+    free(ctx->cc_version);
+    free(ctx->cc_machine);
 
     free(ctx);
 
@@ -0,0 +1,89 @@
+/* -*- c-file-style: "java"; indent-tabs-mode: nil; tab-width: 4; fill-column: 78 -*-
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/* Reading the size and load that distccd --zeroconf puts in its TXT
+ * record, and ordering servers by them.  This doesn't need Avahi, so
+ * that it can be tested anywhere. */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "distcc.h"
+#include "hosts.h"
+#include "zeroconf.h"
+
+/* Start a record with what we assume about a server that says nothing. */
+void dcc_zeroconf_load_init(struct dcc_zeroconf_load *l) {
+    l->n_cpus = 1;
+    l->n_jobs = 0;
+    l->free_slots = l->mem_free = l->load = -1;
+}
+
+/* Take in one "key=value" string of the TXT record.  Keys we don't know
+ * are ignored, as are keys with no value. */
+void dcc_zeroconf_load_pair(struct dcc_zeroconf_load *l,
+                            const char *key, const char *value) {
+    if (!value)
+        return;
+
+    if (!strcmp(key, "cpus")) {
+        if ((l->n_cpus = atoi(value)) <= 0)
+            l->n_cpus = 1;
+    } else if (!strcmp(key, "jobs")) {
+        l->n_jobs = atoi(value);
+    } else if (!strcmp(key, "free")) {
+        l->free_slots = atoi(value);
+        if (l->free_slots < 0)
+            l->free_slots = 0;
+    } else if (!strcmp(key, "memfree")) {
+        l->mem_free = atoi(value);
+    } else if (!strcmp(key, "load")) {
+        l->load = (int) (atof(value) * 10 + 0.5);
+    }
+}
+
+/* Fill in what the record left out, once all of it has been read: if
+ * there is no job count, assume n_cpus + 2 as distccd does. */
+void dcc_zeroconf_load_done(struct dcc_zeroconf_load *l) {
+    if (l->n_jobs <= 0)
+        l->n_jobs = l->n_cpus + 2;
+    if (l->free_slots > l->n_jobs)
+        l->free_slots = l->n_jobs;
+}
+
+/* Number of slots we expect to be free; all of them if the server
+ * doesn't say. */
+int dcc_zeroconf_free_slots(const struct dcc_zeroconf_load *l) {
+    return l->free_slots < 0 ? l->n_jobs : l->free_slots;
+}
+
+/* Order servers so the least loaded ones come first: by free slots, then
+ * by memory headroom, then by size.  Saturated servers sort last.
+ * Returns 0 if there is nothing to choose between them. */
+int dcc_zeroconf_compare_load(const struct dcc_zeroconf_load *a,
+                              const struct dcc_zeroconf_load *b) {
+    int fa = dcc_zeroconf_free_slots(a), fb = dcc_zeroconf_free_slots(b);
+
+    if (fa != fb)
+        return fb - fa;
+    if (a->mem_free != b->mem_free)
+        return b->mem_free > a->mem_free ? 1 : -1;
+    return b->n_jobs - a->n_jobs;
+}
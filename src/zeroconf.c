@@ -78,10 +78,13 @@ struct host {
 
     AvahiAddress address;
     uint16_t port;
-    int n_cpus;
-    int n_jobs;
+    /* Size and load figures from the TXT record */
+    struct dcc_zeroconf_load load;
 
+    /* The resolver is kept running after the first reply, so that we
+     * see updates to the TXT record. */
     AvahiServiceResolver *resolver;
+    int resolved;
 };
 
 /* A generic, system independent lock routine, similar to sys_lock,
@@ -134,10 +137,19 @@ static time_t fd_last_used(int fd, time_t clip_time) {
 
 static void remove_duplicate_services(struct daemon_data *d);
 
+/* Order hosts so the least loaded ones come first */
+static int compare_hosts(const void *a, const void *b) {
+    const struct host *ha = *(const struct host *const *) a;
+    const struct host *hb = *(const struct host *const *) b;
+    int c = dcc_zeroconf_compare_load(&ha->load, &hb->load);
+
+    return c ? c : strcmp(ha->service, hb->service);
+}
+
 /* Write host data to host file */
 static int write_hosts(struct daemon_data *d) {
-    struct host *h;
-    int r = 0;
+    struct host *h, **sorted;
+    int i, n = 0, r = 0;
     assert(d);
 
     rs_log_info("writing zeroconf data.\n");
@@ -159,16 +171,40 @@ static int write_hosts(struct daemon_data *d) {
 
     remove_duplicate_services(d);
 
-    for (h = d->hosts; h; h = h->next) {
-        char t[256], a[AVAHI_ADDRESS_STR_MAX];
+    for (h = d->hosts; h; h = h->next)
+        n++;
+
+    sorted = malloc((n ? n : 1) * sizeof(struct host *));
+    assert(sorted);
 
-        if (h->resolver)
+    n = 0;
+    for (h = d->hosts; h; h = h->next) {
+        if (!h->resolved)
             /* Not yet fully resolved */
             continue;
-	if (h->address.proto == AVAHI_PROTO_INET6)
-	    snprintf(t, sizeof(t), "[%s]:%u/%i\n", avahi_address_snprint(a, sizeof(a), &h->address), h->port, h->n_jobs);
-	else
-	    snprintf(t, sizeof(t), "%s:%u/%i\n", avahi_address_snprint(a, sizeof(a), &h->address), h->port, h->n_jobs);
+        sorted[n++] = h;
+    }
+
+    qsort(sorted, n, sizeof(struct host *), compare_hosts);
+
+    for (i = 0; i < n; i++) {
+        char t[256], a[AVAHI_ADDRESS_STR_MAX];
+
+        h = sorted[i];
+        avahi_address_snprint(a, sizeof(a), &h->address);
+        if (h->address.proto == AVAHI_PROTO_INET6)
+            snprintf(t, sizeof(t), "[%s]:%u/%i", a, h->port, h->load.n_jobs);
+        else
+            snprintf(t, sizeof(t), "%s:%u/%i", a, h->port, h->load.n_jobs);
+
+        /* Record why this host sorted where it did */
+        if (h->load.free_slots >= 0)
+            snprintf(t + strlen(t), sizeof(t) - strlen(t),
+                     "  # free=%i memfree=%i load=%i.%i",
+                     h->load.free_slots, h->load.mem_free,
+                     h->load.load < 0 ? 0 : h->load.load / 10,
+                     h->load.load < 0 ? 0 : h->load.load % 10);
+        strcat(t, "\n");
 
         if (dcc_writex(d->fd, t, strlen(t)) != 0) {
             rs_log_crit("write() failed: %s\n", strerror(errno));
@@ -180,6 +216,7 @@ static int write_hosts(struct daemon_data *d) {
 
 finish:
 
+    free(sorted);
     generic_lock(d->fd, 1, 0, 1);
     return r;
 
@@ -264,41 +301,28 @@ static void resolve_reply(
         case AVAHI_RESOLVER_FOUND: {
             AvahiStringList *i;
 
-            /* Look for the number of CPUs in TXT RRs */
-            for (i = txt; i; i = i->next) {
-                char *key, *value;
-
-                if (avahi_string_list_get_pair(i, &key, &value, NULL) < 0)
-                    continue;
-
-                if (!strcmp(key, "cpus"))
-                    if ((h->n_cpus = atoi(value)) <= 0)
-                        h->n_cpus = 1;
-
-                avahi_free(key);
-                avahi_free(value);
-            }
-
-            /* Look for the number of jobs in TXT RRs, and if not found, then set n_jobs = n_cpus + 2 */
+            /* Look for the number of CPUs and jobs, and the current load,
+             * in TXT RRs */
+            dcc_zeroconf_load_init(&h->load);
             for (i = txt; i; i = i->next) {
                 char *key, *value;
 
                 if (avahi_string_list_get_pair(i, &key, &value, NULL) < 0)
                     continue;
 
-                if (!strcmp(key, "jobs"))
-                    if ((h->n_jobs = atoi(value)) <= 0)
-                        h->n_jobs = h->n_cpus + 2;
+                dcc_zeroconf_load_pair(&h->load, key, value);
 
                 avahi_free(key);
                 avahi_free(value);
             }
+            dcc_zeroconf_load_done(&h->load);
 
             h->address = *a;
             h->port = port;
+            h->resolved = 1;
 
-            avahi_service_resolver_free(h->resolver);
-            h->resolver = NULL;
+            rs_trace("%s: free=%d memfree=%d load=%d", name,
+                     h->load.free_slots, h->load.mem_free, h->load.load);
 
             /* Write modified hosts file */
             write_hosts(h->daemon_data);
@@ -311,7 +335,15 @@ static void resolve_reply(
             rs_log_warning("Failed to resolve service '%s': %s\n", name,
                            avahi_strerror(avahi_client_errno(h->daemon_data->client)));
 
-            free_host(h);
+            if (h->resolved) {
+                /* Keep the last known data; we just won't see
+                 * further updates */
+                avahi_service_resolver_free(h->resolver);
+                h->resolver = NULL;
+            } else {
+                remove_service(h->daemon_data, h->interface, h->protocol,
+                               h->service, h->domain);
+            }
             break;
     }
 
@@ -367,8 +399,9 @@ static void browse_reply(
                 h->interface = interface;
                 h->protocol = protocol;
                 h->next = d->hosts;
-                h->n_cpus = 1;
-                h->n_jobs = 4;
+                dcc_zeroconf_load_init(&h->load);
+                dcc_zeroconf_load_done(&h->load);
+                h->resolved = 0;
                 d->hosts = h;
             }
 
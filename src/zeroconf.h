@@ -35,4 +35,22 @@ char* dcc_make_dnssd_subtype(char *stype, size_t nbytes, const char *v, const ch
 
 #define DCC_DNS_SERVICE_TYPE "_distcc._tcp"
 
+/* What a server's TXT record says about its size and load.  The load
+ * figures are -1 if it doesn't advertise them. */
+struct dcc_zeroconf_load {
+    int n_cpus;
+    int n_jobs;
+    int free_slots;
+    int mem_free;               /* megabytes */
+    int load;                   /* 1-minute load average * 10 */
+};
+
+void dcc_zeroconf_load_init(struct dcc_zeroconf_load *l);
+void dcc_zeroconf_load_pair(struct dcc_zeroconf_load *l,
+                            const char *key, const char *value);
+void dcc_zeroconf_load_done(struct dcc_zeroconf_load *l);
+int dcc_zeroconf_free_slots(const struct dcc_zeroconf_load *l);
+int dcc_zeroconf_compare_load(const struct dcc_zeroconf_load *a,
+                              const struct dcc_zeroconf_load *b);
+
 #endif
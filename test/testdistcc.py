@@ -175,6 +175,9 @@ _valgrind_command            = "" # Command to invoke valgrind (or other
                                   # e.g. "valgrind --quiet --num-callsers=20 "
 _server_options              = "" # Distcc host options to use for the server.
                                   # Should be "", ",lzo", or ",lzo,cpp".
+_test_cgroup = os.environ.get("DISTCC_TEST_CGROUP")
+                                  # A cgroup v2 directory with the memory
+                                  # controller, for tests of --cgroup.
 
 def _ShellSafe(s):
     '''Returns a version of s that will be interpreted literally by the shell.'''
@@ -323,6 +326,18 @@ as soon as that happens we can go ahead and start the client."""
         SimpleDistCC_Case.teardown(self)
 
 
+    def installStubCompiler(self, name, defines):
+        """Put a compiler called NAME on PATH that runs distcc-stubcc with
+        DEFINES.  Call it before the daemon starts, so that it finds it."""
+        bindir = os.path.join(os.getcwd(), "bin")
+        if not os.path.isdir(bindir):
+            os.mkdir(bindir)
+            os.environ['PATH'] = bindir + ":" + os.environ['PATH']
+        open(os.path.join(bindir, name), "w").write(
+            '#!/bin/sh\nexec distcc-stubcc %s "$@"\n' % defines)
+        os.chmod(os.path.join(bindir, name), 0o755)
+
+
     def killDaemon(self):
         try:
             pid = int(open(self.daemon_pidfile, 'rt').read())
@@ -1424,6 +1439,89 @@ int main(void) {
         Compilation_Case.setupEnv(self)
         os.environ['DISTCC_HOSTS'] = '127.0.0.1:%d,lzo' % self.server_port
 
+class IoUring_Case(Compilation_Case):
+    """Compile a big source on a daemon receiving with io_uring.
+
+    The preprocessed source is over DCC_URING_MIN_SIZE, so the daemon
+    receives it through the ring when it isn't compressed.  Compressed, it
+    must still use the LZO path.  Either way the object has to match a
+    local build byte for byte."""
+
+    def setup(self):
+        out, err = self.runcmd(self.distccd() + "--help")
+        if "--io-uring" not in out:
+            raise comfychair.NotRunError("distccd was built without io_uring")
+        Compilation_Case.setup(self)
+
+    def daemon_command(self):
+        return Compilation_Case.daemon_command(self) + " --io-uring"
+
+    def source(self):
+        return "".join(["int v%d = %d;\n" % (i, i) for i in range(80000)])
+
+    def runtest(self):
+        self.runcmd(self._cc + " -o local.o -c " + self.sourceFilename())
+        for options in ["", ",lzo"]:
+            os.environ['DISTCC_HOSTS'] = ('127.0.0.1:%d%s'
+                                          % (self.server_port, options))
+            if os.path.exists("testtmp.o"):
+                os.unlink("testtmp.o")
+            self.compile()
+            self.runcmd("cmp local.o testtmp.o")
+
+        log = open(self.daemon_logfile).read()
+        if re.search(r"io_uring not available|io_uring can't wait", log):
+            raise comfychair.NotRunError("the kernel doesn't do io_uring")
+        self.assert_re_search(r"io_uring set up", log)
+
+
+class TlsCompile_Case(CompileHello_Case):
+    """Compile over TLS, with a self-signed certificate.
+
+    A second compilation should resume the first one's session."""
+    def setup(self):
+        out, err = self.runcmd(self.distccd() + "--help")
+        if "--tls-cert" not in out:
+            raise comfychair.NotRunError("distccd was built without TLS")
+        self.cert = os.path.join(os.getcwd(), "cert.pem")
+        self.key = os.path.join(os.getcwd(), "key.pem")
+        rc, out, err = self.runcmd_unchecked(
+            "openssl req -x509 -newkey rsa:2048 -nodes -days 1 "
+            "-subj /CN=127.0.0.1 -addext subjectAltName=IP:127.0.0.1 "
+            "-keyout %s -out %s 2>/dev/null"
+            % (_ShellSafe(self.key), _ShellSafe(self.cert)))
+        if rc != 0:
+            raise comfychair.NotRunError("openssl can't make a certificate")
+        CompileHello_Case.setup(self)
+
+    def daemon_command(self):
+        return (CompileHello_Case.daemon_command(self)
+                + " --tls-cert %s --tls-key %s"
+                % (_ShellSafe(self.cert), _ShellSafe(self.key)))
+
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] = ('127.0.0.1:%d%s,tls' %
+                                      (self.server_port, _server_options))
+        os.environ['DISTCC_TLS_CA'] = self.cert
+
+    def runtest(self):
+        CompileHello_Case.runtest(self)
+        log = open(self.daemon_logfile).read()
+        self.assert_equal(len(re.findall(r"TLS connection established\n",
+                                         log)), 1)
+
+        # The session secret is only for us.
+        sessions = glob.glob(os.path.join(os.environ['DISTCC_DIR'],
+                                          'tls', '*.pem'))
+        self.assert_equal(len(sessions), 1)
+        self.assert_equal(S_IMODE(os.stat(sessions[0])[ST_MODE]), 0o600)
+
+        self.compile()
+        log = open(self.daemon_logfile).read()
+        self.assert_re_search(r"TLS connection established \(resumed\)", log)
+
+
 class DashONoSpace_Case(CompileHello_Case):
     def compileCmd(self):
         return self.distcc_without_fallback() + \
@@ -1447,6 +1545,81 @@ class WriteDevNull_Case(CompileHello_Case):
                " -c -o /dev/null -c %s" % (self.sourceFilename())
 
 
+class TruncatedOutput_Case(CompileHello_Case):
+    """Test that a connection lost in the middle of the object file leaves
+    the old object alone"""
+    def setupEnv(self):
+        import threading
+        WithDaemon_Case.setupEnv(self)
+        self.listener = socket.socket()
+        self.listener.bind(('127.0.0.1', 0))
+        self.listener.listen(5)
+        self.cuts = 0
+        t = threading.Thread(target=self.cutter)
+        t.daemon = True
+        t.start()
+        os.environ['DISTCC_HOSTS'] = ('127.0.0.1:%d%s' %
+          (self.listener.getsockname()[1], _server_options))
+        # Let the second compile through, rather than backing off.
+        os.environ['DISTCC_BACKOFF_PERIOD'] = '0'
+
+    def cutter(self):
+        """Pass each connection through to the daemon, but hang up halfway
+        through the DOTO that carries the object file."""
+        import threading
+        def pump(src, dst):
+            while True:
+                data = src.recv(65536)
+                if not data:
+                    break
+                dst.sendall(data)
+        while True:
+            try:
+                client, addr = self.listener.accept()
+            except socket.error:
+                return
+            server = socket.create_connection(('127.0.0.1', self.server_port))
+            t = threading.Thread(target=pump, args=(client, server))
+            t.daemon = True
+            t.start()
+            buf = b''
+            while True:
+                data = server.recv(65536)
+                if not data:
+                    break
+                buf += data
+                i = buf.find(b'DOTO')
+                if i != -1 and len(buf) >= i + 12:
+                    keep = i + 12 + int(buf[i + 4:i + 12], 16) // 2
+                    if len(buf) >= keep:
+                        client.sendall(buf[:keep])
+                        self.cuts += 1
+                        break
+            client.shutdown(socket.SHUT_RDWR)
+            client.close()
+            server.close()
+
+    def runtest(self):
+        open("testtmp.o", "w").write("previous object\n")
+        rc, out, err = self.runcmd_unchecked(self.compileCmd())
+        self.assert_notequal(rc, 0)
+        self.assert_(self.cuts >= 1)
+        self.assert_equal(open("testtmp.o").read(), "previous object\n")
+        self.assert_equal([f for f in os.listdir(".") if "testtmp.o" in f],
+                          ["testtmp.o"])
+
+        os.unlink("testtmp.o")
+        cuts = self.cuts
+        rc, out, err = self.runcmd_unchecked(self.compileCmd())
+        self.assert_notequal(rc, 0)
+        self.assert_(self.cuts > cuts)
+        self.assert_equal([f for f in os.listdir(".") if "testtmp.o" in f], [])
+
+    def teardown(self):
+        self.listener.close()
+        CompileHello_Case.teardown(self)
+
+
 class MultipleCompile_Case(Compilation_Case):
     """Test compiling several files from one line"""
     def setup(self):
@@ -1469,6 +1642,130 @@ int main(void) {
 
 
 
+class BatchCompile_Case(WithDaemon_Case):
+    """Test running the compilations in a compile_commands.json"""
+    def setup(self):
+        WithDaemon_Case.setup(self)
+        open("test1.c", "w").write("const char *msg = MSG;\n")
+        open("test2.c", "w").write("""#include <stdio.h>
+
+int main(void) {
+   extern const char *msg;
+   puts(msg);
+   return 0;
+}
+""")
+        cwd = os.getcwd()
+        open("compile_commands.json", "w").write("""[
+  { "directory": "%s",
+    "command": "%s -c '-DMSG=\\"hello batch\\"' -o test1.o test1.c",
+    "file": "test1.c" },
+  { "directory": "%s",
+    "arguments": ["distcc", "%s", "-c", "-o", "test2.o", "test2.c"],
+    "file": "test2.c" }
+]
+""" % (cwd, self._cc, cwd, self._cc))
+
+    def runtest(self):
+        out, err = self.runcmd(self.distcc()
+                               + "--batch compile_commands.json")
+        self.assert_re_search(r"^\[1/2\] ok test1.c .*\n\[2/2\] ok test2.c ",
+                              out)
+        self.runcmd(self._cc + " -o test test1.o test2.o")
+        out, err = self.runcmd("./test")
+        self.assert_equal(out, "hello batch\n")
+
+
+class LtoMake_Case(WithDaemon_Case):
+    """Test running gcc's LTO partitions through distcc-lto-make"""
+    def setup(self):
+        WithDaemon_Case.setup(self)
+        if self.is_clang(self._cc):
+            raise comfychair.NotRunError('lto-wrapper is specific to gcc')
+        open("test1.c", "w").write("""int twice(int x) {
+   return 2 * x;
+}
+""")
+        open("test2.c", "w").write("""#include <stdio.h>
+
+int twice(int x);
+
+int main(void) {
+   printf("%d\\n", twice(21));
+   return 0;
+}
+""")
+        self.runcmd(self._cc + " -O2 -flto -c test1.c test2.c")
+        for path in os.environ['PATH'].split(':'):
+            distcc = os.path.join(path, 'distcc')
+            if os.path.isfile(distcc):
+                break
+        os.symlink(os.path.abspath(distcc), 'distcc-lto-make')
+
+    def link(self):
+        return ("MAKE=%s/distcc-lto-make DISTCC_VERBOSE=1 DISTCC_LOG=lto.log "
+                "%s -O2 -flto=2 -flto-partition=max -frandom-seed=1 "
+                "-o test test1.o test2.o" % (os.getcwd(), self._cc))
+
+    def runtest(self):
+        self.runcmd(self.link())
+        out, err = self.runcmd("./test")
+        self.assert_equal(out, "42\n")
+        self.assert_re_search("ltrans partitions from", open("lto.log").read())
+
+        # The same partitions again come from the cache.
+        os.unlink("test")
+        os.unlink("lto.log")
+        self.runcmd(self.link())
+        out, err = self.runcmd("./test")
+        self.assert_equal(out, "42\n")
+        self.assert_re_search("unchanged since an earlier link",
+                              open("lto.log").read())
+
+
+class ProfileCache_Case(WithDaemon_Case):
+    """Test sending -fprofile-use profiles by hash to the server's cache"""
+    def setup(self):
+        WithDaemon_Case.setup(self)
+        if self.is_clang(self._cc):
+            raise comfychair.NotRunError('.gcda profiles are specific to gcc')
+        if _server_options.find('cpp') != -1:
+            raise comfychair.NotRunError('profiles are not sent in pump mode')
+        os.environ['DISTCC_HOSTS'] = ('127.0.0.1:%d%s,gcda' %
+          (self.server_port, _server_options))
+        open("testtmp.c", "w").write("""#include <stdio.h>
+
+int main(int argc, char **argv) {
+   int i, n = 0;
+   for (i = 0; i < 1000; i++)
+      n += argc > 1 ? i : 2 * i;
+   printf("%d\\n", n);
+   return 0;
+}
+""")
+        self.runcmd(self._cc + " -O2 -fprofile-generate -c testtmp.c "
+                    "-o testtmp.o")
+        self.runcmd(self._cc + " -fprofile-generate -o testtmp testtmp.o")
+        self.runcmd("./testtmp")
+        if not os.path.exists("testtmp.gcda"):
+            raise comfychair.NotRunError('no profile was written')
+
+    def compile(self):
+        cmd = (self.distcc() + self._cc +
+               " -O2 -fprofile-use -Wmissing-profile -c testtmp.c "
+               "-o testtmp.o")
+        out, err = self.runcmd(cmd)
+        self.assert_equal(err, '')
+
+    def runtest(self):
+        self.compile()
+        self.assert_re_search("added [0-9a-f]+ to the profile cache",
+                              open(self.daemon_logfile).read())
+        self.compile()
+        self.assert_re_search("testtmp.gcda is [0-9a-f]+ from the profile cache",
+                              open(self.daemon_logfile).read())
+
+
 class CppError_Case(CompileHello_Case):
     """Test failure of cpp"""
     def source(self):
@@ -1735,6 +2032,576 @@ class Concurrent_Case(CompileHello_Case):
             del pids[pid]
 
 
+class Sharded_Case(Concurrent_Case):
+    """Run several compilations at once against a daemon with --shards 2"""
+    def daemon_command(self):
+        return CompileHello_Case.daemon_command(self) + " --shards 2"
+
+    def runtest(self):
+        pids = {}
+        for unused_i in range(12):
+            kid = self.runcmd_background(self.distcc_without_fallback() +
+                                         self._cc + " -o testtmp.o -c testtmp.c")
+            pids[kid] = kid
+        while len(pids):
+            pid, status = os.wait()
+            if status:
+                self.fail("child %d failed with status %#x" % (pid, status))
+            del pids[pid]
+        log = open(self.daemon_logfile, 'r').read()
+        self.assert_equal(len(re.findall(r"job complete", log)), 12)
+        # There is no point in more shards than CPUs.
+        if len(os.sched_getaffinity(0)) < 2:
+            self.assert_re_search(r"using 1 shards rather than 2", log)
+        else:
+            self.assert_re_search(r"shard 0: up to [0-9]+ jobs", log)
+            self.assert_re_search(r"shard 1: up to [0-9]+ jobs", log)
+
+
+class DeadFirstAddress_Case(CompileHello_Case):
+    """Check that a host whose first address is dead is reached through
+    the next one.
+
+    The host's addresses are seeded in the client's address cache: first
+    one from TEST-NET-1, which never answers, then the loopback address
+    the daemon is on."""
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] = 'localhost:%d%s' % (self.server_port,
+                                                        _server_options)
+        addrs = os.path.join(os.environ['DISTCC_DIR'], 'addrs')
+        if not os.path.isdir(addrs):
+            os.mkdir(addrs)
+        open(os.path.join(addrs, 'localhost_%d' % self.server_port),
+             'w').write('192.0.2.1\n127.0.0.1\n')
+
+    def runtest(self):
+        CompileHello_Case.runtest(self)
+        log = open(os.environ['DISTCC_LOG']).read()
+        if not re.search(r'using cached addresses for localhost', log):
+            self.fail("address cache not used:\n" + log)
+        if not re.search(r'connected to 127\.0\.0\.1', log):
+            self.fail("did not connect through the second address:\n" + log)
+
+
+class Affinity_Case(CompileHello_Case):
+    """Check that --affinity keeps a file on one host, and spills over.
+
+    The four hosts are all this daemon under different loopback addresses,
+    with one slot each.  The test takes a host's slot itself by locking its
+    lock file, the way another distcc would."""
+    def setupEnv(self):
+        CompileHello_Case.setupEnv(self)
+        self.hosts = ['127.0.0.%d' % i for i in range(1, 5)]
+        os.environ['DISTCC_HOSTS'] = '--affinity ' + ' '.join(
+            ['%s:%d/1' % (h, self.server_port) for h in self.hosts])
+
+    def compiledOn(self, source="testtmp.c"):
+        """Compile source, and return the host the log says it went to."""
+        log = os.environ['DISTCC_LOG']
+        if os.path.exists(log):
+            os.unlink(log)
+        self.runcmd(self.distcc_without_fallback() + self._cc
+                    + " -o testtmp.o -c " + source)
+        m = re.findall(r'compiled on (\S+) in', open(log).read())
+        self.assert_equal(len(m), 1)
+        return m[0]
+
+    def holdSlot(self, host):
+        import fcntl
+        f = open(os.path.join(os.environ['DISTCC_DIR'], 'lock',
+                              'cpu_tcp_%s_%d_0' % (host, self.server_port)),
+                 'w')
+        fcntl.lockf(f, fcntl.LOCK_EX | fcntl.LOCK_NB)
+        return f
+
+    def runtest(self):
+        first = self.compiledOn()
+        for unused_i in range(3):
+            self.assert_equal(self.compiledOn(), first)
+
+        # With the preferred host busy, the file goes to its second choice,
+        # and always the same one.
+        held = [self.holdSlot(first)]
+        second = self.compiledOn()
+        assert second != first
+        self.assert_equal(self.compiledOn(), second)
+
+        held.append(self.holdSlot(second))
+        third = self.compiledOn()
+        assert third not in (first, second)
+
+        for f in held:
+            f.close()
+        self.assert_equal(self.compiledOn(), first)
+
+        # Another file has its own ranking, so some file should prefer a
+        # host other than the first one.
+        others = set()
+        for i in range(8):
+            open('other%d.c' % i, 'w').write(self.source())
+            others.add(self.compiledOn('other%d.c' % i))
+        assert others - set([first]), others
+
+
+class FairShare_Case(CompileHello_Case):
+    """Run jobs of several priority classes under --fair-share"""
+    def daemon_command(self):
+        return (CompileHello_Case.daemon_command(self)
+                + " --jobs 1 --fair-share --queue 4 --share 127.0.0.1=2")
+
+    def runtest(self):
+        pids = {}
+        for prio in ["batch", "ci", "interactive"]:
+            kid = self.runcmd_background("DISTCC_PRIORITY=%s " % prio
+                                         + self.distcc_without_fallback()
+                                         + self._cc + " -o testtmp.o -c testtmp.c")
+            pids[kid] = kid
+        while len(pids):
+            pid, status = os.wait()
+            if status:
+                self.fail("child %d failed with status %#x" % (pid, status))
+            del pids[pid]
+        log = open(self.daemon_logfile, 'r').read()
+        for prio in ["batch", "ci", "interactive"]:
+            self.assert_re_search("COMPILE_OK .*class:%s wait:" % prio, log)
+
+
+class Scheduler_Case(WithDaemon_Case):
+    """Register a daemon with distccsched, take and give back leases, and
+    compile through it"""
+    def setup(self):
+        # A compile that outlasts the lease, so that it must be renewed.
+        self.installStubCompiler("slowcc", "-DSTUB_CPU_MS=2500")
+        WithDaemon_Case.setup(self)
+
+    def startDaemon(self):
+        self.sched_socket = os.path.join(os.getcwd(), "sched.sock")
+        self.sched_log = os.path.join(os.getcwd(), "distccsched.log")
+        self.sched_pid = self.runcmd_background(
+            "exec distccsched --no-tcp --socket %s --interval 1 --verbose "
+            "--lease-time 3 --log-file %s"
+            % (_ShellSafe(self.sched_socket), _ShellSafe(self.sched_log)))
+        self.add_cleanup(self.killScheduler)
+        for i in range(50):
+            if os.path.exists(self.sched_socket):
+                break
+            time.sleep(0.1)
+        else:
+            self.fail("distccsched did not start")
+        WithDaemon_Case.startDaemon(self)
+
+    def killScheduler(self):
+        os.kill(self.sched_pid, signal.SIGTERM)
+        os.waitpid(self.sched_pid, 0)
+
+    def daemon_command(self):
+        return (WithDaemon_Case.daemon_command(self)
+                + " --jobs 2 --scheduler %s --scheduler-name 127.0.0.1:%d"
+                % (_ShellSafe(self.sched_socket), self.server_port))
+
+    def request(self, line):
+        sock = socket.socket(socket.AF_UNIX)
+        sock.connect(self.sched_socket)
+        sock.sendall((line + "\n").encode())
+        reply = b""
+        while not reply.endswith(b"\n"):
+            data = sock.recv(256)
+            if not data:
+                break
+            reply += data
+        sock.close()
+        return reply.decode().strip()
+
+    def runtest(self):
+        name = "127.0.0.1:%d" % self.server_port
+        for i in range(50):
+            reply = self.request("LEASE nohost:1 " + name)
+            if reply != "UNKNOWN":
+                break
+            time.sleep(0.2)
+        self.assert_re_match(r"GRANT \w+ %s 0 3$" % name, reply)
+        first = reply.split()[1]
+        reply = self.request("LEASE " + name)
+        self.assert_re_match(r"GRANT \w+ %s 1 " % name, reply)
+        second = reply.split()[1]
+        self.assert_equal(self.request("LEASE " + name), "WAIT")
+        self.assert_equal(self.request("LEASE nohost:1"), "UNKNOWN")
+        self.assert_equal(self.request("RENEW " + first), "OK 3")
+        self.assert_equal(self.request("RENEW nosuchlease"), "UNKNOWN")
+        self.assert_equal(self.request("RELEASE " + first), "OK")
+        self.assert_equal(self.request("RELEASE " + first), "UNKNOWN")
+        reply = self.request("PREFER " + name)
+        self.assert_re_match(r"GRANT \w+ %s 0 " % name, reply)
+        self.assert_equal(self.request("RELEASE " + reply.split()[1]), "OK")
+        self.assert_equal(self.request("RELEASE " + second), "OK")
+        self.compile()
+
+    def compile(self):
+        """Compile with the one local slot for the host taken at first, so
+        that the client must give back its lease and wait, and then for
+        longer than the lease."""
+        import fcntl, threading
+        name = "127.0.0.1:%d" % self.server_port
+        lockdir = os.path.join(os.environ['DISTCC_DIR'], 'lock')
+        if not os.path.isdir(lockdir):
+            os.makedirs(lockdir)
+        lock = open(os.path.join(lockdir, "cpu_tcp_127.0.0.1_%d_0"
+                                 % self.server_port), "w")
+        fcntl.lockf(lock, fcntl.LOCK_EX)
+        unlock = threading.Timer(2, lock.close)
+        unlock.start()
+
+        open("testtmp.i", "w").write("int x;\n")
+        self.runcmd("DISTCC_SCHEDULER=%s DISTCC_HOSTS=%s/1 "
+                    % (_ShellSafe(self.sched_socket), name)
+                    + self.distcc_without_fallback()
+                    + "slowcc -c testtmp.i -o testtmp.o")
+        unlock.join()
+        self.assert_(os.path.exists("testtmp.o"))
+
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_re_search(r"all 1 of our slots on it are busy", log)
+        self.assert_re_search(r"GRANT \w+ %s \d+ 3" % name, log)
+        sched_log = open(self.sched_log).read()
+        self.assert_re_search(r"RENEW -> OK 3", sched_log)
+        # Every lease granted was given back, none left to run out.
+        self.assert_equal(len(re.findall(r"-> GRANT", sched_log)),
+                          len(re.findall(r"RELEASE -> OK", sched_log)))
+        self.assert_(not re.search(r"expired", sched_log))
+
+
+class Handoff_Case(WithDaemon_Case):
+    """Replace a daemon with --handoff, then drain the new one while it
+    runs one compile and has another queued"""
+    def setup(self):
+        self.installStubCompiler("slowcc", "-DSTUB_CPU_MS=2000")
+        WithDaemon_Case.setup(self)
+
+    def daemon_command(self):
+        return (WithDaemon_Case.daemon_command(self)
+                + " --jobs 1 --handoff %s"
+                % _ShellSafe(os.path.join(os.getcwd(), "handoff.sock")))
+
+    def readPid(self):
+        return int(open(self.daemon_pidfile, 'rt').read())
+
+    def waitExit(self, pid):
+        for i in range(100):
+            try:
+                os.kill(pid, 0)
+            except OSError:
+                return
+            time.sleep(0.1)
+        self.fail("daemon %d did not exit" % pid)
+
+    def runtest(self):
+        old_pid = self.readPid()
+        os.chdir("daemon")
+        try:
+            self.runcmd(self.daemon_command())
+        finally:
+            os.chdir("..")
+        self.waitExit(old_pid)
+        new_pid = self.readPid()
+        self.assert_notequal(new_pid, old_pid)
+
+        sock = socket.socket()
+        sock.connect(('127.0.0.1', self.server_port))
+        sock.close()
+
+        # One compile running on the only child, and one waiting in the
+        # backlog behind it, when the drain starts.
+        open("testtmp.i", "w").write("int x;\n")
+        compile = self.distcc_without_fallback() + "slowcc -c testtmp.i -o "
+        running = self.runcmd_background(compile + "running.o")
+        for i in range(100):
+            if re.search(r"slowcc", open(self.daemon_logfile).read()):
+                break
+            time.sleep(0.1)
+        else:
+            self.fail("the compile did not start")
+        queued = self.runcmd_background(compile + "queued.o")
+        time.sleep(0.5)
+
+        self.runcmd(self.distccd() + "--drain --pid-file %s"
+                    % _ShellSafe(self.daemon_pidfile))
+        for kid in running, queued:
+            pid, status = os.waitpid(kid, 0)
+            self.assert_equal(status, 0)
+        self.assert_(os.path.exists("running.o"))
+        self.assert_(os.path.exists("queued.o"))
+        self.waitExit(new_pid)
+        self.assert_no_file(self.daemon_pidfile)
+        self.assert_equal(len(re.findall(r"job complete",
+                                         open(self.daemon_logfile).read())),
+                          2)
+
+
+class Placement_Case(WithDaemon_Case):
+    """Test that --placement gives each running job its own CPU, and
+    leaves jobs unpinned once every CPU has one"""
+    def daemon_command(self):
+        return (WithDaemon_Case.daemon_command(self)
+                + " --placement --jobs 3")
+
+    def load(self, clients):
+        import json
+        out, err = self.runcmd("distcc-loadgen --port %d --clients %d "
+                               "--jobs 1 --sizes 1 --cpu 1000 --mem 1 "
+                               "--out 1 --json" % (self.server_port, clients))
+        self.assert_equal(json.loads(out)["outcomes"]["ok"], clients)
+        return open(self.daemon_logfile).read()
+
+    def runtest(self):
+        placed = min(3, len(os.sched_getaffinity(0)))
+
+        # Three jobs at once, each using a second of CPU.
+        log = self.load(3)
+        cpus = re.findall(r"cpu:([0-9]+) node:[0-9]+", log)
+        self.assert_equal(len(cpus), placed)
+        self.assert_equal(len(set(cpus)), placed)
+        self.assert_equal(len(re.findall(r"every CPU has a job", log)),
+                          3 - placed)
+
+        # The CPUs were given back.
+        log = self.load(1)
+        self.assert_equal(len(re.findall(r"cpu:[0-9]+ node:[0-9]+", log)),
+                          placed + 1)
+
+
+class BigmemRetry_Case(WithDaemon_Case):
+    """Test that a job killed for using too much memory is retried on a
+    ,bigmem host, without putting the small host in backoff.
+
+    The small host is a distccd with --cgroup and a small --job-memory-max
+    if $DISTCC_TEST_CGROUP names a cgroup it can use.  Otherwise it is a
+    stand-in that answers every job as such a daemon would."""
+    def setup(self):
+        # The compiler uses 64MB, and both daemons must find it.
+        self.installStubCompiler("bigcc", "-DSTUB_MEM_MB=64")
+        WithDaemon_Case.setup(self)
+
+    def setupEnv(self):
+        WithDaemon_Case.setupEnv(self)
+        if _test_cgroup:
+            self.small_port = self.startSmallDaemon()
+        else:
+            self.small_port = self.startStandIn()
+        os.environ['DISTCC_HOSTS'] = ('127.0.0.1:%d 127.0.0.1:%d,bigmem' %
+                                      (self.small_port, self.server_port))
+
+    def startSmallDaemon(self):
+        self.small_pidfile = os.path.join(os.getcwd(), "smallpid.tmp")
+        port = self.server_port + 1
+        while True:
+            rc, out, err = self.runcmd_unchecked(
+                self.distccd() +
+                "--verbose --lifetime=%d --daemon --log-file %s "
+                "--pid-file %s --port %d --allow 127.0.0.1 "
+                "--enable-tcp-insecure --cgroup %s --job-memory-max 16"
+                % (self.daemon_lifetime(),
+                   _ShellSafe(os.path.join(os.getcwd(), "small.log")),
+                   _ShellSafe(self.small_pidfile), port,
+                   _ShellSafe(_test_cgroup)))
+            if rc != EXIT_BIND_FAILED:
+                break
+            port += 1
+        self.assert_equal(rc, 0)
+        self.add_cleanup(self.killSmallDaemon)
+        return port
+
+    def killSmallDaemon(self):
+        os.kill(int(open(self.small_pidfile).read()), signal.SIGTERM)
+
+    def startStandIn(self):
+        import threading
+        self.listener = socket.socket()
+        self.listener.bind(('127.0.0.1', 0))
+        self.listener.listen(5)
+        t = threading.Thread(target=self.standIn)
+        t.daemon = True
+        t.start()
+        return self.listener.getsockname()[1]
+
+    def standIn(self):
+        """Read each request, then say the compiler was killed at 16MB."""
+        while True:
+            try:
+                client, addr = self.listener.accept()
+            except socket.error:
+                return
+            buf = b''
+            while True:
+                data = client.recv(65536)
+                if not data:
+                    break
+                buf += data
+                i = buf.find(b'DOTI')
+                if (i != -1 and len(buf) >= i + 12
+                    and len(buf) >= i + 12 + int(buf[i + 4:i + 12], 16)):
+                    client.sendall(b'OOMK%08x' % 16)
+                    break
+            client.close()
+
+    def runtest(self):
+        open("testtmp.i", "w").write("int x;\n")
+        self.runcmd(self.distcc_without_fallback()
+                    + "bigcc -c testtmp.i -o testtmp.o")
+        self.assert_(os.path.exists("testtmp.o"))
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_re_search(r"killed the compiler for using more than 16MB",
+                              log)
+        self.assert_re_search(r"retrying testtmp.i on a bigmem host", log)
+        self.assert_re_search(r"job complete",
+                              open(self.daemon_logfile).read())
+        self.assert_(not glob.glob(os.path.join(
+            os.environ['DISTCC_DIR'], 'lock',
+            'backoff_tcp_127.0.0.1_%d_*' % self.small_port)))
+
+    def teardown(self):
+        if not _test_cgroup:
+            self.listener.close()
+        WithDaemon_Case.teardown(self)
+
+
+class LoadGen_Case(WithDaemon_Case):
+    """Run distcc-loadgen against a daemon, with and without pump mode"""
+    def runtest(self):
+        import json
+        for extra in ["", " --pump 3", " --compress none"]:
+            out, err = self.runcmd("distcc-loadgen --port %d --clients 2 "
+                                   "--jobs 3 --sizes 1 --cpu 1 --mem 1 "
+                                   "--out 1 --json%s"
+                                   % (self.server_port, extra))
+            result = json.loads(out)
+            self.assert_equal(result["jobs"], 6)
+            self.assert_equal(result["outcomes"]["ok"], 6)
+
+
+class SchedSim_Case(SimpleDistCC_Case):
+    """Compare host-selection policies with distcc-schedsim"""
+    def runtest(self):
+        import json
+        hosts = "--hosts 'good/4 bad/4 localhost/2' --model bad,fail=1"
+        out, err = self.runcmd("distcc-schedsim %s --jobs 40 --parallel 6 "
+                               "--json" % hosts)
+        results = [json.loads(line) for line in out.splitlines()]
+        self.assert_equal([r["policy"] for r in results],
+                          ["first-free", "random", "weighted", "affinity"])
+        for r in results:
+            self.assert_equal(r["jobs"], 40)
+            self.assert_(r["makespan"] > 0)
+            # Once bad has failed a job it is backed off for the rest of
+            # the run, so it only sees the jobs sent before that.
+            self.assert_equal(r["hosts"]["bad"]["failures"],
+                              r["hosts"]["bad"]["jobs"])
+            self.assert_(r["hosts"]["bad"]["jobs"] <= 6)
+            self.assert_equal(r["fallbacks"], r["hosts"]["bad"]["jobs"])
+
+        # The same file always goes to the same host with --affinity.
+        out, err = self.runcmd("distcc-schedsim --hosts 'a/2 b/2 c/2' "
+                               "--jobs 60 --files 3 --parallel 1 "
+                               "--cache-factor 0.5 --json --policy affinity")
+        r = json.loads(out)
+        self.assert_equal(sum([h["cache_hits"]
+                               for h in r["hosts"].values()]), 57)
+
+        open("trace.log", "w").write(
+            "distcc[1] 1000 bytes from a.c compiled on a in 2.0000s, rate 1kB/s\n"
+            "distcc[2] elapsed compilation time 2.100000s\n"
+            "b.c 1.0 10 10\n")
+        out, err = self.runcmd("distcc-schedsim --hosts 'a/1' --model a,speed=2 "
+                               "--trace trace.log --parallel 1 --json "
+                               "--policy first-free")
+        r = json.loads(out)
+        self.assert_equal(r["jobs"], 2)
+        # 4s of work at speed 2, then 1s at speed 2, one after the other
+        self.assert_(2.5 <= r["makespan"] < 2.6)
+
+
+class Agent_Case(CompileHello_Case):
+    """Compile through a running distcc --agent.
+
+    The agent should parse the host list once for all the compiles it
+    runs, and run them concurrently."""
+    def setupEnv(self):
+        import subprocess
+        CompileHello_Case.setupEnv(self)
+        self.agent = subprocess.Popen((self.distcc() + "--agent").split())
+        sock = os.path.join(os.environ['DISTCC_DIR'], 'agent.sock')
+        for unused_i in range(50):
+            if os.path.exists(sock):
+                break
+            time.sleep(0.1)
+        else:
+            self.fail("agent did not start")
+        os.environ['DISTCC_AGENT'] = '1'
+
+    def runtest(self):
+        CompileHello_Case.runtest(self)
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_equal(len(re.findall(r'parsed 1 hosts from', log)), 1)
+        self.assert_(len(re.findall(r'handling request', log)) >= 2)
+        self.assert_re_search(r'using host list from the agent', log)
+
+        # Four compiles that each take a second, through the agent, at
+        # once: they should overlap.
+        open('slowcc', 'w').write('#!/bin/sh\nsleep 1\nexec %s "$@"\n'
+                                  % self._cc)
+        os.chmod('slowcc', 0o755)
+        os.environ['DISTCC_HOSTS'] = 'localhost/4'
+        start = time.time()
+        self.runcmd("for i in 1 2 3 4; do %s ./slowcc -c testtmp.c "
+                    "-o slow$i.o & done; wait"
+                    % self.distcc_without_fallback())
+        elapsed = time.time() - start
+        for i in range(1, 5):
+            self.assert_(os.path.exists('slow%d.o' % i))
+        self.assert_(elapsed < 3.5, "compiles took %.1fs" % elapsed)
+        log = open(os.environ['DISTCC_LOG']).read()
+        self.assert_equal(len(re.findall(r'parsed 1 hosts from', log)), 2)
+
+    def teardown(self):
+        self.agent.terminate()
+        self.agent.wait()
+        CompileHello_Case.teardown(self)
+
+
+class NetProxy_Case(CompileHello_Case):
+    """Compile through bench/netproxy.py on a slow, lossy link"""
+    def setupEnv(self):
+        import subprocess
+        proxy = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                             "..", "bench", "netproxy.py")
+        if not os.path.isfile(proxy):
+            raise comfychair.NotRunError("bench/netproxy.py not found")
+        self.proxy_stats = os.path.join(os.getcwd(), "netproxy.json")
+        self.proxy = subprocess.Popen(
+            [sys.executable, proxy, "--listen", "0",
+             "--target", "127.0.0.1:%d" % self.server_port,
+             "--bandwidth", "2mbit", "--rtt", "20", "--jitter", "5",
+             "--loss", "5", "--stats", self.proxy_stats],
+            stdout=subprocess.PIPE, universal_newlines=True)
+        line = self.proxy.stdout.readline()
+        WithDaemon_Case.setupEnv(self)
+        os.environ['DISTCC_HOSTS'] = ('127.0.0.1:%s%s' %
+          (line.split(':')[-1].strip(), _server_options))
+
+    def runtest(self):
+        import json
+        CompileHello_Case.runtest(self)
+        stats = json.load(open(self.proxy_stats))["total"]
+        self.assert_equal(stats["connections"], 1)
+        self.assert_(stats["up"]["bytes"] > os.path.getsize("testtmp.c"))
+        self.assert_(stats["down"]["bytes"] > 0)
+
+    def teardown(self):
+        self.proxy.terminate()
+        self.proxy.wait()
+        CompileHello_Case.teardown(self)
+
+
 class BigAssFile_Case(Compilation_Case):
     """Test compilation of a really big C file
 
@@ -1763,6 +2630,38 @@ class BigAssFile_Case(Compilation_Case):
 
 
 
+class SpillCompile_Case(Compilation_Case):
+    """Test moving preprocessor output out of memory once it passes
+    $DISTCC_MEM_TEMP_SIZE, when the first host tried is down"""
+    def setupEnv(self):
+        if ',cpp' in _server_options:
+            raise comfychair.NotRunError('the server runs cpp in pump mode')
+        Compilation_Case.setupEnv(self)
+        sock = socket.socket()
+        sock.bind(('127.0.0.1', 0))
+        dead_port = sock.getsockname()[1]
+        sock.close()
+        os.environ['DISTCC_HOSTS'] = ('127.0.0.1:%d%s 127.0.0.1:%d%s' %
+          (dead_port, _server_options, self.server_port, _server_options))
+        os.environ['DISTCC_MEM_TEMP_SIZE'] = '1'
+
+    def source(self):
+        # About 1.5MB once preprocessed.
+        return "".join(["int i%05d = %d;\n" % (i, i) for i in range(80000)]
+                       + ["int main(void) { return i79999 != 79999; }\n"])
+
+    def runtest(self):
+        Compilation_Case.runtest(self)
+        log = open(os.environ['DISTCC_LOG'], 'r').read()
+        self.assert_re_search(r"connect to 127\.0\.0\.1:[0-9]+ failed", log)
+        self.assert_equal(len(re.findall(r"moving [0-9]+ bytes from memory", log)),
+                          1)
+        # cpp ran only once, for the first host, and its output went to
+        # the second.
+        self.assert_equal(len(re.findall(r"forking to execute: .* -E\b", log)), 1)
+        self.assert_re_search(r"compiled on 127\.0\.0\.1 in", log)
+
+
 class BinFalse_Case(Compilation_Case):
     """Compiler that fails without reading input.
 
@@ -2080,6 +2979,100 @@ class ParseMask_Case(comfychair.TestCase):
                 self.fail("%s gave %d, expected %d" % (cmd, ret, expected))
 
 
+class ZeroconfTxt_Case(comfychair.TestCase):
+    """Test reading zeroconf TXT records, and the order of the host file."""
+    def runtest(self):
+        out, err = self.runcmd(
+            "h_zeroconf 'busy cpus=4 jobs=6 free=0 memfree=4096 load=6.0' "
+            "'idle cpus=2 jobs=4 free=4 memfree=512 load=0.2' "
+            "'roomy cpus=2 jobs=4 free=4 memfree=2048' "
+            "'old cpus=2' "
+            "'odd jobs=3 free=9 load=x junk cpus=' "
+            "'half cpus=8 jobs=10 free=3 memfree=8192 load=5.04'")
+        self.assert_equal(out,
+            "roomy/4 cpus=2 free=4 memfree=2048 load=-1\n"
+            "idle/4 cpus=2 free=4 memfree=512 load=2\n"
+            "old/4 cpus=2 free=-1 memfree=-1 load=-1\n"
+            "half/10 cpus=8 free=3 memfree=8192 load=50\n"
+            "odd/3 cpus=1 free=3 memfree=-1 load=0\n"
+            "busy/6 cpus=4 free=0 memfree=4096 load=60\n")
+
+
+class Ticket_Case(comfychair.TestCase):
+    """Test SHA-256 and HMAC-SHA-256 against published vectors, and the
+    issue and check of GSS-API session tickets."""
+
+    def hex(self, s):
+        return "".join(["%02x" % ord(c) for c in s])
+
+    def runtest(self):
+        # FIPS 180-2 examples, and a two-block message.
+        for data, digest in [
+            ("", "e3b0c44298fc1c149afbf4c8996fb924"
+                 "27ae41e4649b934ca495991b7852b855"),
+            ("abc", "ba7816bf8f01cfea414140de5dae2223"
+                    "b00361a396177a9cb410ff61f20015ad"),
+            ("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+             "248d6a61d20638b8e5c026930c3e6039"
+             "a33ce45964ff2167f6ecedd419db06c1"),
+            ("a" * 1000, "41edece42d63e8d9bf515a9ba6932e1c"
+                         "20cbc9f5a5d134645adb5db1b9737ea3")]:
+            out, err = self.runcmd("h_ticket sha256 '%s'" % self.hex(data))
+            self.assert_equal(out, digest + "\n")
+
+        # RFC 4231 test cases 1-7; case 5 checks only the first 128 bits.
+        big_key = "aa" * 131
+        for key, data, mac in [
+            ("0b" * 20, self.hex("Hi There"),
+             "b0344c61d8db38535ca8afceaf0bf12b"
+             "881dc200c9833da726e9376c2e32cff7"),
+            (self.hex("Jefe"), self.hex("what do ya want for nothing?"),
+             "5bdcc146bf60754e6a042426089575c7"
+             "5a003f089d2739839dec58b964ec3843"),
+            ("aa" * 20, "dd" * 50,
+             "773ea91e36800e46854db8ebd09181a7"
+             "2959098b3ef8c122d9635514ced565fe"),
+            ("0102030405060708090a0b0c0d0e0f10111213141516171819", "cd" * 50,
+             "82558a389a443c0ea4cc819899f2083a"
+             "85f0faa3e578f8077a2e3ff46729665b"),
+            ("0c" * 20, self.hex("Test With Truncation"),
+             "a3b6167473100ee06e0c796c2955552b"),
+            (big_key,
+             self.hex("Test Using Larger Than Block-Size Key - "
+                      "Hash Key First"),
+             "60e431591ee0b67f0d8a26aacbf5b77f"
+             "8e0bc6213728c5140546040f0ee37f54"),
+            (big_key,
+             self.hex("This is a test using a larger than block-size key "
+                      "and a larger than block-size data. The key needs "
+                      "to be hashed before being used by the HMAC "
+                      "algorithm."),
+             "9b09ffa71b942fcb27635fbcd5b0e944"
+             "bfdc63644f0713938a7f51535c3a35e2")]:
+            out, err = self.runcmd("h_ticket hmac %s %s" % (key, data))
+            self.assert_equal(out[:len(mac)], mac)
+
+        # A ticket is good until it expires, and then refused.
+        for age, result in [(0, "accepted alice@EXAMPLE.COM"),
+                            (3599, "accepted alice@EXAMPLE.COM"),
+                            (3600, "refused"),
+                            (7200, "refused")]:
+            out, err = self.runcmd("h_ticket ticket alice@EXAMPLE.COM "
+                                   "3600 %d" % age)
+            self.assert_equal(out, result + "\n")
+
+        # Another server's ticket is refused.  A ticket whose principal
+        # was changed, or whose expiry was pushed back after it ran out,
+        # gets as far as the proofs, which fail.
+        for field, age, result in [("magic", 30, "refused"),
+                                   ("keyid", 30, "refused"),
+                                   ("principal", 30, "bad proof"),
+                                   ("expiry", 120, "bad proof")]:
+            out, err = self.runcmd("h_ticket ticket alice@EXAMPLE.COM "
+                                   "60 %d %s" % (age, field))
+            self.assert_equal(out, result + "\n")
+
+
 class HostFile_Case(CompileHello_Case):
     def setup(self):
         CompileHello_Case.setup(self)
@@ -2152,6 +3145,57 @@ class Lsdistcc_Case(WithDaemon_Case):
           self.assert_re_search("127.0.0.4:%d\n" % self.server_port, out)
           self.assert_re_search("127.0.0.5:%d\n" % self.server_port, out)
 
+        # Test "lsdistcc -a": one host list, with a limit on every host.
+        out, err = self.runcmd(lsdistcc + " -a localhost 127.0.0.1")
+        self.assert_equal(err, "")
+        out_list = out.split()
+        out_list.sort()
+        self.assert_equal(out_list,
+                          ["%s:%d/4" % (host, self.server_port) for host in
+                           ["127.0.0.1", "localhost"]])
+
+        self.rankByStats(lsdistcc)
+
+    def rankByStats(self, lsdistcc):
+        """Test "lsdistcc -a -sPORT": the host with the most free slots
+        comes first, and one whose stats say it is full comes last.  This
+        needs 127.0.0.2 to be a local address."""
+        import threading
+        stats = {"127.0.0.1": b"dcc_max_kids 4\ndcc_current_load 4\n",
+                 "127.0.0.2": b"dcc_max_kids 40\ndcc_current_load 0\n"}
+        port = 0
+        for addr in sorted(stats):
+            listener = socket.socket()
+            try:
+                listener.bind((addr, port))
+            except socket.error:
+                listener.close()
+                return
+            listener.listen(5)
+            port = listener.getsockname()[1]
+            self.add_cleanup(listener.close)
+            t = threading.Thread(target=self.statsStandIn,
+                                 args=(listener, stats[addr]))
+            t.daemon = True
+            t.start()
+
+        # 127.0.0.3 has no stats server, so is taken to have 4 slots free.
+        out, err = self.runcmd(lsdistcc + " -a -s%d 127.0.0.1 127.0.0.2 "
+                               "127.0.0.3" % port)
+        self.assert_equal(err, "")
+        self.assert_equal(out, "127.0.0.2:%d/40 127.0.0.3:%d/4 "
+                          "127.0.0.1:%d/4\n" % ((self.server_port,) * 3))
+
+    def statsStandIn(self, listener, reply):
+        """Answer every connection as distccd --stats would."""
+        while True:
+            try:
+                client, addr = listener.accept()
+            except socket.error:
+                return
+            client.sendall(reply)
+            client.close()
+
 class Getline_Case(comfychair.TestCase):
     """Test getline()."""
     values = [
@@ -2208,6 +3252,8 @@ tests = [
          BadLogFile_Case,
          ScanArgs_Case,
          ParseMask_Case,
+         ZeroconfTxt_Case,
+         Ticket_Case,
          DotD_Case,
          DashMD_DashMF_DashMT_Case,
          Compile_c_Case,
@@ -2215,8 +3261,11 @@ tests = [
          StripArgs_Case,
          StartStopDaemon_Case,
          CompressedCompile_Case,
+         IoUring_Case,
+         TlsCompile_Case,
          DashONoSpace_Case,
          WriteDevNull_Case,
+         TruncatedOutput_Case,
          CppError_Case,
          BadInclude_Case,
          PreprocessPlainText_Case,
@@ -2224,12 +3273,16 @@ tests = [
          SBeatsC_Case,
          DashD_Case,
          DashWpMD_Case,
+         SpillCompile_Case,
          BinFalse_Case,
          BinTrue_Case,
          VersionOption_Case,
          HelpOption_Case,
          BogusOption_Case,
          MultipleCompile_Case,
+         BatchCompile_Case,
+         LtoMake_Case,
+         ProfileCache_Case,
          CompilerOptionsPassed_Case,
          IsSource_Case,
          ExtractExtension_Case,
@@ -2250,8 +3303,20 @@ tests = [
          HostFile_Case,
          AbsSourceFilename_Case,
          Getline_Case,
+         Affinity_Case,
+         DeadFirstAddress_Case,
+         FairShare_Case,
+         Scheduler_Case,
+         Handoff_Case,
+         Placement_Case,
+         BigmemRetry_Case,
+         LoadGen_Case,
+         NetProxy_Case,
+         Agent_Case,
+         SchedSim_Case,
          # slow tests below here
          Concurrent_Case,
+         Sharded_Case,
          HundredFold_Case,
          BigAssFile_Case]
 